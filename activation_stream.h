@@ -0,0 +1,285 @@
+// Activation streaming over shared memory.
+//
+// A training or inference process publishes per-layer activation statistics
+// into a named shared-memory segment; the visualizer maps the same segment
+// and colors layers and neurons by the newest frame. The segment is a ring of
+// ACTIVATION_STREAM_SLOTS frames, each guarded by a sequence number, so the
+// producer never waits for the viewer and the viewer reads a frame in place
+// without taking a lock.
+//
+// A frame holds, per layer, the layer's value followed by binCount values for
+// its neurons (downsampled into bins), all in 0..1. Values are colored from
+// blue (0) to red (1). ActivationStreamSummarize turns raw activations into
+// that form.
+//
+// Producer use:
+//
+//     ActivationStream s;
+//     if (!ActivationStreamCreate(&s, ACTIVATION_STREAM_DEFAULT_NAME, layers, 64))
+//         ...;
+//     for (;;) {
+//         float* frame = ActivationStreamBegin(&s);
+//         for (int l = 0; l < layers; l++)
+//             ActivationStreamSummarize(act[l], actCount[l], 1.0f, ActivationStreamLayer(&s, frame, l), 64);
+//         ActivationStreamPublish(&s);
+//     }
+//     ActivationStreamClose(&s);
+//
+// Header-only; builds with gcc or clang on Windows (MinGW) and POSIX. Linux
+// builds with an older glibc than 2.34 need -lrt for shm_open.
+#ifndef ACTIVATION_STREAM_H
+#define ACTIVATION_STREAM_H
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+#define ACTIVATION_STREAM_MAGIC        0x31534144u     // "DAS1"
+#define ACTIVATION_STREAM_VERSION      1
+#define ACTIVATION_STREAM_SLOTS        4
+#define ACTIVATION_STREAM_DEFAULT_NAME "deep3d-activations"
+
+// Start of the segment. The slots follow at multiples of slotBytes after
+// ACTIVATION_STREAM_HEADER_BYTES; each begins with its sequence number.
+typedef struct {
+    unsigned int magic;         // Written last by the producer, so a zero means not ready
+    unsigned int version;
+    unsigned int layerCount;
+    unsigned int binCount;      // Neuron bins per layer after the layer's own value
+    unsigned int slotCount;
+    unsigned int slotBytes;
+    long long published;        // Newest complete frame, 0 before the first
+} ActivationStreamHeader;
+
+#define ACTIVATION_STREAM_HEADER_BYTES 64
+#define ACTIVATION_STREAM_VALUES       16   // Offset of a slot's values: sequence plus padding
+
+// Either end of a stream. Producers own the segment and remove it on close.
+typedef struct {
+    ActivationStreamHeader* header;
+    size_t size;
+    long long frame;            // Producer: frame being written
+    int owner;
+#ifdef _WIN32
+    HANDLE mapping;
+#endif
+    char name[128];
+} ActivationStream;
+
+static inline long long ActivationStreamLoad(const volatile long long* value) {
+    return __atomic_load_n(value, __ATOMIC_ACQUIRE);
+}
+
+static inline void ActivationStreamStore(volatile long long* value, long long v) {
+    __atomic_store_n(value, v, __ATOMIC_RELEASE);
+}
+
+static inline volatile long long* ActivationStreamSequence(const ActivationStream* s, long long frame) {
+    char* base = (char*)s->header + ACTIVATION_STREAM_HEADER_BYTES;
+    return (volatile long long*)(base + (size_t)(frame % s->header->slotCount) * s->header->slotBytes);
+}
+
+static inline float* ActivationStreamValues(const ActivationStream* s, long long frame) {
+    return (float*)((char*)ActivationStreamSequence(s, frame) + ACTIVATION_STREAM_VALUES);
+}
+
+// Values of one layer within a frame: [0] the layer, [1..binCount] its bins.
+static inline float* ActivationStreamLayer(const ActivationStream* s, float* frame, int layer) {
+    return frame + (size_t)layer * (1 + s->header->binCount);
+}
+
+static inline void ActivationStreamSegmentName(const char* name, char* out, size_t size) {
+#ifdef _WIN32
+    snprintf(out, size, "%s", name);
+#else
+    snprintf(out, size, "/%s", name);
+#endif
+}
+
+// Create (or replace) the named segment for layerCount layers of binCount
+// bins each. Returns 0 on failure.
+static inline int ActivationStreamCreate(ActivationStream* s, const char* name, int layerCount, int binCount) {
+    char segment[160];
+    memset(s, 0, sizeof(*s));
+    if (layerCount <= 0 || binCount < 0)
+        return 0;
+    size_t slotBytes = ACTIVATION_STREAM_VALUES + (size_t)layerCount * (1 + binCount) * sizeof(float);
+    slotBytes = (slotBytes + 63) & ~(size_t)63;
+    s->size = ACTIVATION_STREAM_HEADER_BYTES + slotBytes * ACTIVATION_STREAM_SLOTS;
+    snprintf(s->name, sizeof(s->name), "%s", name);
+    ActivationStreamSegmentName(name, segment, sizeof(segment));
+#ifdef _WIN32
+    s->mapping = CreateFileMappingA(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE,
+                                    (DWORD)((unsigned long long)s->size >> 32), (DWORD)s->size, segment);
+    if (!s->mapping)
+        return 0;
+    s->header = MapViewOfFile(s->mapping, FILE_MAP_ALL_ACCESS, 0, 0, s->size);
+    if (!s->header) {
+        CloseHandle(s->mapping);
+        return 0;
+    }
+#else
+    shm_unlink(segment);
+    int fd = shm_open(segment, O_CREAT | O_EXCL | O_RDWR, 0600);
+    if (fd < 0)
+        return 0;
+    if (ftruncate(fd, (off_t)s->size) != 0) {
+        close(fd);
+        shm_unlink(segment);
+        return 0;
+    }
+    void* view = mmap(NULL, s->size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (view == MAP_FAILED) {
+        shm_unlink(segment);
+        return 0;
+    }
+    s->header = view;
+#endif
+    memset(s->header, 0, s->size);
+    s->header->version = ACTIVATION_STREAM_VERSION;
+    s->header->layerCount = (unsigned int)layerCount;
+    s->header->binCount = (unsigned int)binCount;
+    s->header->slotCount = ACTIVATION_STREAM_SLOTS;
+    s->header->slotBytes = (unsigned int)slotBytes;
+    __atomic_store_n(&s->header->magic, ACTIVATION_STREAM_MAGIC, __ATOMIC_RELEASE);
+    s->owner = 1;
+    return 1;
+}
+
+// Map an existing segment read-only. Returns 0 when it does not exist yet
+// or is not a stream of this version.
+static inline int ActivationStreamOpen(ActivationStream* s, const char* name) {
+    char segment[160];
+    memset(s, 0, sizeof(*s));
+    snprintf(s->name, sizeof(s->name), "%s", name);
+    ActivationStreamSegmentName(name, segment, sizeof(segment));
+#ifdef _WIN32
+    s->mapping = OpenFileMappingA(FILE_MAP_READ, FALSE, segment);
+    if (!s->mapping)
+        return 0;
+    s->header = MapViewOfFile(s->mapping, FILE_MAP_READ, 0, 0, 0);
+    MEMORY_BASIC_INFORMATION info;
+    if (!s->header || !VirtualQuery(s->header, &info, sizeof(info))) {
+        if (s->header)
+            UnmapViewOfFile(s->header);
+        CloseHandle(s->mapping);
+        s->header = NULL;
+        return 0;
+    }
+    s->size = info.RegionSize;
+#else
+    struct stat st;
+    int fd = shm_open(segment, O_RDONLY, 0);
+    if (fd < 0)
+        return 0;
+    if (fstat(fd, &st) != 0 || st.st_size < ACTIVATION_STREAM_HEADER_BYTES) {
+        close(fd);
+        return 0;
+    }
+    void* view = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (view == MAP_FAILED)
+        return 0;
+    s->header = view;
+    s->size = (size_t)st.st_size;
+#endif
+    const ActivationStreamHeader* h = s->header;
+    if (__atomic_load_n(&h->magic, __ATOMIC_ACQUIRE) != ACTIVATION_STREAM_MAGIC ||
+        h->version != ACTIVATION_STREAM_VERSION || h->slotCount == 0 ||
+        ACTIVATION_STREAM_HEADER_BYTES + (size_t)h->slotBytes * h->slotCount > s->size ||
+        ACTIVATION_STREAM_VALUES + (size_t)h->layerCount * (1 + h->binCount) * sizeof(float) > h->slotBytes) {
+#ifdef _WIN32
+        UnmapViewOfFile(s->header);
+        CloseHandle(s->mapping);
+#else
+        munmap(s->header, s->size);
+#endif
+        s->header = NULL;
+        return 0;
+    }
+    return 1;
+}
+
+static inline void ActivationStreamClose(ActivationStream* s) {
+    if (!s->header)
+        return;
+#ifdef _WIN32
+    UnmapViewOfFile(s->header);
+    CloseHandle(s->mapping);
+#else
+    munmap(s->header, s->size);
+    if (s->owner) {
+        char segment[160];
+        ActivationStreamSegmentName(s->name, segment, sizeof(segment));
+        shm_unlink(segment);
+    }
+#endif
+    s->header = NULL;
+}
+
+// Producer: the slot to fill with the next frame. Readers skip it until
+// ActivationStreamPublish.
+static inline float* ActivationStreamBegin(ActivationStream* s) {
+    s->frame = s->header->published + 1;
+    volatile long long* sequence = ActivationStreamSequence(s, s->frame);
+    __atomic_store_n(sequence, 2 * s->frame - 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    return ActivationStreamValues(s, s->frame);
+}
+
+static inline void ActivationStreamPublish(ActivationStream* s) {
+    ActivationStreamStore(ActivationStreamSequence(s, s->frame), 2 * s->frame);
+    ActivationStreamStore(&s->header->published, s->frame);
+}
+
+// Consumer: newest complete frame, or NULL when none was published or the
+// producer is already rewriting its slot. Read the values in place, then
+// check ActivationStreamIntact before trusting them.
+static inline const float* ActivationStreamLatest(const ActivationStream* s, long long* frame) {
+    long long newest = ActivationStreamLoad(&s->header->published);
+    if (newest <= 0 || ActivationStreamLoad(ActivationStreamSequence(s, newest)) != 2 * newest)
+        return NULL;
+    *frame = newest;
+    return ActivationStreamValues(s, newest);
+}
+
+// Whether frame's slot was left alone while it was being read.
+static inline int ActivationStreamIntact(const ActivationStream* s, long long frame) {
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return __atomic_load_n(ActivationStreamSequence(s, frame), __ATOMIC_RELAXED) == 2 * frame;
+}
+
+static inline float ActivationStreamSquash(double magnitude, float halfPoint) {
+    return halfPoint > 0.0f ? (float)(magnitude / (magnitude + halfPoint)) : 0.0f;
+}
+
+// Reduce one layer's raw activations to its frame values: the mean absolute
+// activation of the layer, then of each bin of neighbouring neurons, mapped
+// to 0..1 so that halfPoint lands in the middle of the color scale. Layers
+// summarized with the same halfPoint compare directly.
+static inline void ActivationStreamSummarize(const float* activations, long long count, float halfPoint,
+                                             float* out, int binCount) {
+    double total = 0.0;
+    for (int b = 0; b < binCount || (b == 0 && count > 0); b++) {
+        long long first = binCount ? count * b / binCount : 0;
+        long long end = binCount ? count * (b + 1) / binCount : count;
+        double sum = 0.0;
+        for (long long i = first; i < end; i++)
+            sum += fabsf(activations[i]);
+        total += sum;
+        if (binCount)
+            out[1 + b] = ActivationStreamSquash(end > first ? sum / (end - first) : 0.0, halfPoint);
+    }
+    out[0] = ActivationStreamSquash(count > 0 ? total / count : 0.0, halfPoint);
+}
+
+#endif
@@ -1,555 +1,15232 @@
+#ifdef _WIN32
+#include <winsock2.h>
 #include <windows.h>
+#include <psapi.h>
 #include <GL/gl.h>
 #include <GL/glu.h>
+#else
+#include <arpa/inet.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <strings.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#endif
+#include <float.h>
+#include <limits.h>
 #include <math.h>
+#include <stdarg.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#endif
+#include "activation_stream.h"
+
+#ifndef _WIN32
+// Headless builds have no OpenGL; the scene buffers still use its index types.
+typedef unsigned int GLuint;
+typedef unsigned int GLenum;
+#define _stricmp strcasecmp
+#endif
 
 //-------------------------
 // Constants & Prototypes
 //-------------------------
 
 #define PI 3.14159265358979323846
-#define MAX_LAYERS 20
 #define TEXT_OFFSET_X 3.0f
 #define TOP_Y 8.0f
 #define LAYER_SPACING 2.0f
+#define MAX_BOX_SIZE 100.0              // Largest box side a text spec may give
+#define MESH_DETAIL_LEVELS 3
+#define EDGE_BUNDLES 16
+#define ARENA_BLOCK_SIZE (64 * 1024)
+#define GLYPH_WIDTH 5
+#define GLYPH_HEIGHT 7
+#define GLYPH_SCALE 2
+#define TILE_SIZE 64
+#define SCENE_ELEMENT_BATCH 32
+#define SCENE_PART_ITEMS 256
+#define SCENE_PARTS_PER_THREAD 4
+#define BVH_LEAF_SIZE 4
+#define BVH_MAX_DEPTH 64
+#define LOD_HYSTERESIS 1.25f
+#define PICK_LINE_PIXELS 4.0f
+#define ATLAS_FIRST_CHAR 32
+#define ATLAS_GLYPH_COUNT 95
+#define ATLAS_WIDTH 256
+#define LABEL_CELL_SIZE 8
+#define PROFILE_EVENT_CAPACITY (1 << 18)
+#define PROFILE_SAMPLE_CAPACITY (1 << 14)
+#define PROFILE_HISTORY 60
+#define LAYOUT_SWEEPS 12
+#define LAYOUT_GAP 1.0f
+#define EDIT_JOURNAL_CAPACITY 1024
+#define WATCH_INTERVAL_MS 250
+#define DEFLATE_WINDOW 32768
+#define DEFLATE_HASH_SIZE 65536
+#define DEFLATE_MAX_CHAIN 32
+#define WEIGHT_GRID_MAX 64
+#define WEIGHT_ROW_BINS 4096
+#define WEIGHT_MAX_LEVELS 16
+#define WEIGHT_CHUNK 1024
+#define WEIGHT_RELEASE_BYTES (8 << 20)
+#define TIMELINE_BINS 32
+#define TIMELINE_AHEAD 12
+#define TIMELINE_BEHIND 4
+#define TIMELINE_THREADS 2
+#define TIMELINE_CACHE_BYTES (64 << 20)
+#define TIMELINE_FADE_SECONDS 0.12
+#define TIMELINE_PLAY_SECONDS 10.0
+#define INPUT_QUEUE_SIZE 1024
+#define LOADER_THREADS 2
+#define SCENE_CACHE_MAGIC 0x43533344u   // "D3SC"
+#define SCENE_CACHE_VERSION 1
+#define SCENE_CACHE_ALIGN 64
+#define SCENE_CACHE_MIN_SECONDS 0.05    // Quicker loads are not stored
+#define SCENE_CACHE_BUDGET_MB 4096      // The oldest files go beyond this
+#define SERVE_PORT 8765
+#define SERVE_BATCH 8                   // Requests for one model a worker takes at once
+#define SERVE_QUEUE_LIMIT 1024          // Further requests are turned away with 503
+#define SERVE_CACHE_MB 1024
+#define SERVE_MAX_SIZE 4096
+#define SERVE_MAX_SYNTH_LAYERS 100000   // Largest synth: network a request may ask for
+#define SERVE_MAX_SYNTH_WIDTH 100000
+#define SERVE_REQUEST_BYTES 4096
+#define SERVE_PENDING_LIMIT 32          // Connections still sending their request; more get 503
+#define SERVE_LATENCY_SAMPLES 8192
+#define SERVE_TIMEOUT_MS 2000
+#define GLTF_CHUNK_EXTENT 2048.0f       // Largest span of a line chunk per axis: steps of 1/32 unit
+#define GLTF_SCALE_STEP 4096.0f         // Instance sizes are told apart to 1/4096
+#define GLTF_KEY_GROUPS 256             // Nodes for the commonest sizes and colors
+#define GLTF_MIN_GROUP 16               // Rarer sizes and colors go to an overflow group
+#define GLTF_COLOR_LEVELS 16            // Overflow groups per shape: colors rounded to 16 levels a channel
+#define GLTF_OVERFLOW_COLORS (GLTF_COLOR_LEVELS * GLTF_COLOR_LEVELS * GLTF_COLOR_LEVELS)
+#define GLTF_MAX_GROUPS (GLTF_KEY_GROUPS + MESH_KIND_COUNT * GLTF_OVERFLOW_COLORS)
+#define GLTF_KEY_SLOTS 8192
+#define GLTF_SKIP 0xFFFF                // Instance slot: not at the finest level, so not written
+#define GLTF_OVERFLOW 0xFFFE            // Instance slot: met with the key table full
+
+// Forward declarations
+typedef struct GeometryBuffer GeometryBuffer;
+typedef struct Mesh Mesh;
+typedef struct InstanceList InstanceList;
+typedef struct MeshInstance MeshInstance;
+typedef struct Arena Arena;
+typedef struct NetworkGraph NetworkGraph;
+typedef struct SceneCache SceneCache;
+typedef struct BvhBuildItem BvhBuildItem;
+typedef struct MappedFile MappedFile;
+typedef struct NameMap NameMap;
+typedef struct TensorShape TensorShape;
+typedef struct LineCursor LineCursor;
+typedef struct PbReader PbReader;
+typedef struct PbField PbField;
+typedef struct ShapeTable ShapeTable;
+typedef struct Camera Camera;
+typedef struct Framebuffer Framebuffer;
+typedef struct ExportJob ExportJob;
+typedef struct Rasterizer Rasterizer;
+typedef struct RasterPrim RasterPrim;
+typedef struct VisibleSet VisibleSet;
+typedef struct CullStats CullStats;
+typedef struct SceneElement SceneElement;
+typedef struct ByteWriter ByteWriter;
+typedef struct GlyphAtlas GlyphAtlas;
+typedef struct LabelCache LabelCache;
+typedef struct Profiler Profiler;
+typedef struct BenchResult BenchResult;
+typedef struct GraphLayout GraphLayout;
+typedef struct ElementRange ElementRange;
+typedef struct LayerSpan LayerSpan;
+typedef struct LayerOp LayerOp;
+typedef struct LayerCost LayerCost;
+typedef struct LiveActivations LiveActivations;
+typedef struct WeightStats WeightStats;
+typedef struct WeightSummary WeightSummary;
+typedef struct WeightSet WeightSet;
+typedef struct JsonCursor JsonCursor;
+typedef struct Timeline Timeline;
+typedef struct PickHit PickHit;
+typedef struct PickRay PickRay;
+typedef struct InputEvent InputEvent;
+typedef struct InputQueue InputQueue;
+typedef struct LoadJob LoadJob;
+typedef struct SceneSnapshot SceneSnapshot;
+typedef struct SceneLoader SceneLoader;
+typedef struct ServedModel ServedModel;
+typedef struct RenderRequest RenderRequest;
+typedef struct PendingConnection PendingConnection;
+typedef struct RenderServer RenderServer;
+typedef struct GltfInstance GltfInstance;
+typedef struct GltfChunk GltfChunk;
+typedef struct GltfStats GltfStats;
+typedef struct GltfExport GltfExport;
+
+typedef enum {
+    LAYER_BOX,   // Representing input/conv layers as boxes
+    LAYER_FC     // Representing fully-connected layers as rows of spheres
+} LayerType;
+
+typedef enum {
+    EDGE_MODE_AUTO,     // Pick one of the modes below from the edge count
+    EDGE_MODE_FULL,     // Every neuron-to-neuron edge
+    EDGE_MODE_SAMPLED,  // Deterministic subset of edges
+    EDGE_MODE_BUNDLED,  // Edges routed through a few shared waist points
+    EDGE_MODE_RIBBON,   // One aggregated band per layer
+    EDGE_MODE_COUNT
+} EdgeMode;
+
+// Connection patterns of generated benchmark networks.
+typedef enum {
+    SYNTH_CHAIN,        // Each layer feeds the next
+    SYNTH_RESIDUAL,     // Chain plus a skip over every second layer
+    SYNTH_DENSE,        // Every layer feeds all later layers of its block of 4
+    SYNTH_INCEPTION,    // Blocks of four parallel branches between shared layers
+    SYNTH_TOPOLOGY_COUNT
+} SynthTopology;
+
+// What a layer computes, as far as shape inference needs to know. Layers are
+// OP_SCHEMATIC unless a model or built-in network says otherwise.
+typedef enum {
+    OP_SCHEMATIC,       // Drawn as given; no shape or cost
+    OP_TENSOR,          // Output shape given: network inputs, ops without a rule
+    OP_CONV,            // Convolution block, see LayerOp
+    OP_POOL,            // Max or average pooling; kernel 0 pools globally
+    OP_DENSE,           // Fully connected on the flattened input
+    OP_NORM,            // Batch normalization: a scale and shift per channel
+    OP_ELEMENTWISE,     // Activations, residual adds and other shape-keeping ops
+    OP_CONCAT,          // Inputs stacked along channels
+    OP_FLATTEN,
+    OP_KIND_COUNT
+} OpKind;
+
+enum {
+    OP_FLAG_BIAS = 1,       // Conv and dense layers add a bias per output channel
+    OP_FLAG_NORM = 2,       // Every convolution of the block is batch-normalized
+    OP_FLAG_RESIDUAL = 4,   // Convolutions pair up into residual blocks
+    OP_FLAG_AUTOSIZE = 8    // Box dimensions follow the inferred shape
+};
+
+// Per-layer cost the heat-map view sizes and colors boxes by.
+typedef enum {
+    COST_VIEW_OFF,
+    COST_VIEW_MACS,
+    COST_VIEW_PARAMS,
+    COST_VIEW_MEMORY,   // Activation memory written
+    COST_VIEW_COUNT
+} CostView;
+
+// Weight statistic neurons, edges and layers are colored by.
+typedef enum {
+    WEIGHT_VIEW_OFF,
+    WEIGHT_VIEW_MEAN,   // Mean |w|
+    WEIGHT_VIEW_MAX,    // Largest |w|
+    WEIGHT_VIEW_NORM,   // L2 norm
+    WEIGHT_VIEW_COUNT
+} WeightView;
+
+typedef enum {
+    WEIGHT_F32,
+    WEIGHT_F16,
+    WEIGHT_BF16,
+    WEIGHT_F64,
+    WEIGHT_DTYPE_COUNT
+} WeightDtype;
+
+// Scripted camera motion replayed by the benchmark suite.
+typedef enum {
+    PATH_ORBIT,         // Full turn around the vertical axis
+    PATH_TILT,          // Swing over the top and back
+    PATH_DIVE,          // Zoom from far out to close in while turning
+    PATH_COUNT
+} CameraPath;
+
+// Per-layer detail, picked each frame from the layer's projected size.
+typedef enum {
+    LOD_FULL,       // Finest neuron mesh, edges as configured
+    LOD_LOW_POLY,   // Coarsest neuron mesh, edges folded into one band
+    LOD_COLLAPSED,  // One glyph for the whole row plus the band
+    LOD_LEVEL_COUNT
+} LayerLod;
+
+#define LOD_MASK(level) (1 << (level))
+#define LOD_MASK_ALL ((1 << LOD_LEVEL_COUNT) - 1)
+
+// Text variants laid out for every layer; the layer's LOD picks one per frame.
+typedef enum {
+    LABEL_NONE = -1,
+    LABEL_NAME,         // The layer label as given
+    LABEL_COUNT,        // Label plus neuron count, for collapsed FC layers
+    LABEL_VARIANT_COUNT
+} LabelVariant;
+
+// What a pick landed on.
+typedef enum {
+    PICK_NONE,
+    PICK_LAYER,         // A box layer
+    PICK_NEURON,        // One neuron of a fully-connected row
+    PICK_ROW,           // A collapsed fully-connected row
+    PICK_LAYER_EDGES,   // The edges or band drawn inside a fully-connected layer
+    PICK_CONNECTION     // An arrow between two layers
+} PickKind;
+
+// Timed stages of the profiler. Stages may nest, e.g. edges inside a scene build.
+typedef enum {
+    PROF_FRAME,             // Window redraw (swap included), benchmark frame or exported image
+    PROF_SETUP,             // Network setup or model load
+    PROF_LAYOUT,
+    PROF_SCENE_BUILD,
+    PROF_SCENE_PATCH,       // Re-emitting only the layers edited since the last build
+    PROF_SCENE_CACHE,       // Mapping a stored scene, or storing a built one
+    PROF_LIVE_COLORS,       // Recoloring the scene from a streamed activation frame
+    PROF_TIMELINE,          // Blending the cached checkpoints around the scrub position
+    PROF_BUILD_EDGES,       // Fully-connected edges within a scene build
+    PROF_SCENE_UPLOAD,
+    PROF_CULL,
+    PROF_PICK,              // Ray cast under the cursor
+    PROF_DRAW_SCENE,        // GL draws of the retained buffers and instances
+    PROF_LABELS,
+    PROF_RASTER_SETUP,      // CPU renderer: transform, clip and bin
+    PROF_RASTER_TILES,
+    PROF_PRESENT,           // Blit of a CPU frame into the window
+    PROF_SWAP,
+    PROF_IMAGE_WRITE,
+    PROF_STAGE_COUNT
+} ProfileStage;
+
+typedef enum {
+    PROF_DRAW_CALLS,
+    PROF_VERTICES,          // Vertices submitted to GL, instanced meshes included
+    PROF_INSTANCES,
+    PROF_PRIMITIVES,        // Triangles and lines queued by the CPU renderer
+    PROF_GLU_CALLS,
+    PROF_ELEMENTS_CULLED,
+    PROF_LABELS_DRAWN,
+    PROF_COUNTER_COUNT
+} ProfileCounter;
+
+// Minimal threading shim over Win32 threads and pthreads.
+#ifdef _WIN32
+typedef HANDLE Thread;
+typedef CRITICAL_SECTION Mutex;
+typedef CONDITION_VARIABLE CondVar;
+#else
+typedef pthread_t Thread;
+typedef pthread_mutex_t Mutex;
+typedef pthread_cond_t CondVar;
+#endif
+typedef void (*ThreadFunc)(void* arg);
+typedef void (*RangeFunc)(void* ctx, int begin, int end);
+
+// Sockets, for the render server.
+#ifdef _WIN32
+typedef SOCKET Socket;
+typedef int SocketLength;
+#else
+typedef int Socket;
+typedef socklen_t SocketLength;
+#define INVALID_SOCKET (-1)
+#define closesocket close
+#endif
 
 // Function prototypes
+#ifdef _WIN32
 void SetupConsole(void);
-void SetupNetwork(void);
-void SetupAlexNet(void);
-void SetupVGG16(void);
-void SetupResNet18(void);
-void SetupCustomNetwork(void);
+#endif
+
+void* ArenaAlloc(Arena* arena, size_t size);
+void* ArenaGrow(Arena* arena, void* old, size_t oldSize, size_t newSize);
+void ArenaRelease(Arena* arena);
+
+void ResetNetwork(NetworkGraph* net);
+void ReserveLayers(NetworkGraph* net, int capacity);
+void ReserveConnections(NetworkGraph* net, int capacity);
+unsigned int HashBytes(const char* text, size_t len);
+const char* InternLabel(NetworkGraph* net, const char* text);
+const char* InternLabelRange(NetworkGraph* net, const char* text, size_t len);
+int AddLayer(NetworkGraph* net, LayerType type, const char* label, float r, float g, float b);
+int AddBoxLayer(NetworkGraph* net, const char* label, float width, float height, float depth, float r, float g, float b);
+int AddFullyConnectedLayer(NetworkGraph* net, const char* label, int neuronCount, float r, float g, float b);
+void AddConnection(NetworkGraph* net, int from, int to);
+void ConnectSequentialLayers(NetworkGraph* net);
+void ReserveRoutes(NetworkGraph* net, int edgeCount, int pointCount);
+void ReportNetworkMemory(const NetworkGraph* net);
+void MarkGraphChanged(NetworkGraph* net);
+void JournalLayer(NetworkGraph* net, int layer);
+float LayerWidth(const NetworkGraph* net, int layer);
+
+void SetLayerColor(NetworkGraph* net, int layer, const float* rgb);
+void SetLayerSize(NetworkGraph* net, int layer, const float* size);
+void SetLayerNeurons(NetworkGraph* net, int layer, int neuronCount);
+void SetLayerLabel(NetworkGraph* net, int layer, const char* label);
+void SetLayerOp(NetworkGraph* net, int layer, LayerOp op);
+void ReflowRank(NetworkGraph* net, int layer);
+int InsertLayerBelow(NetworkGraph* net, int parent);
+void RemoveLayer(NetworkGraph* net, int layer);
+unsigned int TopologyHash(const NetworkGraph* net);
+int SameTopology(const NetworkGraph* a, const NetworkGraph* b);
+int ApplyModelEdits(NetworkGraph* net, const NetworkGraph* fresh);
+
+LayerOp TensorOp(long long channels, long long height, long long width);
+LayerOp ConvOp(int channels, int kernel, int stride, int pad, int repeat, int flags);
+LayerOp WithPool(LayerOp op, int kernel, int stride, int pad);
+LayerOp DenseOp(int units);
+int SameLayerOp(const LayerOp* a, const LayerOp* b);
+long long ShapeElements(const TensorShape* shape);
+long long ConvExtent(long long size, int kernel, int stride, int pad);
+void ConvBlockCost(const LayerOp* op, const TensorShape* in, LayerCost* c);
+void PoolCost(int kernel, int stride, int pad, TensorShape* x, LayerCost* c);
+void LayerCostRule(const NetworkGraph* net, int layer, const int* inStart, const int* inFrom, LayerCost* c);
+void InferLayerCosts(NetworkGraph* net);
+const char* OpKindName(OpKind kind);
+const char* CostViewName(CostView view);
+long long CostViewValue(const NetworkGraph* net, int layer, CostView view);
+void FormatQuantity(double value, const char* unit, char* buf, size_t size);
+void FormatShape(const TensorShape* shape, char* buf, size_t size);
+void FormatLayerCost(const NetworkGraph* net, int layer, CostView view, char* buf, size_t size);
+void FormatCostSummary(const NetworkGraph* net, CostView view, int topCount, char* text, size_t size);
+void HeatColor(float t, float* rgb);
+void CostViewStyle(const NetworkGraph* net, int layer, float* color, float* size);
+
+int MapFile(const char* path, MappedFile* file);
+int MapFileView(const char* path, MappedFile* file, int writable);
+void UnmapFile(MappedFile* file);
+void NameMapPut(NameMap* map, const char* key, int len, int value);
+int NameMapGet(const NameMap* map, const char* key, int len);
+void DefaultLayerColor(int index, float* rgb);
+void BoxSizeFromShape(const TensorShape* shape, float* width, float* height, float* depth);
+int LoadModelFile(NetworkGraph* net, const char* path);
+int LoadTextModel(NetworkGraph* net, const unsigned char* data, size_t size, const char* path);
+int NextField(LineCursor* c, const char** field);
+int ParseNumber(const char* text, int len, double* value);
+int ParseNumbers(LineCursor* c, double* values, int count);
+int ResolveLayerRef(const NetworkGraph* net, const NameMap* labels, const char* field, int len);
+int LoadOnnxModel(NetworkGraph* net, const unsigned char* data, size_t size, const char* path);
+int PbVarint(PbReader* r, unsigned long long* value);
+int PbNext(PbReader* r, PbField* f);
+int PbInts(const PbField* f, long long* out, int count, int max);
+void ShapeFromDims(const long long* dims, int rank, TensorShape* shape);
+int ParseValueInfo(PbReader r, const char** name, int* nameLen, TensorShape* shape);
+void AppendShape(ShapeTable* table, const TensorShape* shape, const char* name, int nameLen);
+LayerOp OnnxLayerOp(const char* opType, int opLen, const TensorShape* shape, const TensorShape* weight,
+                    long long kernel, long long stride, long long pad, long long group, int inCount);
 
+size_t WeightDtypeSize(WeightDtype dtype);
+int WeightShapeFits(const long long* dims, int rank, size_t elementSize, unsigned long long bytes,
+                    long long* elements);
+const char* WeightDtypeName(WeightDtype dtype);
+const char* WeightViewName(WeightView view);
+int ParseWeightView(const char* name, WeightView* view);
+float WeightStatValue(const WeightStats* s, WeightView view);
+void AddWeightStats(WeightStats* into, const WeightStats* s);
+WeightSummary* AppendWeightTensor(WeightSet* set, const char* name, int nameLen, WeightDtype dtype,
+                                  const long long* dims, int rank, const unsigned char* data);
+int ParseNpyHeader(WeightSet* set, const unsigned char* data, size_t size, const char* name);
+void JsonSpace(JsonCursor* c);
+int JsonString(JsonCursor* c, const char** text, int* len);
+int JsonExpect(JsonCursor* c, char ch);
+int JsonSkipValue(JsonCursor* c);
+int JsonInts(JsonCursor* c, long long* out, int max);
+int ParseSafetensorsHeader(WeightSet* set, const unsigned char* data, size_t size, const char* path);
+void WeightKernel(const float* v, int count, WeightStats* s);
+float HalfToFloat(unsigned short h);
+void WeightRunStats(const unsigned char* data, WeightDtype dtype, long long count, WeightStats* s);
+void ReleaseMappedPages(const void* begin, const void* end);
+void SummarizeWeightBands(void* ctx, int begin, int end);
+void BuildWeightLevels(WeightSummary* w);
+int LoadWeightFile(WeightSet* set, const char* path);
+void ReleaseWeights(WeightSet* set);
+void WeightRowStats(const WeightSummary* w, int first, int end, WeightStats* out);
+float WeightShare(float value, float top);
+void WeightNeuronValues(const WeightSummary* w, int neuronCount, float* out);
+int WeightGridLevel(const WeightSummary* w, int neuronCount);
+void WeightEdgeColor(const WeightSummary* w, int level, int src, int dst, int neuronCount, float* rgb);
+void WeightLayerColor(const WeightSet* set, const WeightSummary* w, float* rgb);
+const WeightSummary* LayerWeights(const NetworkGraph* net, int layer);
+int NormalizeWeightName(const char* text, int textLen, char* out, int size);
+void MatchWeights(const NetworkGraph* net, const WeightSet* set, int* layerTensor);
+void AttachWeights(NetworkGraph* net, const WeightSet* set);
+int LoadSiblingWeights(WeightSet* set, const char* modelPath);
+
+void SetupNetwork(NetworkGraph* net, const char* modelPath);
+void SetupAlexNet(NetworkGraph* net);
+void SetupVGG16(NetworkGraph* net);
+void SetupResNet18(NetworkGraph* net);
+void SetupCustomNetwork(NetworkGraph* net);
+int SetupSyntheticNetwork(NetworkGraph* net, const char* spec);
+
+#ifdef _WIN32
 void SetupPixelFormatForDC(HDC hDC);
 void InitOpenGL(void);
+void LoadBufferExtensions(void);
+void LoadInstancingExtensions(void);
+void ReleaseInstancing(void);
+void ResizeViewport(int width, int height);
+void ApplySwapInterval(void);
+#endif
+
+void EmitBox(SceneCache* sc, float cx, float cy, float cz, float width, float height, float depth, const float* color);
+void EmitSphere(SceneCache* sc, float x, float y, float z, float radius, const float* color);
+float ArrowLength(float x1, float y1, float z1, float x2, float y2, float z2);
+void EmitArrow(SceneCache* sc, float x1, float y1, float z1, float x2, float y2, float z2, const float* color);
+void EmitLine(SceneCache* sc, float x1, float y1, float z1, float x2, float y2, float z2, const float* color);
+void EmitFullyConnectedLayer(SceneCache* sc, const float* center, int neuronCount, const float* color,
+                             const WeightSummary* weights);
+
+void NeuronPosition(const float* center, int index, int neuronCount, float* x, float* z);
+EdgeMode ResolveEdgeMode(long long edgeCount);
+void EmitFullyConnectedEdges(SceneCache* sc, const float* center, int neuronCount, const float* color,
+                             const WeightSummary* weights);
+void EmitSampledEdges(SceneCache* sc, const float* center, int neuronCount, const float* color,
+                      const WeightSummary* weights);
+void EmitBundledEdges(SceneCache* sc, const float* center, int neuronCount, const float* color,
+                      const WeightSummary* weights);
+void EmitEdgeRibbon(SceneCache* sc, const float* center, int neuronCount, const float* color);
+const char* EdgeModeName(EdgeMode mode);
+void NeuronRow(const float* center, int neuronCount, float* xs, float* zs);
+void EmitNeuronSpheres(SceneCache* sc, int count, const float* xs, float y, const float* zs, float radius,
+                       const float* colors, const float* color);
+void EmitNeuronEdges(SceneCache* sc, int count, const float* x1, const float* z1, int sourceStep, float y1,
+                     const float* x2, const float* z2, float y2, const float* colors, const float* color);
+void RebaseIndices(GLuint* dst, const GLuint* src, int count, GLuint offset);
+
+void ReserveGeometry(GeometryBuffer* buf, int extraVertices, int extraIndices);
+void SliceOverflow(void);
+void AppendVertex(GeometryBuffer* buf, float x, float y, float z, const float* color);
+void BuildMeshCache(void);
+void TessellateSphere(Mesh* mesh, int slices, int stacks);
+void TessellateCone(Mesh* mesh, int slices);
+void TessellateBox(Mesh* mesh);
+MeshInstance* AppendInstance(InstanceList* list);
+void ReserveInstances(InstanceList* list, int extra);
+int ChooseMeshDetail(int instanceCount);
+void ReleaseMeshCache(void);
+void BuildScene(SceneCache* sc, const NetworkGraph* net);
+void ReserveSceneLayers(SceneCache* sc, int layerCount);
+void GroupEdgesByTarget(SceneCache* sc, const NetworkGraph* net);
+void EmitSceneItems(SceneCache* sc, const NetworkGraph* net, int begin, int end);
+void SceneItemSize(const SceneCache* sc, const NetworkGraph* net, int item, long long* size);
+long long PredictSceneBytes(SceneCache* sc, const NetworkGraph* net);
+long long SceneSizeBytes(const long long* size);
+int SceneWithinLimit(const char* spec, long long bytes);
+void SizeSceneParts(void* ctx, int begin, int end);
+void EmitSceneParts(void* ctx, int begin, int end);
+void EmitScenePartsParallel(SceneCache* sc, const NetworkGraph* net, int threadCount);
+void EmitIncomingEdges(SceneCache* sc, const NetworkGraph* net, int layer);
+void EmitLayerBody(SceneCache* sc, const NetworkGraph* net, int layer);
+int PatchScene(SceneCache* sc, const NetworkGraph* net);
+int ReplaceSpan(SceneCache* sc, ElementRange* span, int first);
+void RetireSpan(SceneCache* sc, ElementRange* span);
+void MarkPatched(GeometryBuffer* buf, int firstVertex, int endVertex, int firstIndex, int endIndex);
+void MarkRecolored(GeometryBuffer* buf, int firstVertex, int endVertex);
+void ReleaseSceneBuffers(SceneCache* sc);
+void ReleaseScene(SceneCache* sc);
+size_t SceneMemory(const SceneCache* sc);
+
+int AttachLiveActivations(LiveActivations* live, const char* name);
+void DetachLiveActivations(LiveActivations* live);
+int LiveFramePending(const LiveActivations* live, const SceneCache* sc);
+void RecolorLayer(SceneCache* sc, const NetworkGraph* net, int layer, const float* values, int binCount);
+int ApplyLiveActivations(SceneCache* sc, const NetworkGraph* net, LiveActivations* live);
+void FillDemoFrame(ActivationStream* stream, float* frame, long long tick, float* scratch, int neurons);
+
+int CompareCheckpointPaths(const void* a, const void* b);
+void AddCheckpointPath(Timeline* tl, const char* dir, const char* name);
+int ListCheckpoints(Timeline* tl, const char* dir);
+int DecodeCheckpoint(const Timeline* tl, int checkpoint, float* values, long long* bytes);
+void NormalizeCheckpoint(const Timeline* tl, float* values);
+int OpenTimeline(Timeline* tl, const NetworkGraph* net, const char* dir, size_t cacheBytes);
+void CloseTimeline(Timeline* tl);
+int InTimelineWindow(const Timeline* tl, int checkpoint);
+int NextTimelineJob(Timeline* tl, int* slot);
+void TimelineWorker(void* arg);
+void SeekTimeline(Timeline* tl, double position);
+int ApplyTimeline(SceneCache* sc, const NetworkGraph* net, Timeline* tl, double now);
+int TimelineBusy(const Timeline* tl);
+void FormatTimelineStatus(Timeline* tl, char* text, size_t size);
+
+int SceneCacheDirectory(char* dir, size_t size);
+void SetSceneCacheOption(const char* value);
+int MakeDirectories(const char* path);
+int SceneCacheKey(const char* spec, char* key, size_t size);
+unsigned int AtlasHash(const GlyphAtlas* atlas);
+void* DuplicateArray(const void* data, size_t bytes);
+int InSceneCacheFile(const SceneCache* sc, const void* data);
+void* SceneRealloc(const SceneCache* sc, void* data, size_t usedBytes, size_t bytes);
+void SceneFree(const SceneCache* sc, void* data);
+long long StoreSceneCache(const char* path, const char* key, const NetworkGraph* net, const SceneCache* sc,
+                          const LabelCache* lc);
+int LoadSceneCache(const char* path, const char* key, NetworkGraph* net, SceneCache* sc, LabelCache* lc,
+                   const GlyphAtlas* atlas);
+int RangeWithin(ElementRange r, long long count);
+void TrimSceneCache(const char* dir);
+int SceneCachePath(const char* spec, char* dir, size_t dirSize, char* path, size_t pathSize, char* key, size_t keySize);
+int LoadModelScene(NetworkGraph* net, SceneCache* sc, LabelCache* lc, const GlyphAtlas* atlas, const char* spec,
+                   const WeightSet* weights);
 
-void DrawBox(float cx, float cy, float cz, float width, float height, float depth);
-void DrawSphere(float x, float y, float z, float radius);
-void DrawArrow(float x1, float y1, float z1, float x2, float y2, float z2);
-void DrawFullyConnectedLayer(float y, int neuronCount);
-void RenderText(const char* text, float x, float y, float z);
+int PushInput(InputQueue* q, const InputEvent* e);
+int PopInput(InputQueue* q, InputEvent* e);
+void BuildSnapshot(const LoadJob* job, SceneSnapshot* snap);
+void ReleaseSnapshot(SceneSnapshot* snap);
+void SwapInSnapshot(NetworkGraph* net, SceneCache* sc, SceneSnapshot* snap);
+void LoaderWorker(void* arg);
+void StartLoader(SceneLoader* loader, void (*notify)(void));
+void StopLoader(SceneLoader* loader);
+void SubmitLoad(SceneLoader* loader, const LoadJob* job);
+SceneSnapshot* TakeSnapshot(SceneLoader* loader, int* busy);
+void RetireSnapshot(SceneLoader* loader, SceneSnapshot* snap);
+#ifdef _WIN32
+void MarkSceneDirty(void);
+void UploadGeometry(GeometryBuffer* buf);
+void DrawGeometry(const GeometryBuffer* buf, GLenum mode, const GLuint* subset, int subsetCount);
+void UploadMesh(Mesh* mesh);
+void UploadMeshCache(void);
+void DrawInstances(const Mesh* mesh, const InstanceList* list, int first, int count);
+void StreamInstances(const MeshInstance* items, int count);
+void DrawStreamedInstances(const Mesh* mesh, int first, int count);
+void UploadScene(SceneCache* sc);
+void UploadPatchedGeometry(GeometryBuffer* buf);
+void UploadScenePatch(SceneCache* sc);
+void DrawVisibleInstances(const SceneCache* sc, const VisibleSet* vis, const Mesh* sphere, const Mesh* lowSphere,
+                          const Mesh* cone);
+void DrawSceneBuffers(SceneCache* sc, const VisibleSet* vis);
+#endif
 
+void CloseSceneElement(SceneCache* sc);
+void ReserveSceneElements(SceneCache* sc, int extra);
+void BuildBvhNode(SceneCache* sc, BvhBuildItem* items, int node, int first, int count);
+void BuildSceneBvh(SceneCache* sc);
+void RefitBvh(SceneCache* sc, int element);
+void ExtractFrustum(const float* m, float planes[6][4]);
+int ClassifyBox(const float planes[6][4], const float* bounds);
+void AppendVisible(VisibleSet* vis, int element);
+int CompareInts(const void* a, const void* b);
+void UpdateLayerLod(const SceneCache* sc, const float* viewProj, int viewportHeight, VisibleSet* vis);
+void ResetLayerLod(VisibleSet* vis);
+int ElementLod(const VisibleSet* vis, const SceneElement* e);
+LabelVariant LayerLabelVariant(const NetworkGraph* net, const VisibleSet* vis, int layer);
+void CullScene(const SceneCache* sc, const float* viewProj, int viewportHeight, VisibleSet* vis);
+void ReleaseVisibleSet(VisibleSet* vis);
+void FormatCullStats(const CullStats* st, char* text, size_t size);
+
+int MakePickRay(const float* viewProj, int width, int height, float x, float y, PickRay* ray);
+float RayBoxEntry(const PickRay* ray, const float* bounds, float margin, float limit);
+float RayTriangle(const PickRay* ray, const float* a, const float* b, const float* c);
+float RayInstance(const PickRay* ray, const float* m);
+float RaySegment(const PickRay* ray, const float* a, const float* b);
+void PickElement(const SceneCache* sc, const PickRay* ray, int element, PickHit* hit);
+int PickableElement(const SceneCache* sc, const VisibleSet* vis, int element);
+void ClassifyPick(const SceneCache* sc, const NetworkGraph* net, PickHit* hit);
+int PickScene(const SceneCache* sc, const NetworkGraph* net, const VisibleSet* vis, const float* viewProj,
+              int width, int height, float x, float y, PickHit* hit);
+void FormatPickInfo(const NetworkGraph* net, const PickHit* hit, char* text, size_t size);
+
+void Mat4Multiply(const float* a, const float* b, float* out);
+void Mat4Rotate(float* m, float angle, float x, float y, float z);
+int Mat4Invert(const float* m, float* out);
+void CameraMatrix(const Camera* cam, float aspect, float* out);
+void TransformPoint(const float* m, float x, float y, float z, float* clip);
+
+void AllocateGlyphAtlas(GlyphAtlas* atlas, const int* widths, int cellHeight);
+void BuildEmbeddedAtlas(GlyphAtlas* atlas);
+void ReleaseGlyphAtlas(GlyphAtlas* atlas);
+void FormatLayerLabel(const NetworkGraph* net, int layer, LabelVariant variant, char* buf, size_t size);
+void LayoutLabels(LabelCache* lc, const GlyphAtlas* atlas, const NetworkGraph* net);
+void LayoutLayerLabels(LabelCache* lc, const GlyphAtlas* atlas, const NetworkGraph* net, int layer);
+int PatchLabels(LabelCache* lc, const GlyphAtlas* atlas, const NetworkGraph* net);
+int ComparePlacedLabels(const void* a, const void* b);
+void PlaceLabels(LabelCache* lc, const GlyphAtlas* atlas, const NetworkGraph* net, VisibleSet* vis,
+                 const float* viewProj, int width, int height);
+void SwapLabelLayouts(LabelCache* a, LabelCache* b);
+void ReleaseLabelCache(LabelCache* lc);
+#ifdef _WIN32
+int BuildFontAtlas(GlyphAtlas* atlas);
+void UploadGlyphAtlas(GlyphAtlas* atlas);
+void DrawLabels(const GlyphAtlas* atlas, LabelCache* lc);
+float* PutGlyphQuad(float* v, const GlyphAtlas* atlas, int index, float x, float top, float depth);
+void ReserveGlyphQuads(float** vertices, int* capacity, int quads);
+void DrawGlyphQuads(const GlyphAtlas* atlas, const float* vertices, int quads, int depthTest);
+void DrawScreenText(const GlyphAtlas* atlas, const char* text, int x, int y);
+#endif
+int InitFramebuffer(Framebuffer* fb, int width, int height);
+void ReleaseFramebuffer(Framebuffer* fb);
+void ProjectToScreen(const Framebuffer* fb, const float* clip, float* screen);
+unsigned int PackColor(const float* color);
+void InitRasterizer(Rasterizer* r, int threadCount);
+void ReleaseRasterizer(Rasterizer* r);
+float* ClipScratch(Rasterizer* r, int vertexCount);
+RasterPrim* AppendPrim(Rasterizer* r);
+void QueueTriangle(Rasterizer* r, const float* a, const float* b, const float* c, unsigned int color);
+void DrawClippedTriangle(Rasterizer* r, const float* a, const float* b, const float* c, unsigned int color);
+void DrawClippedLine(Rasterizer* r, const float* a, const float* b, unsigned int color);
+void RasterMesh(Rasterizer* r, const float* viewProj, const Mesh* mesh, const InstanceList* list, int first, int count);
+void BinPrimitives(Rasterizer* r);
+void RasterTileTriangle(const RasterPrim* prim, int ox, int oy, int width, int height, unsigned int* color, float* depth);
+void RasterTileLine(const RasterPrim* prim, int ox, int oy, int width, int height, unsigned int* color, float* depth);
+void RasterTile(Rasterizer* r, int tile);
+void RasterTiles(Rasterizer* r);
+void RasterWorker(void* arg);
+void RasterLabels(Framebuffer* fb, const GlyphAtlas* atlas, const LabelCache* lc);
+void RasterScreenText(Framebuffer* fb, const GlyphAtlas* atlas, const char* text, int x, int y);
+void RasterScene(Rasterizer* r, Framebuffer* fb, const SceneCache* sc, const NetworkGraph* net, const Camera* cam);
+int RunRasterBenchmark(int argc, char** argv);
+void CameraPathPose(CameraPath path, float t, Camera* cam);
+const char* CameraPathName(CameraPath path);
+int CompareDoubles(const void* a, const void* b);
+double Percentile(const double* sorted, int count, double p);
+int WriteBenchmarkCsv(const BenchResult* results, int count, const char* path);
+int CheckBenchmarkBaseline(const BenchResult* results, int count, const char* path, double threshold);
+int RunBenchmarkSuite(int argc, char** argv);
+long long CountPixelDifferences(const Framebuffer* a, const Framebuffer* b);
+int RunEditBenchmark(int argc, char** argv);
+int RunStreamDemo(int argc, char** argv);
+void StreamProducerThread(void* arg);
+int RunStreamBenchmark(int argc, char** argv);
+int RunTimelineBenchmark(int argc, char** argv);
+int RunPickBenchmark(int argc, char** argv);
+void InputFeedThread(void* arg);
+int RunInputBenchmark(int argc, char** argv);
+double SceneDifference(const SceneCache* a, const SceneCache* b);
+int RunBuildBenchmark(int argc, char** argv);
+int SameGraph(const NetworkGraph* a, const NetworkGraph* b);
+int RunCacheBenchmark(int argc, char** argv);
+
+unsigned int Crc32(unsigned int crc, const unsigned char* data, size_t len);
+void PutByte(ByteWriter* w, unsigned char value);
+void PutBytes(ByteWriter* w, const void* data, size_t size);
+void PutBig32(ByteWriter* w, unsigned int value);
+void PutBits(ByteWriter* w, unsigned int value, int count);
+void PutCode(ByteWriter* w, unsigned int code, int length);
+void PutFixedSymbol(ByteWriter* w, int symbol);
+void PutMatch(ByteWriter* w, int length, int distance);
+void Deflate(ByteWriter* w, const unsigned char* data, size_t size);
+int WritePPM(const Framebuffer* fb, const char* path);
+int EncodePNG(const Framebuffer* fb, ByteWriter* png);
+int WritePNG(const Framebuffer* fb, const char* path);
+
+double NowSeconds(void);
+void SleepSeconds(double seconds);
+#ifdef _WIN32
+DWORD WINAPI ThreadTrampoline(LPVOID param);
+#else
+void* ThreadTrampoline(void* param);
+#endif
+int StartThread(Thread* thread, ThreadFunc func, void* arg);
+void JoinThread(Thread thread);
+void YieldThread(void);
+void LowerThreadPriority(void);
+long AtomicIncrement(volatile long* value);
+long AtomicLoad(volatile long* value);
+void AtomicStore(volatile long* value, long v);
+int CpuCount(void);
+unsigned long CurrentThreadId(void);
+void ParallelWorker(void* arg);
+void ParallelFor(int count, int grain, RangeFunc func, void* ctx);
+void ParallelForThreads(int count, int grain, int threadCount, RangeFunc func, void* ctx);
+size_t PeakMemoryBytes(void);
+size_t ResidentMemoryBytes(void);
+void InitMutex(Mutex* mutex);
+void DestroyMutex(Mutex* mutex);
+void LockMutex(Mutex* mutex);
+void UnlockMutex(Mutex* mutex);
+void InitCondVar(CondVar* cond);
+void DestroyCondVar(CondVar* cond);
+void WaitCondVar(CondVar* cond, Mutex* mutex);
+void WakeAllCondVar(CondVar* cond);
+
+void LayoutNetwork(NetworkGraph* net);
+void AssignLayoutRanks(GraphLayout* g, const NetworkGraph* net);
+void BuildLayoutGraph(GraphLayout* g, const NetworkGraph* net);
+void ComputeSweepKeys(void* ctx, int begin, int end);
+int CompareLayoutItems(const void* a, const void* b);
+void SortLayoutRanks(void* ctx, int begin, int end);
+void CountRankCrossings(void* ctx, int begin, int end);
+long long CountLayoutCrossings(GraphLayout* g);
+void AssignLayoutCoordinates(GraphLayout* g, const NetworkGraph* net);
+void ReleaseGraphLayout(GraphLayout* g);
+
+void EnableProfiler(int enabled);
+double ProfileStart(void);
+void ProfileEnd(ProfileStage stage, double start);
+void ProfileCount(ProfileCounter counter, long long amount);
+void ProfileFrameEnd(void);
+const char* ProfileStageName(ProfileStage stage);
+const char* ProfileCounterName(ProfileCounter counter);
+void FormatProfileHud(char* text, size_t size);
+int WriteProfileTrace(const char* path);
+int WriteProfileCsv(const char* path);
+int WriteProfile(const char* path);
+
+int LoadModelSpec(NetworkGraph* net, const char* spec);
+void ModelStem(const char* spec, char* stem, size_t size);
+char** UniqueStems(const char** models, int count, Arena* arena);
+void ExportWorker(void* arg);
+int RunExport(int argc, char** argv);
+void PrintExportUsage(void);
+void SetSocketTimeouts(Socket s, int ms);
+int SendAll(Socket s, const void* data, size_t size);
+const char* HttpStatusText(int status);
+int SendHttpResponse(Socket s, int status, const char* type, const void* body, size_t size);
+void SendHttpError(Socket s, int status, const char* message);
+int ReadHttpRequest(Socket s, char* buf, int* used, int size);
+int HexDigit(char c);
+int QueryValue(const char* query, const char* name, char* value, size_t size);
+int ResolveServedModel(const RenderServer* server, const char* id, char* spec, size_t size);
+int ParseRenderRequest(const RenderServer* server, const char* target, RenderRequest* req, char* message,
+                       size_t size);
+void FormatServeStats(const RenderServer* server, char* text, size_t size);
+RenderRequest* TakeRequestBatch(RenderServer* server);
+size_t ServedModelBytes(const ServedModel* model);
+void UnlinkServedModel(RenderServer* server, ServedModel* model);
+void FreeServedModels(ServedModel* model);
+void ReleaseServedModel(RenderServer* server, ServedModel* model);
+ServedModel* AcquireServedModel(RenderServer* server, const char* spec);
+ServedModel* EvictServedModels(RenderServer* server);
+int SameRenderView(const RenderRequest* a, const RenderRequest* b);
+int RenderServedImage(Rasterizer* r, Framebuffer* fb, const ServedModel* model, const RenderRequest* req,
+                      ByteWriter* out);
+void ServeWorker(void* arg);
+void HandleServeConnection(RenderServer* server, Socket client, const char* request, double arrival);
+void ServeConnections(RenderServer* server);
+void ServeAcceptThread(void* arg);
+int StartRenderServer(RenderServer* server, int port, int threadCount, size_t cacheBytes);
+void StopRenderServer(RenderServer* server);
+int RunServer(int argc, char** argv);
+int HttpGet(int port, const char* target, ByteWriter* body);
+void ServeClientThread(void* arg);
+int RunServeBenchmark(int argc, char** argv);
+int GltfWritesElement(const SceneElement* e);
+void GltfQuaternion(const float column[3][3], float* q);
+void GltfInstanceAt(const SceneCache* sc, int shape, long long item, GltfInstance* out);
+unsigned char GltfColorByte(float value);
+float GltfLinear(unsigned char srgb);
+unsigned short GltfKeySlot(GltfExport* ex, int shape, const GltfInstance* inst);
+int GltfOverflowGroup(GltfExport* ex, int shape, const unsigned char* color);
+void GltfAddLines(GltfExport* ex, int element);
+short GltfQuantize(const GltfChunk* chunk, const float* v, int axis);
+int GltfMaterial(GltfExport* ex, const unsigned char* color);
+int CompareGltfKeys(const void* a, const void* b);
+void GltfPlan(GltfExport* ex);
+void PutText(ByteWriter* w, const char* format, ...);
+int GltfAccessor(ByteWriter* w, int* count, int view, long long offset, int componentType, int normalized,
+                 long long items, const char* type);
+void GltfWriteJson(GltfExport* ex, ByteWriter* json);
+void GltfFlush(GltfExport* ex);
+void GltfWrite(GltfExport* ex, const void* data, size_t size);
+void GltfWriteBinary(GltfExport* ex);
+void PutLittle32(unsigned char* out, unsigned int value);
+unsigned int ReadLittle32(const unsigned char* in);
+int WriteGltfScene(const SceneCache* sc, const char* path, GltfStats* stats);
+int RunGltfBenchmark(int argc, char** argv);
+int RunBatchCommand(int argc, char** argv, int* exitCode);
+int ParseCostView(const char* name, CostView* view);
+int RunCostReport(int argc, char** argv);
+int RunWeightStats(int argc, char** argv);
+
+#ifdef _WIN32
+void UpdateScene(void);
 void DrawNetwork(void);
+void PresentCpuFrame(void);
+void RequestRedraw(void);
 void RenderScene(void);
+void ShowCullStats(const CullStats* st);
+void DrawProfilerHud(void);
+void DrawCostHud(void);
+void DrawTimelineHud(void);
+void DumpProfile(void);
+void PrintEditLayer(const char* action);
+void EditLayer(WPARAM key);
+void ScrubTimeline(WPARAM key);
+int PickAtCursor(int x, int y, PickHit* hit);
+void HoverAt(int x, int y);
+void SelectAtCursor(int x, int y);
+void DrawPickTooltip(void);
+void DrawLoadHud(void);
+void CheckWatchedModel(void);
+void PostWindowTitle(const char* title);
+void QueueInput(UINT message, WPARAM wParam, LPARAM lParam);
+void WakeRenderThread(void);
+void SubmitModelLoad(int reload);
+void AdoptSnapshot(void);
+void ApplyInput(const InputEvent* e);
+int DrainInput(void);
+void RunRenderLoop(void);
+void RenderThread(void* arg);
+void RunMessageLoop(MSG* msg);
 
 // Window procedure
 LRESULT CALLBACK WndProc(HWND hWnd, UINT message, WPARAM wParam, LPARAM lParam);
+#endif
 
 //-------------------------
 // Data Structures
 //-------------------------
 
+// Bump allocator: memory is carved out of large blocks and released all at once.
+typedef struct ArenaBlock {
+    struct ArenaBlock* next;
+    size_t used, size;
+    double data[];      // double keeps the payload suitably aligned
+} ArenaBlock;
+
+struct Arena {
+    ArenaBlock* head;
+    size_t reservedBytes;   // Sum of block sizes
+    size_t usedBytes;       // Sum of live allocations, including abandoned growth
+};
+
+// The model as a graph. Hot per-layer fields are kept as parallel arrays
+// (structure of arrays) so scene building streams through exactly what it
+// reads; all storage, labels included, lives in the arena.
+struct NetworkGraph {
+    int layerCount, layerCapacity;
+    LayerType* type;
+    float* size;            // width, height, depth per layer (box layers)
+    int* neuronCount;       // Neurons per layer (FC layers)
+    float* color;           // rgb per layer
+    float* position;        // xyz of the layer center
+    int* rank;              // Layout rank; the layer's y is TOP_Y - rank * LAYER_SPACING
+    const char** label;     // Interned, owned by the arena
+    LayerOp* op;            // What each layer computes, for shape inference
+    LayerCost* cost;        // Derived from op and the edges by InferLayerCosts
+    int* weight;            // Tensor of weights that colors the layer, -1 for none
+    const WeightSet* weights;   // Set the indices refer to, owned by the caller
+    
+    int edgeCount, edgeCapacity;
+    int* edgeFrom;          // Explicit connections, so any DAG can be expressed
+    int* edgeTo;
+    
+    // Bend points of edges that skip ranks, set by LayoutNetwork: edge e runs
+    // through routePoints[routeStart[e] .. routeStart[e + 1]), xyz each.
+    int* routeStart;
+    float* routePoints;
+    int routedEdges;        // edgeCount the routes belong to, 0 when none
+    int routeCapacity, routePointCapacity;
+    
+    const char** internTable;   // Open-addressing set of interned labels
+    int internCount, internCapacity;
+    
+    Arena arena;
+    int revision;           // Bumped on every change so caches know to rebuild
+    
+    // Layers changed by edits, one entry per revision: a cache built at
+    // revision R >= journalStart only has to redo journal[R - journalStart ..].
+    // Bulk changes restart the journal, which sends older caches to a rebuild.
+    int* journal;
+    int journalStart, journalCount;
+    
+    // Totals of the last InferLayerCosts run.
+    long long totalParams, totalMacs, totalActivationBytes;
+    long long peakActivationBytes;          // Estimate: outputs live until their last consumer ran
+    long long maxCost[COST_VIEW_COUNT];     // Largest per-layer value, the top of the heat scale
+    int costLayers;                         // Layers with a known output shape
+};
+
+NetworkGraph network;
+char watchedModel[260];     // Model file the window was opened with, "" for built-ins
+
+typedef struct {
+    float key;
+    int order;                  // Previous position, keeps equal keys stable
+    int node;
+} LayoutItem;
+
+// Scratch of one LayoutNetwork run. Nodes below layerCount are layers; the
+// rest are dummies, one per rank an edge skips, so long edges take part in
+// ordering and come out with bend points. Per-rank data is stored in rank
+// segments (rankStart), which lets the parallel passes work on disjoint ranges.
+struct GraphLayout {
+    int layerCount, nodeCount, rankCount;
+    int* rank;
+    int* order;                 // Index within the node's rank
+    int* rankStart;             // rankCount + 1 offsets into byRank
+    int* byRank;                // Nodes grouped by rank, in order
+    int* predStart;             // Adjacency in both directions, compressed rows
+    int* preds;
+    int* succStart;
+    int* succs;
+    int* edgeDummy;             // First dummy of each graph edge, -1 when it spans one rank
+    unsigned char* edgeFlipped; // Edge points upward; its bends are reversed
+    
+    float* key;                 // Barycenter of the current sweep
+    LayoutItem* items;          // Sort scratch, rank segments like byRank
+    int* bestOrder;
+    int* rankEdgeStart;         // Offsets of each rank's outgoing edges in crossScratch
+    int* crossScratch;
+    int* fenwick;               // Rank segments like byRank, one slot per node
+    long long* rankCrossings;   // Between each rank and the next
+    int downward;               // Sweep uses predecessors, else successors
+    int sweepRank;              // Rank whose keys the sweep is computing
+    float* x;
+    float* width;
+};
+
+// Read-only view of a whole file mapped into memory.
+struct MappedFile {
+    const unsigned char* data;
+    size_t size;
+#ifdef _WIN32
+    HANDLE file, mapping;
+#else
+    int fd;
+#endif
+};
+
+// Open-addressing map from a (not NUL-terminated) name to an int, used by the
+// importers to resolve tensor and layer names that point into mapped files.
+typedef struct {
+    const char* key;
+    int len;
+    int value;
+} NameEntry;
+
+struct NameMap {
+    NameEntry* entries;
+    int count, capacity;
+    Arena* arena;
+};
+
+// Activation shape in NCHW terms with the batch dimension dropped; rank 1
+// holds a flat feature vector in channels.
+struct TensorShape {
+    int rank;
+    long long channels, height, width;
+};
+
+// Hyperparameters of a layer. A layer of the built-in schematics stands for
+// a whole block: repeat convolutions (stride and padding on the first, the
+// rest keeping the size), residual shortcuts over each pair when
+// OP_FLAG_RESIDUAL is set, then pooling when poolKernel is non-zero.
+struct LayerOp {
+    OpKind kind;
+    int channels;               // Output channels, or units of a dense layer
+    TensorShape shape;          // Output shape of OP_TENSOR layers
+    short kernel, stride, pad, groups;
+    short repeat;
+    short poolKernel, poolStride, poolPad;
+    int flags;                  // OP_FLAG_*
+};
+
+// Output shape and costs of one layer; out.rank is 0 when the shape is not
+// known. MACs count multiply-accumulates of convolutions and dense layers,
+// and one operation per element read by pooling, normalization and
+// elementwise ops. Activations are float32.
+struct LayerCost {
+    TensorShape out;
+    long long params, macs;
+    long long activationBytes;  // Every tensor the layer writes, intermediates of a block included
+};
+
+// Sums over a block of weights; blocks combine by adding the sums.
+struct WeightStats {
+    double sumAbs, sumSq;
+    float maxAbs;
+    long long count;
+};
+
+// Summary of one weight tensor, viewed as a rows x cols matrix: the leading
+// dimension (output channels or units) by the product of the rest. Two
+// pyramids are kept, each level combining pairs of the level below:
+//   rows:  rowBins bins of neighbouring rows, for neuron colors;
+//   grid:  at most WEIGHT_GRID_MAX x WEIGHT_GRID_MAX blocks, for edge colors.
+// Neither depends on the tensor's size beyond those caps, so the summaries of
+// a multi-gigabyte checkpoint fit in a few megabytes.
+struct WeightSummary {
+    const char* name;
+    WeightDtype dtype;
+    int rank;
+    long long dims[8];
+    long long rows, cols;
+    const unsigned char* data;  // In the mapped file while summarizing, then NULL
+    int rowLevels, gridLevels;
+    int rowCount[WEIGHT_MAX_LEVELS];
+    int gridRows[WEIGHT_MAX_LEVELS], gridCols[WEIGHT_MAX_LEVELS];
+    WeightStats* rowLevel[WEIGHT_MAX_LEVELS];
+    WeightStats* grid[WEIGHT_MAX_LEVELS];
+    float rowMax[WEIGHT_VIEW_COUNT];                       // Largest value of a row bin
+    float gridMax[WEIGHT_MAX_LEVELS][WEIGHT_VIEW_COUNT];   // Largest value of a cell of each level
+    WeightStats total;
+};
+
+// Tensors loaded from any number of .npy and .safetensors files. The files
+// are only mapped while they are summarized.
+struct WeightSet {
+    WeightSummary* tensors;
+    int count, capacity;
+    float maxValue[WEIGHT_VIEW_COUNT];     // Largest whole-tensor value, the top of the layer scale
+    long long summarizedBytes;
+    double summarizeSeconds;
+    int quiet;                  // Skip the per-file report, for loads in the background
+    Arena arena;
+};
+
+// Growable vertex/index arrays holding one kind of primitive of the retained scene.
+struct GeometryBuffer {
+    float*  vertices;   // xyz per vertex
+    float*  colors;     // rgb per vertex
+    GLuint* indices;
+    int vertexCount, vertexCapacity;
+    int indexCount, indexCapacity;
+    GLuint vbo[3];      // Vertex, color and index buffer objects (0 when not uploaded)
+    int gpuVertexCapacity, gpuIndexCapacity;    // Sizes the buffer objects were created with
+    int patchedVertices[2], patchedIndices[2];  // [first, end) rewritten since the last upload
+    int patchedColors[2];                       // [first, end) of vertices only recolored
+    int fixedCapacity;                          // A slice of a larger buffer, which must not grow
+    int mapped;                                 // Arrays are in a scene cache file: copied out to grow, never freed
+};
+
+// Unit shape tessellated once and shared by every instance that uses it.
+struct Mesh {
+    float*  vertices;   // xyz per vertex
+    GLuint* indices;    // GL_TRIANGLES
+    int vertexCount, indexCount;
+    GLuint vbo[2];      // Vertex and index buffer objects (0 when not uploaded)
+};
+
 typedef enum {
-    LAYER_BOX,   // Representing input/conv layers as boxes
-    LAYER_FC     // Representing fully-connected layers as rows of spheres
-} LayerType;
+    MESH_SPHERE,  // Unit sphere centered on the origin
+    MESH_CONE,    // Unit-radius base at z = 0, apex at z = 1
+    MESH_BOX,     // Unit cube centered on the origin, for glTF export
+    MESH_KIND_COUNT
+} MeshKind;
+
+// One placement of a cached mesh: full model transform plus flat color.
+struct MeshInstance {
+    float transform[16];  // Column-major, ready for glMultMatrixf
+    float color[3];
+};
+
+struct InstanceList {
+    MeshInstance* items;
+    int count, capacity;
+    int fixedCapacity;          // As for GeometryBuffer
+    int mapped;
+};
 
+// Indexed by [MeshKind][detail], detail 0 being the finest.
+Mesh meshCache[MESH_KIND_COUNT][MESH_DETAIL_LEVELS];
+
+struct ElementRange {
+    int first, count;
+};
+
+// Unit of frustum culling: a few nearby items, as ranges into the scene buffers.
+struct SceneElement {
+    float bounds[6];            // min xyz, max xyz
+    ElementRange triVerts, triIndices;
+    ElementRange lineVerts, lineIndices;
+    ElementRange spheres, cones;
+    int layer;                  // Owning layer for LOD selection, -1 for arrows
+    int arrowFrom, arrowTo;     // Layers an arrow connects, -1 for layer bodies
+    int lodMask;                // LOD_MASK bits of the levels that draw it, 0 once retired by a patch
+};
+
+// Elements a layer owns: the arrows of its incoming edges and its own body.
+// Each range is contiguous in the elements and in every buffer.
+struct LayerSpan {
+    ElementRange edges, body;
+};
+
+// What LOD selection needs of a layer, gathered when the scene is built.
 typedef struct {
-    LayerType type;
-    union {
-        struct {
-            float width;
-            float height;
-            float depth;
-        } box;
-        struct {
-            int neuronCount;
-        } fc;
-    };
-    float color[3];  // RGB color
-    char label[64];  // Text label for the layer
-} Layer;
+    float center[3];
+    float featureSize;          // World size to keep legible: neuron or box extent
+    int maxLod;                 // Box layers never collapse
+} LayerLodInfo;
+
+// Leaves (count > 0) own bvhItems[first, first + count); inner nodes have
+// their two children at first and first + 1.
+typedef struct {
+    float bounds[6];
+    int first, count;
+} BvhNode;
+
+// An element as BuildBvhNode sorts it: bounds and centroid copied out.
+struct BvhBuildItem {
+    float bounds[6];
+    float center[3];
+    int element;
+};
+
+// Geometry for the whole network, built once and rebuilt only when the graph changes.
+struct SceneCache {
+    GeometryBuffer triangles;  // Box faces
+    GeometryBuffer lines;      // Arrow shafts and connections
+    InstanceList spheres;      // FC neurons
+    InstanceList cones;        // Arrowheads
+    int builtRevision;         // NetworkGraph revision the buffers were built from
+    int dirty;                 // Set when build settings change
+    
+    SceneElement* elements;
+    int elementCount, elementCapacity;
+    int fixedCapacity;         // Elements are a slice of a larger scene's, as for GeometryBuffer
+    int elementStart[6];       // Buffer counts where the open element began
+    BvhNode* bvh;              // Node 0 is the root
+    int* bvhItems;             // Element indices, grouped by leaf
+    int bvhNodeCount, bvhItemCapacity;
+    int openLayer, openLod;    // Tags given to the element being emitted
+    int openArrowFrom, openArrowTo;
+    
+    LayerLodInfo* layers;
+    LayerSpan* spans;          // Parallel to layers
+    int layerCount, layerCapacity;
+    int buildCount;            // Bumped by every rebuild, so views can tell stale LOD state
+    
+    // Patching: a patch re-emits edited layers at the end of the buffers and
+    // moves them over their old elements when the shapes match, refitting
+    // the BVH; otherwise the old elements are retired and the new ones stay
+    // outside the BVH, culled one by one until it is rebuilt.
+    int* inStart;              // Incoming edges of every layer, grouped by target
+    int* inEdges;
+    int inCapacity, inEdgeCapacity;
+    unsigned char* patchFlags;
+    int patchFlagCapacity;
+    int bvhElementCount;       // Elements from here on are not in the BVH
+    int* bvhParent;            // Per node, -1 for the root
+    int* elementLeaf;          // Per element below bvhElementCount, -1 when retired
+    int retiredElements;
+    
+    // Scene cache file the scene was loaded from. Arrays that still point
+    // into it are written in place, copy-on-write, and copied out to grow.
+    MappedFile cacheFile;
+};
+
+// Arrays of a scene cache file, in file order.
+typedef enum {
+    CACHE_KEY,                  // The key text the file was stored under
+    CACHE_LAYER_TYPE, CACHE_LAYER_SIZE, CACHE_NEURONS, CACHE_LAYER_COLOR, CACHE_POSITION, CACHE_RANK,
+    CACHE_LABELS,               // Layer labels, each NUL-terminated
+    CACHE_OPS, CACHE_COSTS,
+    CACHE_EDGE_FROM, CACHE_EDGE_TO, CACHE_ROUTE_START, CACHE_ROUTE_POINTS,
+    CACHE_TRI_VERTICES, CACHE_TRI_COLORS, CACHE_TRI_INDICES,
+    CACHE_LINE_VERTICES, CACHE_LINE_COLORS, CACHE_LINE_INDICES,
+    CACHE_SPHERES, CACHE_CONES,
+    CACHE_ELEMENTS, CACHE_LAYER_LOD, CACHE_SPANS, CACHE_IN_START, CACHE_IN_EDGES,
+    CACHE_BVH, CACHE_BVH_ITEMS, CACHE_BVH_PARENT, CACHE_ELEMENT_LEAF,
+    CACHE_LABEL_RUNS, CACHE_LABEL_GLYPHS,
+    CACHE_SECTION_COUNT
+} CacheSection;
+
+// Start of a scene cache file: the counts, then where each array starts, at
+// SCENE_CACHE_ALIGN boundaries. Arrays are stored as this build holds them in
+// memory, which the key pins down.
+typedef struct {
+    unsigned int magic, version;
+    int layerCount, edgeCount, routedEdges, routePoints;
+    int triVertices, triIndices, lineVertices, lineIndices;
+    int spheres, cones, elements;
+    int bvhNodes, bvhElements;
+    int labelGlyphs;
+    unsigned int labelAtlas;    // AtlasHash of the atlas the labels were laid out with, 0 for none
+    int costLayers;
+    long long totalParams, totalMacs, totalActivationBytes, peakActivationBytes;
+    long long maxCost[COST_VIEW_COUNT];
+    long long offset[CACHE_SECTION_COUNT];
+    long long bytes[CACHE_SECTION_COUNT];
+} SceneCacheHeader;
+
+struct CullStats {
+    int elements;               // Culling elements in the scene
+    int visibleElements;
+    int nodesVisited;
+    int triangles, lines, instances;    // Submitted after culling
+    int layersAtLod[LOD_LEVEL_COUNT];
+    int labels, labelsHidden;           // Drawn / illegible, off screen or overlapping
+};
+
+// Result of culling one view: visible element indices in build order.
+struct VisibleSet {
+    int* items;
+    int count, capacity;
+    int allVisible;
+    CullStats stats;
+    unsigned char* layerLod;    // Current LayerLod per layer, kept between frames
+    int layerLodCapacity;
+    int lodBuild;               // SceneCache buildCount the levels belong to
+};
+
+// The nearest primitive under the cursor and what it belongs to.
+struct PickHit {
+    PickKind kind;
+    int element;                // -1 when nothing was hit
+    int instance;               // Sphere instance hit, -1 for other primitives
+    int layer;                  // Layer hit, or the target of a connection
+    int from;                   // Source layer of a connection
+    int neuron;                 // Neuron of PICK_NEURON
+    float distance;             // Along the pick ray from the near plane
+    int nodesVisited, elementsTested;
+};
+
+// A ray through one pixel, with what the screen-space line test needs.
+struct PickRay {
+    float origin[3], dir[3], invDir[3];
+    float length;               // From the near plane to the far plane
+    float margin;               // World size of PICK_LINE_PIXELS at the deepest visible point
+    const float* viewProj;
+    float x, y;
+    int width, height;
+};
+
+SceneCache scene = { .dirty = 1 };
+
+// A scene's link to an activation stream. Frames are read in place from the
+// shared segment; one the producer overwrote mid-read is redone from a newer
+// frame, so neither side ever waits for the other.
+struct LiveActivations {
+    ActivationStream stream;    // header is NULL while detached
+    long long appliedFrame;     // 0 when the colors do not show a whole frame
+    int appliedRevision;        // Scene state the colors were written into
+    int appliedBuild;
+    int mismatchReported;
+    long long frames, torn;     // Frames applied and reads redone
+};
+
+typedef enum {
+    TIMELINE_LOADING,
+    TIMELINE_READY,
+    TIMELINE_FAILED     // Kept, so a broken file is not decoded again while cached
+} TimelineState;
+
+// One decoded checkpoint: per weight view from mean on, every layer's value
+// and TIMELINE_BINS neuron bins, scaled for the whole run.
+typedef struct {
+    int checkpoint;             // -1 while free
+    TimelineState state;
+    long long lastUsed;         // Tick of the last frame or decode that wanted it
+    float* values;
+} TimelineSlot;
+
+// A directory of checkpoints of one model, scrubbed like a video. Worker
+// threads decode the checkpoints ahead of the scrub position (and a few
+// behind) into a fixed pool of slots, evicting the least recently used ones
+// outside that window. Frames only blend two cached checkpoints under the
+// lock and never wait for a decode: until the wanted ones arrive they keep
+// showing the last ones that did.
+struct Timeline {
+    char** paths;               // In natural order, so step_9 comes before step_10
+    int count, pathCapacity;
+    int layerCount;
+    int* tensor;                // Per layer, tensor index in the first checkpoint, -1 for none
+    const char** tensorName;    // Looked up by name in later checkpoints, by index when absent
+    int valueCount;             // Floats per view: layerCount * (1 + TIMELINE_BINS)
+    float layerScale[WEIGHT_VIEW_COUNT];
+    float* binScale;            // [view][layer], the top of each layer's neuron scale
+    TimelineSlot* slots;
+    int slotCount;
+    int* slotOf;                // Per checkpoint, its slot or -1
+
+    // Shared with the workers, under lock.
+    Mutex lock;
+    CondVar wake;
+    Thread threads[TIMELINE_THREADS];
+    int threadCount;
+    int stop;
+    int cursor, direction;      // Checkpoint at the position and the way the scrub last went
+    long long tick;
+    long long decoded, failed, hits, misses;
+    long long decodedBytes;
+    double decodeSeconds;
+
+    // Render side only.
+    double position;            // Fractional between checkpoints
+    int playing;
+    double playRate;            // Checkpoints per second
+    float* target;              // Values at the position for the current view
+    float* shown;               // Values in the scene, easing toward target
+    double shownTime;
+    int appliedRevision, appliedBuild;
+    int settled;                // The scene shows the position exactly
+    Arena arena;
+};
+
+// One input message as the window thread recorded it, and when.
+struct InputEvent {
+    unsigned int message;
+    unsigned long long wParam;
+    long long lParam;
+    double time;
+};
+
+// Lock-free ring with one producer, the window thread, and one consumer, the
+// render thread. Each side writes only its own index, so a push or a pop is a
+// copy and one release store, and neither side ever waits for the other.
+struct InputQueue {
+    InputEvent events[INPUT_QUEUE_SIZE];
+    volatile long head;         // Next to pop, advanced by the consumer
+    volatile long tail;         // Next to push, advanced by the producer
+};
+
+typedef enum {
+    LOAD_FAILED,
+    LOAD_EDITS,         // Same layers and edges as the graph it reloads: apply as edits
+    LOAD_BUILT          // Laid out, with its scene built
+} LoadStatus;
+
+// A model for a loader thread to read, lay out and build a scene for. A
+// reload whose layers and edges hash to topology stops after parsing.
+struct LoadJob {
+    char spec[260];             // Model file, built-in name or synth: spec
+    long long generation;       // Later submissions supersede earlier ones
+    int reload;
+    unsigned int topology;
+    int loadWeights;            // Also load the weights stored next to the model
+    const WeightSet* weights;   // Otherwise attach these; owned by the caller, read only
+    int settings;               // Revision of the scene settings the build reads
+    const GlyphAtlas* atlas;    // Labels are laid out against it for the scene cache
+};
+
+// Loader threads for model loads, layout and scene builds, kept off the
+// render thread. One job waits at a time and a newer one replaces it; of the
+// finished snapshots only the newest waits to be taken.
+struct SceneLoader {
+    Mutex lock;
+    CondVar wake;
+    Thread threads[LOADER_THREADS];
+    int threadCount;
+    int stop;
+    LoadJob job;
+    int queued, running;
+    SceneSnapshot* ready;
+    SceneSnapshot* retired;     // Freed by the loader threads, off the render thread
+    void (*notify)(void);       // Called after publishing, to wake whoever takes snapshots
+};
+
+// Cell of one glyph in an atlas. Every cell spans the atlas's cellHeight rows,
+// with the baseline ascent rows below its top.
+typedef struct {
+    int x, y;
+    int width, advance;
+} AtlasGlyph;
+
+// A font rasterized once into a single coverage image, ASCII 32..126.
+struct GlyphAtlas {
+    unsigned char* pixels;      // width * height coverage, 0..255
+    int width, height;          // Powers of two, as GL 1.1 textures require
+    int cellHeight, ascent;
+    AtlasGlyph glyphs[ATLAS_GLYPH_COUNT];
+    GLuint texture;             // 0 when not uploaded
+};
 
-Layer networkLayers[MAX_LAYERS];
-int numLayers = 0;
+// The built-in 5x7 font, used by the CPU renderer and when GDI cannot
+// provide the window's font.
+GlyphAtlas embeddedAtlas;
 
+// Glyph of a laid-out label: pen offset from the label's anchor and atlas cell.
+typedef struct {
+    short x;
+    unsigned char glyph;
+} LaidGlyph;
+
+typedef struct {
+    int first, count;           // Range of LabelCache.glyphs
+    int width;                  // Pixels from the anchor to the end of the text
+} LabelRun;
+
+// A label that survived culling this frame, at its anchor's pixel position.
+typedef struct {
+    int run;
+    int x, y;                   // Baseline start, y down
+    float depth;                // Window depth of the anchor
+} PlacedLabel;
+
+// Every layer's label variants laid out once against an atlas and kept until
+// the graph changes; each frame only anchors are projected, then labels are
+// culled and decluttered on a coarse occupancy grid.
+struct LabelCache {
+    LaidGlyph* glyphs;
+    int glyphCount, glyphCapacity;
+    LabelRun* runs;             // LABEL_VARIANT_COUNT per layer
+    int runCapacity;
+    const GlyphAtlas* atlas;    // Atlas and graph revision the layout belongs to
+    int builtRevision;
+    int layerCount;
+    int staleGlyphs;            // Left behind by patched layers until the next full layout
+    
+    PlacedLabel* placed;        // This frame's labels, front to back
+    int placedCount, placedCapacity;
+    unsigned char* grid;        // LABEL_CELL_SIZE cells, set once covered
+    int gridCapacity;
+    float* vertices;            // Quad scratch for the GL path
+    int vertexCapacity;
+};
+
+// A finished load. Once published the loader never touches it again, so the
+// render thread can take it over between two frames.
+struct SceneSnapshot {
+    LoadJob job;
+    LoadStatus status;
+    NetworkGraph net;
+    SceneCache scene;           // Built but not uploaded
+    LabelCache labels;          // Laid out against job.atlas when the scene cache was used
+    WeightSet weights;          // When hasWeights: the ones job.loadWeights found
+    int hasWeights;
+    double seconds;
+    SceneSnapshot* next;        // In the loader's list of snapshots to free
+};
+
+// View parameters shared by the window and the headless renderer: the same
+// top-down look at the origin, spun by rotX/rotY degrees, eye 20 / zoom away.
+struct Camera {
+    float rotX, rotY;
+    float zoom;
+};
+
+// CPU render target. Rows are stored top row first, as image files expect.
+struct Framebuffer {
+    int width, height;
+    unsigned char* color;   // Packed RGB
+    float* depth;           // Window-space depth in [0, 1]
+};
+
+// Screen-space primitive queued for the tile rasterizer; lines use the first
+// two vertices.
+struct RasterPrim {
+    float x[3], y[3], z[3];
+    unsigned int color;     // Packed 0x00BBGGRR
+    int isLine;
+};
+
+// Indices into the primitive queue, in submission order.
+typedef struct {
+    int* items;
+    int count, capacity;
+} TileBin;
+
+// Binned tile renderer plus the worker pool that rasterizes its tiles.
+struct Rasterizer {
+    Framebuffer* target;
+    RasterPrim* prims;
+    int primCount, primCapacity;
+    int triangleCount;          // Triangles queued for the last frame
+    TileBin* bins;
+    int tilesX, tilesY, binCapacity;
+    float* clip;                // Transform scratch, clipCapacity vertices
+    int clipCapacity;
+    VisibleSet visible;
+    LabelCache labels;
+    volatile long nextTile;
+    
+    Thread* threads;            // Helpers; the calling thread also rasterizes
+    int threadCount;
+    Mutex lock;
+    CondVar wake, done;         // Frame posted / all helpers finished
+    int generation, busy, quit;
+};
+
+// One --export invocation. Workers claim models through nextModel and write
+// one image per camera preset; when there are fewer models than threads the
+// spare threads go to each worker's tile pool instead.
+struct ExportJob {
+    const char** models;
+    char** stems;           // Unique output name of each model
+    int modelCount;
+    Camera* cameras;
+    int cameraCount;
+    int width, height;
+    int png;                // Otherwise binary PPM
+    int gltf;               // The scene as binary glTF instead of images
+    const char* outDir;
+    const char* liveName;   // Activation stream to color layers by, or NULL
+    const WeightSet* weights;   // Attached to every model when it has tensors
+    int tileThreads;        // Rasterizer threads per worker, caller included
+    volatile long nextModel;
+    volatile long failures;
+};
+
+// A model the render server keeps warm. Once ready, workers render it
+// concurrently and only read it; the label layout is lent to each render.
+struct ServedModel {
+    char spec[300];
+    NetworkGraph net;
+    SceneCache scene;
+    LabelCache labels;          // Laid out against embeddedAtlas
+    size_t bytes;
+    int ready;                  // 0 while loading, 1 when loaded, -1 when the load failed
+    int users;                  // Workers holding it; only unused models are evicted
+    double lastUse;
+    ServedModel* next;
+};
+
+// One parsed /render request, queued with its connection.
+struct RenderRequest {
+    Socket client;
+    char spec[300];
+    Camera camera;
+    int width, height;
+    int png;                    // Otherwise binary PPM
+    double arrival;             // When the connection was accepted
+    RenderRequest* next;
+};
+
+// An accepted connection whose request has not fully arrived yet.
+struct PendingConnection {
+    Socket client;
+    double arrival;
+    int used;
+    char request[SERVE_REQUEST_BYTES];
+};
+
+// State shared by the acceptor and the workers, under lock.
+struct RenderServer {
+    Socket listener;
+    int port;
+    const char* modelDir;       // --models DIR: where model ids other than built-ins are looked up
+    size_t cacheBytes;
+    RenderRequest* queue;       // Oldest first
+    RenderRequest* queueTail;
+    int queued;
+    ServedModel* models;
+    int modelCount;
+    size_t modelBytes;
+    Mutex lock;
+    CondVar wake;               // Requests queued, or stop
+    CondVar loaded;             // A model finished loading
+    Thread* threads;
+    int threadCount;
+    Thread acceptor;
+    int acceptorRunning;
+    volatile long stop;
+    double started, stopAt;     // stopAt 0 runs until stopped
+    
+    // Statistics, the latencies as a ring of the most recent requests.
+    double latency[SERVE_LATENCY_SAMPLES];
+    long long served, failed, rejected, shared;
+    long long hits, misses, evictions, batches, batched;
+};
+
+// Buffer views of an exported glTF file, in file order.
+typedef enum {
+    GLTF_VIEW_MESH_POSITIONS,   // float xyz of each mesh variant
+    GLTF_VIEW_MESH_INDICES,     // 16-bit, once per shape
+    GLTF_VIEW_TRANSLATIONS,     // float xyz per instance
+    GLTF_VIEW_ROTATIONS,        // Normalized byte quaternion per arrowhead
+    GLTF_VIEW_SCALES,           // float xyz per overflow instance
+    GLTF_VIEW_LINE_POSITIONS,   // 16-bit xyz plus padding per shaft end
+    GLTF_VIEW_LINE_COLORS,      // Normalized byte rgba per shaft end, for chunks of mixed color
+    GLTF_VIEW_COUNT
+} GltfView;
+
+// A sphere, arrowhead or box as glTF places it. Colors are sRGB.
+struct GltfInstance {
+    float translation[3];
+    float rotation[4];          // x, y, z, w
+    float scale[3];
+    float color[3];
+};
+
+// Distinct shape, size and color among the instances, with how many share it.
+typedef struct {
+    long long count;            // 0 for a free slot
+    int shape;                  // MeshKind
+    int scale[3];               // In 1/GLTF_SCALE_STEP
+    unsigned char color[3];     // sRGB
+    int group;
+} GltfKey;
+
+// Instances written as one node. Color is the material's; size is baked
+// into the mesh, except in overflow groups, which scale each instance.
+typedef struct {
+    int shape;                  // MeshKind
+    int overflow;
+    int scale[3];               // As in GltfKey, 1 for overflow groups
+    int material;
+    int variant;                // Group whose mesh positions this one shares
+    long long count;
+    long long start;            // Of the members in GltfExport.order
+    long long offset[GLTF_VIEW_COUNT];
+} GltfGroup;
+
+// Consecutive elements whose arrow shafts are written as one LINES mesh,
+// quantized to 16 bits over their bounds.
+struct GltfChunk {
+    int firstElement, endElement;
+    float bounds[6];
+    float center[3], step[3];   // The node's translation and scale
+    int low[3], high[3];        // Quantized bounds, for the accessor
+    int color;                  // 0xRRGGBB shared by all, or -1 for per-vertex colors
+    int material;
+    long long vertexCount;
+    long long offset, colorOffset;
+};
+
+// What WriteGltfScene wrote.
+struct GltfStats {
+    long long instances[MESH_KIND_COUNT];
+    long long lineVertices;
+    int groups, chunks, materials;
+    long long jsonBytes, binaryBytes, fileBytes;
+    long long meshBytes;        // The same scene as float meshes, one copy per instance
+};
+
+struct GltfExport {
+    const SceneCache* sc;
+    GltfKey keys[GLTF_KEY_SLOTS];
+    int keyCount;
+    unsigned short* slots[MESH_KIND_COUNT];     // Key slot of each instance, then its group
+    int* order[MESH_KIND_COUNT];                // Instances by group, in instance order within one
+    long long itemCount[MESH_KIND_COUNT];
+    GltfGroup groups[GLTF_MAX_GROUPS];
+    int groupCount;
+    int overflowGroup[MESH_KIND_COUNT][GLTF_OVERFLOW_COLORS];   // By rounded color, -1 until used
+    unsigned char (*materials)[3];              // sRGB
+    int materialCount, materialCapacity;
+    GltfChunk* chunks;
+    int chunkCount, chunkCapacity;
+    long long viewSize[GLTF_VIEW_COUNT], viewOffset[GLTF_VIEW_COUNT];
+    long long binarySize;
+    GltfStats stats;
+    FILE* file;
+    unsigned char buffer[1 << 16];
+    size_t used;
+    int failed;
+};
+
+// Fully-connected edge rendering. In EDGE_MODE_AUTO a layer draws every edge up
+// to fullEdgeLimit, falls back to sampling up to ribbonEdgeLimit, and collapses
+// into a single ribbon beyond that.
+typedef struct {
+    EdgeMode mode;
+    int arrowheads;             // Cone at the end of every drawn edge
+    long long fullEdgeLimit;
+    long long ribbonEdgeLimit;
+    int sampleBudget;           // Edges kept per layer in EDGE_MODE_SAMPLED
+} EdgeSettings;
+
+EdgeSettings edgeSettings = { EDGE_MODE_AUTO, 1, 2500, 4000000, 2500 };
+int geometryKernels = 1;        // Batch kernels for neuron rows and their edges; 0 emits primitives one by one
+int sceneBuildThreads = 0;      // Threads BuildScene splits into, 0 for one per core
+char sceneCacheDir[260];        // --scene-cache DIR; "" for the user's cache folder
+int sceneCacheOff;              // --scene-cache off
+long long sceneBuildLimit;      // Bytes of scene buffers LoadModelScene may build, 0 for no limit
+volatile long sceneCacheWrites;     // Numbers temporary files
+CostView costView = COST_VIEW_OFF;      // Heat map shown instead of the layer colors
+WeightView weightView = WEIGHT_VIEW_OFF;    // Recolors layers that have weights attached
+
+// One timed scope, seconds since the profiler's origin.
+typedef struct {
+    double start, duration;
+    int stage;
+    unsigned long thread;
+} ProfileEvent;
+
+// Counter values of one finished frame, for the trace's counter tracks.
+typedef struct {
+    double time;
+    long long counters[PROF_COUNTER_COUNT];
+} ProfileSample;
+
+// Per-stage timers and draw counters. Everything is off until enabled, and a
+// disabled profiler costs one branch per scope: ProfileStart returns 0 and
+// ProfileEnd ignores it. Events go to a fixed buffer, so a long session keeps
+// its totals but drops the tail of the trace.
+struct Profiler {
+    int enabled;
+    int ready;                  // lock initialized, buffers allocated
+    Mutex lock;
+    double origin;
+    
+    ProfileEvent* events;
+    int eventCount;
+    long long dropped;
+    ProfileSample* samples;
+    int sampleCount;
+    
+    double stageTotal[PROF_STAGE_COUNT], stageMax[PROF_STAGE_COUNT];
+    long long stageCalls[PROF_STAGE_COUNT];
+    long long counterTotal[PROF_COUNTER_COUNT];
+    
+    double frameStage[PROF_STAGE_COUNT];            // Frame in progress
+    long long frameCounter[PROF_COUNTER_COUNT];
+    double historyStage[PROFILE_HISTORY][PROF_STAGE_COUNT];     // Last frames, for the HUD
+    long long historyCounter[PROFILE_HISTORY][PROF_COUNTER_COUNT];
+    int historyCount, historyNext;
+    long long frames;
+};
+
+Profiler profiler;
+
+// Embedded 5x7 font for the CPU renderer, ASCII 32..126. Each byte is one
+// row, top first, with the leftmost pixel in bit 4.
+const unsigned char glyphRows[95][GLYPH_HEIGHT] = {
+    { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 },  // ' '
+    { 0x04, 0x04, 0x04, 0x04, 0x04, 0x00, 0x04 },  // '!'
+    { 0x0A, 0x0A, 0x0A, 0x00, 0x00, 0x00, 0x00 },  // '"'
+    { 0x0A, 0x0A, 0x1F, 0x0A, 0x1F, 0x0A, 0x0A },  // '#'
+    { 0x04, 0x0F, 0x14, 0x0E, 0x05, 0x1E, 0x04 },  // '$'
+    { 0x18, 0x19, 0x02, 0x04, 0x08, 0x13, 0x03 },  // '%'
+    { 0x0C, 0x12, 0x14, 0x08, 0x15, 0x12, 0x0D },  // '&'
+    { 0x04, 0x04, 0x08, 0x00, 0x00, 0x00, 0x00 },  // '''
+    { 0x02, 0x04, 0x08, 0x08, 0x08, 0x04, 0x02 },  // '('
+    { 0x08, 0x04, 0x02, 0x02, 0x02, 0x04, 0x08 },  // ')'
+    { 0x00, 0x04, 0x15, 0x0E, 0x15, 0x04, 0x00 },  // '*'
+    { 0x00, 0x04, 0x04, 0x1F, 0x04, 0x04, 0x00 },  // '+'
+    { 0x00, 0x00, 0x00, 0x00, 0x0C, 0x04, 0x08 },  // ','
+    { 0x00, 0x00, 0x00, 0x1F, 0x00, 0x00, 0x00 },  // '-'
+    { 0x00, 0x00, 0x00, 0x00, 0x00, 0x0C, 0x0C },  // '.'
+    { 0x00, 0x01, 0x02, 0x04, 0x08, 0x10, 0x00 },  // '/'
+    { 0x0E, 0x11, 0x13, 0x15, 0x19, 0x11, 0x0E },  // '0'
+    { 0x04, 0x0C, 0x04, 0x04, 0x04, 0x04, 0x0E },  // '1'
+    { 0x0E, 0x11, 0x01, 0x02, 0x04, 0x08, 0x1F },  // '2'
+    { 0x1F, 0x02, 0x04, 0x02, 0x01, 0x11, 0x0E },  // '3'
+    { 0x02, 0x06, 0x0A, 0x12, 0x1F, 0x02, 0x02 },  // '4'
+    { 0x1F, 0x10, 0x1E, 0x01, 0x01, 0x11, 0x0E },  // '5'
+    { 0x06, 0x08, 0x10, 0x1E, 0x11, 0x11, 0x0E },  // '6'
+    { 0x1F, 0x01, 0x02, 0x04, 0x08, 0x08, 0x08 },  // '7'
+    { 0x0E, 0x11, 0x11, 0x0E, 0x11, 0x11, 0x0E },  // '8'
+    { 0x0E, 0x11, 0x11, 0x0F, 0x01, 0x02, 0x0C },  // '9'
+    { 0x00, 0x0C, 0x0C, 0x00, 0x0C, 0x0C, 0x00 },  // ':'
+    { 0x00, 0x0C, 0x0C, 0x00, 0x0C, 0x04, 0x08 },  // ';'
+    { 0x02, 0x04, 0x08, 0x10, 0x08, 0x04, 0x02 },  // '<'
+    { 0x00, 0x00, 0x1F, 0x00, 0x1F, 0x00, 0x00 },  // '='
+    { 0x08, 0x04, 0x02, 0x01, 0x02, 0x04, 0x08 },  // '>'
+    { 0x0E, 0x11, 0x01, 0x02, 0x04, 0x00, 0x04 },  // '?'
+    { 0x0E, 0x11, 0x01, 0x0D, 0x15, 0x15, 0x0E },  // '@'
+    { 0x0E, 0x11, 0x11, 0x1F, 0x11, 0x11, 0x11 },  // 'A'
+    { 0x1E, 0x11, 0x11, 0x1E, 0x11, 0x11, 0x1E },  // 'B'
+    { 0x0E, 0x11, 0x10, 0x10, 0x10, 0x11, 0x0E },  // 'C'
+    { 0x1C, 0x12, 0x11, 0x11, 0x11, 0x12, 0x1C },  // 'D'
+    { 0x1F, 0x10, 0x10, 0x1E, 0x10, 0x10, 0x1F },  // 'E'
+    { 0x1F, 0x10, 0x10, 0x1E, 0x10, 0x10, 0x10 },  // 'F'
+    { 0x0E, 0x11, 0x10, 0x17, 0x11, 0x11, 0x0F },  // 'G'
+    { 0x11, 0x11, 0x11, 0x1F, 0x11, 0x11, 0x11 },  // 'H'
+    { 0x0E, 0x04, 0x04, 0x04, 0x04, 0x04, 0x0E },  // 'I'
+    { 0x07, 0x02, 0x02, 0x02, 0x02, 0x12, 0x0C },  // 'J'
+    { 0x11, 0x12, 0x14, 0x18, 0x14, 0x12, 0x11 },  // 'K'
+    { 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x1F },  // 'L'
+    { 0x11, 0x1B, 0x15, 0x15, 0x11, 0x11, 0x11 },  // 'M'
+    { 0x11, 0x11, 0x19, 0x15, 0x13, 0x11, 0x11 },  // 'N'
+    { 0x0E, 0x11, 0x11, 0x11, 0x11, 0x11, 0x0E },  // 'O'
+    { 0x1E, 0x11, 0x11, 0x1E, 0x10, 0x10, 0x10 },  // 'P'
+    { 0x0E, 0x11, 0x11, 0x11, 0x15, 0x12, 0x0D },  // 'Q'
+    { 0x1E, 0x11, 0x11, 0x1E, 0x14, 0x12, 0x11 },  // 'R'
+    { 0x0F, 0x10, 0x10, 0x0E, 0x01, 0x01, 0x1E },  // 'S'
+    { 0x1F, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04 },  // 'T'
+    { 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x0E },  // 'U'
+    { 0x11, 0x11, 0x11, 0x11, 0x11, 0x0A, 0x04 },  // 'V'
+    { 0x11, 0x11, 0x11, 0x15, 0x15, 0x15, 0x0A },  // 'W'
+    { 0x11, 0x11, 0x0A, 0x04, 0x0A, 0x11, 0x11 },  // 'X'
+    { 0x11, 0x11, 0x11, 0x0A, 0x04, 0x04, 0x04 },  // 'Y'
+    { 0x1F, 0x01, 0x02, 0x04, 0x08, 0x10, 0x1F },  // 'Z'
+    { 0x0E, 0x08, 0x08, 0x08, 0x08, 0x08, 0x0E },  // '['
+    { 0x00, 0x10, 0x08, 0x04, 0x02, 0x01, 0x00 },  // backslash
+    { 0x0E, 0x02, 0x02, 0x02, 0x02, 0x02, 0x0E },  // ']'
+    { 0x04, 0x0A, 0x11, 0x00, 0x00, 0x00, 0x00 },  // '^'
+    { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x1F },  // '_'
+    { 0x08, 0x04, 0x02, 0x00, 0x00, 0x00, 0x00 },  // '`'
+    { 0x00, 0x00, 0x0E, 0x01, 0x0F, 0x11, 0x0F },  // 'a'
+    { 0x10, 0x10, 0x16, 0x19, 0x11, 0x11, 0x1E },  // 'b'
+    { 0x00, 0x00, 0x0E, 0x10, 0x10, 0x11, 0x0E },  // 'c'
+    { 0x01, 0x01, 0x0D, 0x13, 0x11, 0x11, 0x0F },  // 'd'
+    { 0x00, 0x00, 0x0E, 0x11, 0x1F, 0x10, 0x0E },  // 'e'
+    { 0x06, 0x09, 0x08, 0x1C, 0x08, 0x08, 0x08 },  // 'f'
+    { 0x00, 0x0F, 0x11, 0x11, 0x0F, 0x01, 0x0E },  // 'g'
+    { 0x10, 0x10, 0x16, 0x19, 0x11, 0x11, 0x11 },  // 'h'
+    { 0x04, 0x00, 0x0C, 0x04, 0x04, 0x04, 0x0E },  // 'i'
+    { 0x02, 0x00, 0x06, 0x02, 0x02, 0x12, 0x0C },  // 'j'
+    { 0x10, 0x10, 0x12, 0x14, 0x18, 0x14, 0x12 },  // 'k'
+    { 0x0C, 0x04, 0x04, 0x04, 0x04, 0x04, 0x0E },  // 'l'
+    { 0x00, 0x00, 0x1A, 0x15, 0x15, 0x11, 0x11 },  // 'm'
+    { 0x00, 0x00, 0x16, 0x19, 0x11, 0x11, 0x11 },  // 'n'
+    { 0x00, 0x00, 0x0E, 0x11, 0x11, 0x11, 0x0E },  // 'o'
+    { 0x00, 0x00, 0x1E, 0x11, 0x1E, 0x10, 0x10 },  // 'p'
+    { 0x00, 0x00, 0x0D, 0x13, 0x0F, 0x01, 0x01 },  // 'q'
+    { 0x00, 0x00, 0x16, 0x19, 0x10, 0x10, 0x10 },  // 'r'
+    { 0x00, 0x00, 0x0E, 0x10, 0x0E, 0x01, 0x1E },  // 's'
+    { 0x08, 0x08, 0x1C, 0x08, 0x08, 0x09, 0x06 },  // 't'
+    { 0x00, 0x00, 0x11, 0x11, 0x11, 0x13, 0x0D },  // 'u'
+    { 0x00, 0x00, 0x11, 0x11, 0x11, 0x0A, 0x04 },  // 'v'
+    { 0x00, 0x00, 0x11, 0x11, 0x15, 0x15, 0x0A },  // 'w'
+    { 0x00, 0x00, 0x11, 0x0A, 0x04, 0x0A, 0x11 },  // 'x'
+    { 0x00, 0x00, 0x11, 0x11, 0x0F, 0x01, 0x0E },  // 'y'
+    { 0x00, 0x00, 0x1F, 0x02, 0x04, 0x08, 0x1F },  // 'z'
+    { 0x02, 0x04, 0x04, 0x08, 0x04, 0x04, 0x02 },  // '{'
+    { 0x04, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04 },  // '|'
+    { 0x08, 0x04, 0x04, 0x02, 0x04, 0x04, 0x08 },  // '}'
+    { 0x00, 0x00, 0x08, 0x15, 0x02, 0x00, 0x00 },  // '~'
+};
+
+#ifdef _WIN32
 //-------------------------
 // Global Variables for OpenGL & Window
 //-------------------------
 
-HGLRC hRC = NULL;
-HDC   hDC = NULL;
-HWND  hWnd = NULL;
-HINSTANCE hInstance;
+HGLRC hRC = NULL;
+HDC   hDC = NULL;
+HWND  hWnd = NULL;
+HINSTANCE hInstance;
+
+GlyphAtlas glyphAtlas;       // Label font, uploaded as a texture
+LabelCache windowLabels;
+
+// Buffer object entry points (OpenGL 1.5). opengl32 only exports 1.1, so these
+// are resolved at runtime and left NULL when the driver lacks them.
+#ifndef GL_ARRAY_BUFFER
+#define GL_ARRAY_BUFFER         0x8892
+#define GL_ELEMENT_ARRAY_BUFFER 0x8893
+#define GL_STATIC_DRAW          0x88E4
+#endif
+
+typedef void (APIENTRY *GenBuffersProc)(GLsizei n, GLuint* buffers);
+typedef void (APIENTRY *DeleteBuffersProc)(GLsizei n, const GLuint* buffers);
+typedef void (APIENTRY *BindBufferProc)(GLenum target, GLuint buffer);
+typedef void (APIENTRY *BufferDataProc)(GLenum target, ptrdiff_t size, const void* data, GLenum usage);
+typedef void (APIENTRY *BufferSubDataProc)(GLenum target, ptrdiff_t offset, ptrdiff_t size, const void* data);
+
+GenBuffersProc    pglGenBuffers = NULL;
+DeleteBuffersProc pglDeleteBuffers = NULL;
+BindBufferProc    pglBindBuffer = NULL;
+BufferDataProc    pglBufferData = NULL;
+BufferSubDataProc pglBufferSubData = NULL;
+
+// Instanced drawing entry points: GL 3.1 draw_instanced and 3.3
+// instanced_arrays, or their ARB extensions, plus the GL 2.0 shader calls a
+// per-instance transform needs. instanceProgram stays 0 when any is missing,
+// and instances are then drawn one by one.
+#ifndef GL_VERTEX_SHADER
+#define GL_STREAM_DRAW          0x88E0
+#define GL_VERTEX_SHADER        0x8B31
+#define GL_COMPILE_STATUS       0x8B81
+#define GL_LINK_STATUS          0x8B82
+#endif
+
+typedef void (APIENTRY *DrawElementsInstancedProc)(GLenum mode, GLsizei count, GLenum type, const void* indices,
+                                                   GLsizei instances);
+typedef void (APIENTRY *VertexAttribDivisorProc)(GLuint index, GLuint divisor);
+typedef void (APIENTRY *VertexAttribPointerProc)(GLuint index, GLint size, GLenum type, GLboolean normalized,
+                                                 GLsizei stride, const void* pointer);
+typedef void (APIENTRY *VertexAttribArrayProc)(GLuint index);
+typedef GLuint (APIENTRY *CreateShaderProc)(GLenum type);
+typedef void (APIENTRY *ShaderSourceProc)(GLuint shader, GLsizei count, const char* const* text, const GLint* lengths);
+typedef void (APIENTRY *ObjectProc)(GLuint object);
+typedef void (APIENTRY *GetObjectivProc)(GLuint object, GLenum name, GLint* value);
+typedef GLuint (APIENTRY *CreateProgramProc)(void);
+typedef void (APIENTRY *AttachShaderProc)(GLuint program, GLuint shader);
+typedef void (APIENTRY *BindAttribLocationProc)(GLuint program, GLuint index, const char* name);
+
+DrawElementsInstancedProc pglDrawElementsInstanced = NULL;
+VertexAttribDivisorProc   pglVertexAttribDivisor = NULL;
+VertexAttribPointerProc   pglVertexAttribPointer = NULL;
+VertexAttribArrayProc     pglEnableVertexAttribArray = NULL;
+VertexAttribArrayProc     pglDisableVertexAttribArray = NULL;
+CreateShaderProc          pglCreateShader = NULL;
+ShaderSourceProc          pglShaderSource = NULL;
+ObjectProc                pglCompileShader = NULL;
+ObjectProc                pglDeleteShader = NULL;
+GetObjectivProc           pglGetShaderiv = NULL;
+CreateProgramProc         pglCreateProgram = NULL;
+AttachShaderProc          pglAttachShader = NULL;
+BindAttribLocationProc    pglBindAttribLocation = NULL;
+ObjectProc                pglLinkProgram = NULL;
+GetObjectivProc           pglGetProgramiv = NULL;
+ObjectProc                pglUseProgram = NULL;
+ObjectProc                pglDeleteProgram = NULL;
+
+GLuint instanceProgram = 0;     // Applies one MeshInstance per instance; 0 without instancing
+GLuint instanceBuffer = 0;      // The instances of the draws in flight, rewritten each time
+int instanceBufferCapacity = 0;
+MeshInstance* visibleInstances = NULL;  // Culled draws gather visible instances here
+int visibleInstanceCapacity = 0;
+
+// Frame pacing. By default a frame is drawn only after something changed
+// (rotation, resize, expose, scene rebuild); continuous mode redraws every
+// frame, optionally capped to frameCap per second and synced to vblank.
+typedef struct {
+    int continuous;
+    int frameCap;       // Frames per second in continuous mode, 0 for uncapped
+    int vsync;
+} FramePacing;
+
+FramePacing pacing = { 0, 60, 1 };
+int redrawPending = 1;
+int windowWidth = 800, windowHeight = 600;
+
+typedef BOOL (APIENTRY *SwapIntervalProc)(int interval);
+SwapIntervalProc pwglSwapIntervalEXT = NULL;
+
+// Who draws the window. Microsoft's software OpenGL is far slower than the
+// built-in tile rasterizer, so it switches to the CPU backend automatically.
+typedef enum {
+    BACKEND_GL,
+    BACKEND_CPU     // Rasterize into windowFrame and blit it with glDrawPixels
+} RenderBackend;
+
+RenderBackend backend = BACKEND_GL;
+Rasterizer windowRaster;
+int windowRasterReady = 0;
+Framebuffer windowFrame;
+
+// Frustum culling for the GL path. The stats are shown in the title bar while
+// showCullStats is on.
+VisibleSet windowVisible;
+GLuint* visibleIndices = NULL;
+int visibleIndexCapacity = 0;
+int showCullStats = 0;
+
+// On-screen profiler HUD; toggling it also turns the profiler on and off.
+int showProfiler = 0;
+
+// Live editing: the layer the edit keys act on, a palette cursor for
+// recoloring, and the watched model file's last write time.
+int editLayer = 0;
+int editColor = 0;
+FILETIME watchedWriteTime;
+
+// Activation stream the window's layers are colored by while attached.
+LiveActivations liveActivations;
+
+// Weights found next to the model file, shown with the W key.
+WeightSet windowWeights;
+
+// Checkpoints given with --timeline, scrubbed with the timeline keys.
+Timeline timeline;
+
+// Global mouse control variables
+Camera camera = { 0.0f, 0.0f, 1.0f };
+int mouseDown = 0;
+int mouseDragged = 0;           // The press turned the camera, so its release is not a click
+int lastMouseX = 0, lastMouseY = 0;
+
+// What the cursor rests on, shown in a tooltip; hoverX is -1 while the
+// cursor is outside the window.
+int hoverX = -1, hoverY = -1;
+PickHit hoverHit = { .kind = PICK_NONE, .element = -1 };
+
+// Threads of the window. WndProc, on the window thread, only queues input;
+// the render thread owns the GL context and all of the state above, applying
+// the input between frames; loader threads read models, lay them out and
+// build their scenes into snapshots the render thread swaps in.
+#define WM_SHOW_TITLE (WM_APP + 1)     // lParam: title to show, freed by the window thread
+InputQueue inputQueue;
+HANDLE renderWake;              // Auto-reset: input queued or a load finished
+Thread renderThread;
+SceneLoader loader;
+int mouseTracked = 0;           // Window thread: WM_MOUSELEAVE requested
+
+// Loads. A model named on the command line is read after the window opens;
+// modelReady is set once the first one is in. sceneSettings counts changes
+// to what scene builds read, so a snapshot built across one is rebuilt.
+long long loadGeneration = 0, adoptedGeneration = 0;
+int loadBusy = 0;
+int modelReady = 0;
+int sceneSettings = 0;
+const char* startupTimeline = NULL;     // --timeline DIR, opened with the first model
+
+//-------------------------
+// Console Setup
+//-------------------------
+
+void SetupConsole(void) {
+    AllocConsole();
+    freopen("CONIN$", "r", stdin);
+    freopen("CONOUT$", "w", stdout);
+    printf("Console initialized.\n");
+}
+#endif
+
+//-------------------------
+// Arena Allocator
+//-------------------------
+
+void* ArenaAlloc(Arena* arena, size_t size) {
+    size = (size + 15) & ~(size_t)15;
+    ArenaBlock* block = arena->head;
+    if (!block || block->used + size > block->size) {
+        size_t blockSize = size > ARENA_BLOCK_SIZE ? size : ARENA_BLOCK_SIZE;
+        block = malloc(sizeof(ArenaBlock) + blockSize);
+        if (!block) {
+            printf("Error: Out of memory allocating network storage.\n");
+            exit(EXIT_FAILURE);
+        }
+        block->next = arena->head;
+        block->used = 0;
+        block->size = blockSize;
+        arena->head = block;
+        arena->reservedBytes += blockSize;
+    }
+    void* ptr = (char*)block->data + block->used;
+    block->used += size;
+    arena->usedBytes += size;
+    return ptr;
+}
+
+// Resize an arena allocation. The most recent allocation grows in place;
+// anything else is copied and the old space stays dead until release.
+void* ArenaGrow(Arena* arena, void* old, size_t oldSize, size_t newSize) {
+    ArenaBlock* block = arena->head;
+    oldSize = (oldSize + 15) & ~(size_t)15;
+    size_t alignedNew = (newSize + 15) & ~(size_t)15;
+    if (old && block && (char*)old + oldSize == (char*)block->data + block->used &&
+        block->used - oldSize + alignedNew <= block->size) {
+        block->used += alignedNew - oldSize;
+        arena->usedBytes += alignedNew - oldSize;
+        return old;
+    }
+    void* ptr = ArenaAlloc(arena, newSize);
+    if (old)
+        memcpy(ptr, old, oldSize < newSize ? oldSize : newSize);
+    return ptr;
+}
+
+void ArenaRelease(Arena* arena) {
+    while (arena->head) {
+        ArenaBlock* next = arena->head->next;
+        free(arena->head);
+        arena->head = next;
+    }
+    arena->reservedBytes = 0;
+    arena->usedBytes = 0;
+}
+
+//-------------------------
+// Network Graph Store
+//-------------------------
+
+void ResetNetwork(NetworkGraph* net) {
+    int revision = net->revision;
+    ArenaRelease(&net->arena);
+    memset(net, 0, sizeof(NetworkGraph));
+    net->revision = revision;
+    MarkGraphChanged(net);
+}
+
+// A change caches cannot follow layer by layer, like a new layout.
+void MarkGraphChanged(NetworkGraph* net) {
+    net->revision++;
+    net->journalStart = net->revision;
+    net->journalCount = 0;
+}
+
+// Record that layer's attributes, position or incoming edges changed. Once
+// the journal is full it restarts, as replaying that many layers would cost
+// about as much as a rebuild.
+void JournalLayer(NetworkGraph* net, int layer) {
+    if (!net->journal)
+        net->journal = ArenaAlloc(&net->arena, EDIT_JOURNAL_CAPACITY * sizeof(int));
+    if (net->journalCount == EDIT_JOURNAL_CAPACITY) {
+        MarkGraphChanged(net);
+        return;
+    }
+    net->journal[net->journalCount++] = layer;
+    net->revision++;
+}
+
+// Extent along x that the layout keeps clear: the box width, or the neuron row.
+float LayerWidth(const NetworkGraph* net, int layer) {
+    if (net->type[layer] == LAYER_FC)
+        return (net->neuronCount[layer] > 0 ? net->neuronCount[layer] - 1 : 0) * 1.0f + 0.6f;
+    return net->size[layer * 3];
+}
+
+void ReserveLayers(NetworkGraph* net, int capacity) {
+    if (capacity <= net->layerCapacity)
+        return;
+    size_t oldCap = net->layerCapacity, newCap = capacity;
+    Arena* a = &net->arena;
+    net->type = ArenaGrow(a, net->type, oldCap * sizeof(LayerType), newCap * sizeof(LayerType));
+    net->size = ArenaGrow(a, net->size, oldCap * 3 * sizeof(float), newCap * 3 * sizeof(float));
+    net->neuronCount = ArenaGrow(a, net->neuronCount, oldCap * sizeof(int), newCap * sizeof(int));
+    net->color = ArenaGrow(a, net->color, oldCap * 3 * sizeof(float), newCap * 3 * sizeof(float));
+    net->position = ArenaGrow(a, net->position, oldCap * 3 * sizeof(float), newCap * 3 * sizeof(float));
+    net->rank = ArenaGrow(a, net->rank, oldCap * sizeof(int), newCap * sizeof(int));
+    net->label = ArenaGrow(a, net->label, oldCap * sizeof(char*), newCap * sizeof(char*));
+    net->op = ArenaGrow(a, net->op, oldCap * sizeof(LayerOp), newCap * sizeof(LayerOp));
+    net->cost = ArenaGrow(a, net->cost, oldCap * sizeof(LayerCost), newCap * sizeof(LayerCost));
+    net->weight = ArenaGrow(a, net->weight, oldCap * sizeof(int), newCap * sizeof(int));
+    net->layerCapacity = capacity;
+}
+
+void ReserveConnections(NetworkGraph* net, int capacity) {
+    if (capacity <= net->edgeCapacity)
+        return;
+    size_t oldCap = net->edgeCapacity, newCap = capacity;
+    net->edgeFrom = ArenaGrow(&net->arena, net->edgeFrom, oldCap * sizeof(int), newCap * sizeof(int));
+    net->edgeTo = ArenaGrow(&net->arena, net->edgeTo, oldCap * sizeof(int), newCap * sizeof(int));
+    net->edgeCapacity = capacity;
+}
+
+void ReserveRoutes(NetworkGraph* net, int edgeCount, int pointCount) {
+    if (edgeCount + 1 > net->routeCapacity) {
+        size_t oldCap = net->routeCapacity, newCap = edgeCount + 1;
+        net->routeStart = ArenaGrow(&net->arena, net->routeStart, oldCap * sizeof(int), newCap * sizeof(int));
+        net->routeCapacity = (int)newCap;
+    }
+    if (pointCount > net->routePointCapacity) {
+        size_t oldCap = net->routePointCapacity, newCap = pointCount;
+        net->routePoints = ArenaGrow(&net->arena, net->routePoints, oldCap * 3 * sizeof(float), newCap * 3 * sizeof(float));
+        net->routePointCapacity = pointCount;
+    }
+}
+
+unsigned int HashBytes(const char* text, size_t len) {
+    unsigned int h = 2166136261u;
+    for (size_t i = 0; i < len; i++)
+        h = (h ^ (unsigned char)text[i]) * 16777619u;
+    return h;
+}
+
+const char* InternLabel(NetworkGraph* net, const char* text) {
+    return InternLabelRange(net, text, strlen(text));
+}
+
+// Return the canonical arena copy of text, so repeated names ("Conv", "ReLU")
+// are stored once and can be compared by pointer. text need not be
+// NUL-terminated, which lets importers intern straight from a mapped file.
+const char* InternLabelRange(NetworkGraph* net, const char* text, size_t len) {
+    if (net->internCount * 2 >= net->internCapacity) {
+        int capacity = net->internCapacity ? net->internCapacity * 2 : 64;
+        const char** table = ArenaAlloc(&net->arena, capacity * sizeof(char*));
+        memset(table, 0, capacity * sizeof(char*));
+        for (int i = 0; i < net->internCapacity; i++) {
+            const char* entry = net->internTable[i];
+            if (!entry)
+                continue;
+            unsigned int slot = HashBytes(entry, strlen(entry)) & (capacity - 1);
+            while (table[slot])
+                slot = (slot + 1) & (capacity - 1);
+            table[slot] = entry;
+        }
+        net->internTable = table;
+        net->internCapacity = capacity;
+    }
+    
+    unsigned int slot = HashBytes(text, len) & (net->internCapacity - 1);
+    while (net->internTable[slot]) {
+        const char* entry = net->internTable[slot];
+        if (strncmp(entry, text, len) == 0 && entry[len] == '\0')
+            return entry;
+        slot = (slot + 1) & (net->internCapacity - 1);
+    }
+    char* copy = ArenaAlloc(&net->arena, len + 1);
+    memcpy(copy, text, len);
+    copy[len] = '\0';
+    net->internTable[slot] = copy;
+    net->internCount++;
+    return copy;
+}
+
+// Append a layer stacked below the previous one and return its index.
+int AddLayer(NetworkGraph* net, LayerType type, const char* label, float r, float g, float b) {
+    if (net->layerCount == net->layerCapacity)
+        ReserveLayers(net, net->layerCapacity ? net->layerCapacity * 2 : 16);
+    int i = net->layerCount++;
+    net->type[i] = type;
+    net->size[i * 3 + 0] = net->size[i * 3 + 1] = net->size[i * 3 + 2] = 0.0f;
+    net->neuronCount[i] = 0;
+    net->color[i * 3 + 0] = r;
+    net->color[i * 3 + 1] = g;
+    net->color[i * 3 + 2] = b;
+    net->position[i * 3 + 0] = 0.0f;
+    net->position[i * 3 + 1] = TOP_Y - i * LAYER_SPACING;
+    net->position[i * 3 + 2] = 0.0f;
+    net->rank[i] = i;
+    net->label[i] = InternLabel(net, label);
+    memset(&net->op[i], 0, sizeof(LayerOp));
+    memset(&net->cost[i], 0, sizeof(LayerCost));
+    net->weight[i] = -1;
+    JournalLayer(net, i);
+    return i;
+}
+
+int AddBoxLayer(NetworkGraph* net, const char* label, float width, float height, float depth, float r, float g, float b) {
+    int i = AddLayer(net, LAYER_BOX, label, r, g, b);
+    net->size[i * 3 + 0] = width;
+    net->size[i * 3 + 1] = height;
+    net->size[i * 3 + 2] = depth;
+    return i;
+}
+
+int AddFullyConnectedLayer(NetworkGraph* net, const char* label, int neuronCount, float r, float g, float b) {
+    int i = AddLayer(net, LAYER_FC, label, r, g, b);
+    net->neuronCount[i] = neuronCount;
+    return i;
+}
+
+void AddConnection(NetworkGraph* net, int from, int to) {
+    if (net->edgeCount == net->edgeCapacity)
+        ReserveConnections(net, net->edgeCapacity ? net->edgeCapacity * 2 : 16);
+    int e = net->edgeCount++;
+    net->edgeFrom[e] = from;
+    net->edgeTo[e] = to;
+    // Edges added after a layout run straight; the others keep their routes.
+    if (net->routedEdges == e && e > 0) {
+        if (e + 2 > net->routeCapacity)
+            ReserveRoutes(net, e * 2, 0);
+        net->routeStart[e + 1] = net->routeStart[e];
+        net->routedEdges = e + 1;
+    }
+    JournalLayer(net, to);
+}
+
+// Link every layer to the next one, the topology of all built-in networks.
+void ConnectSequentialLayers(NetworkGraph* net) {
+    ReserveConnections(net, net->edgeCount + net->layerCount);
+    for (int i = 1; i < net->layerCount; i++)
+        AddConnection(net, i - 1, i);
+}
+
+void ReportNetworkMemory(const NetworkGraph* net) {
+    size_t perLayer = net->layerCount ? net->arena.usedBytes / net->layerCount : 0;
+    printf("Network: %d layers, %d connections, %d unique labels\n",
+           net->layerCount, net->edgeCount, net->internCount);
+    printf("Network memory: %zu bytes used, %zu reserved (%zu bytes per layer)\n",
+           net->arena.usedBytes, net->arena.reservedBytes, perLayer);
+}
+
+//-------------------------
+// Predefined Network Setup Functions
+//-------------------------
+
+// AlexNet (simplified schematic). Each layer carries the hyperparameters of
+// the original network, with max pooling folded into the convolution before it.
+void SetupAlexNet(NetworkGraph* net) {
+    SetLayerOp(net, AddBoxLayer(net, "Input", 2.0f, 1.0f, 2.0f, 1.0f, 1.0f, 1.0f), TensorOp(3, 227, 227));
+    SetLayerOp(net, AddBoxLayer(net, "Conv1", 2.0f, 1.0f, 2.0f, 1.0f, 0.0f, 0.0f), WithPool(ConvOp(96, 11, 4, 0, 1, OP_FLAG_BIAS), 3, 2, 0));
+    SetLayerOp(net, AddBoxLayer(net, "Conv2", 1.8f, 1.0f, 1.8f, 0.0f, 1.0f, 0.0f), WithPool(ConvOp(256, 5, 1, 2, 1, OP_FLAG_BIAS), 3, 2, 0));
+    SetLayerOp(net, AddBoxLayer(net, "Conv3", 1.6f, 1.0f, 1.6f, 0.0f, 0.0f, 1.0f), ConvOp(384, 3, 1, 1, 1, OP_FLAG_BIAS));
+    SetLayerOp(net, AddBoxLayer(net, "Conv4", 1.4f, 1.0f, 1.4f, 1.0f, 0.0f, 1.0f), ConvOp(384, 3, 1, 1, 1, OP_FLAG_BIAS));
+    SetLayerOp(net, AddBoxLayer(net, "Conv5", 1.2f, 1.0f, 1.2f, 0.0f, 1.0f, 1.0f), WithPool(ConvOp(256, 3, 1, 1, 1, OP_FLAG_BIAS), 3, 2, 0));
+    SetLayerOp(net, AddFullyConnectedLayer(net, "FC6", 5, 1.0f, 1.0f, 0.0f), DenseOp(4096));
+    SetLayerOp(net, AddFullyConnectedLayer(net, "FC7", 5, 1.0f, 0.5f, 0.0f), DenseOp(4096));
+    SetLayerOp(net, AddFullyConnectedLayer(net, "FC8", 5, 0.5f, 0.5f, 0.5f), DenseOp(1000));
+    ConnectSequentialLayers(net);
+}
+
+// VGG16 (simplified schematic): one layer per block of 3x3 convolutions and
+// the max pool closing it.
+void SetupVGG16(NetworkGraph* net) {
+    SetLayerOp(net, AddBoxLayer(net, "Input", 3.0f, 2.0f, 3.0f, 1.0f, 1.0f, 1.0f), TensorOp(3, 224, 224));
+    SetLayerOp(net, AddBoxLayer(net, "ConvBlock1", 3.0f, 1.5f, 3.0f, 1.0f, 0.0f, 0.0f), WithPool(ConvOp(64, 3, 1, 1, 2, OP_FLAG_BIAS), 2, 2, 0));
+    SetLayerOp(net, AddBoxLayer(net, "ConvBlock2", 2.8f, 1.5f, 2.8f, 0.0f, 1.0f, 0.0f), WithPool(ConvOp(128, 3, 1, 1, 2, OP_FLAG_BIAS), 2, 2, 0));
+    SetLayerOp(net, AddBoxLayer(net, "ConvBlock3", 2.6f, 1.5f, 2.6f, 0.0f, 0.0f, 1.0f), WithPool(ConvOp(256, 3, 1, 1, 3, OP_FLAG_BIAS), 2, 2, 0));
+    SetLayerOp(net, AddBoxLayer(net, "ConvBlock4", 2.4f, 1.5f, 2.4f, 1.0f, 0.0f, 1.0f), WithPool(ConvOp(512, 3, 1, 1, 3, OP_FLAG_BIAS), 2, 2, 0));
+    SetLayerOp(net, AddBoxLayer(net, "ConvBlock5", 2.2f, 1.5f, 2.2f, 0.0f, 1.0f, 1.0f), WithPool(ConvOp(512, 3, 1, 1, 3, OP_FLAG_BIAS), 2, 2, 0));
+    SetLayerOp(net, AddFullyConnectedLayer(net, "FC1", 5, 1.0f, 1.0f, 0.0f), DenseOp(4096));
+    SetLayerOp(net, AddFullyConnectedLayer(net, "FC2", 5, 1.0f, 0.5f, 0.0f), DenseOp(4096));
+    SetLayerOp(net, AddFullyConnectedLayer(net, "FC3", 5, 0.5f, 0.5f, 0.5f), DenseOp(1000));
+    ConnectSequentialLayers(net);
+}
+
+// ResNet18 (simplified schematic): the stem, then one layer per stage of two
+// basic blocks; the last stage ends in the global average pool.
+void SetupResNet18(NetworkGraph* net) {
+    const int stage = OP_FLAG_NORM | OP_FLAG_RESIDUAL;
+    SetLayerOp(net, AddBoxLayer(net, "Input", 3.0f, 2.0f, 3.0f, 1.0f, 1.0f, 1.0f), TensorOp(3, 224, 224));
+    SetLayerOp(net, AddBoxLayer(net, "InitialConv", 3.0f, 1.5f, 3.0f, 1.0f, 0.0f, 0.0f), WithPool(ConvOp(64, 7, 2, 3, 1, OP_FLAG_NORM), 3, 2, 1));
+    SetLayerOp(net, AddBoxLayer(net, "ResBlock1", 2.8f, 1.5f, 2.8f, 0.0f, 1.0f, 0.0f), ConvOp(64, 3, 1, 1, 4, stage));
+    SetLayerOp(net, AddBoxLayer(net, "ResBlock2", 2.6f, 1.5f, 2.6f, 0.0f, 0.0f, 1.0f), ConvOp(128, 3, 2, 1, 4, stage));
+    SetLayerOp(net, AddBoxLayer(net, "ResBlock3", 2.4f, 1.5f, 2.4f, 1.0f, 0.0f, 1.0f), ConvOp(256, 3, 2, 1, 4, stage));
+    SetLayerOp(net, AddBoxLayer(net, "ResBlock4", 2.2f, 1.5f, 2.2f, 0.0f, 1.0f, 1.0f), WithPool(ConvOp(512, 3, 2, 1, 4, stage), 7, 7, 0));
+    SetLayerOp(net, AddFullyConnectedLayer(net, "FinalFC", 5, 1.0f, 1.0f, 0.0f), DenseOp(1000));
+    ConnectSequentialLayers(net);
+}
+
+// Custom network: label each layer as "Layer i"
+void SetupCustomNetwork(NetworkGraph* net) {
+    int layerCount = 0;
+    printf("Enter the number of layers: ");
+    scanf("%d", &layerCount);
+    ReserveLayers(net, layerCount);
+    
+    printf("Note: You may separate numbers with spaces or commas.\n");
+    
+    for (int i = 0; i < layerCount; i++) {
+        int typeInput;
+        float width = 0.0f, height = 0.0f, depth = 0.0f;
+        int neuronCount = 0;
+        float color[3] = { 1.0f, 1.0f, 1.0f };
+        char label[32];
+        printf("Layer %d: Enter type (0 for box, 1 for fully-connected): ", i);
+        scanf("%d", &typeInput);
+        if (typeInput == 0) {
+            printf("Enter width, height, depth for box: ");
+            scanf(" %f%*[ ,]%f%*[ ,]%f", &width, &height, &depth);
+        } else {
+            printf("Enter number of neurons for fully-connected layer: ");
+            scanf("%d", &neuronCount);
+        }
+        printf("Enter color (r, g, b, each between 0 and 1): ");
+        scanf(" %f%*[ ,]%f%*[ ,]%f", &color[0], &color[1], &color[2]);
+        sprintf(label, "Layer %d", i);
+        if (typeInput == 0)
+            AddBoxLayer(net, label, width, height, depth, color[0], color[1], color[2]);
+        else
+            AddFullyConnectedLayer(net, label, neuronCount, color[0], color[1], color[2]);
+    }
+    ConnectSequentialLayers(net);
+}
+
+// Generated network for benchmarks, from "synth:LAYERS[xWIDTH][:TOPOLOGY]",
+// e.g. synth:2000x128:residual. Every eighth layer is fully connected with
+// WIDTH neurons (none when WIDTH is 0, default 64); the rest are boxes whose
+// sizes come from a fixed-seed generator, so a spec always builds the same
+// scene. Returns 0 on a malformed spec.
+int SetupSyntheticNetwork(NetworkGraph* net, const char* spec) {
+    static const char* topologies[SYNTH_TOPOLOGY_COUNT] = { "chain", "residual", "dense", "inception" };
+    int layerCount = 0, width = 64, used = 0;
+    SynthTopology topology = SYNTH_CHAIN;
+    if (sscanf(spec, "synth:%d%n", &layerCount, &used) != 1 || layerCount <= 0)
+        return 0;
+    spec += used;
+    if (*spec == 'x') {
+        if (sscanf(spec, "x%d%n", &width, &used) != 1 || width < 0)
+            return 0;
+        spec += used;
+    }
+    if (*spec == ':') {
+        spec++;
+        for (topology = 0; topology < SYNTH_TOPOLOGY_COUNT; topology++) {
+            if (_stricmp(spec, topologies[topology]) == 0)
+                break;
+        }
+        if (topology == SYNTH_TOPOLOGY_COUNT)
+            return 0;
+    } else if (*spec) {
+        return 0;
+    }
+
+    unsigned int seed = 12345u;
+    ReserveLayers(net, layerCount);
+    for (int i = 0; i < layerCount; i++) {
+        char label[32];
+        float color[3];
+        DefaultLayerColor(i, color);
+        if (width > 0 && i % 8 == 7) {
+            sprintf(label, "FC%d", i);
+            AddFullyConnectedLayer(net, label, width, color[0], color[1], color[2]);
+            continue;
+        }
+        float size[3];
+        for (int k = 0; k < 3; k++) {
+            seed = seed * 1664525u + 1013904223u;
+            size[k] = 0.5f + (seed >> 8) * (2.5f / 16777216.0f);
+        }
+        sprintf(label, "Conv%d", i);
+        AddBoxLayer(net, label, size[0], size[1] * 0.5f, size[2], color[0], color[1], color[2]);
+    }
+    if (topology == SYNTH_CHAIN) {
+        ConnectSequentialLayers(net);
+    } else if (topology == SYNTH_RESIDUAL) {
+        ReserveConnections(net, layerCount * 2);
+        for (int i = 1; i < layerCount; i++) {
+            AddConnection(net, i - 1, i);
+            if (i >= 2 && i % 2 == 0)
+                AddConnection(net, i - 2, i);
+        }
+    } else if (topology == SYNTH_DENSE) {
+        ReserveConnections(net, layerCount * 4);
+        for (int i = 1; i < layerCount; i++) {
+            for (int from = i - i % 4 - (i % 4 == 0); from < i; from++)
+                AddConnection(net, from, i);
+        }
+    } else {
+        // Layers 5k are shared; 5k+1 .. 5k+4 branch off 5k and join in 5k+5.
+        ReserveConnections(net, layerCount * 2);
+        for (int i = 1; i < layerCount; i++) {
+            if (i % 5 != 0)
+                AddConnection(net, i - i % 5, i);
+            else {
+                for (int from = i - 4; from < i; from++)
+                    AddConnection(net, from, i);
+            }
+        }
+    }
+    return 1;
+}
+
+//-------------------------
+// Threads & Timing
+//-------------------------
+
+double NowSeconds(void) {
+#ifdef _WIN32
+    LARGE_INTEGER counter, frequency;
+    QueryPerformanceCounter(&counter);
+    QueryPerformanceFrequency(&frequency);
+    return (double)counter.QuadPart / (double)frequency.QuadPart;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+#endif
+}
+
+void SleepSeconds(double seconds) {
+    if (seconds <= 0.0)
+        return;
+#ifdef _WIN32
+    Sleep((DWORD)(seconds * 1000.0));
+#else
+    struct timespec ts;
+    ts.tv_sec = (time_t)seconds;
+    ts.tv_nsec = (long)((seconds - (double)ts.tv_sec) * 1e9);
+    nanosleep(&ts, NULL);
+#endif
+}
+
+// Heap-allocated so the starting thread does not depend on the caller's stack.
+typedef struct {
+    ThreadFunc func;
+    void* arg;
+} ThreadStart;
+
+#ifdef _WIN32
+DWORD WINAPI ThreadTrampoline(LPVOID param) {
+#else
+void* ThreadTrampoline(void* param) {
+#endif
+    ThreadStart start = *(ThreadStart*)param;
+    free(param);
+    start.func(start.arg);
+    return 0;
+}
+
+// Returns 0 when the thread could not be created.
+int StartThread(Thread* thread, ThreadFunc func, void* arg) {
+    ThreadStart* start = malloc(sizeof(ThreadStart));
+    if (!start)
+        return 0;
+    start->func = func;
+    start->arg = arg;
+#ifdef _WIN32
+    *thread = CreateThread(NULL, 0, ThreadTrampoline, start, 0, NULL);
+    if (*thread)
+        return 1;
+#else
+    if (pthread_create(thread, NULL, ThreadTrampoline, start) == 0)
+        return 1;
+#endif
+    free(start);
+    return 0;
+}
+
+void JoinThread(Thread thread) {
+#ifdef _WIN32
+    WaitForSingleObject(thread, INFINITE);
+    CloseHandle(thread);
+#else
+    pthread_join(thread, NULL);
+#endif
+}
+
+// Give the rest of the time slice to another ready thread, if any.
+void YieldThread(void) {
+#ifdef _WIN32
+    SwitchToThread();
+#else
+    sched_yield();
+#endif
+}
+
+// Run the calling thread, and the threads it starts, behind the others, for
+// background work that must not delay frames. On Linux the thread becomes
+// SCHED_IDLE, so waking it never preempts the thread that woke it; a high
+// nice value, which Linux keeps per thread too, is the fallback.
+void LowerThreadPriority(void) {
+#ifdef _WIN32
+    SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_BELOW_NORMAL);
+#elif defined(__linux__)
+    struct sched_param param = {0};
+    if (sched_setscheduler(0, 5, &param) != 0)     // SCHED_IDLE, hidden without _GNU_SOURCE
+        setpriority(PRIO_PROCESS, 0, 19);
+#endif
+}
+
+// Returns the incremented value.
+long AtomicIncrement(volatile long* value) {
+#ifdef _WIN32
+    return InterlockedIncrement(value);
+#else
+    return __sync_add_and_fetch(value, 1);
+#endif
+}
+
+// Acquire load and release store, for an index one thread publishes to another.
+long AtomicLoad(volatile long* value) {
+#ifdef _WIN32
+    return InterlockedCompareExchange(value, 0, 0);
+#else
+    return __atomic_load_n(value, __ATOMIC_ACQUIRE);
+#endif
+}
+
+void AtomicStore(volatile long* value, long v) {
+#ifdef _WIN32
+    InterlockedExchange(value, v);
+#else
+    __atomic_store_n(value, v, __ATOMIC_RELEASE);
+#endif
+}
+
+typedef struct {
+    RangeFunc func;
+    void* ctx;
+    int count, grain;
+    volatile long nextBlock;
+} ParallelJob;
+
+void ParallelWorker(void* arg) {
+    ParallelJob* job = arg;
+    for (;;) {
+        long long begin = (long long)(AtomicIncrement(&job->nextBlock) - 1) * job->grain;
+        if (begin >= job->count)
+            break;
+        long long end = begin + job->grain < job->count ? begin + job->grain : job->count;
+        job->func(job->ctx, (int)begin, (int)end);
+    }
+}
+
+// Run func over [0, count) in blocks of grain items claimed by every core,
+// the caller's included. Ranges of one block run inline without threads.
+void ParallelFor(int count, int grain, RangeFunc func, void* ctx) {
+    ParallelForThreads(count, grain, CpuCount(), func, ctx);
+}
+
+// ParallelFor on at most threadCount threads.
+void ParallelForThreads(int count, int grain, int threadCount, RangeFunc func, void* ctx) {
+    Thread threads[64];
+    int blocks = (count + grain - 1) / grain;
+    if (blocks <= 1)
+        threadCount = 1;
+    if (threadCount > blocks)
+        threadCount = blocks;
+    if (threadCount > 64)
+        threadCount = 64;
+    if (threadCount <= 1) {
+        if (count > 0)
+            func(ctx, 0, count);
+        return;
+    }
+    ParallelJob job = { func, ctx, count, grain, 0 };
+    int started = 0;
+    while (started < threadCount - 1 && StartThread(&threads[started], ParallelWorker, &job))
+        started++;
+    ParallelWorker(&job);
+    for (int i = 0; i < started; i++)
+        JoinThread(threads[i]);
+}
+
+unsigned long CurrentThreadId(void) {
+#ifdef _WIN32
+    return GetCurrentThreadId();
+#else
+    return (unsigned long)pthread_self();
+#endif
+}
+
+// Process high-water mark of resident memory, 0 when unknown. psapi's
+// function is resolved at runtime, so the build needs no extra library.
+size_t PeakMemoryBytes(void) {
+#ifdef _WIN32
+    typedef BOOL (WINAPI *MemoryInfoProc)(HANDLE process, PROCESS_MEMORY_COUNTERS* counters, DWORD size);
+    MemoryInfoProc getInfo = (MemoryInfoProc)GetProcAddress(GetModuleHandle("kernel32.dll"), "K32GetProcessMemoryInfo");
+    PROCESS_MEMORY_COUNTERS counters;
+    if (getInfo && getInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+        return counters.PeakWorkingSetSize;
+    return 0;
+#else
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0)
+        return 0;
+#ifdef __APPLE__
+    return (size_t)usage.ru_maxrss;
+#else
+    return (size_t)usage.ru_maxrss * 1024;     // Kilobytes on Linux
+#endif
+#endif
+}
+
+// Resident memory right now, 0 when unknown.
+size_t ResidentMemoryBytes(void) {
+#ifdef _WIN32
+    typedef BOOL (WINAPI *MemoryInfoProc)(HANDLE process, PROCESS_MEMORY_COUNTERS* counters, DWORD size);
+    MemoryInfoProc getInfo = (MemoryInfoProc)GetProcAddress(GetModuleHandle("kernel32.dll"), "K32GetProcessMemoryInfo");
+    PROCESS_MEMORY_COUNTERS counters;
+    if (getInfo && getInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+        return counters.WorkingSetSize;
+    return 0;
+#else
+    unsigned long long pages = 0, resident = 0;
+    FILE* statm = fopen("/proc/self/statm", "r");
+    if (!statm)
+        return 0;
+    if (fscanf(statm, "%llu %llu", &pages, &resident) != 2)
+        resident = 0;
+    fclose(statm);
+    return (size_t)resident * (size_t)sysconf(_SC_PAGESIZE);
+#endif
+}
+
+int CpuCount(void) {
+#ifdef _WIN32
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return info.dwNumberOfProcessors > 0 ? (int)info.dwNumberOfProcessors : 1;
+#else
+    long count = sysconf(_SC_NPROCESSORS_ONLN);
+    return count > 0 ? (int)count : 1;
+#endif
+}
+
+#ifdef _WIN32
+void InitMutex(Mutex* mutex) { InitializeCriticalSection(mutex); }
+void DestroyMutex(Mutex* mutex) { DeleteCriticalSection(mutex); }
+void LockMutex(Mutex* mutex) { EnterCriticalSection(mutex); }
+void UnlockMutex(Mutex* mutex) { LeaveCriticalSection(mutex); }
+void InitCondVar(CondVar* cond) { InitializeConditionVariable(cond); }
+void DestroyCondVar(CondVar* cond) { }
+void WaitCondVar(CondVar* cond, Mutex* mutex) { SleepConditionVariableCS(cond, mutex, INFINITE); }
+void WakeAllCondVar(CondVar* cond) { WakeAllConditionVariable(cond); }
+#else
+void InitMutex(Mutex* mutex) { pthread_mutex_init(mutex, NULL); }
+void DestroyMutex(Mutex* mutex) { pthread_mutex_destroy(mutex); }
+void LockMutex(Mutex* mutex) { pthread_mutex_lock(mutex); }
+void UnlockMutex(Mutex* mutex) { pthread_mutex_unlock(mutex); }
+void InitCondVar(CondVar* cond) { pthread_cond_init(cond, NULL); }
+void DestroyCondVar(CondVar* cond) { pthread_cond_destroy(cond); }
+void WaitCondVar(CondVar* cond, Mutex* mutex) { pthread_cond_wait(cond, mutex); }
+void WakeAllCondVar(CondVar* cond) { pthread_cond_broadcast(cond); }
+#endif
+
+//-------------------------
+// Frame Profiler
+//-------------------------
+
+// Turning the profiler on for the first time sets the trace origin; later
+// toggles keep what was recorded so far.
+void EnableProfiler(int enabled) {
+    if (enabled && !profiler.ready) {
+        profiler.events = malloc(PROFILE_EVENT_CAPACITY * sizeof(ProfileEvent));
+        profiler.samples = malloc(PROFILE_SAMPLE_CAPACITY * sizeof(ProfileSample));
+        if (!profiler.events || !profiler.samples) {
+            printf("Error: Out of memory allocating the profiler.\n");
+            exit(EXIT_FAILURE);
+        }
+        InitMutex(&profiler.lock);
+        profiler.origin = NowSeconds();
+        profiler.ready = 1;
+    }
+    profiler.enabled = enabled;
+}
+
+double ProfileStart(void) {
+    return profiler.enabled ? NowSeconds() : 0.0;
+}
+
+// Close a scope opened by ProfileStart. Safe from any thread.
+void ProfileEnd(ProfileStage stage, double start) {
+    if (start == 0.0)
+        return;
+    double end = NowSeconds(), duration = end - start;
+    LockMutex(&profiler.lock);
+    profiler.stageTotal[stage] += duration;
+    profiler.stageCalls[stage]++;
+    if (duration > profiler.stageMax[stage])
+        profiler.stageMax[stage] = duration;
+    profiler.frameStage[stage] += duration;
+    if (profiler.eventCount < PROFILE_EVENT_CAPACITY) {
+        ProfileEvent* ev = &profiler.events[profiler.eventCount++];
+        ev->start = start - profiler.origin;
+        ev->duration = duration;
+        ev->stage = stage;
+        ev->thread = CurrentThreadId();
+    } else {
+        profiler.dropped++;
+    }
+    UnlockMutex(&profiler.lock);
+}
+
+void ProfileCount(ProfileCounter counter, long long amount) {
+    if (!profiler.enabled)
+        return;
+    LockMutex(&profiler.lock);
+    profiler.counterTotal[counter] += amount;
+    profiler.frameCounter[counter] += amount;
+    UnlockMutex(&profiler.lock);
+}
+
+// Move the frame's stage times and counters into the HUD history and the
+// trace's counter samples, then start a new frame.
+void ProfileFrameEnd(void) {
+    if (!profiler.enabled)
+        return;
+    LockMutex(&profiler.lock);
+    memcpy(profiler.historyStage[profiler.historyNext], profiler.frameStage, sizeof(profiler.frameStage));
+    memcpy(profiler.historyCounter[profiler.historyNext], profiler.frameCounter, sizeof(profiler.frameCounter));
+    profiler.historyNext = (profiler.historyNext + 1) % PROFILE_HISTORY;
+    if (profiler.historyCount < PROFILE_HISTORY)
+        profiler.historyCount++;
+    if (profiler.sampleCount < PROFILE_SAMPLE_CAPACITY) {
+        ProfileSample* sample = &profiler.samples[profiler.sampleCount++];
+        sample->time = NowSeconds() - profiler.origin;
+        memcpy(sample->counters, profiler.frameCounter, sizeof(profiler.frameCounter));
+    }
+    memset(profiler.frameStage, 0, sizeof(profiler.frameStage));
+    memset(profiler.frameCounter, 0, sizeof(profiler.frameCounter));
+    profiler.frames++;
+    UnlockMutex(&profiler.lock);
+}
+
+const char* ProfileStageName(ProfileStage stage) {
+    static const char* names[PROF_STAGE_COUNT] = {
+        "frame", "setup", "layout", "scene_build", "scene_patch", "scene_cache", "live_colors", "timeline", "build_edges", "scene_upload", "cull",
+        "pick", "draw_scene", "labels", "raster_setup", "raster_tiles", "present", "swap", "image_write"
+    };
+    return names[stage];
+}
+
+const char* ProfileCounterName(ProfileCounter counter) {
+    static const char* names[PROF_COUNTER_COUNT] = {
+        "draw_calls", "vertices", "instances", "primitives", "glu_calls", "elements_culled", "labels_drawn"
+    };
+    return names[counter];
+}
+
+// Averages over the last PROFILE_HISTORY frames, one stage per line; stages
+// that took no time are left out.
+void FormatProfileHud(char* text, size_t size) {
+    double stage[PROF_STAGE_COUNT] = {0}, frameMax = 0.0;
+    long long counter[PROF_COUNTER_COUNT] = {0};
+    size_t len = 0;
+    text[0] = '\0';
+    if (!profiler.ready)
+        return;
+    LockMutex(&profiler.lock);
+    int n = profiler.historyCount;
+    for (int f = 0; f < n; f++) {
+        for (int s = 0; s < PROF_STAGE_COUNT; s++)
+            stage[s] += profiler.historyStage[f][s];
+        for (int c = 0; c < PROF_COUNTER_COUNT; c++)
+            counter[c] += profiler.historyCounter[f][c];
+        if (profiler.historyStage[f][PROF_FRAME] > frameMax)
+            frameMax = profiler.historyStage[f][PROF_FRAME];
+    }
+    UnlockMutex(&profiler.lock);
+    if (n == 0)
+        n = 1;
+    len += snprintf(text + len, size - len, "frame %.2f ms avg, %.2f max over %d frames\n",
+                    stage[PROF_FRAME] * 1000.0 / n, frameMax * 1000.0, profiler.historyCount);
+    for (int s = PROF_FRAME + 1; s < PROF_STAGE_COUNT && len < size; s++) {
+        if (stage[s] > 0.0)
+            len += snprintf(text + len, size - len, "  %-13s %6.2f ms\n", ProfileStageName(s), stage[s] * 1000.0 / n);
+    }
+    for (int c = 0; c < PROF_COUNTER_COUNT && len < size; c++)
+        len += snprintf(text + len, size - len, "%s %lld\n", ProfileCounterName(c), counter[c] / n);
+}
+
+// Chrome trace event format, loadable in chrome://tracing or Perfetto: one
+// complete ("X") event per scope and a counter ("C") track per frame counter.
+int WriteProfileTrace(const char* path) {
+    FILE* file = fopen(path, "w");
+    if (!file)
+        return 0;
+    LockMutex(&profiler.lock);
+    fprintf(file, "{\"traceEvents\":[\n");
+    fprintf(file, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"deep3d\"}}");
+    for (int i = 0; i < profiler.eventCount; i++) {
+        const ProfileEvent* ev = &profiler.events[i];
+        fprintf(file, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":1,\"tid\":%lu}",
+                ProfileStageName(ev->stage), ev->start * 1e6, ev->duration * 1e6, ev->thread);
+    }
+    for (int i = 0; i < profiler.sampleCount; i++) {
+        const ProfileSample* sample = &profiler.samples[i];
+        for (int c = 0; c < PROF_COUNTER_COUNT; c++) {
+            fprintf(file, ",\n{\"name\":\"%s\",\"ph\":\"C\",\"ts\":%.3f,\"pid\":1,\"args\":{\"value\":%lld}}",
+                    ProfileCounterName(c), sample->time * 1e6, sample->counters[c]);
+        }
+    }
+    fprintf(file, "\n],\"displayTimeUnit\":\"ms\",\"otherData\":{\"droppedEvents\":%lld}}\n", profiler.dropped);
+    UnlockMutex(&profiler.lock);
+    return fclose(file) == 0;
+}
+
+// Totals since the profiler was first enabled, one row per stage and counter;
+// per_frame divides by the frames ended with ProfileFrameEnd, or 1 if none.
+int WriteProfileCsv(const char* path) {
+    FILE* file = fopen(path, "w");
+    if (!file)
+        return 0;
+    LockMutex(&profiler.lock);
+    double frames = profiler.frames > 0 ? (double)profiler.frames : 1.0;
+    fprintf(file, "kind,name,count,total_ms,mean_ms,max_ms,per_frame\n");
+    for (int s = 0; s < PROF_STAGE_COUNT; s++) {
+        long long calls = profiler.stageCalls[s];
+        fprintf(file, "stage,%s,%lld,%.4f,%.4f,%.4f,%.4f\n", ProfileStageName(s), calls,
+                profiler.stageTotal[s] * 1000.0, calls ? profiler.stageTotal[s] * 1000.0 / calls : 0.0,
+                profiler.stageMax[s] * 1000.0, profiler.stageTotal[s] * 1000.0 / frames);
+    }
+    for (int c = 0; c < PROF_COUNTER_COUNT; c++) {
+        fprintf(file, "counter,%s,%lld,,,,%.1f\n", ProfileCounterName(c), profiler.counterTotal[c],
+                profiler.counterTotal[c] / frames);
+    }
+    UnlockMutex(&profiler.lock);
+    return fclose(file) == 0;
+}
+
+// .csv writes the summary, anything else the Chrome trace.
+int WriteProfile(const char* path) {
+    if (!profiler.ready) {
+        printf("Error: Nothing profiled yet.\n");
+        return 0;
+    }
+    const char* ext = strrchr(path, '.');
+    int ok = ext && _stricmp(ext, ".csv") == 0 ? WriteProfileCsv(path) : WriteProfileTrace(path);
+    if (ok)
+        printf("Profile written to %s\n", path);
+    else
+        printf("Error: Cannot write profile '%s'.\n", path);
+    return ok;
+}
+
+//-------------------------
+// Layered Graph Layout
+//-------------------------
+// Sugiyama-style layout of the layer graph: ranks from longest paths, dummy
+// nodes on edges that skip ranks, barycenter sweeps against crossings, then
+// x coordinates pulled toward each layer's neighbors. Every step is linear or
+// n log n in the graph size, and the sweeps run on all cores. A plain chain
+// comes out as the classic single column.
+
+// Ranks from the longest path out of any source, so every edge points down.
+// A cycle is broken by ranking its lowest unranked layer as if it were a
+// source. Sources are then pulled down to just above their first consumer,
+// which keeps side inputs next to where they are used.
+void AssignLayoutRanks(GraphLayout* g, const NetworkGraph* net) {
+    int n = net->layerCount;
+    int* inDegree = calloc(n, sizeof(int));
+    int* outStart = calloc(n + 1, sizeof(int));
+    int* fill = malloc(n * sizeof(int));
+    int* outs = malloc((net->edgeCount + 1) * sizeof(int));
+    int* queue = malloc(n * sizeof(int));
+    unsigned char* state = calloc(n, 1);    // 0 unranked, 1 queued, 2 done
+    g->rank = calloc(n, sizeof(int));
+    if (!inDegree || !outStart || !fill || !outs || !queue || !state || !g->rank) {
+        printf("Error: Out of memory laying out the network.\n");
+        exit(EXIT_FAILURE);
+    }
+    for (int e = 0; e < net->edgeCount; e++) {
+        int from = net->edgeFrom[e], to = net->edgeTo[e];
+        if (from == to || from < 0 || to < 0 || from >= n || to >= n)
+            continue;
+        outStart[from + 1]++;
+        inDegree[to]++;
+    }
+    for (int v = 0; v < n; v++)
+        outStart[v + 1] += outStart[v];
+    memcpy(fill, outStart, n * sizeof(int));
+    for (int e = 0; e < net->edgeCount; e++) {
+        int from = net->edgeFrom[e], to = net->edgeTo[e];
+        if (from == to || from < 0 || to < 0 || from >= n || to >= n)
+            continue;
+        outs[fill[from]++] = to;
+    }
+    
+    int head = 0, tail = 0, nextForced = 0, maxRank = 0;
+    for (int v = 0; v < n; v++) {
+        if (inDegree[v] == 0) {
+            queue[tail++] = v;
+            state[v] = 1;
+        }
+    }
+    for (int done = 0; done < n; done++) {
+        if (head == tail) {
+            while (state[nextForced])
+                nextForced++;
+            queue[tail++] = nextForced;
+            state[nextForced] = 1;
+        }
+        int u = queue[head++];
+        state[u] = 2;
+        for (int i = outStart[u]; i < outStart[u + 1]; i++) {
+            int v = outs[i];
+            if (state[v] == 2)
+                continue;
+            if (g->rank[u] + 1 > g->rank[v])
+                g->rank[v] = g->rank[u] + 1;
+            if (--inDegree[v] == 0 && state[v] == 0) {
+                queue[tail++] = v;
+                state[v] = 1;
+            }
+        }
+    }
+    for (int e = 0; e < net->edgeCount; e++) {
+        int to = net->edgeTo[e];
+        if (to >= 0 && to < n)
+            state[to] = 0;      // Reused: 0 once a layer has an incoming edge
+    }
+    for (int v = 0; v < n; v++) {
+        if (state[v] == 2 && outStart[v + 1] > outStart[v]) {
+            int first = INT_MAX;
+            for (int i = outStart[v]; i < outStart[v + 1]; i++)
+                first = g->rank[outs[i]] < first ? g->rank[outs[i]] : first;
+            if (first - 1 > g->rank[v])
+                g->rank[v] = first - 1;
+        }
+        if (g->rank[v] > maxRank)
+            maxRank = g->rank[v];
+    }
+    g->rankCount = maxRank + 1;
+    free(inDegree);
+    free(outStart);
+    free(fill);
+    free(outs);
+    free(queue);
+    free(state);
+}
+
+// Add the dummies, build adjacency in both directions and an initial order.
+// Edges between layers of the same rank (only left by broken cycles) are
+// not part of the layout and stay straight.
+void BuildLayoutGraph(GraphLayout* g, const NetworkGraph* net) {
+    int n = net->layerCount, edgeCount = net->edgeCount;
+    long long nodeCount = n, linkCount = 0;
+    g->layerCount = n;
+    g->edgeDummy = malloc((edgeCount + 1) * sizeof(int));
+    g->edgeFlipped = malloc(edgeCount + 1);
+    if (!g->edgeDummy || !g->edgeFlipped) {
+        printf("Error: Out of memory laying out the network.\n");
+        exit(EXIT_FAILURE);
+    }
+    for (int e = 0; e < edgeCount; e++) {
+        int from = net->edgeFrom[e], to = net->edgeTo[e];
+        g->edgeDummy[e] = -1;
+        g->edgeFlipped[e] = 2;      // Not laid out
+        if (from < 0 || to < 0 || from >= n || to >= n || g->rank[from] == g->rank[to])
+            continue;
+        int span = abs(g->rank[to] - g->rank[from]);
+        g->edgeFlipped[e] = g->rank[to] < g->rank[from];
+        if (span > 1) {
+            g->edgeDummy[e] = (int)nodeCount;
+            nodeCount += span - 1;
+        }
+        linkCount += span;
+    }
+    if (nodeCount > INT_MAX / 4 || linkCount > INT_MAX / 2) {
+        printf("Error: Network too large to lay out.\n");
+        exit(EXIT_FAILURE);
+    }
+    g->nodeCount = (int)nodeCount;
+    int links = (int)linkCount, N = g->nodeCount, R = g->rankCount;
+    g->rank = realloc(g->rank, N * sizeof(int));
+    g->order = malloc(N * sizeof(int));
+    g->bestOrder = malloc(N * sizeof(int));
+    g->rankStart = calloc(R + 1, sizeof(int));
+    g->byRank = malloc(N * sizeof(int));
+    g->predStart = calloc(N + 1, sizeof(int));
+    g->succStart = calloc(N + 1, sizeof(int));
+    g->preds = malloc((links + 1) * sizeof(int));
+    g->succs = malloc((links + 1) * sizeof(int));
+    g->key = malloc(N * sizeof(float));
+    g->items = malloc(N * sizeof(LayoutItem));
+    g->rankEdgeStart = calloc(R + 1, sizeof(int));
+    g->crossScratch = malloc((links + 1) * sizeof(int));
+    g->fenwick = malloc(N * sizeof(int));
+    g->rankCrossings = calloc(R, sizeof(long long));
+    g->x = malloc(N * sizeof(float));
+    g->width = calloc(N, sizeof(float));
+    int* fill = malloc((N + 1) * sizeof(int));
+    if (!g->rank || !g->order || !g->bestOrder || !g->rankStart || !g->byRank || !g->predStart ||
+        !g->succStart || !g->preds || !g->succs || !g->key || !g->items || !g->rankEdgeStart ||
+        !g->crossScratch || !g->fenwick || !g->rankCrossings || !g->x || !g->width || !fill) {
+        printf("Error: Out of memory laying out the network.\n");
+        exit(EXIT_FAILURE);
+    }
+    
+    // Each laid-out edge becomes a chain upper -> dummies -> lower, one link
+    // per rank, so every link joins neighboring ranks.
+    for (int pass = 0; pass < 2; pass++) {
+        for (int e = 0; e < edgeCount; e++) {
+            if (g->edgeFlipped[e] == 2)
+                continue;
+            int upper = g->edgeFlipped[e] ? net->edgeTo[e] : net->edgeFrom[e];
+            int lower = g->edgeFlipped[e] ? net->edgeFrom[e] : net->edgeTo[e];
+            int dummies = abs(g->rank[lower] - g->rank[upper]) - 1;
+            int prev = upper;
+            for (int k = 0; k <= dummies; k++) {
+                int node = k < dummies ? g->edgeDummy[e] + k : lower;
+                if (pass == 0) {
+                    if (k < dummies)
+                        g->rank[node] = g->rank[upper] + 1 + k;
+                    g->succStart[prev + 1]++;
+                    g->predStart[node + 1]++;
+                } else {
+                    g->succs[fill[prev]++] = node;
+                    g->preds[g->predStart[node + 1]++] = prev;
+                }
+                prev = node;
+            }
+        }
+        if (pass == 0) {
+            for (int v = 0; v < N; v++) {
+                g->succStart[v + 1] += g->succStart[v];
+                g->predStart[v + 1] += g->predStart[v];
+            }
+            memcpy(fill, g->succStart, N * sizeof(int));
+            // predStart[v + 1] doubles as the fill cursor and ends up back in place.
+            memmove(g->predStart + 1, g->predStart, N * sizeof(int));
+        }
+    }
+    
+    for (int v = 0; v < N; v++) {
+        g->rankStart[g->rank[v] + 1]++;
+        g->rankEdgeStart[g->rank[v] + 1] += g->succStart[v + 1] - g->succStart[v];
+    }
+    for (int r = 0; r < R; r++) {
+        g->rankStart[r + 1] += g->rankStart[r];
+        g->rankEdgeStart[r + 1] += g->rankEdgeStart[r];
+    }
+    memcpy(fill, g->rankStart, R * sizeof(int));
+    for (int v = 0; v < N; v++) {
+        int slot = fill[g->rank[v]]++;
+        g->byRank[slot] = v;
+        g->order[v] = slot - g->rankStart[g->rank[v]];
+    }
+    free(fill);
+}
+
+// Barycenter of each node's neighbors on the sweep's side, with positions
+// normalized by rank width so ranks of different sizes line up. Covers the
+// slots [begin, end) of the rank being swept; its nodes only read the
+// neighboring rank, so a wide rank is split across threads.
+void ComputeSweepKeys(void* ctx, int begin, int end) {
+    GraphLayout* g = ctx;
+    for (int slot = begin; slot < end; slot++) {
+        int v = g->byRank[g->rankStart[g->sweepRank] + slot];
+        const int* adj = g->downward ? g->preds + g->predStart[v] : g->succs + g->succStart[v];
+        int count = g->downward ? g->predStart[v + 1] - g->predStart[v] : g->succStart[v + 1] - g->succStart[v];
+        if (count == 0) {
+            int r = g->rank[v];
+            g->key[v] = (g->order[v] + 0.5f) / (g->rankStart[r + 1] - g->rankStart[r]);
+            continue;
+        }
+        float sum = 0.0f;
+        for (int i = 0; i < count; i++) {
+            int u = adj[i], r = g->rank[u];
+            sum += (g->order[u] + 0.5f) / (g->rankStart[r + 1] - g->rankStart[r]);
+        }
+        g->key[v] = sum / count;
+    }
+}
+
+int CompareLayoutItems(const void* a, const void* b) {
+    const LayoutItem* x = a;
+    const LayoutItem* y = b;
+    if (x->key != y->key)
+        return x->key < y->key ? -1 : 1;
+    return x->order - y->order;
+}
+
+void SortLayoutRanks(void* ctx, int begin, int end) {
+    GraphLayout* g = ctx;
+    for (int r = begin; r < end; r++) {
+        int first = g->rankStart[r], count = g->rankStart[r + 1] - first;
+        LayoutItem* items = g->items + first;
+        if (count < 2)
+            continue;
+        for (int i = 0; i < count; i++) {
+            int node = g->byRank[first + i];
+            items[i].key = g->key[node];
+            items[i].order = i;
+            items[i].node = node;
+        }
+        qsort(items, count, sizeof(LayoutItem), CompareLayoutItems);
+        for (int i = 0; i < count; i++) {
+            g->byRank[first + i] = items[i].node;
+            g->order[items[i].node] = i;
+        }
+    }
+}
+
+// Crossings between rank r and r + 1 are inversions among the links' lower
+// ends once they are listed by upper end, counted with a Fenwick tree over
+// the lower rank.
+void CountRankCrossings(void* ctx, int begin, int end) {
+    GraphLayout* g = ctx;
+    for (int r = begin; r < end; r++) {
+        int* list = g->crossScratch + g->rankEdgeStart[r];
+        int* tree = g->fenwick + g->rankStart[r + 1];
+        int size = g->rankStart[r + 2] - g->rankStart[r + 1];
+        int count = 0;
+        long long crossings = 0;
+        for (int i = g->rankStart[r]; i < g->rankStart[r + 1]; i++) {
+            int v = g->byRank[i], first = count;
+            for (int k = g->succStart[v]; k < g->succStart[v + 1]; k++)
+                list[count++] = g->order[g->succs[k]];
+            if (count - first > 1)
+                qsort(list + first, count - first, sizeof(int), CompareInts);
+        }
+        memset(tree, 0, size * sizeof(int));
+        for (int j = 0; j < count; j++) {
+            int atMost = 0;
+            for (int i = list[j] + 1; i > 0; i -= i & -i)
+                atMost += tree[i - 1];
+            crossings += j - atMost;
+            for (int i = list[j] + 1; i <= size; i += i & -i)
+                tree[i - 1]++;
+        }
+        g->rankCrossings[r] = crossings;
+    }
+}
+
+long long CountLayoutCrossings(GraphLayout* g) {
+    long long total = 0;
+    ParallelFor(g->rankCount - 1, 64, CountRankCrossings, g);
+    for (int r = 0; r + 1 < g->rankCount; r++)
+        total += g->rankCrossings[r];
+    return total;
+}
+
+// Pack each rank left to right in its final order, then pull every node
+// toward the mean x of its neighbors, down, up and down again. After each
+// pull the rank is pushed apart where it overlaps and shifted back by the
+// average displacement, so order and spacing are kept.
+void AssignLayoutCoordinates(GraphLayout* g, const NetworkGraph* net) {
+    for (int v = 0; v < g->layerCount; v++)
+        g->width[v] = LayerWidth(net, v);
+    for (int r = 0; r < g->rankCount; r++) {
+        float x = 0.0f;
+        for (int i = g->rankStart[r]; i < g->rankStart[r + 1]; i++) {
+            int v = g->byRank[i];
+            if (i > g->rankStart[r]) {
+                int u = g->byRank[i - 1];
+                x += (g->width[u] + g->width[v]) * 0.5f + (u < g->layerCount && v < g->layerCount ? LAYOUT_GAP : LAYOUT_GAP * 0.5f);
+            }
+            g->x[v] = x;
+        }
+        for (int i = g->rankStart[r]; i < g->rankStart[r + 1]; i++)
+            g->x[g->byRank[i]] -= x * 0.5f;
+    }
+    
+    for (int pass = 0; pass < 3; pass++) {
+        int down = pass != 1;
+        for (int step = 1; step < g->rankCount; step++) {
+            int r = down ? step : g->rankCount - 1 - step;
+            int first = g->rankStart[r], last = g->rankStart[r + 1];
+            float shift = 0.0f;
+            for (int i = first; i < last; i++) {
+                int v = g->byRank[i];
+                const int* adj = down ? g->preds + g->predStart[v] : g->succs + g->succStart[v];
+                int count = down ? g->predStart[v + 1] - g->predStart[v] : g->succStart[v + 1] - g->succStart[v];
+                float sum = 0.0f;
+                for (int k = 0; k < count; k++)
+                    sum += g->x[adj[k]];
+                g->key[v] = count ? sum / count : g->x[v];
+                g->x[v] = g->key[v];
+                if (i > first) {
+                    int u = g->byRank[i - 1];
+                    float gap = u < g->layerCount && v < g->layerCount ? LAYOUT_GAP : LAYOUT_GAP * 0.5f;
+                    float minX = g->x[u] + (g->width[u] + g->width[v]) * 0.5f + gap;
+                    if (g->x[v] < minX)
+                        g->x[v] = minX;
+                }
+                shift += g->x[v] - g->key[v];
+            }
+            shift /= last - first;
+            for (int i = first; i < last; i++)
+                g->x[g->byRank[i]] -= shift;
+        }
+    }
+}
+
+void ReleaseGraphLayout(GraphLayout* g) {
+    free(g->rank);
+    free(g->order);
+    free(g->bestOrder);
+    free(g->rankStart);
+    free(g->byRank);
+    free(g->predStart);
+    free(g->preds);
+    free(g->succStart);
+    free(g->succs);
+    free(g->edgeDummy);
+    free(g->edgeFlipped);
+    free(g->key);
+    free(g->items);
+    free(g->rankEdgeStart);
+    free(g->crossScratch);
+    free(g->fenwick);
+    free(g->rankCrossings);
+    free(g->x);
+    free(g->width);
+    memset(g, 0, sizeof(GraphLayout));
+}
+
+// Place every layer from the graph's topology and route edges that skip
+// ranks through their dummies' positions. Keeps the order with the fewest
+// crossings seen over LAYOUT_SWEEPS alternating sweeps.
+void LayoutNetwork(NetworkGraph* net) {
+    GraphLayout g = {0};
+    double profileStart = ProfileStart(), start = NowSeconds();
+    if (net->layerCount == 0)
+        return;
+    AssignLayoutRanks(&g, net);
+    BuildLayoutGraph(&g, net);
+    
+    long long initial = CountLayoutCrossings(&g), best = initial;
+    memcpy(g.bestOrder, g.order, g.nodeCount * sizeof(int));
+    for (int sweep = 0; sweep < LAYOUT_SWEEPS && best > 0; sweep++) {
+        g.downward = sweep % 2 == 0;
+        for (int step = 1; step < g.rankCount; step++) {
+            g.sweepRank = g.downward ? step : g.rankCount - 1 - step;
+            int r = g.sweepRank;
+            ParallelFor(g.rankStart[r + 1] - g.rankStart[r], 4096, ComputeSweepKeys, &g);
+            SortLayoutRanks(&g, r, r + 1);
+        }
+        long long crossings = CountLayoutCrossings(&g);
+        if (crossings < best) {
+            best = crossings;
+            memcpy(g.bestOrder, g.order, g.nodeCount * sizeof(int));
+        }
+    }
+    memcpy(g.order, g.bestOrder, g.nodeCount * sizeof(int));
+    for (int v = 0; v < g.nodeCount; v++)
+        g.byRank[g.rankStart[g.rank[v]] + g.order[v]] = v;
+    AssignLayoutCoordinates(&g, net);
+    
+    for (int v = 0; v < net->layerCount; v++) {
+        net->position[v * 3 + 0] = g.x[v];
+        net->position[v * 3 + 1] = TOP_Y - g.rank[v] * LAYER_SPACING;
+        net->position[v * 3 + 2] = 0.0f;
+        net->rank[v] = g.rank[v];
+    }
+    int bends = g.nodeCount - g.layerCount;
+    ReserveRoutes(net, net->edgeCount, bends);
+    net->routeStart[0] = 0;
+    for (int e = 0; e < net->edgeCount; e++) {
+        int point = net->routeStart[e];
+        if (g.edgeDummy[e] >= 0) {
+            int count = abs(g.rank[net->edgeTo[e]] - g.rank[net->edgeFrom[e]]) - 1;
+            for (int k = 0; k < count; k++, point++) {
+                int node = g.edgeDummy[e] + (g.edgeFlipped[e] ? count - 1 - k : k);
+                net->routePoints[point * 3 + 0] = g.x[node];
+                net->routePoints[point * 3 + 1] = TOP_Y - g.rank[node] * LAYER_SPACING;
+                net->routePoints[point * 3 + 2] = 0.0f;
+            }
+        }
+        net->routeStart[e + 1] = point;
+    }
+    net->routedEdges = net->edgeCount;
+    MarkGraphChanged(net);
+    
+    printf("Layout: %d layers in %d ranks, %d bend points, %lld crossings (%lld unordered) in %.2f ms\n",
+           net->layerCount, g.rankCount, bends, best, initial, (NowSeconds() - start) * 1000.0);
+    ReleaseGraphLayout(&g);
+    ProfileEnd(PROF_LAYOUT, profileStart);
+}
+
+//-------------------------
+// Live Editing
+//-------------------------
+
+// Edits change one layer in place and journal it, so the scene and labels
+// redo that layer (and the edges touching it) instead of the whole model.
+
+void SetLayerColor(NetworkGraph* net, int layer, const float* rgb) {
+    memcpy(&net->color[layer * 3], rgb, 3 * sizeof(float));
+    JournalLayer(net, layer);
+}
+
+void SetLayerSize(NetworkGraph* net, int layer, const float* size) {
+    memcpy(&net->size[layer * 3], size, 3 * sizeof(float));
+    net->op[layer].flags &= ~OP_FLAG_AUTOSIZE;      // A size set by hand sticks
+    JournalLayer(net, layer);
+    ReflowRank(net, layer);
+}
+
+void SetLayerNeurons(NetworkGraph* net, int layer, int neuronCount) {
+    net->neuronCount[layer] = neuronCount;
+    JournalLayer(net, layer);
+    ReflowRank(net, layer);
+}
+
+void SetLayerLabel(NetworkGraph* net, int layer, const char* label) {
+    net->label[layer] = InternLabel(net, label);
+    JournalLayer(net, layer);
+}
+
+// Push the layers sharing layer's rank outward until nothing overlaps,
+// keeping layer itself where it is. Only layers that move are journaled;
+// bend points of edges passing through the rank stay put.
+void ReflowRank(NetworkGraph* net, int layer) {
+    int rank = net->rank[layer], count = 0, self = 0;
+    for (int v = 0; v < net->layerCount; v++)
+        count += net->rank[v] == rank;
+    LayoutItem* items = malloc(count * sizeof(LayoutItem));
+    if (!items) {
+        printf("Error: Out of memory laying out the network.\n");
+        exit(EXIT_FAILURE);
+    }
+    count = 0;
+    for (int v = 0; v < net->layerCount; v++) {
+        if (net->rank[v] != rank)
+            continue;
+        items[count].key = net->position[v * 3];
+        items[count].order = v;
+        items[count++].node = v;
+    }
+    qsort(items, count, sizeof(LayoutItem), CompareLayoutItems);
+    while (items[self].node != layer)
+        self++;
+    for (int side = -1; side <= 1; side += 2) {
+        for (int i = self + side; i >= 0 && i < count; i += side) {
+            int u = items[i].node, fixed = items[i - side].node;
+            float clear = (LayerWidth(net, u) + LayerWidth(net, fixed)) * 0.5f + LAYOUT_GAP;
+            float limit = net->position[fixed * 3] + side * clear;
+            if (side < 0 ? net->position[u * 3] <= limit : net->position[u * 3] >= limit)
+                break;
+            net->position[u * 3] = limit;
+            JournalLayer(net, u);
+        }
+    }
+    free(items);
+}
+
+// New layer one rank below parent, copying its shape and color, fed by it.
+int InsertLayerBelow(NetworkGraph* net, int parent) {
+    char label[32];
+    snprintf(label, sizeof(label), "Layer %d", net->layerCount + 1);
+    const float* color = &net->color[parent * 3];
+    int i = AddLayer(net, net->type[parent], label, color[0], color[1], color[2]);
+    memcpy(&net->size[i * 3], &net->size[parent * 3], 3 * sizeof(float));
+    net->neuronCount[i] = net->neuronCount[parent];
+    net->op[i] = net->op[parent];
+    net->rank[i] = net->rank[parent] + 1;
+    net->position[i * 3 + 0] = net->position[parent * 3 + 0];
+    net->position[i * 3 + 1] = TOP_Y - net->rank[i] * LAYER_SPACING;
+    net->position[i * 3 + 2] = net->position[parent * 3 + 2];
+    AddConnection(net, parent, i);
+    ReflowRank(net, i);
+    InferLayerCosts(net);
+    return i;
+}
+
+// Drop layer and its edges. The last layer takes over its index, so only the
+// layer at that index and the targets of the dropped edges are journaled;
+// the remaining layers keep their places and the gap stays until the next
+// full layout.
+void RemoveLayer(NetworkGraph* net, int layer) {
+    int last = net->layerCount - 1;
+    int routed = net->routedEdges == net->edgeCount;
+    int kept = 0, point = 0;
+    for (int e = 0; e < net->edgeCount; e++) {
+        int from = net->edgeFrom[e], to = net->edgeTo[e];
+        int first = routed ? net->routeStart[e] : 0, end = routed ? net->routeStart[e + 1] : 0;
+        if (to == last)
+            to = layer;
+        if (from == last)
+            from = layer;
+        if (net->edgeFrom[e] == layer || net->edgeTo[e] == layer) {
+            if (net->edgeTo[e] != layer && to != layer)
+                JournalLayer(net, to);
+            continue;
+        }
+        net->edgeFrom[kept] = from;
+        net->edgeTo[kept] = to;
+        if (routed) {
+            memmove(&net->routePoints[point * 3], &net->routePoints[first * 3], (end - first) * 3 * sizeof(float));
+            net->routeStart[kept] = point;
+            point += end - first;
+        }
+        kept++;
+    }
+    net->edgeCount = kept;
+    if (routed) {
+        net->routeStart[kept] = point;
+        net->routedEdges = kept;
+    }
+    
+    net->type[layer] = net->type[last];
+    memcpy(&net->size[layer * 3], &net->size[last * 3], 3 * sizeof(float));
+    net->neuronCount[layer] = net->neuronCount[last];
+    memcpy(&net->color[layer * 3], &net->color[last * 3], 3 * sizeof(float));
+    memcpy(&net->position[layer * 3], &net->position[last * 3], 3 * sizeof(float));
+    net->rank[layer] = net->rank[last];
+    net->label[layer] = net->label[last];
+    net->op[layer] = net->op[last];
+    net->cost[layer] = net->cost[last];
+    net->weight[layer] = net->weight[last];
+    net->layerCount--;
+    JournalLayer(net, layer);      // Past the end when the last layer went, which caches read as a removal
+    InferLayerCosts(net);
+}
+
+// Hash of the layers' types and the edges, which decide whether a reloaded
+// model can be applied as edits. Equal hashes still need SameTopology.
+unsigned int TopologyHash(const NetworkGraph* net) {
+    unsigned int h = HashBytes((const char*)net->type, net->layerCount * sizeof(LayerType));
+    h = h * 31 + HashBytes((const char*)net->edgeFrom, net->edgeCount * sizeof(int));
+    h = h * 31 + HashBytes((const char*)net->edgeTo, net->edgeCount * sizeof(int));
+    return h * 31 + (unsigned int)net->layerCount;
+}
+
+int SameTopology(const NetworkGraph* a, const NetworkGraph* b) {
+    int n = a->layerCount, edges = a->edgeCount;
+    return b->layerCount == n && b->edgeCount == edges &&
+           memcmp(a->type, b->type, n * sizeof(LayerType)) == 0 &&
+           memcmp(a->edgeFrom, b->edgeFrom, edges * sizeof(int)) == 0 &&
+           memcmp(a->edgeTo, b->edgeTo, edges * sizeof(int)) == 0;
+}
+
+// Bring net up to date with a fresh parse of its model file that has the
+// same layers and edges: the differences are applied as edits and the layout
+// is kept. Costs must already be inferred on fresh, as sizes taken from
+// shapes are compared. Returns the number of layers edited.
+int ApplyModelEdits(NetworkGraph* net, const NetworkGraph* fresh) {
+    int edited = 0, opsChanged = 0;
+    for (int v = 0; v < net->layerCount; v++) {
+        int before = net->revision;
+        if (!SameLayerOp(&fresh->op[v], &net->op[v])) {
+            SetLayerOp(net, v, fresh->op[v]);
+            opsChanged = 1;
+        }
+        if (memcmp(&fresh->color[v * 3], &net->color[v * 3], 3 * sizeof(float)) != 0)
+            SetLayerColor(net, v, &fresh->color[v * 3]);
+        if (memcmp(&fresh->size[v * 3], &net->size[v * 3], 3 * sizeof(float)) != 0)
+            SetLayerSize(net, v, &fresh->size[v * 3]);
+        if (fresh->neuronCount[v] != net->neuronCount[v])
+            SetLayerNeurons(net, v, fresh->neuronCount[v]);
+        if (strcmp(fresh->label[v], net->label[v]) != 0)
+            SetLayerLabel(net, v, fresh->label[v]);
+        edited += net->revision != before;
+    }
+    if (opsChanged)
+        InferLayerCosts(net);
+    return edited;
+}
+
+//-------------------------
+// Shape Inference & Costs
+//-------------------------
+
+LayerOp TensorOp(long long channels, long long height, long long width) {
+    LayerOp op = { .kind = OP_TENSOR };
+    op.shape.rank = height > 1 || width > 1 ? 3 : 1;
+    op.shape.channels = channels;
+    op.shape.height = height;
+    op.shape.width = width;
+    return op;
+}
+
+LayerOp ConvOp(int channels, int kernel, int stride, int pad, int repeat, int flags) {
+    LayerOp op = { .kind = OP_CONV, .channels = channels, .kernel = (short)kernel, .stride = (short)stride,
+                   .pad = (short)pad, .groups = 1, .repeat = (short)repeat, .flags = flags };
+    return op;
+}
+
+LayerOp WithPool(LayerOp op, int kernel, int stride, int pad) {
+    op.poolKernel = (short)kernel;
+    op.poolStride = (short)stride;
+    op.poolPad = (short)pad;
+    return op;
+}
+
+LayerOp DenseOp(int units) {
+    LayerOp op = { .kind = OP_DENSE, .channels = units, .flags = OP_FLAG_BIAS };
+    return op;
+}
+
+// Field by field, as the padding of copied ops is not reliably zero.
+int SameLayerOp(const LayerOp* a, const LayerOp* b) {
+    return a->kind == b->kind && a->channels == b->channels && a->flags == b->flags &&
+           a->shape.rank == b->shape.rank && a->shape.channels == b->shape.channels &&
+           a->shape.height == b->shape.height && a->shape.width == b->shape.width &&
+           a->kernel == b->kernel && a->stride == b->stride && a->pad == b->pad && a->groups == b->groups &&
+           a->repeat == b->repeat && a->poolKernel == b->poolKernel && a->poolStride == b->poolStride &&
+           a->poolPad == b->poolPad;
+}
+
+void SetLayerOp(NetworkGraph* net, int layer, LayerOp op) {
+    net->op[layer] = op;
+    JournalLayer(net, layer);
+}
+
+long long ShapeElements(const TensorShape* shape) {
+    return shape->rank ? shape->channels * shape->height * shape->width : 0;
+}
+
+// Output size of a sliding window along one axis, never below 1.
+long long ConvExtent(long long size, int kernel, int stride, int pad) {
+    long long out = (size + 2 * pad - kernel) / (stride > 0 ? stride : 1) + 1;
+    return out > 0 ? out : 1;
+}
+
+// Pool x in place; kernel 0 pools the whole map.
+void PoolCost(int kernel, int stride, int pad, TensorShape* x, LayerCost* c) {
+    long long window = kernel > 0 ? (long long)kernel * kernel : x->height * x->width;
+    if (kernel > 0) {
+        x->height = ConvExtent(x->height, kernel, stride, pad);
+        x->width = ConvExtent(x->width, kernel, stride, pad);
+    } else {
+        x->height = x->width = 1;
+    }
+    c->macs += ShapeElements(x) * window;
+    c->activationBytes += ShapeElements(x) * 4;
+}
+
+// The convolutions, shortcuts and pooling of one block; see LayerOp.
+void ConvBlockCost(const LayerOp* op, const TensorShape* in, LayerCost* c) {
+    TensorShape x = *in, blockIn = *in;
+    int groups = op->groups > 0 ? op->groups : 1;
+    int repeat = op->repeat > 0 ? op->repeat : 1;
+    long long perChannel = (op->flags & OP_FLAG_BIAS ? 1 : 0) + (op->flags & OP_FLAG_NORM ? 2 : 0);
+    for (int k = 0; k < repeat; k++) {
+        TensorShape y = { 3, op->channels, 0, 0 };
+        int stride = k == 0 ? op->stride : 1, pad = k == 0 ? op->pad : op->kernel / 2;
+        y.height = ConvExtent(x.height, op->kernel, stride, pad);
+        y.width = ConvExtent(x.width, op->kernel, stride, pad);
+        long long weights = (long long)op->channels * (x.channels / groups) * op->kernel * op->kernel;
+        c->params += weights + perChannel * op->channels;
+        c->macs += weights * y.height * y.width;
+        c->activationBytes += ShapeElements(&y) * 4;
+        if ((op->flags & OP_FLAG_RESIDUAL) && k % 2 == 1) {
+            // A 1x1 projection carries the shortcut when the shape changes.
+            if (blockIn.channels != y.channels || blockIn.height != y.height || blockIn.width != y.width) {
+                long long projection = blockIn.channels * y.channels;
+                c->params += projection + perChannel * y.channels;
+                c->macs += projection * y.height * y.width;
+                c->activationBytes += ShapeElements(&y) * 4;
+            }
+            c->macs += ShapeElements(&y);
+            blockIn = y;
+        }
+        x = y;
+    }
+    if (op->poolKernel != 0)
+        PoolCost(op->poolKernel, op->poolStride, op->poolPad, &x, c);
+    c->out = x;
+}
+
+// Shape and costs of layer from the shapes of its inputs, listed in
+// inFrom[inStart[layer] .. inStart[layer + 1]).
+void LayerCostRule(const NetworkGraph* net, int layer, const int* inStart, const int* inFrom, LayerCost* c) {
+    const LayerOp* op = &net->op[layer];
+    int inputs = inStart[layer + 1] - inStart[layer];
+    TensorShape in = { 0, 0, 0, 0 };
+    memset(c, 0, sizeof(LayerCost));
+    if (inputs > 0)
+        in = net->cost[inFrom[inStart[layer]]].out;
+    if (op->kind == OP_TENSOR) {
+        c->out = op->shape;
+        c->activationBytes = ShapeElements(&c->out) * 4;
+        return;
+    }
+    if (in.rank == 0 || op->kind == OP_SCHEMATIC)
+        return;
+    long long elements = ShapeElements(&in);
+    switch (op->kind) {
+    case OP_CONV:
+        ConvBlockCost(op, &in, c);
+        return;
+    case OP_POOL:
+        c->out = in;
+        PoolCost(op->kernel, op->stride, op->pad, &c->out, c);
+        return;
+    case OP_DENSE:
+        c->out.rank = 1;
+        c->out.channels = op->channels;
+        c->out.height = c->out.width = 1;
+        c->params = elements * op->channels + (op->flags & OP_FLAG_BIAS ? op->channels : 0);
+        c->macs = elements * op->channels;
+        break;
+    case OP_NORM:
+        c->out = in;
+        c->params = 2 * in.channels;
+        c->macs = elements;
+        break;
+    case OP_ELEMENTWISE:
+        c->out = in;
+        c->macs = elements * (inputs > 1 ? inputs - 1 : 1);
+        break;
+    case OP_CONCAT:
+        c->out = in;
+        for (int k = inStart[layer] + 1; k < inStart[layer + 1]; k++) {
+            const TensorShape* other = &net->cost[inFrom[k]].out;
+            if (other->rank == 0 || other->height != in.height || other->width != in.width) {
+                c->out.rank = 0;
+                return;
+            }
+            c->out.channels += other->channels;
+        }
+        break;
+    case OP_FLATTEN:
+        c->out.rank = 1;
+        c->out.channels = elements;
+        c->out.height = c->out.width = 1;
+        break;
+    default:
+        return;
+    }
+    c->activationBytes = ShapeElements(&c->out) * 4;
+}
+
+// Derive every layer's output shape, parameters, MACs and activation memory
+// from its op and its inputs, visiting layers in topological order (layers on
+// a cycle last, in index order). Layers whose input shape is unknown stay
+// unknown. Costs that change are journaled while the heat map shows them, so
+// a live edit only redraws the layers downstream of it.
+void InferLayerCosts(NetworkGraph* net) {
+    int n = net->layerCount, e = net->edgeCount;
+    if (n == 0)
+        return;
+    int* inStart = calloc(n + 1, sizeof(int));
+    int* outStart = calloc(n + 1, sizeof(int));
+    int* inFrom = malloc((e + 1) * sizeof(int));
+    int* outTo = malloc((e + 1) * sizeof(int));
+    int* pending = malloc(n * sizeof(int));
+    int* order = malloc(n * sizeof(int));
+    int* lastUse = malloc(n * sizeof(int));
+    if (!inStart || !outStart || !inFrom || !outTo || !pending || !order || !lastUse) {
+        printf("Error: Out of memory inferring shapes.\n");
+        exit(EXIT_FAILURE);
+    }
+    for (int k = 0; k < e; k++) {
+        inStart[net->edgeTo[k] + 1]++;
+        outStart[net->edgeFrom[k] + 1]++;
+    }
+    for (int v = 0; v < n; v++) {
+        pending[v] = inStart[v + 1];
+        inStart[v + 1] += inStart[v];
+        outStart[v + 1] += outStart[v];
+    }
+    // Stable fills, so a layer's first input is its first edge in the graph.
+    for (int k = 0; k < e; k++) {
+        inFrom[inStart[net->edgeTo[k]]++] = net->edgeFrom[k];
+        outTo[outStart[net->edgeFrom[k]]++] = net->edgeTo[k];
+    }
+    memmove(inStart + 1, inStart, n * sizeof(int));
+    memmove(outStart + 1, outStart, n * sizeof(int));
+    inStart[0] = outStart[0] = 0;
+
+    int head = 0, tail = 0;
+    for (int v = 0; v < n; v++) {
+        if (pending[v] == 0)
+            order[tail++] = v;
+    }
+    while (tail < n) {
+        for (; head < tail; head++) {
+            int v = order[head];
+            for (int k = outStart[v]; k < outStart[v + 1]; k++) {
+                if (--pending[outTo[k]] == 0)
+                    order[tail++] = outTo[k];
+            }
+        }
+        // What is left sits on cycles; break them at the lowest index.
+        for (int v = 0; v < n && head == tail; v++) {
+            if (pending[v] > 0) {
+                pending[v] = 0;
+                order[tail++] = v;
+            }
+        }
+    }
+
+    long long maxCost[COST_VIEW_COUNT] = {0};
+    long long live = 0, peak = 0;
+    net->totalParams = net->totalMacs = net->totalActivationBytes = 0;
+    net->costLayers = 0;
+    // pending is free again: it now holds each layer's place in the order,
+    // to find the last consumer of every output.
+    for (int p = 0; p < n; p++) {
+        pending[order[p]] = p;
+        lastUse[order[p]] = p;
+    }
+    for (int k = 0; k < e; k++) {
+        int u = net->edgeFrom[k], at = pending[net->edgeTo[k]];
+        if (at > lastUse[u])
+            lastUse[u] = at;
+    }
+    for (int p = 0; p < n; p++) {
+        int v = order[p];
+        LayerCost c;
+        LayerCostRule(net, v, inStart, inFrom, &c);
+        const LayerCost* old = &net->cost[v];
+        int changed = c.out.rank != old->out.rank || c.out.channels != old->out.channels ||
+                      c.out.height != old->out.height || c.out.width != old->out.width ||
+                      c.params != old->params || c.macs != old->macs || c.activationBytes != old->activationBytes;
+        net->cost[v] = c;
+        if (net->type[v] == LAYER_BOX && (net->op[v].flags & OP_FLAG_AUTOSIZE)) {
+            float size[3] = { 1.0f, 0.5f, 1.0f };
+            if (c.out.rank)
+                BoxSizeFromShape(&c.out, &size[0], &size[1], &size[2]);
+            if (memcmp(size, &net->size[v * 3], sizeof(size)) != 0) {
+                memcpy(&net->size[v * 3], size, sizeof(size));
+                changed = 1;
+            }
+        }
+        if (changed && costView != COST_VIEW_OFF)
+            JournalLayer(net, v);
+
+        net->costLayers += c.out.rank != 0;
+        net->totalParams += c.params;
+        net->totalMacs += c.macs;
+        net->totalActivationBytes += c.activationBytes;
+        for (CostView view = COST_VIEW_MACS; view < COST_VIEW_COUNT; view++) {
+            if (CostViewValue(net, v, view) > maxCost[view])
+                maxCost[view] = CostViewValue(net, v, view);
+        }
+        // Everything the layer writes is live next to the outputs still
+        // waiting for a consumer; then only its own output stays.
+        long long outBytes = ShapeElements(&c.out) * 4;
+        if (live + c.activationBytes > peak)
+            peak = live + c.activationBytes;
+        live += outBytes;
+        for (int k = inStart[v]; k < inStart[v + 1]; k++) {
+            int u = inFrom[k];
+            if (lastUse[u] == p) {
+                live -= ShapeElements(&net->cost[u].out) * 4;
+                lastUse[u] = -1;        // Freed once even when feeding v twice
+            }
+        }
+    }
+    net->peakActivationBytes = peak;
+    if (costView != COST_VIEW_OFF && maxCost[costView] != net->maxCost[costView])
+        MarkGraphChanged(net);      // The heat scale moved, so every layer recolors
+    memcpy(net->maxCost, maxCost, sizeof(maxCost));
+    free(inStart);
+    free(outStart);
+    free(inFrom);
+    free(outTo);
+    free(pending);
+    free(order);
+    free(lastUse);
+}
+
+const char* OpKindName(OpKind kind) {
+    static const char* names[OP_KIND_COUNT] = {
+        "schematic", "tensor", "conv", "pool", "dense", "norm", "elementwise", "concat", "flatten"
+    };
+    return names[kind];
+}
+
+const char* CostViewName(CostView view) {
+    static const char* names[COST_VIEW_COUNT] = { "off", "MACs", "parameters", "activation memory" };
+    return names[view];
+}
+
+long long CostViewValue(const NetworkGraph* net, int layer, CostView view) {
+    const LayerCost* c = &net->cost[layer];
+    if (view == COST_VIEW_MACS)
+        return c->macs;
+    if (view == COST_VIEW_PARAMS)
+        return c->params;
+    if (view == COST_VIEW_MEMORY)
+        return c->activationBytes;
+    return 0;
+}
+
+// Three significant digits and a decimal prefix: 1234567 "B" -> "1.23 MB".
+void FormatQuantity(double value, const char* unit, char* buf, size_t size) {
+    static const char* prefixes[5] = { "", "K", "M", "G", "T" };
+    int p = 0;
+    while (value >= 999.5 && p < 4) {
+        value /= 1000.0;
+        p++;
+    }
+    int digits = p == 0 ? 0 : value < 9.995 ? 2 : value < 99.95 ? 1 : 0;
+    snprintf(buf, size, "%.*f%s%s%s", digits, value, p || unit[0] ? " " : "", prefixes[p], unit);
+}
+
+// "?" when unknown, "4096" for vectors, "64x56x56" (CxHxW) for feature maps.
+void FormatShape(const TensorShape* shape, char* buf, size_t size) {
+    if (shape->rank == 0)
+        snprintf(buf, size, "?");
+    else if (shape->rank == 1)
+        snprintf(buf, size, "%lld", shape->channels);
+    else
+        snprintf(buf, size, "%lldx%lldx%lld", shape->channels, shape->height, shape->width);
+}
+
+// The layer's value in view, e.g. "2.31 GMACs" or "37.8 M params".
+void FormatLayerCost(const NetworkGraph* net, int layer, CostView view, char* buf, size_t size) {
+    char number[32];
+    double value = (double)CostViewValue(net, layer, view);
+    if (view == COST_VIEW_MACS)
+        FormatQuantity(value, "MACs", buf, size);
+    else if (view == COST_VIEW_MEMORY)
+        FormatQuantity(value, "B", buf, size);
+    else {
+        FormatQuantity(value, "", number, sizeof(number));
+        snprintf(buf, size, "%s params", number);
+    }
+}
+
+// Totals of the whole network and the topCount layers costing most in view,
+// one line each, for the HUD, exported images and the console.
+void FormatCostSummary(const NetworkGraph* net, CostView view, int topCount, char* text, size_t size) {
+    char macs[32], params[32], weightBytes[32], written[32], peak[32];
+    FormatQuantity((double)net->totalMacs, "MACs", macs, sizeof(macs));
+    FormatQuantity((double)net->totalParams, "", params, sizeof(params));
+    FormatQuantity((double)net->totalParams * 4.0, "B", weightBytes, sizeof(weightBytes));
+    FormatQuantity((double)net->totalActivationBytes, "B", written, sizeof(written));
+    FormatQuantity((double)net->peakActivationBytes, "B", peak, sizeof(peak));
+    int used = snprintf(text, size, "%s, %s params (%s)\nActivations %s written, %s peak\n"
+                        "Shapes known for %d of %d layers",
+                        macs, params, weightBytes, written, peak, net->costLayers, net->layerCount);
+    long long total = view == COST_VIEW_MACS ? net->totalMacs :
+                      view == COST_VIEW_PARAMS ? net->totalParams : net->totalActivationBytes;
+    if (view == COST_VIEW_OFF || total <= 0)
+        return;
+    used += snprintf(text + used, used < (int)size ? size - used : 0, "\nTop layers by %s:", CostViewName(view));
+    // Repeated selection of the next largest; topCount is a handful.
+    long long below = LLONG_MAX;
+    int belowLayer = -1;
+    for (int rank = 0; rank < topCount; rank++) {
+        int best = -1;
+        for (int v = 0; v < net->layerCount; v++) {
+            long long value = CostViewValue(net, v, view);
+            if (value > below || (value == below && v <= belowLayer))
+                continue;
+            if (best < 0 || value > CostViewValue(net, best, view))
+                best = v;
+        }
+        if (best < 0 || CostViewValue(net, best, view) == 0)
+            break;
+        char cost[48];
+        below = CostViewValue(net, best, view);
+        belowLayer = best;
+        FormatLayerCost(net, best, view, cost, sizeof(cost));
+        used += snprintf(text + used, used < (int)size ? size - used : 0, "\n  %-20.20s %14s %5.1f%%",
+                         net->label[best], cost, 100.0 * below / total);
+    }
+}
+
+// Blue through green and yellow to red for t in [0, 1].
+void HeatColor(float t, float* rgb) {
+    static const float stops[4][3] = {
+        { 0.15f, 0.25f, 0.85f }, { 0.1f, 0.8f, 0.35f }, { 1.0f, 0.85f, 0.1f }, { 1.0f, 0.15f, 0.1f }
+    };
+    t = t < 0.0f ? 0.0f : t > 1.0f ? 1.0f : t;
+    int i = t >= 1.0f ? 2 : (int)(t * 3.0f);
+    float f = t * 3.0f - i;
+    for (int k = 0; k < 3; k++)
+        rgb[k] = stops[i][k] + (stops[i + 1][k] - stops[i][k]) * f;
+}
+
+// Color and box size the scene draws layer with. Under the heat map both
+// follow the layer's share of the largest value, linearly, so the layers
+// that dominate stand out; layers without a known shape turn gray.
+void CostViewStyle(const NetworkGraph* net, int layer, float* color, float* size) {
+    memcpy(color, &net->color[layer * 3], 3 * sizeof(float));
+    memcpy(size, &net->size[layer * 3], 3 * sizeof(float));
+    if (costView == COST_VIEW_OFF)
+        return;
+    long long top = net->maxCost[costView];
+    if (net->cost[layer].out.rank == 0 || top <= 0) {
+        color[0] = color[1] = color[2] = 0.35f;
+        return;
+    }
+    float t = (float)((double)CostViewValue(net, layer, costView) / top);
+    HeatColor(t, color);
+    size[1] = 0.15f + 1.65f * t;
+}
+
+//-------------------------
+// Model File Import
+//-------------------------
+
+int MapFile(const char* path, MappedFile* file) {
+    return MapFileView(path, file, 0);
+}
+
+// Map path read-only, or when writable copy-on-write: writes land in private
+// pages and never reach the file.
+int MapFileView(const char* path, MappedFile* file, int writable) {
+    memset(file, 0, sizeof(MappedFile));
+#ifndef _WIN32
+    file->fd = open(path, O_RDONLY);
+    if (file->fd < 0)
+        return 0;
+    struct stat info;
+    if (fstat(file->fd, &info) != 0) {
+        close(file->fd);
+        return 0;
+    }
+    file->size = (size_t)info.st_size;
+    if (file->size == 0)
+        return 1;
+    void* view = mmap(NULL, file->size, writable ? PROT_READ | PROT_WRITE : PROT_READ, MAP_PRIVATE, file->fd, 0);
+    if (view == MAP_FAILED) {
+        UnmapFile(file);
+        return 0;
+    }
+    file->data = view;
+    return 1;
+#else
+    file->file = CreateFile(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file->file == INVALID_HANDLE_VALUE)
+        return 0;
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(file->file, &size)) {
+        CloseHandle(file->file);
+        return 0;
+    }
+    file->size = (size_t)size.QuadPart;
+    if (file->size == 0)
+        return 1;
+    file->mapping = CreateFileMapping(file->file, NULL, writable ? PAGE_WRITECOPY : PAGE_READONLY, 0, 0, NULL);
+    if (file->mapping)
+        file->data = MapViewOfFile(file->mapping, writable ? FILE_MAP_COPY : FILE_MAP_READ, 0, 0, 0);
+    if (!file->data) {
+        UnmapFile(file);
+        return 0;
+    }
+    return 1;
+#endif
+}
+
+void UnmapFile(MappedFile* file) {
+#ifndef _WIN32
+    if (file->data)
+        munmap((void*)file->data, file->size);
+    if (file->fd > 0)
+        close(file->fd);
+#else
+    if (file->data)
+        UnmapViewOfFile(file->data);
+    if (file->mapping)
+        CloseHandle(file->mapping);
+    if (file->file && file->file != INVALID_HANDLE_VALUE)
+        CloseHandle(file->file);
+#endif
+    memset(file, 0, sizeof(MappedFile));
+}
+
+void NameMapPut(NameMap* map, const char* key, int len, int value) {
+    if (map->count * 2 >= map->capacity) {
+        int capacity = map->capacity ? map->capacity * 2 : 256;
+        NameEntry* entries = ArenaAlloc(map->arena, capacity * sizeof(NameEntry));
+        memset(entries, 0, capacity * sizeof(NameEntry));
+        for (int i = 0; i < map->capacity; i++) {
+            if (!map->entries[i].key)
+                continue;
+            unsigned int slot = HashBytes(map->entries[i].key, map->entries[i].len) & (capacity - 1);
+            while (entries[slot].key)
+                slot = (slot + 1) & (capacity - 1);
+            entries[slot] = map->entries[i];
+        }
+        map->entries = entries;
+        map->capacity = capacity;
+    }
+    unsigned int slot = HashBytes(key, len) & (map->capacity - 1);
+    while (map->entries[slot].key) {
+        NameEntry* entry = &map->entries[slot];
+        if (entry->len == len && memcmp(entry->key, key, len) == 0) {
+            entry->value = value;
+            return;
+        }
+        slot = (slot + 1) & (map->capacity - 1);
+    }
+    map->entries[slot].key = key;
+    map->entries[slot].len = len;
+    map->entries[slot].value = value;
+    map->count++;
+}
+
+// Returns -1 when the name is unknown.
+int NameMapGet(const NameMap* map, const char* key, int len) {
+    if (!map->capacity)
+        return -1;
+    unsigned int slot = HashBytes(key, len) & (map->capacity - 1);
+    while (map->entries[slot].key) {
+        const NameEntry* entry = &map->entries[slot];
+        if (entry->len == len && memcmp(entry->key, key, len) == 0)
+            return entry->value;
+        slot = (slot + 1) & (map->capacity - 1);
+    }
+    return -1;
+}
+
+// Same color cycle as the built-in networks: white input, then red, green,
+// blue, magenta, cyan, yellow, orange.
+void DefaultLayerColor(int index, float* rgb) {
+    static const float palette[8][3] = {
+        {1.0f, 1.0f, 1.0f}, {1.0f, 0.0f, 0.0f}, {0.0f, 1.0f, 0.0f}, {0.0f, 0.0f, 1.0f},
+        {1.0f, 0.0f, 1.0f}, {0.0f, 1.0f, 1.0f}, {1.0f, 1.0f, 0.0f}, {1.0f, 0.5f, 0.0f}
+    };
+    const float* c = index == 0 ? palette[0] : palette[1 + (index - 1) % 7];
+    rgb[0] = c[0]; rgb[1] = c[1]; rgb[2] = c[2];
+}
+
+// Map a tensor shape to box dimensions on a log scale, so a 224x224x3 input and
+// a 7x7x512 feature map both stay within the range of the built-in schematics.
+void BoxSizeFromShape(const TensorShape* shape, float* width, float* height, float* depth) {
+    double spatialW = shape->rank >= 3 ? (double)shape->width : 1.0;
+    double spatialH = shape->rank >= 3 ? (double)shape->height : 1.0;
+    double channels = shape->rank >= 1 ? (double)shape->channels : 1.0;
+    *width = 0.6f + 0.3f * (float)log2(spatialW > 1.0 ? spatialW : 1.0);
+    *depth = 0.6f + 0.3f * (float)log2(spatialH > 1.0 ? spatialH : 1.0);
+    *height = 0.4f + 0.15f * (float)log2(channels > 1.0 ? channels : 1.0);
+}
+
+// Load a model description file into the network graph, choosing the parser by
+// extension. Prints parse time and throughput so regressions are visible.
+int LoadModelFile(NetworkGraph* net, const char* path) {
+    MappedFile file;
+    double start = NowSeconds();
+    if (!MapFile(path, &file)) {
+        printf("Error: Cannot open model file '%s'.\n", path);
+        return 0;
+    }
+    
+    size_t pathLen = strlen(path);
+    int ok;
+    ResetNetwork(net);
+    if (pathLen > 5 && _stricmp(path + pathLen - 5, ".onnx") == 0)
+        ok = LoadOnnxModel(net, file.data, file.size, path);
+    else
+        ok = LoadTextModel(net, file.data, file.size, path);
+    
+    double elapsed = NowSeconds() - start;
+    if (ok) {
+        printf("Loaded '%s': %d layers, %d connections, %zu bytes in %.2f ms (%.1f MB/s)\n",
+               path, net->layerCount, net->edgeCount, file.size, elapsed * 1000.0,
+               elapsed > 0.0 ? file.size / elapsed / (1024.0 * 1024.0) : 0.0);
+    }
+    UnmapFile(&file);
+    return ok;
+}
+
+//-------------------------
+// Text Model Format
+//-------------------------
+// One statement per line, '#' starts a comment, fields separated by spaces or
+// commas. Labels may be quoted to contain spaces. Colors are optional and
+// default to the built-in palette.
+//
+//   box     <label> <width> <height> <depth> [r g b]
+//   fc      <label> <neurons> [r g b]
+//   tensor  <label> <channels> <height> <width> [r g b]  (box sized from shape)
+//   conv    <label> <channels> <kernel> <stride> <pad> [r g b]
+//   pool    <label> <kernel> <stride> [r g b]             (kernel 0: global)
+//   norm | add | concat | flatten <label> [r g b]
+//   edge    <from> <to>                                   (labels or 0-based indices)
+//
+// Layers must be declared before an edge refers to them. A file without edge
+// statements is connected sequentially. Layers from conv onwards are boxes
+// sized from their inferred shape; fc layers are dense layers as well.
+
+typedef struct {
+    const char* keyword;
+    LayerType type;
+    OpKind op;
+    int values;         // Numbers before the optional color
+} TextStatement;
+
+const TextStatement textStatements[] = {
+    { "box", LAYER_BOX, OP_SCHEMATIC, 3 },
+    { "fc", LAYER_FC, OP_DENSE, 1 },
+    { "tensor", LAYER_BOX, OP_TENSOR, 3 },
+    { "conv", LAYER_BOX, OP_CONV, 4 },
+    { "pool", LAYER_BOX, OP_POOL, 2 },
+    { "norm", LAYER_BOX, OP_NORM, 0 },
+    { "add", LAYER_BOX, OP_ELEMENTWISE, 0 },
+    { "concat", LAYER_BOX, OP_CONCAT, 0 },
+    { "flatten", LAYER_BOX, OP_FLATTEN, 0 }
+};
+
+struct LineCursor {
+    const char* p;
+    const char* end;    // End of the current line
+};
+
+// Advance to the next field on the line; returns its length, 0 at end of line.
+int NextField(LineCursor* c, const char** field) {
+    while (c->p < c->end && (*c->p == ' ' || *c->p == '\t' || *c->p == ',' || *c->p == '\r'))
+        c->p++;
+    if (c->p >= c->end || *c->p == '#')
+        return 0;
+    if (*c->p == '"') {
+        const char* start = ++c->p;
+        while (c->p < c->end && *c->p != '"')
+            c->p++;
+        *field = start;
+        int len = (int)(c->p - start);
+        if (c->p < c->end)
+            c->p++;
+        return len > 0 ? len : 0;
+    }
+    const char* start = c->p;
+    while (c->p < c->end && *c->p != ' ' && *c->p != '\t' && *c->p != ',' && *c->p != '\r' && *c->p != '#')
+        c->p++;
+    *field = start;
+    return (int)(c->p - start);
+}
+
+// Parse a decimal number without relying on NUL termination.
+int ParseNumber(const char* text, int len, double* value) {
+    const char* p = text;
+    const char* end = text + len;
+    double sign = 1.0, result = 0.0;
+    if (p < end && (*p == '-' || *p == '+')) {
+        if (*p == '-')
+            sign = -1.0;
+        p++;
+    }
+    int digits = 0;
+    while (p < end && *p >= '0' && *p <= '9') {
+        result = result * 10.0 + (*p++ - '0');
+        digits++;
+    }
+    if (p < end && *p == '.') {
+        double scale = 0.1;
+        for (p++; p < end && *p >= '0' && *p <= '9'; p++, digits++) {
+            result += (*p - '0') * scale;
+            scale *= 0.1;
+        }
+    }
+    if (p < end && (*p == 'e' || *p == 'E')) {
+        int expSign = 1, exponent = 0;
+        p++;
+        if (p < end && (*p == '-' || *p == '+')) {
+            if (*p == '-')
+                expSign = -1;
+            p++;
+        }
+        while (p < end && *p >= '0' && *p <= '9')
+            exponent = exponent * 10 + (*p++ - '0');
+        result *= pow(10.0, expSign * exponent);
+    }
+    *value = sign * result;
+    return digits > 0 && p == end;
+}
+
+// Read up to count numbers; returns how many were present.
+int ParseNumbers(LineCursor* c, double* values, int count) {
+    int n = 0;
+    const char* field;
+    int len;
+    while (n < count && (len = NextField(c, &field)) > 0) {
+        if (!ParseNumber(field, len, &values[n]))
+            return -1;
+        n++;
+    }
+    return n;
+}
+
+int ResolveLayerRef(const NetworkGraph* net, const NameMap* labels, const char* field, int len) {
+    double index;
+    if (ParseNumber(field, len, &index) && index >= 0 && index < net->layerCount)
+        return (int)index;
+    return NameMapGet(labels, field, len);
+}
+
+int LoadTextModel(NetworkGraph* net, const unsigned char* data, size_t size, const char* path) {
+    Arena scratch = {0};
+    NameMap labels = { NULL, 0, 0, &scratch };
+    const char* p = (const char*)data;
+    const char* end = p + size;
+    int lineNumber = 0, sawEdge = 0, ok = 1;
+    
+    while (p < end && ok) {
+        const char* lineEnd = memchr(p, '\n', end - p);
+        if (!lineEnd)
+            lineEnd = end;
+        LineCursor c = { p, lineEnd };
+        p = lineEnd + 1;
+        lineNumber++;
+        
+        const char* keyword;
+        int keywordLen = NextField(&c, &keyword);
+        if (keywordLen == 0)
+            continue;
+        
+        if (keywordLen == 4 && memcmp(keyword, "edge", 4) == 0) {
+            const char* from;
+            const char* to;
+            int fromLen = NextField(&c, &from);
+            int toLen = fromLen ? NextField(&c, &to) : 0;
+            int a = fromLen ? ResolveLayerRef(net, &labels, from, fromLen) : -1;
+            int b = toLen ? ResolveLayerRef(net, &labels, to, toLen) : -1;
+            if (a < 0 || b < 0) {
+                printf("Error: %s:%d: edge refers to an undeclared layer.\n", path, lineNumber);
+                ok = 0;
+                break;
+            }
+            AddConnection(net, a, b);
+            sawEdge = 1;
+            continue;
+        }
+        
+        const char* label;
+        int labelLen = NextField(&c, &label);
+        double values[7];
+        float color[3];
+        int index = net->layerCount;
+        int n;
+        const TextStatement* st = NULL;
+        for (size_t k = 0; k < sizeof(textStatements) / sizeof(textStatements[0]); k++) {
+            if ((int)strlen(textStatements[k].keyword) == keywordLen &&
+                memcmp(keyword, textStatements[k].keyword, keywordLen) == 0)
+                st = &textStatements[k];
+        }
+        if (!st) {
+            printf("Error: %s:%d: unknown statement '%.*s'.\n", path, lineNumber, keywordLen, keyword);
+            ok = 0;
+            break;
+        }
+        int fieldCount = st->values;
+        n = labelLen ? ParseNumbers(&c, values, fieldCount + 3) : -1;
+        if (n != fieldCount && n != fieldCount + 3) {
+            printf("Error: %s:%d: expected a label, %d values and an optional color.\n",
+                   path, lineNumber, fieldCount);
+            ok = 0;
+            break;
+        }
+        // Counts must fit the fields they are stored in: neuron counts and
+        // channels in an int, kernels, strides and padding in a short. Box
+        // sides must be positive and small enough to lay out, and color
+        // components between 0 and 1.
+        for (int v = 0; v < n && ok; v++) {
+            double x = values[v];
+            if (v >= fieldCount) {
+                ok = isfinite(x) && x >= 0.0 && x <= 1.0;
+                if (!ok)
+                    printf("Error: %s:%d: color component %d must be between 0 and 1.\n",
+                           path, lineNumber, v - fieldCount + 1);
+            } else if (st->op == OP_SCHEMATIC) {
+                ok = isfinite(x) && x > 0.0 && x <= MAX_BOX_SIZE;
+                if (!ok)
+                    printf("Error: %s:%d: box size %d must be above 0 and at most %.0f.\n",
+                           path, lineNumber, v + 1, MAX_BOX_SIZE);
+            } else {
+                double low = st->op == OP_CONV && v == 3 ? 0.0 : 1.0;
+                double high = st->op == OP_POOL || (st->op == OP_CONV && v > 0) ? SHRT_MAX : INT_MAX;
+                ok = isfinite(x) && x >= low && x <= high;
+                if (!ok)
+                    printf("Error: %s:%d: value %d of '%.*s' must be between %.0f and %.0f.\n",
+                           path, lineNumber, v + 1, keywordLen, keyword, low, high);
+            }
+        }
+        if (!ok)
+            break;
+        if (n == fieldCount + 3) {
+            color[0] = (float)values[fieldCount];
+            color[1] = (float)values[fieldCount + 1];
+            color[2] = (float)values[fieldCount + 2];
+        } else {
+            DefaultLayerColor(index, color);
+        }
+        
+        AddLayer(net, st->type, "", color[0], color[1], color[2]);
+        LayerOp* op = &net->op[index];
+        float* boxSize = &net->size[index * 3];
+        op->kind = st->op;
+        if (st->op == OP_SCHEMATIC) {
+            boxSize[0] = (float)values[0];
+            boxSize[1] = (float)values[1];
+            boxSize[2] = (float)values[2];
+        } else if (st->op == OP_DENSE) {
+            net->neuronCount[index] = (int)values[0];
+            *op = DenseOp((int)values[0]);
+        } else if (st->op == OP_TENSOR) {
+            *op = TensorOp((long long)values[0], (long long)values[1], (long long)values[2]);
+            BoxSizeFromShape(&op->shape, &boxSize[0], &boxSize[1], &boxSize[2]);
+        } else {
+            if (st->op == OP_CONV)
+                *op = ConvOp((int)values[0], (int)values[1], (int)values[2], (int)values[3], 1, OP_FLAG_BIAS);
+            else if (st->op == OP_POOL) {
+                op->kernel = (short)values[0];
+                op->stride = (short)values[1];
+            }
+            op->flags |= OP_FLAG_AUTOSIZE;
+        }
+        net->label[index] = InternLabelRange(net, label, labelLen);
+        NameMapPut(&labels, net->label[index], labelLen, index);
+    }
+    
+    if (ok && !sawEdge)
+        ConnectSequentialLayers(net);
+    ArenaRelease(&scratch);
+    return ok;
+}
+
+//-------------------------
+// ONNX Import
+//-------------------------
+// ONNX files are protobuf-encoded ModelProto messages. Only the handful of
+// fields needed to recover the graph are decoded, directly from the mapped
+// bytes: ModelProto.graph(7), GraphProto.node(1)/initializer(5)/input(11)/
+// value_info(13), NodeProto.input(1)/output(2)/name(3)/op_type(4)/attribute(5),
+// TensorProto.dims(1)/name(8) and the ValueInfoProto shape chain.
+
+struct PbReader {
+    const unsigned char* p;
+    const unsigned char* end;
+};
+
+struct PbField {
+    int field, wire;
+    unsigned long long value;   // Varint and fixed-width payloads
+    PbReader bytes;             // Length-delimited payloads
+};
+
+int PbVarint(PbReader* r, unsigned long long* value) {
+    unsigned long long result = 0;
+    for (int shift = 0; shift < 64 && r->p < r->end; shift += 7) {
+        unsigned char b = *r->p++;
+        result |= (unsigned long long)(b & 0x7F) << shift;
+        if (!(b & 0x80)) {
+            *value = result;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Read the next field of a message; returns 0 at the end or on malformed input.
+int PbNext(PbReader* r, PbField* f) {
+    unsigned long long key;
+    if (r->p >= r->end || !PbVarint(r, &key))
+        return 0;
+    f->field = (int)(key >> 3);
+    f->wire = (int)(key & 7);
+    switch (f->wire) {
+        case 0:
+            return PbVarint(r, &f->value);
+        case 1:
+            if (r->end - r->p < 8) return 0;
+            memcpy(&f->value, r->p, 8);
+            r->p += 8;
+            return 1;
+        case 5:
+            if (r->end - r->p < 4) return 0;
+            f->value = 0;
+            memcpy(&f->value, r->p, 4);
+            r->p += 4;
+            return 1;
+        case 2: {
+            unsigned long long len;
+            if (!PbVarint(r, &len) || len > (unsigned long long)(r->end - r->p))
+                return 0;
+            f->bytes.p = r->p;
+            f->bytes.end = r->p + len;
+            r->p += len;
+            return 1;
+        }
+        default:
+            return 0;
+    }
+}
+
+// Collect int64 values of a repeated field, packed or not.
+int PbInts(const PbField* f, long long* out, int count, int max) {
+    if (f->wire == 0) {
+        if (count < max)
+            out[count++] = (long long)f->value;
+        return count;
+    }
+    if (f->wire == 2) {
+        PbReader packed = f->bytes;
+        unsigned long long v;
+        while (packed.p < packed.end && PbVarint(&packed, &v)) {
+            if (count < max)
+                out[count++] = (long long)v;
+        }
+    }
+    return count;
+}
+
+// Drop a leading batch dimension and fold the rest into a TensorShape.
+void ShapeFromDims(const long long* dims, int rank, TensorShape* shape) {
+    if (rank == 4 || rank == 2) {
+        dims++;
+        rank--;
+    }
+    shape->rank = rank > 3 ? 3 : rank;
+    shape->channels = rank >= 1 ? dims[0] : 1;
+    shape->height = rank >= 2 ? dims[1] : 1;
+    shape->width = rank >= 3 ? dims[2] : 1;
+}
+
+// ValueInfoProto -> name plus shape; returns 0 when the shape is not static
+// and -1 when a dimension is given but outside 1..INT_MAX.
+int ParseValueInfo(PbReader r, const char** name, int* nameLen, TensorShape* shape) {
+    PbField f, tf, tt, sf, df;
+    long long dims[8];
+    int rank = 0, known = 1, valid = 1;
+    *nameLen = 0;
+    while (PbNext(&r, &f)) {
+        if (f.field == 1 && f.wire == 2) {
+            *name = (const char*)f.bytes.p;
+            *nameLen = (int)(f.bytes.end - f.bytes.p);
+        } else if (f.field == 2 && f.wire == 2) {
+            PbReader type = f.bytes;
+            while (PbNext(&type, &tf)) {
+                if (tf.field != 1 || tf.wire != 2)
+                    continue;
+                PbReader tensor = tf.bytes;
+                while (PbNext(&tensor, &tt)) {
+                    if (tt.field != 2 || tt.wire != 2)
+                        continue;
+                    PbReader dimsReader = tt.bytes;
+                    while (PbNext(&dimsReader, &sf)) {
+                        if (sf.field != 1 || sf.wire != 2)
+                            continue;
+                        PbReader dim = sf.bytes;
+                        long long value = -1;
+                        while (PbNext(&dim, &df)) {
+                            if (df.field == 1 && df.wire == 0) {
+                                value = (long long)df.value;
+                                if (value < 1 || value > INT_MAX)
+                                    valid = 0;
+                            }
+                        }
+                        if (value <= 0)
+                            known = 0;
+                        if (rank < 8)
+                            dims[rank++] = value;
+                    }
+                }
+            }
+        }
+    }
+    if (!valid)
+        return -1;
+    if (!known || rank == 0 || *nameLen == 0)
+        return 0;
+    ShapeFromDims(dims, rank, shape);
+    return 1;
+}
+
+typedef struct {
+    const char* name;
+    int len;
+} NameRef;
+
+// Known tensor shapes, indexed by tensor name.
+struct ShapeTable {
+    TensorShape* items;
+    int count, capacity;
+    NameMap index;
+};
+
+void AppendShape(ShapeTable* table, const TensorShape* shape, const char* name, int nameLen) {
+    if (table->count == table->capacity) {
+        int capacity = table->capacity ? table->capacity * 2 : 256;
+        table->items = ArenaGrow(table->index.arena, table->items,
+                                 table->capacity * sizeof(TensorShape), capacity * sizeof(TensorShape));
+        table->capacity = capacity;
+    }
+    table->items[table->count] = *shape;
+    NameMapPut(&table->index, name, nameLen, table->count++);
+}
+
+// Hyperparameters of an ONNX node for shape inference. Ops without a rule of
+// their own keep the shape the importer derived for them.
+LayerOp OnnxLayerOp(const char* opType, int opLen, const TensorShape* shape, const TensorShape* weight,
+                    long long kernel, long long stride, long long pad, long long group, int inCount) {
+    static const char* elementwise[] = {
+        "Relu", "LeakyRelu", "Sigmoid", "Tanh", "Clip", "Add", "Sum", "Mul", "Sub", "Div",
+        "Dropout", "Identity", "Softmax", "HardSwish", "HardSigmoid", "Gelu", "Erf", "LRN"
+    };
+    LayerOp op = TensorOp(shape->channels, shape->height, shape->width);
+    op.shape.rank = shape->rank;
+    if (opLen == 4 && memcmp(opType, "Conv", 4) == 0 && weight) {
+        op = ConvOp((int)weight->channels, (int)(kernel > 0 ? kernel : weight->width), (int)stride, (int)pad, 1,
+                    inCount > 2 ? OP_FLAG_BIAS : 0);
+        op.groups = (short)(group > 0 ? group : 1);
+    } else if (opLen >= 4 && memcmp(opType + opLen - 4, "Pool", 4) == 0) {
+        op = (LayerOp){ .kind = OP_POOL };
+        if (opLen < 10 || memcmp(opType, "Global", 6) != 0) {
+            op.kernel = (short)kernel;
+            op.stride = (short)stride;
+            op.pad = (short)pad;
+        }
+    } else if ((opLen == 4 && memcmp(opType, "Gemm", 4) == 0) || (opLen == 6 && memcmp(opType, "MatMul", 6) == 0)) {
+        op = DenseOp((int)shape->channels);
+        if (opLen == 6 || inCount < 3)
+            op.flags = 0;
+    } else if (opLen == 18 && memcmp(opType, "BatchNormalization", 18) == 0) {
+        op = (LayerOp){ .kind = OP_NORM };
+    } else if (opLen == 6 && memcmp(opType, "Concat", 6) == 0) {
+        op = (LayerOp){ .kind = OP_CONCAT };
+    } else if (opLen == 7 && memcmp(opType, "Flatten", 7) == 0) {
+        op = (LayerOp){ .kind = OP_FLATTEN };
+    } else {
+        for (size_t k = 0; k < sizeof(elementwise) / sizeof(elementwise[0]); k++) {
+            if ((int)strlen(elementwise[k]) == opLen && memcmp(opType, elementwise[k], opLen) == 0)
+                op = (LayerOp){ .kind = OP_ELEMENTWISE };
+        }
+    }
+    return op;
+}
+
+int LoadOnnxModel(NetworkGraph* net, const unsigned char* data, size_t size, const char* path) {
+    Arena scratch = {0};
+    ShapeTable shapes = { NULL, 0, 0, { NULL, 0, 0, &scratch } };  // Tensor name -> shape
+    NameMap weightIndex = { NULL, 0, 0, &scratch };  // initializer name -> weights[]
+    NameMap producer = { NULL, 0, 0, &scratch };     // tensor name -> layer index
+    TensorShape* weights = NULL;        // Raw initializer dims, batch not dropped
+    PbReader* nodes = NULL;
+    PbReader* inputs = NULL;
+    int weightCount = 0, weightCap = 0;
+    int nodeCount = 0, nodeCap = 0, inputCount = 0, inputCap = 0;
+    
+    // Single pass over the graph: nodes and graph inputs are only recorded as
+    // byte ranges, initializer dims and declared shapes are indexed by name.
+    PbReader model = { data, data + size };
+    PbReader graph = { NULL, NULL };
+    PbField f;
+    while (PbNext(&model, &f)) {
+        if (f.field == 7 && f.wire == 2)
+            graph = f.bytes;
+    }
+    if (!graph.p) {
+        printf("Error: %s: no graph found, not an ONNX model.\n", path);
+        ArenaRelease(&scratch);
+        return 0;
+    }
+    while (PbNext(&graph, &f)) {
+        if (f.wire != 2)
+            continue;
+        if (f.field == 1) {
+            if (nodeCount == nodeCap) {
+                int cap = nodeCap ? nodeCap * 2 : 256;
+                nodes = ArenaGrow(&scratch, nodes, nodeCap * sizeof(PbReader), cap * sizeof(PbReader));
+                nodeCap = cap;
+            }
+            nodes[nodeCount++] = f.bytes;
+        } else if (f.field == 11) {
+            if (inputCount == inputCap) {
+                int cap = inputCap ? inputCap * 2 : 16;
+                inputs = ArenaGrow(&scratch, inputs, inputCap * sizeof(PbReader), cap * sizeof(PbReader));
+                inputCap = cap;
+            }
+            inputs[inputCount++] = f.bytes;
+        } else if (f.field == 5) {
+            PbReader tensor = f.bytes;
+            PbField tf;
+            long long dims[8];
+            int rank = 0;
+            const char* name = NULL;
+            int nameLen = 0;
+            while (PbNext(&tensor, &tf)) {
+                if (tf.field == 1)
+                    rank = PbInts(&tf, dims, rank, 8);
+                else if (tf.field == 8 && tf.wire == 2) {
+                    name = (const char*)tf.bytes.p;
+                    nameLen = (int)(tf.bytes.end - tf.bytes.p);
+                }
+            }
+            if (!name)
+                continue;
+            for (int d = 0; d < rank; d++) {
+                if (dims[d] < 1 || dims[d] > INT_MAX) {
+                    printf("Error: %s: initializer '%.*s' has dimension %lld, outside 1..%d.\n",
+                           path, nameLen, name, dims[d], INT_MAX);
+                    ArenaRelease(&scratch);
+                    return 0;
+                }
+            }
+            if (weightCount == weightCap) {
+                int cap = weightCap ? weightCap * 2 : 256;
+                weights = ArenaGrow(&scratch, weights, weightCap * sizeof(TensorShape), cap * sizeof(TensorShape));
+                weightCap = cap;
+            }
+            TensorShape* w = &weights[weightCount];
+            w->rank = rank;
+            w->channels = rank >= 1 ? dims[0] : 0;
+            w->height = rank >= 2 ? dims[1] : 0;
+            w->width = rank >= 3 ? dims[2] : 0;
+            NameMapPut(&weightIndex, name, nameLen, weightCount++);
+        } else if (f.field == 13 || f.field == 12) {
+            TensorShape shape;
+            const char* name;
+            int nameLen;
+            int parsed = ParseValueInfo(f.bytes, &name, &nameLen, &shape);
+            if (parsed < 0) {
+                printf("Error: %s: a declared shape has a dimension outside 1..%d.\n", path, INT_MAX);
+                ArenaRelease(&scratch);
+                return 0;
+            }
+            if (!parsed)
+                continue;
+            AppendShape(&shapes, &shape, name, nameLen);
+        }
+    }
+    ReserveLayers(net, nodeCount + inputCount);
+    ReserveConnections(net, nodeCount * 2);
+    
+    // Graph inputs that are not weights become input boxes.
+    for (int i = 0; i < inputCount; i++) {
+        TensorShape shape;
+        const char* name;
+        int nameLen;
+        int parsed = ParseValueInfo(inputs[i], &name, &nameLen, &shape);
+        if (parsed < 0) {
+            printf("Error: %s: a graph input has a dimension outside 1..%d.\n", path, INT_MAX);
+            ArenaRelease(&scratch);
+            return 0;
+        }
+        if (!parsed || NameMapGet(&weightIndex, name, nameLen) >= 0)
+            continue;
+        float w, h, d, color[3];
+        BoxSizeFromShape(&shape, &w, &h, &d);
+        DefaultLayerColor(0, color);
+        int layer = AddBoxLayer(net, "", w, h, d, color[0], color[1], color[2]);
+        net->label[layer] = InternLabelRange(net, name, nameLen);
+        net->op[layer] = TensorOp(shape.channels, shape.height, shape.width);
+        NameMapPut(&producer, name, nameLen, layer);
+        AppendShape(&shapes, &shape, name, nameLen);
+    }
+    
+    for (int n = 0; n < nodeCount; n++) {
+        NameRef nodeInputs[16], nodeOutputs[4];
+        int inCount = 0, outCount = 0;
+        const char* opType = "";
+        const char* nodeName = NULL;
+        int opLen = 0, nodeNameLen = 0;
+        long long strides[4] = { 1, 1, 1, 1 };
+        long long kernelShape[4] = { 0, 0, 0, 0 };
+        long long pads[4] = { 0, 0, 0, 0 };
+        long long transB = 0, group = 1;
+        PbReader node = nodes[n];
+        PbField nf;
+        while (PbNext(&node, &nf)) {
+            if (nf.wire != 2)
+                continue;
+            const char* str = (const char*)nf.bytes.p;
+            int len = (int)(nf.bytes.end - nf.bytes.p);
+            if (nf.field == 1 && inCount < 16) {
+                nodeInputs[inCount].name = str;
+                nodeInputs[inCount++].len = len;
+            } else if (nf.field == 2 && outCount < 4) {
+                nodeOutputs[outCount].name = str;
+                nodeOutputs[outCount++].len = len;
+            } else if (nf.field == 3) {
+                nodeName = str;
+                nodeNameLen = len;
+            } else if (nf.field == 4) {
+                opType = str;
+                opLen = len;
+            } else if (nf.field == 5) {
+                // AttributeProto: name(1), i(3), ints(8)
+                PbReader attr = nf.bytes;
+                PbField af;
+                const char* attrName = "";
+                int attrLen = 0, stridesCount = 0;
+                long long ints[4], i = 0;
+                while (PbNext(&attr, &af)) {
+                    if (af.field == 1 && af.wire == 2) {
+                        attrName = (const char*)af.bytes.p;
+                        attrLen = (int)(af.bytes.end - af.bytes.p);
+                    } else if (af.field == 3 && af.wire == 0) {
+                        i = (long long)af.value;
+                    } else if (af.field == 8) {
+                        stridesCount = PbInts(&af, ints, stridesCount, 4);
+                    }
+                }
+                // Everything but transB ends up in a short of the LayerOp
+                // and strides divide, so out-of-range values reject the model.
+                long long* target = NULL;
+                long long low = 1;
+                if (attrLen == 7 && memcmp(attrName, "strides", 7) == 0) {
+                    target = strides;
+                } else if (attrLen == 12 && memcmp(attrName, "kernel_shape", 12) == 0) {
+                    target = kernelShape;
+                } else if (attrLen == 4 && memcmp(attrName, "pads", 4) == 0) {
+                    target = pads;
+                    low = 0;
+                } else if (attrLen == 6 && memcmp(attrName, "transB", 6) == 0) {
+                    transB = i;
+                } else if (attrLen == 5 && memcmp(attrName, "group", 5) == 0) {
+                    target = &group;
+                    ints[0] = i;
+                    stridesCount = 1;
+                }
+                for (int k = 0; target && k < stridesCount; k++) {
+                    if (ints[k] < low || ints[k] > SHRT_MAX) {
+                        printf("Error: %s: node %d has %.*s %lld, outside %lld..%d.\n",
+                               path, n, attrLen, attrName, ints[k], low, SHRT_MAX);
+                        ArenaRelease(&scratch);
+                        return 0;
+                    }
+                }
+                if (target)
+                    memcpy(target, ints, stridesCount * sizeof(long long));
+            }
+        }
+        
+        // Output shape: declared if available, otherwise derived from the
+        // first input and the op's weights.
+        TensorShape shape = { 3, 1, 1, 1 };
+        int declared = outCount ? NameMapGet(&shapes.index, nodeOutputs[0].name, nodeOutputs[0].len) : -1;
+        int base = inCount ? NameMapGet(&shapes.index, nodeInputs[0].name, nodeInputs[0].len) : -1;
+        int weight = inCount > 1 ? NameMapGet(&weightIndex, nodeInputs[1].name, nodeInputs[1].len) : -1;
+        int isDense = (opLen == 4 && memcmp(opType, "Gemm", 4) == 0) ||
+                      (opLen == 6 && memcmp(opType, "MatMul", 6) == 0);
+        int isConv = opLen == 4 && memcmp(opType, "Conv", 4) == 0;
+        if (isConv && kernelShape[0] == 0 && weight >= 0 && weights[weight].width > SHRT_MAX) {
+            printf("Error: %s: node %d has a kernel of %lld, outside 1..%d.\n",
+                   path, n, weights[weight].width, SHRT_MAX);
+            ArenaRelease(&scratch);
+            return 0;
+        }
+        if (base >= 0)
+            shape = shapes.items[base];
+        if (declared >= 0) {
+            shape = shapes.items[declared];
+        } else if (isConv) {
+            if (weight >= 0)
+                shape.channels = weights[weight].channels;
+            shape.height = (shape.height + strides[0] - 1) / strides[0];
+            shape.width = (shape.width + strides[1] - 1) / strides[1];
+        } else if (opLen >= 4 && memcmp(opType + opLen - 4, "Pool", 4) == 0) {
+            if (opLen >= 10 && memcmp(opType, "Global", 6) == 0) {
+                shape.height = shape.width = 1;
+            } else {
+                shape.height = (shape.height + strides[0] - 1) / strides[0];
+                shape.width = (shape.width + strides[1] - 1) / strides[1];
+            }
+        } else if (opLen == 7 && memcmp(opType, "Flatten", 7) == 0) {
+            if (shape.channels > INT_MAX / shape.height / shape.width) {
+                printf("Error: %s: node %d flattens to more than %d features.\n", path, n, INT_MAX);
+                ArenaRelease(&scratch);
+                return 0;
+            }
+            shape.channels = shape.channels * shape.height * shape.width;
+            shape.height = shape.width = 1;
+            shape.rank = 1;
+        } else if (isDense && weight >= 0) {
+            // Gemm with transB stores weights as [out, in], MatMul as [in, out].
+            shape.channels = transB ? weights[weight].channels : weights[weight].height;
+            shape.height = shape.width = 1;
+            shape.rank = 1;
+        }
+        
+        float color[3];
+        DefaultLayerColor(net->layerCount, color);
+        int layer;
+        if (isDense) {
+            layer = AddFullyConnectedLayer(net, "", (int)shape.channels, color[0], color[1], color[2]);
+        } else {
+            float w, h, d;
+            BoxSizeFromShape(&shape, &w, &h, &d);
+            layer = AddBoxLayer(net, "", w, h, d, color[0], color[1], color[2]);
+        }
+        if (nodeNameLen > 0)
+            net->label[layer] = InternLabelRange(net, nodeName, nodeNameLen);
+        else
+            net->label[layer] = InternLabelRange(net, opType, opLen);
+        net->op[layer] = OnnxLayerOp(opType, opLen, &shape, weight >= 0 ? &weights[weight] : NULL,
+                                     kernelShape[0], strides[0], pads[0], group, inCount);
+        
+        for (int i = 0; i < inCount; i++) {
+            int from = NameMapGet(&producer, nodeInputs[i].name, nodeInputs[i].len);
+            if (from >= 0)
+                AddConnection(net, from, layer);
+        }
+        for (int i = 0; i < outCount; i++) {
+            NameMapPut(&producer, nodeOutputs[i].name, nodeOutputs[i].len, layer);
+            AppendShape(&shapes, &shape, nodeOutputs[i].name, nodeOutputs[i].len);
+        }
+    }
+    
+    ArenaRelease(&scratch);
+    return 1;
+}
+
+//-------------------------
+// Weight Tensors
+//-------------------------
+// Trained weights from NumPy .npy files (one tensor each) and .safetensors
+// files (many, with a JSON header). A file is mapped, each of its tensors is
+// summarized in one parallel pass over the mapped bytes, and the file is
+// unmapped again; only the summaries stay in memory. Pages are handed back to
+// the OS as soon as a pass is done with them, so even a checkpoint larger than
+// memory keeps the resident set to a few megabytes per thread.
+
+struct JsonCursor {
+    const char* p;
+    const char* end;
+};
+
+size_t WeightDtypeSize(WeightDtype dtype) {
+    static const size_t sizes[WEIGHT_DTYPE_COUNT] = { 4, 2, 2, 8 };
+    return sizes[dtype];
+}
+
+const char* WeightDtypeName(WeightDtype dtype) {
+    static const char* names[WEIGHT_DTYPE_COUNT] = { "f32", "f16", "bf16", "f64" };
+    return names[dtype];
+}
+
+const char* WeightViewName(WeightView view) {
+    static const char* names[WEIGHT_VIEW_COUNT] = { "off", "mean |w|", "max |w|", "L2 norm" };
+    return names[view];
+}
+
+int ParseWeightView(const char* name, WeightView* view) {
+    static const char* names[WEIGHT_VIEW_COUNT] = { "off", "mean", "max", "norm" };
+    for (int v = 0; v < WEIGHT_VIEW_COUNT; v++) {
+        if (_stricmp(name, names[v]) == 0) {
+            *view = (WeightView)v;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+float WeightStatValue(const WeightStats* s, WeightView view) {
+    switch (view) {
+        case WEIGHT_VIEW_MEAN: return s->count ? (float)(s->sumAbs / s->count) : 0.0f;
+        case WEIGHT_VIEW_MAX:  return s->maxAbs;
+        case WEIGHT_VIEW_NORM: return (float)sqrt(s->sumSq);
+        default:               return 0.0f;
+    }
+}
+
+void AddWeightStats(WeightStats* into, const WeightStats* s) {
+    into->sumAbs += s->sumAbs;
+    into->sumSq += s->sumSq;
+    if (s->maxAbs > into->maxAbs)
+        into->maxAbs = s->maxAbs;
+    into->count += s->count;
+}
+
+// Whether a tensor of this shape fits in bytes of data; sets its element
+// count. Negative dimensions never fit, and each step of the product is
+// checked so it cannot overflow.
+int WeightShapeFits(const long long* dims, int rank, size_t elementSize, unsigned long long bytes,
+                    long long* elements) {
+    unsigned long long count = 1;
+    int empty = 0;
+    for (int d = 0; d < rank; d++) {
+        if (dims[d] < 0 || (unsigned long long)dims[d] > (unsigned long long)LLONG_MAX / count)
+            return 0;
+        if (dims[d] == 0)
+            empty = 1;
+        else
+            count *= dims[d];
+    }
+    if (!empty && count > bytes / elementSize)
+        return 0;
+    *elements = empty ? 0 : (long long)count;
+    return 1;
+}
+
+// Allocate tensor's pyramids. Row bins are a multiple of the grid rows, so
+// every bin falls inside one grid row and the bands of the parallel pass
+// never write to the same cell.
+WeightSummary* AppendWeightTensor(WeightSet* set, const char* name, int nameLen, WeightDtype dtype,
+                                  const long long* dims, int rank, const unsigned char* data) {
+    if (set->count == set->capacity) {
+        int capacity = set->capacity ? set->capacity * 2 : 64;
+        set->tensors = ArenaGrow(&set->arena, set->tensors, set->capacity * sizeof(WeightSummary),
+                                 capacity * sizeof(WeightSummary));
+        set->capacity = capacity;
+    }
+    WeightSummary* w = &set->tensors[set->count++];
+    memset(w, 0, sizeof(WeightSummary));
+    char* copy = ArenaAlloc(&set->arena, nameLen + 1);
+    memcpy(copy, name, nameLen);
+    copy[nameLen] = '\0';
+    w->name = copy;
+    w->dtype = dtype;
+    w->rank = rank;
+    w->rows = rank ? dims[0] : 1;
+    w->cols = 1;
+    for (int d = 0; d < rank; d++) {
+        w->dims[d] = dims[d];
+        if (d > 0)
+            w->cols *= dims[d];
+    }
+    w->data = data;
+    if (w->rows == 0 || w->cols == 0)
+        return w;
+
+    int gridRows = w->rows < WEIGHT_GRID_MAX ? (int)w->rows : WEIGHT_GRID_MAX;
+    int gridCols = w->cols < WEIGHT_GRID_MAX ? (int)w->cols : WEIGHT_GRID_MAX;
+    long long perBand = w->rows / gridRows;
+    int bins = gridRows * (int)(perBand < WEIGHT_ROW_BINS / gridRows ? perBand : WEIGHT_ROW_BINS / gridRows);
+    for (int count = bins; w->rowLevels < WEIGHT_MAX_LEVELS; count = (count + 1) / 2) {
+        w->rowCount[w->rowLevels] = count;
+        w->rowLevel[w->rowLevels] = ArenaAlloc(&set->arena, count * sizeof(WeightStats));
+        memset(w->rowLevel[w->rowLevels], 0, count * sizeof(WeightStats));
+        w->rowLevels++;
+        if (count == 1)
+            break;
+    }
+    for (;;) {
+        size_t bytes = (size_t)gridRows * gridCols * sizeof(WeightStats);
+        w->gridRows[w->gridLevels] = gridRows;
+        w->gridCols[w->gridLevels] = gridCols;
+        w->grid[w->gridLevels] = ArenaAlloc(&set->arena, bytes);
+        memset(w->grid[w->gridLevels], 0, bytes);
+        w->gridLevels++;
+        if (gridRows == 1 && gridCols == 1)
+            break;
+        gridRows = (gridRows + 1) / 2;
+        gridCols = (gridCols + 1) / 2;
+    }
+    return w;
+}
+
+// NumPy format 1.0 to 3.0: magic, version, header length, then a Python dict
+// literal such as {'descr': '<f4', 'fortran_order': False, 'shape': (64, 3, 11, 11), }.
+int ParseNpyHeader(WeightSet* set, const unsigned char* data, size_t size, const char* name) {
+    if (size < 10 || memcmp(data, "\x93NUMPY", 6) != 0) {
+        printf("Error: '%s' is not a .npy file.\n", name);
+        return 0;
+    }
+    size_t headerLen, start;
+    if (data[6] == 1) {
+        headerLen = data[8] | (size_t)data[9] << 8;
+        start = 10;
+    } else {
+        if (size < 12) {
+            printf("Error: '%s' is truncated.\n", name);
+            return 0;
+        }
+        headerLen = data[8] | (size_t)data[9] << 8 | (size_t)data[10] << 16 | (size_t)data[11] << 24;
+        start = 12;
+    }
+    if (start + headerLen > size || headerLen >= 4096) {
+        printf("Error: '%s' has a bad header.\n", name);
+        return 0;
+    }
+    char header[4096];
+    memcpy(header, data + start, headerLen);
+    header[headerLen] = '\0';
+
+    WeightDtype dtype;
+    const char* descr = strstr(header, "'descr'");
+    const char* order = strstr(header, "'fortran_order'");
+    const char* shape = strstr(header, "'shape'");
+    descr = descr ? strchr(descr + 7, '\'') : NULL;
+    order = order ? order + 15 + strspn(order + 15, ": ") : NULL;
+    if (!descr || !shape || !order || strncmp(order, "False", 5) != 0) {
+        printf("Error: '%s' is not a C-ordered array.\n", name);
+        return 0;
+    }
+    if (strncmp(descr, "'<f4'", 5) == 0)
+        dtype = WEIGHT_F32;
+    else if (strncmp(descr, "'<f2'", 5) == 0)
+        dtype = WEIGHT_F16;
+    else if (strncmp(descr, "'<f8'", 5) == 0)
+        dtype = WEIGHT_F64;
+    else {
+        printf("Error: '%s' holds %.5s values; only little-endian f2, f4 and f8 are supported.\n", name, descr);
+        return 0;
+    }
+    long long dims[8];
+    int rank = 0;
+    const char* p = strchr(shape, '(');
+    while (p && *p && *p != ')') {
+        p++;
+        while (*p == ' ' || *p == ',')
+            p++;
+        if (*p >= '0' && *p <= '9') {
+            if (rank == 8) {
+                printf("Error: '%s' has more than 8 dimensions.\n", name);
+                return 0;
+            }
+            dims[rank++] = strtoll(p, (char**)&p, 10);
+        } else if (*p != ')') {
+            break;
+        }
+    }
+    long long elements;
+    size_t offset = start + headerLen;
+    if (!p || *p != ')') {
+        printf("Error: '%s' has a bad shape.\n", name);
+        return 0;
+    }
+    if (!WeightShapeFits(dims, rank, WeightDtypeSize(dtype), size - offset, &elements)) {
+        printf("Error: '%s' is truncated.\n", name);
+        return 0;
+    }
+    AppendWeightTensor(set, name, (int)strlen(name), dtype, dims, rank, data + offset);
+    return 1;
+}
+
+void JsonSpace(JsonCursor* c) {
+    while (c->p < c->end && (*c->p == ' ' || *c->p == '\t' || *c->p == '\r' || *c->p == '\n'))
+        c->p++;
+}
+
+// A string's raw bytes between the quotes; escapes are kept as written.
+int JsonString(JsonCursor* c, const char** text, int* len) {
+    JsonSpace(c);
+    if (c->p >= c->end || *c->p != '"')
+        return 0;
+    const char* start = ++c->p;
+    while (c->p < c->end && *c->p != '"')
+        c->p += *c->p == '\\' ? 2 : 1;
+    if (c->p >= c->end)
+        return 0;
+    *text = start;
+    *len = (int)(c->p++ - start);
+    return 1;
+}
+
+int JsonExpect(JsonCursor* c, char ch) {
+    JsonSpace(c);
+    if (c->p >= c->end || *c->p != ch)
+        return 0;
+    c->p++;
+    return 1;
+}
+
+// Skip one value of any type, nested ones included.
+int JsonSkipValue(JsonCursor* c) {
+    const char* text;
+    int len, depth = 0;
+    JsonSpace(c);
+    do {
+        if (c->p >= c->end)
+            return 0;
+        if (*c->p == '"') {
+            if (!JsonString(c, &text, &len))
+                return 0;
+            continue;
+        }
+        if (*c->p == '{' || *c->p == '[')
+            depth++;
+        else if (*c->p == '}' || *c->p == ']')
+            depth--;
+        c->p++;
+    } while (depth > 0 || (c->p < c->end && *c->p != ',' && *c->p != '}' && *c->p != ']'));
+    return depth == 0;
+}
+
+// An array of at most max integers; returns the count, -1 when malformed.
+int JsonInts(JsonCursor* c, long long* out, int max) {
+    int count = 0;
+    if (!JsonExpect(c, '['))
+        return -1;
+    JsonSpace(c);
+    if (c->p < c->end && *c->p == ']') {
+        c->p++;
+        return 0;
+    }
+    do {
+        JsonSpace(c);
+        char* next;
+        long long value = strtoll(c->p, &next, 10);
+        if (next == c->p || next > c->end || count == max)
+            return -1;
+        out[count++] = value;
+        c->p = next;
+    } while (JsonExpect(c, ','));
+    return JsonExpect(c, ']') ? count : -1;
+}
+
+// safetensors: a little-endian u64 header size, a JSON object mapping tensor
+// names to {"dtype", "shape", "data_offsets": [begin, end]} relative to the
+// end of the header, and the data. Tensors of other dtypes (integer step
+// counters and the like) are skipped.
+int ParseSafetensorsHeader(WeightSet* set, const unsigned char* data, size_t size, const char* path) {
+    unsigned long long headerLen = 0;
+    for (int i = 0; i < 8 && size >= 8; i++)
+        headerLen |= (unsigned long long)data[i] << (8 * i);
+    if (size < 8 || headerLen > size - 8) {
+        printf("Error: '%s' is not a .safetensors file.\n", path);
+        return 0;
+    }
+    const unsigned char* base = data + 8 + headerLen;
+    size_t dataSize = size - 8 - (size_t)headerLen;
+    JsonCursor c = { (const char*)data + 8, (const char*)base };
+    int skipped = 0;
+    if (!JsonExpect(&c, '{'))
+        goto malformed;
+    JsonSpace(&c);
+    if (c.p < c.end && *c.p == '}')
+        return 1;
+    do {
+        const char* name;
+        int nameLen;
+        if (!JsonString(&c, &name, &nameLen) || !JsonExpect(&c, ':'))
+            goto malformed;
+        if (nameLen == 12 && memcmp(name, "__metadata__", 12) == 0) {
+            if (!JsonSkipValue(&c))
+                goto malformed;
+            continue;
+        }
+        const char* dtypeName = NULL;
+        int dtypeLen = 0, rank = -1, offsetCount = -1;
+        long long dims[8], offsets[2];
+        if (!JsonExpect(&c, '{'))
+            goto malformed;
+        do {
+            const char* key;
+            int keyLen;
+            if (!JsonString(&c, &key, &keyLen) || !JsonExpect(&c, ':'))
+                goto malformed;
+            if (keyLen == 5 && memcmp(key, "dtype", 5) == 0) {
+                if (!JsonString(&c, &dtypeName, &dtypeLen))
+                    goto malformed;
+            } else if (keyLen == 5 && memcmp(key, "shape", 5) == 0) {
+                if ((rank = JsonInts(&c, dims, 8)) < 0)
+                    goto malformed;
+            } else if (keyLen == 12 && memcmp(key, "data_offsets", 12) == 0) {
+                if ((offsetCount = JsonInts(&c, offsets, 2)) != 2)
+                    goto malformed;
+            } else if (!JsonSkipValue(&c))
+                goto malformed;
+        } while (JsonExpect(&c, ','));
+        if (!JsonExpect(&c, '}') || !dtypeName || rank < 0 || offsetCount != 2)
+            goto malformed;
+
+        static const char* dtypes[WEIGHT_DTYPE_COUNT] = { "F32", "F16", "BF16", "F64" };
+        int dtype = 0;
+        while (dtype < WEIGHT_DTYPE_COUNT &&
+               ((int)strlen(dtypes[dtype]) != dtypeLen || memcmp(dtypes[dtype], dtypeName, dtypeLen) != 0))
+            dtype++;
+        if (dtype == WEIGHT_DTYPE_COUNT) {
+            skipped++;
+            continue;
+        }
+        long long elements;
+        if (offsets[0] < 0 || offsets[1] < offsets[0] || (unsigned long long)offsets[1] > dataSize ||
+            !WeightShapeFits(dims, rank, WeightDtypeSize((WeightDtype)dtype), offsets[1] - offsets[0], &elements) ||
+            offsets[1] - offsets[0] != elements * (long long)WeightDtypeSize((WeightDtype)dtype)) {
+            printf("Error: Tensor '%.*s' in '%s' does not match its data.\n", nameLen, name, path);
+            return 0;
+        }
+        AppendWeightTensor(set, name, nameLen, (WeightDtype)dtype, dims, rank, base + offsets[0]);
+    } while (JsonExpect(&c, ','));
+    if (!JsonExpect(&c, '}'))
+        goto malformed;
+    if (skipped)
+        printf("Skipped %d tensors of '%s' that are not f32, f16, bf16 or f64.\n", skipped, path);
+    return 1;
+malformed:
+    printf("Error: Malformed header in '%s' near byte %d.\n", path, (int)(c.p - (const char*)data));
+    return 0;
+}
+
+// Accumulate |v|, v^2 and max |v| of count floats. Four float lanes carry the
+// sums; each call is at most WEIGHT_CHUNK values, short enough that float
+// sums lose nothing that matters for a color, before they move to doubles.
+void WeightKernel(const float* v, int count, WeightStats* s) {
+    int i = 0;
+    float sumAbs = 0.0f, sumSq = 0.0f, maxAbs = s->maxAbs;
+#if defined(__SSE2__) || defined(_M_X64)
+    const __m128 signMask = _mm_set1_ps(-0.0f);
+    __m128 accAbs = _mm_setzero_ps(), accSq = _mm_setzero_ps(), accMax = _mm_setzero_ps();
+    for (; i + 4 <= count; i += 4) {
+        __m128 x = _mm_loadu_ps(v + i);
+        __m128 a = _mm_andnot_ps(signMask, x);
+        accAbs = _mm_add_ps(accAbs, a);
+        accSq = _mm_add_ps(accSq, _mm_mul_ps(x, x));
+        accMax = _mm_max_ps(accMax, a);
+    }
+    float lanes[3][4];
+    _mm_storeu_ps(lanes[0], accAbs);
+    _mm_storeu_ps(lanes[1], accSq);
+    _mm_storeu_ps(lanes[2], accMax);
+    for (int k = 0; k < 4; k++) {
+        sumAbs += lanes[0][k];
+        sumSq += lanes[1][k];
+        if (lanes[2][k] > maxAbs)
+            maxAbs = lanes[2][k];
+    }
+#endif
+    for (; i < count; i++) {
+        float a = fabsf(v[i]);
+        sumAbs += a;
+        sumSq += a * a;
+        if (a > maxAbs)
+            maxAbs = a;
+    }
+    s->sumAbs += sumAbs;
+    s->sumSq += sumSq;
+    s->maxAbs = maxAbs;
+    s->count += count;
+}
+
+float HalfToFloat(unsigned short h) {
+    unsigned int sign = (unsigned int)(h & 0x8000) << 16;
+    unsigned int exponent = (h >> 10) & 0x1F, mantissa = h & 0x3FF;
+    unsigned int bits;
+    if (exponent == 0x1F)
+        bits = sign | 0x7F800000 | mantissa << 13;
+    else if (exponent)
+        bits = sign | (exponent + 112) << 23 | mantissa << 13;
+    else {
+        float value = mantissa * (1.0f / 16777216.0f);     // Subnormal: mantissa * 2^-24
+        return sign ? -value : value;
+    }
+    float value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+// Stats of count consecutive values; other dtypes are widened or narrowed to
+// float a chunk at a time.
+void WeightRunStats(const unsigned char* data, WeightDtype dtype, long long count, WeightStats* s) {
+    float chunk[WEIGHT_CHUNK];
+    for (long long done = 0; done < count; done += WEIGHT_CHUNK) {
+        int n = count - done < WEIGHT_CHUNK ? (int)(count - done) : WEIGHT_CHUNK;
+        const unsigned char* p = data + done * WeightDtypeSize(dtype);
+        const float* values = chunk;
+        switch (dtype) {
+            case WEIGHT_F32:
+                if ((size_t)p & 3)
+                    memcpy(chunk, p, n * sizeof(float));     // safetensors data need not be aligned
+                else
+                    values = (const float*)p;
+                break;
+            case WEIGHT_F16:
+                for (int i = 0; i < n; i++)
+                    chunk[i] = HalfToFloat((unsigned short)(p[2 * i] | p[2 * i + 1] << 8));
+                break;
+            case WEIGHT_BF16:
+                for (int i = 0; i < n; i++) {
+                    unsigned int bits = (unsigned int)(p[2 * i] | p[2 * i + 1] << 8) << 16;
+                    memcpy(&chunk[i], &bits, sizeof(float));
+                }
+                break;
+            default:
+                for (int i = 0; i < n; i++) {
+                    double value;
+                    memcpy(&value, p + 8 * i, sizeof(double));
+                    chunk[i] = (float)value;
+                }
+                break;
+        }
+        WeightKernel(values, n, s);
+    }
+}
+
+// Let the OS drop the mapped pages of [begin, end) from the resident set. The
+// mapping is read-only, so a page touched again is simply read back in.
+void ReleaseMappedPages(const void* begin, const void* end) {
+#ifdef _WIN32
+    if (end > begin)
+        VirtualUnlock((void*)begin, (const char*)end - (const char*)begin);  // Unlocking unlocked pages trims them
+#else
+    static size_t pageSize;
+    if (!pageSize)
+        pageSize = (size_t)sysconf(_SC_PAGESIZE);
+    size_t first = (size_t)begin & ~(pageSize - 1);
+    size_t last = (size_t)end & ~(pageSize - 1);
+    if (last > first)
+        madvise((void*)first, last - first, MADV_DONTNEED);
+#endif
+}
+
+// Work of a summarizing pass: one task per grid row of every new tensor.
+typedef struct {
+    WeightSet* set;
+    int* tasks;         // Tensor and grid row, two ints per task
+} WeightPass;
+
+// Fill grid row a of a tensor, and the row bins inside it, in one sweep over
+// its rows.
+void SummarizeWeightBands(void* ctx, int begin, int end) {
+    WeightPass* pass = ctx;
+    for (int t = begin; t < end; t++) {
+        WeightSummary* w = &pass->set->tensors[pass->tasks[2 * t]];
+        int a = pass->tasks[2 * t + 1];
+        int gridRows = w->gridRows[0], gridCols = w->gridCols[0], bins = w->rowCount[0];
+        long long first = (a * w->rows + gridRows - 1) / gridRows;
+        long long last = ((a + 1) * w->rows + gridRows - 1) / gridRows;
+        size_t elementSize = WeightDtypeSize(w->dtype);
+        const unsigned char* released = w->data + first * w->cols * elementSize;
+        for (long long row = first; row < last; row++) {
+            const unsigned char* rowData = w->data + row * w->cols * elementSize;
+            WeightStats rowStats = {0};
+            for (int b = 0; b < gridCols; b++) {
+                long long c0 = (b * w->cols + gridCols - 1) / gridCols;
+                long long c1 = ((b + 1) * w->cols + gridCols - 1) / gridCols;
+                WeightStats cell = {0};
+                WeightRunStats(rowData + c0 * elementSize, w->dtype, c1 - c0, &cell);
+                AddWeightStats(&w->grid[0][a * gridCols + b], &cell);
+                AddWeightStats(&rowStats, &cell);
+            }
+            AddWeightStats(&w->rowLevel[0][row * bins / w->rows], &rowStats);
+            const unsigned char* done = rowData + w->cols * elementSize;
+            if (done - released >= WEIGHT_RELEASE_BYTES) {
+                ReleaseMappedPages(released, done);
+                released = done;
+            }
+        }
+        ReleaseMappedPages(released, w->data + last * w->cols * elementSize);
+    }
+}
+
+// Coarser levels of both pyramids, the whole-tensor total and the largest
+// value of each level, the tops of the color scales.
+void BuildWeightLevels(WeightSummary* w) {
+    for (int l = 1; l < w->rowLevels; l++) {
+        for (int i = 0; i < w->rowCount[l - 1]; i++)
+            AddWeightStats(&w->rowLevel[l][i / 2], &w->rowLevel[l - 1][i]);
+    }
+    for (int l = 1; l < w->gridLevels; l++) {
+        int cols = w->gridCols[l - 1];
+        for (int i = 0; i < w->gridRows[l - 1] * cols; i++)
+            AddWeightStats(&w->grid[l][(i / cols / 2) * w->gridCols[l] + (i % cols) / 2], &w->grid[l - 1][i]);
+    }
+    for (int i = 0; w->rowLevels && i < w->rowCount[0]; i++) {
+        for (int v = 1; v < WEIGHT_VIEW_COUNT; v++)
+            w->rowMax[v] = fmaxf(w->rowMax[v], WeightStatValue(&w->rowLevel[0][i], (WeightView)v));
+    }
+    for (int l = 0; l < w->gridLevels; l++) {
+        for (int i = 0; i < w->gridRows[l] * w->gridCols[l]; i++) {
+            for (int v = 1; v < WEIGHT_VIEW_COUNT; v++)
+                w->gridMax[l][v] = fmaxf(w->gridMax[l][v], WeightStatValue(&w->grid[l][i], (WeightView)v));
+        }
+    }
+    if (w->rowLevels)
+        w->total = w->rowLevel[w->rowLevels - 1][0];
+    w->data = NULL;
+}
+
+// Map a .npy or .safetensors file, summarize its tensors in parallel and
+// unmap it. Returns 0, leaving the set as it was, when the file cannot be
+// read.
+int LoadWeightFile(WeightSet* set, const char* path) {
+    MappedFile file;
+    if (!MapFile(path, &file)) {
+        printf("Error: Cannot open weight file '%s'.\n", path);
+        return 0;
+    }
+    double start = NowSeconds();
+    int first = set->count;
+    size_t pathLen = strlen(path);
+    int ok;
+    if (pathLen > 4 && _stricmp(path + pathLen - 4, ".npy") == 0) {
+        char stem[256];
+        ModelStem(path, stem, sizeof(stem));
+        ok = ParseNpyHeader(set, file.data, file.size, stem);
+    } else
+        ok = ParseSafetensorsHeader(set, file.data, file.size, path);
+    if (!ok) {
+        set->count = first;
+        UnmapFile(&file);
+        return 0;
+    }
+
+    int taskCount = 0;
+    long long bytes = 0;
+    for (int t = first; t < set->count; t++) {
+        taskCount += set->tensors[t].gridLevels ? set->tensors[t].gridRows[0] : 0;
+        bytes += set->tensors[t].rows * set->tensors[t].cols * (long long)WeightDtypeSize(set->tensors[t].dtype);
+    }
+    WeightPass pass = { set, malloc((taskCount + 1) * 2 * sizeof(int)) };
+    if (!pass.tasks) {
+        printf("Error: Out of memory summarizing weights.\n");
+        exit(EXIT_FAILURE);
+    }
+    taskCount = 0;
+    for (int t = first; t < set->count; t++) {
+        for (int a = 0; set->tensors[t].gridLevels && a < set->tensors[t].gridRows[0]; a++) {
+            pass.tasks[2 * taskCount] = t;
+            pass.tasks[2 * taskCount++ + 1] = a;
+        }
+    }
+    ParallelFor(taskCount, 1, SummarizeWeightBands, &pass);
+    free(pass.tasks);
+    for (int t = first; t < set->count; t++) {
+        WeightSummary* w = &set->tensors[t];
+        BuildWeightLevels(w);
+        for (int v = 1; v < WEIGHT_VIEW_COUNT; v++)
+            set->maxValue[v] = fmaxf(set->maxValue[v], WeightStatValue(&w->total, (WeightView)v));
+    }
+    UnmapFile(&file);
+
+    double elapsed = NowSeconds() - start;
+    set->summarizedBytes += bytes;
+    set->summarizeSeconds += elapsed;
+    if (!set->quiet)
+        printf("Summarized '%s': %d tensors, %.1f MB in %.2f ms (%.2f GB/s)\n", path, set->count - first,
+               bytes / (1024.0 * 1024.0), elapsed * 1000.0, elapsed > 0.0 ? bytes / elapsed / 1e9 : 0.0);
+    return 1;
+}
+
+void ReleaseWeights(WeightSet* set) {
+    ArenaRelease(&set->arena);
+    memset(set, 0, sizeof(WeightSet));
+}
+
+// Combined stats of row bins [first, end): the largest aligned power-of-two
+// cells that fit, so a range of any length costs O(log bins) lookups.
+void WeightRowStats(const WeightSummary* w, int first, int end, WeightStats* out) {
+    memset(out, 0, sizeof(WeightStats));
+    while (first < end) {
+        int level = 0;
+        while (level + 1 < w->rowLevels && !(first & ((2 << level) - 1)) && first + (2 << level) <= end)
+            level++;
+        AddWeightStats(out, &w->rowLevel[level][first >> level]);
+        first += 1 << level;
+    }
+}
+
+// value / top clamped to the color scale; NaNs and empty tensors land at 0.
+float WeightShare(float value, float top) {
+    return top > 0.0f && value >= 0.0f ? fminf(value / top, 1.0f) : 0.0f;
+}
+
+// Values of neuronCount neurons drawn for w, each covering an equal share of
+// its rows, on a 0..1 scale. Means and maxima do not grow with the share, so
+// they are scaled by the strongest row bin and keep their meaning as the
+// neuron count changes; norms do, and are scaled by the strongest neuron.
+void WeightNeuronValues(const WeightSummary* w, int neuronCount, float* out) {
+    int bins = w->rowLevels ? w->rowCount[0] : 0;
+    float top = weightView == WEIGHT_VIEW_NORM ? 0.0f : w->rowMax[weightView];
+    for (int i = 0; i < neuronCount; i++) {
+        WeightStats s;
+        int first = (int)((long long)i * bins / neuronCount);
+        int end = (int)((long long)(i + 1) * bins / neuronCount);
+        WeightRowStats(w, first, end > first ? end : first + 1, &s);
+        out[i] = WeightStatValue(&s, weightView);
+        if (weightView == WEIGHT_VIEW_NORM)
+            top = fmaxf(top, out[i]);
+    }
+    for (int i = 0; i < neuronCount; i++)
+        out[i] = WeightShare(out[i], top);
+}
+
+// Finest grid level no larger than an n x n schematic, so every edge drawn
+// between n neurons reads one cell.
+int WeightGridLevel(const WeightSummary* w, int neuronCount) {
+    int level = 0;
+    while (level + 1 < w->gridLevels && (w->gridRows[level] > neuronCount || w->gridCols[level] > neuronCount))
+        level++;
+    return level;
+}
+
+// Color of the edge from neuron src to neuron dst, by the block of weights
+// from the inputs src stands for into the outputs dst stands for, scaled like
+// the neurons: by the finest blocks, or by the level's own for norms.
+void WeightEdgeColor(const WeightSummary* w, int level, int src, int dst, int neuronCount, float* rgb) {
+    int rows = w->gridRows[level], cols = w->gridCols[level];
+    const WeightStats* cell = &w->grid[level][(long long)dst * rows / neuronCount * cols +
+                                              (long long)src * cols / neuronCount];
+    float top = w->gridMax[weightView == WEIGHT_VIEW_NORM ? level : 0][weightView];
+    HeatColor(WeightShare(WeightStatValue(cell, weightView), top), rgb);
+}
+
+// Layers with weights are colored by the whole tensor, relative to the
+// largest tensor of the set.
+void WeightLayerColor(const WeightSet* set, const WeightSummary* w, float* rgb) {
+    float top = set->maxValue[weightView];
+    HeatColor(WeightShare(WeightStatValue(&w->total, weightView), top), rgb);
+}
+
+// The tensor coloring layer, or NULL when the weight view is off or the
+// layer has none.
+const WeightSummary* LayerWeights(const NetworkGraph* net, int layer) {
+    if (weightView == WEIGHT_VIEW_OFF || !net->weights || net->weight[layer] < 0)
+        return NULL;
+    return &net->weights->tensors[net->weight[layer]];
+}
+
+// Lowercase letters and digits of a name, without a trailing "weight" or
+// "kernel", so "fc6.weight", "FC6" and "fc6/kernel" compare equal.
+int NormalizeWeightName(const char* text, int textLen, char* out, int size) {
+    int len = 0;
+    for (int i = 0; i < textLen && len < size - 1; i++) {
+        if ((text[i] >= 'a' && text[i] <= 'z') || (text[i] >= '0' && text[i] <= '9'))
+            out[len++] = text[i];
+        else if (text[i] >= 'A' && text[i] <= 'Z')
+            out[len++] = (char)(text[i] - 'A' + 'a');
+    }
+    if (len > 6 && (memcmp(out + len - 6, "weight", 6) == 0 || memcmp(out + len - 6, "kernel", 6) == 0))
+        len -= 6;
+    out[len] = '\0';
+    return len;
+}
+
+// Pair layers with tensors of at least two dimensions: by name first, the
+// whole name or its last component ("features.conv1.weight" goes to Conv1),
+// then the remaining tensors in file order to the remaining convolution,
+// dense and fully-connected layers in layer order. layerTensor receives each
+// layer's tensor index, -1 for none.
+void MatchWeights(const NetworkGraph* net, const WeightSet* set, int* layerTensor) {
+    Arena scratch = {0};
+    NameMap names = { .arena = &scratch };
+    char* used = ArenaAlloc(&scratch, set->count + 1);
+    memset(used, 0, set->count + 1);
+    for (int t = 0; t < set->count; t++) {
+        const char* name = set->tensors[t].name;
+        int nameLen = (int)strlen(name);
+        if (set->tensors[t].rank < 2)
+            continue;
+        for (int part = 0; part < 2; part++) {
+            char key[256];
+            int start = 0, end = nameLen;
+            if (part == 1) {
+                while (end > 0 && !strchr("./:", name[end - 1]))
+                    end--;
+                if (end > 0 && (_stricmp(name + end, "weight") == 0 || _stricmp(name + end, "kernel") == 0))
+                    end--;
+                else
+                    end = nameLen;
+                for (start = end; start > 0 && !strchr("./:", name[start - 1]); start--)
+                    ;
+            }
+            int len = NormalizeWeightName(name + start, end - start, key, sizeof(key));
+            if (len == 0 || NameMapGet(&names, key, len) >= 0)
+                continue;
+            char* copy = ArenaAlloc(&scratch, len);
+            memcpy(copy, key, len);
+            NameMapPut(&names, copy, len, t);
+        }
+    }
+    int byName = 0, inOrder = 0, next = 0;
+    for (int i = 0; i < net->layerCount; i++) {
+        char key[256];
+        int len = NormalizeWeightName(net->label[i], (int)strlen(net->label[i]), key, sizeof(key));
+        int t = len ? NameMapGet(&names, key, len) : -1;
+        if (t >= 0 && !used[t]) {
+            used[t] = 1;
+            byName++;
+        } else
+            t = -1;
+        layerTensor[i] = t;
+    }
+    for (int i = 0; i < net->layerCount; i++) {
+        if (layerTensor[i] >= 0 ||
+            (net->type[i] != LAYER_FC && net->op[i].kind != OP_CONV && net->op[i].kind != OP_DENSE))
+            continue;
+        while (next < set->count && (used[next] || set->tensors[next].rank < 2))
+            next++;
+        if (next == set->count)
+            break;
+        used[next] = 1;
+        layerTensor[i] = next;
+        inOrder++;
+    }
+    int unused = 0;
+    for (int t = 0; t < set->count; t++)
+        unused += !used[t] && set->tensors[t].rank >= 2;
+    printf("Weights: %d layers matched by name, %d in order, %d weight tensors unused\n", byName, inOrder, unused);
+    ArenaRelease(&scratch);
+}
+
+void AttachWeights(NetworkGraph* net, const WeightSet* set) {
+    net->weights = set;
+    MatchWeights(net, set, net->weight);
+    MarkGraphChanged(net);
+}
+
+// Weights stored next to a model file under the same name, model.safetensors
+// or model.npy. Returns 0 when there are none.
+int LoadSiblingWeights(WeightSet* set, const char* modelPath) {
+    static const char* extensions[2] = { ".safetensors", ".npy" };
+    const char* dot = strrchr(modelPath, '.');
+    int stemLen = dot && !strpbrk(dot, "/\\") ? (int)(dot - modelPath) : (int)strlen(modelPath);
+    for (int e = 0; e < 2; e++) {
+        char path[300];
+        snprintf(path, sizeof(path), "%.*s%s", stemLen, modelPath, extensions[e]);
+        FILE* probe = fopen(path, "rb");
+        if (!probe)
+            continue;
+        fclose(probe);
+        return LoadWeightFile(set, path);
+    }
+    return 0;
+}
+
+//-------------------------
+// Master Network Setup Menu
+//-------------------------
+
+// A model path given on the command line skips the interactive menu.
+void SetupNetwork(NetworkGraph* net, const char* modelPath) {
+    int choice;
+    char path[260];
+    if (modelPath && modelPath[0]) {
+        if (!LoadModelFile(net, modelPath))
+            exit(EXIT_FAILURE);
+        snprintf(watchedModel, sizeof(watchedModel), "%s", modelPath);
+        InferLayerCosts(net);
+        LayoutNetwork(net);
+        ReportNetworkMemory(net);
+        return;
+    }
+    printf("Choose network option:\n");
+    printf("1. Predefined: AlexNet\n");
+    printf("2. Predefined: VGG16\n");
+    printf("3. Predefined: ResNet18\n");
+    printf("4. Custom\n");
+    printf("5. Load model file (.txt spec or .onnx)\n");
+    printf("Enter choice (1-5): ");
+    scanf("%d", &choice);
+    ResetNetwork(net);
+    if (choice == 5) {
+        printf("Enter model file path: ");
+        scanf(" %259[^\n]", path);
+        if (!LoadModelFile(net, path))
+            exit(EXIT_FAILURE);
+        snprintf(watchedModel, sizeof(watchedModel), "%s", path);
+    } else if (choice == 1)
+        SetupAlexNet(net);
+    else if (choice == 2)
+        SetupVGG16(net);
+    else if (choice == 3)
+        SetupResNet18(net);
+    else
+        SetupCustomNetwork(net);
+    InferLayerCosts(net);
+    LayoutNetwork(net);
+    ReportNetworkMemory(net);
+}
+
+#ifdef _WIN32
+//-------------------------
+// OpenGL Setup & Utility Functions
+//-------------------------
+
+void SetupPixelFormatForDC(HDC hDC) {
+    PIXELFORMATDESCRIPTOR pfd = {0};
+    pfd.nSize      = sizeof(PIXELFORMATDESCRIPTOR);
+    pfd.nVersion   = 1;
+    pfd.dwFlags    = PFD_DRAW_TO_WINDOW | PFD_SUPPORT_OPENGL | PFD_DOUBLEBUFFER;
+    pfd.iPixelType = PFD_TYPE_RGBA;
+    pfd.cColorBits = 32;
+    pfd.cDepthBits = 24;
+    pfd.iLayerType = PFD_MAIN_PLANE;
+    
+    int pixelFormat = ChoosePixelFormat(hDC, &pfd);
+    SetPixelFormat(hDC, pixelFormat, &pfd);
+}
+
+void InitOpenGL(void) {
+    glEnable(GL_DEPTH_TEST);
+    RECT client;
+    if (GetClientRect(hWnd, &client))
+        ResizeViewport(client.right - client.left, client.bottom - client.top);
+    else
+        ResizeViewport(windowWidth, windowHeight);
+    LoadBufferExtensions();
+    LoadInstancingExtensions();
+    pwglSwapIntervalEXT = (SwapIntervalProc)wglGetProcAddress("wglSwapIntervalEXT");
+    ApplySwapInterval();
+    const char* renderer = (const char*)glGetString(GL_RENDERER);
+    if (renderer && strstr(renderer, "GDI Generic")) {
+        backend = BACKEND_CPU;
+        printf("Software OpenGL detected, using the CPU rasterizer.\n");
+    }
+    BuildMeshCache();
+    UploadMeshCache();
+    BuildEmbeddedAtlas(&embeddedAtlas);
+    if (!BuildFontAtlas(&glyphAtlas)) {
+        printf("Font rasterization failed, using the built-in font.\n");
+        BuildEmbeddedAtlas(&glyphAtlas);
+    }
+    UploadGlyphAtlas(&glyphAtlas);
+    UploadGlyphAtlas(&embeddedAtlas);     // Fixed-width font for the profiler HUD
+}
+
+void ResizeViewport(int width, int height) {
+    windowWidth = width > 0 ? width : 1;
+    windowHeight = height > 0 ? height : 1;
+    glViewport(0, 0, windowWidth, windowHeight);
+    glMatrixMode(GL_PROJECTION);
+    glLoadIdentity();
+    gluPerspective(45.0, (double)windowWidth / windowHeight, 1.0, 100.0);
+    ProfileCount(PROF_GLU_CALLS, 1);
+    glMatrixMode(GL_MODELVIEW);
+}
+
+void ApplySwapInterval(void) {
+    if (pwglSwapIntervalEXT)
+        pwglSwapIntervalEXT(pacing.vsync ? 1 : 0);
+}
+
+void LoadBufferExtensions(void) {
+    pglGenBuffers = (GenBuffersProc)wglGetProcAddress("glGenBuffers");
+    pglDeleteBuffers = (DeleteBuffersProc)wglGetProcAddress("glDeleteBuffers");
+    pglBindBuffer = (BindBufferProc)wglGetProcAddress("glBindBuffer");
+    pglBufferData = (BufferDataProc)wglGetProcAddress("glBufferData");
+    pglBufferSubData = (BufferSubDataProc)wglGetProcAddress("glBufferSubData");
+    if (!pglGenBuffers || !pglDeleteBuffers || !pglBindBuffer || !pglBufferData || !pglBufferSubData) {
+        pglGenBuffers = NULL;
+        printf("Buffer objects unavailable, using client-side vertex arrays.\n");
+    }
+}
+
+// The core name, else the ARB one.
+void* LoadGLProc(const char* name, const char* arbName) {
+    void* proc = (void*)wglGetProcAddress(name);
+    return proc ? proc : (void*)wglGetProcAddress(arbName);
+}
+
+// Resolve instancing and build its shader: the mesh vertex goes through the
+// instance's transform, then the fixed-function matrices, and takes the
+// instance's color. Fragments stay fixed-function. Needs buffer objects.
+void LoadInstancingExtensions(void) {
+    static const char* source =
+        "#version 120\n"
+        "attribute vec3 position;\n"
+        "attribute vec4 column0, column1, column2, column3;\n"
+        "attribute vec3 color;\n"
+        "void main() {\n"
+        "    mat4 transform = mat4(column0, column1, column2, column3);\n"
+        "    gl_Position = gl_ModelViewProjectionMatrix * (transform * vec4(position, 1.0));\n"
+        "    gl_FrontColor = vec4(color, 1.0);\n"
+        "}\n";
+    static const char* attributes[6] = { "position", "column0", "column1", "column2", "column3", "color" };
+    pglDrawElementsInstanced = (DrawElementsInstancedProc)LoadGLProc("glDrawElementsInstanced",
+                                                                     "glDrawElementsInstancedARB");
+    pglVertexAttribDivisor = (VertexAttribDivisorProc)LoadGLProc("glVertexAttribDivisor", "glVertexAttribDivisorARB");
+    pglVertexAttribPointer = (VertexAttribPointerProc)wglGetProcAddress("glVertexAttribPointer");
+    pglEnableVertexAttribArray = (VertexAttribArrayProc)wglGetProcAddress("glEnableVertexAttribArray");
+    pglDisableVertexAttribArray = (VertexAttribArrayProc)wglGetProcAddress("glDisableVertexAttribArray");
+    pglCreateShader = (CreateShaderProc)wglGetProcAddress("glCreateShader");
+    pglShaderSource = (ShaderSourceProc)wglGetProcAddress("glShaderSource");
+    pglCompileShader = (ObjectProc)wglGetProcAddress("glCompileShader");
+    pglDeleteShader = (ObjectProc)wglGetProcAddress("glDeleteShader");
+    pglGetShaderiv = (GetObjectivProc)wglGetProcAddress("glGetShaderiv");
+    pglCreateProgram = (CreateProgramProc)wglGetProcAddress("glCreateProgram");
+    pglAttachShader = (AttachShaderProc)wglGetProcAddress("glAttachShader");
+    pglBindAttribLocation = (BindAttribLocationProc)wglGetProcAddress("glBindAttribLocation");
+    pglLinkProgram = (ObjectProc)wglGetProcAddress("glLinkProgram");
+    pglGetProgramiv = (GetObjectivProc)wglGetProcAddress("glGetProgramiv");
+    pglUseProgram = (ObjectProc)wglGetProcAddress("glUseProgram");
+    pglDeleteProgram = (ObjectProc)wglGetProcAddress("glDeleteProgram");
+    if (!pglGenBuffers || !pglDrawElementsInstanced || !pglVertexAttribDivisor || !pglVertexAttribPointer ||
+        !pglEnableVertexAttribArray || !pglDisableVertexAttribArray || !pglCreateShader || !pglShaderSource ||
+        !pglCompileShader || !pglDeleteShader || !pglGetShaderiv || !pglCreateProgram || !pglAttachShader ||
+        !pglBindAttribLocation || !pglLinkProgram || !pglGetProgramiv || !pglUseProgram || !pglDeleteProgram) {
+        printf("Instanced drawing unavailable, drawing instances one by one.\n");
+        return;
+    }
+    
+    GLint compiled = 0, linked = 0;
+    GLuint shader = pglCreateShader(GL_VERTEX_SHADER);
+    pglShaderSource(shader, 1, &source, NULL);
+    pglCompileShader(shader);
+    pglGetShaderiv(shader, GL_COMPILE_STATUS, &compiled);
+    GLuint program = pglCreateProgram();
+    pglAttachShader(program, shader);
+    // position at 0 so it aliases the vertex, as compatibility contexts want.
+    for (GLuint a = 0; a < 6; a++)
+        pglBindAttribLocation(program, a, attributes[a]);
+    if (compiled) {
+        pglLinkProgram(program);
+        pglGetProgramiv(program, GL_LINK_STATUS, &linked);
+    }
+    pglDeleteShader(shader);
+    if (!linked) {
+        pglDeleteProgram(program);
+        printf("Instancing shader rejected by the driver, drawing instances one by one.\n");
+        return;
+    }
+    instanceProgram = program;
+    pglGenBuffers(1, &instanceBuffer);
+}
+
+void ReleaseInstancing(void) {
+    if (instanceProgram) {
+        pglDeleteProgram(instanceProgram);
+        pglDeleteBuffers(1, &instanceBuffer);
+    }
+    instanceProgram = instanceBuffer = 0;
+    instanceBufferCapacity = 0;
+    free(visibleInstances);
+    visibleInstances = NULL;
+    visibleInstanceCapacity = 0;
+}
+#endif
+
+//-------------------------
+// Drawing Primitives
+//-------------------------
+
+// Faces of a box by corner; corner index bits: 1 = +x, 2 = +y, 4 = +z.
+static const int boxQuads[24] = {
+    4, 5, 7, 6,   // Front face
+    0, 1, 3, 2,   // Back face
+    0, 2, 6, 4,   // Left face
+    1, 3, 7, 5,   // Right face
+    2, 3, 7, 6,   // Top face
+    0, 1, 5, 4    // Bottom face
+};
+
+// Append a box to the scene's triangle buffer as 8 shared corners and 12 triangles.
+void EmitBox(SceneCache* sc, float cx, float cy, float cz, float width, float height, float depth, const float* color) {
+    float hw = width / 2.0f;
+    float hh = height / 2.0f;
+    float hd = depth / 2.0f;
+    GeometryBuffer* buf = &sc->triangles;
+    
+    ReserveGeometry(buf, 8, 36);
+    GLuint base = (GLuint)buf->vertexCount;
+    for (int c = 0; c < 8; c++) {
+        AppendVertex(buf,
+                     cx + ((c & 1) ? hw : -hw),
+                     cy + ((c & 2) ? hh : -hh),
+                     cz + ((c & 4) ? hd : -hd), color);
+    }
+    for (int q = 0; q < 24; q += 4) {
+        GLuint* idx = buf->indices + buf->indexCount;
+        idx[0] = base + boxQuads[q];  idx[1] = base + boxQuads[q + 1]; idx[2] = base + boxQuads[q + 2];
+        idx[3] = base + boxQuads[q];  idx[4] = base + boxQuads[q + 2]; idx[5] = base + boxQuads[q + 3];
+        buf->indexCount += 6;
+    }
+}
+
+void EmitSphere(SceneCache* sc, float x, float y, float z, float radius, const float* color) {
+    MeshInstance* inst = AppendInstance(&sc->spheres);
+    float* m = inst->transform;
+    memset(m, 0, sizeof(inst->transform));
+    m[0] = m[5] = m[10] = radius;
+    m[12] = x; m[13] = y; m[14] = z; m[15] = 1.0f;
+    inst->color[0] = color[0]; inst->color[1] = color[1]; inst->color[2] = color[2];
+}
+
+void EmitLine(SceneCache* sc, float x1, float y1, float z1, float x2, float y2, float z2, const float* color) {
+    GeometryBuffer* buf = &sc->lines;
+    ReserveGeometry(buf, 2, 2);
+    buf->indices[buf->indexCount++] = (GLuint)buf->vertexCount;
+    AppendVertex(buf, x1, y1, z1, color);
+    buf->indices[buf->indexCount++] = (GLuint)buf->vertexCount;
+    AppendVertex(buf, x2, y2, z2, color);
+}
+
+// Arrows shorter than 0.0001 are not drawn.
+float ArrowLength(float x1, float y1, float z1, float x2, float y2, float z2) {
+    float dx = x2 - x1, dy = y2 - y1, dz = z2 - z1;
+    return sqrt(dx*dx + dy*dy + dz*dz);
+}
+
+// Append the arrow shaft to the scene's line buffer and the arrowhead to the
+// cone instances.
+void EmitArrow(SceneCache* sc, float x1, float y1, float z1, float x2, float y2, float z2, const float* color) {
+    float dx = x2 - x1, dy = y2 - y1, dz = z2 - z1;
+    float length = ArrowLength(x1, y1, z1, x2, y2, z2);
+    if (length < 0.0001f)
+        return;
+    
+    float arrowHeadLength = (length > 0.5f) ? 0.5f : 0.5f * length;
+    float arrowHeadRadius = 0.2f;
+    float shaftLength = length - arrowHeadLength;
+    float shaftEndX = x1 + (dx / length) * shaftLength;
+    float shaftEndY = y1 + (dy / length) * shaftLength;
+    float shaftEndZ = z1 + (dz / length) * shaftLength;
+    
+    EmitLine(sc, x1, y1, z1, shaftEndX, shaftEndY, shaftEndZ, color);
+    
+    // Orient the unit cone's +z axis along the arrow with any perpendicular basis,
+    // since the cone is rotationally symmetric.
+    float dirX = dx / length, dirY = dy / length, dirZ = dz / length;
+    float ux, uy, uz;
+    if (fabs(dirX) < 0.9f) { ux = 0.0f; uy = dirZ; uz = -dirY; }
+    else                   { ux = -dirZ; uy = 0.0f; uz = dirX; }
+    float ulen = sqrt(ux*ux + uy*uy + uz*uz);
+    ux /= ulen; uy /= ulen; uz /= ulen;
+    float vx = dirY * uz - dirZ * uy;
+    float vy = dirZ * ux - dirX * uz;
+    float vz = dirX * uy - dirY * ux;
+    
+    MeshInstance* inst = AppendInstance(&sc->cones);
+    float* m = inst->transform;
+    m[0]  = ux * arrowHeadRadius;   m[1]  = uy * arrowHeadRadius;   m[2]  = uz * arrowHeadRadius;   m[3]  = 0.0f;
+    m[4]  = vx * arrowHeadRadius;   m[5]  = vy * arrowHeadRadius;   m[6]  = vz * arrowHeadRadius;   m[7]  = 0.0f;
+    m[8]  = dirX * arrowHeadLength; m[9]  = dirY * arrowHeadLength; m[10] = dirZ * arrowHeadLength; m[11] = 0.0f;
+    m[12] = shaftEndX;              m[13] = shaftEndY;              m[14] = shaftEndZ;              m[15] = 1.0f;
+    inst->color[0] = color[0]; inst->color[1] = color[1]; inst->color[2] = color[2];
+}
+
+
+// Every LOD variant is baked in; the view picks which elements to draw.
+// With weights, neurons and edges are colored by the weights they stand for;
+// the ribbon and the collapsed glyph keep the layer's color.
+void EmitFullyConnectedLayer(SceneCache* sc, const float* center, int neuronCount, const float* color,
+                             const WeightSummary* weights) {
+    float y = center[1];
+    int ribbon = ResolveEdgeMode((long long)neuronCount * neuronCount) == EDGE_MODE_RIBBON;
+    if (neuronCount <= 0)
+        return;
+    // x, z, then with weights each neuron's value and its color.
+    float* xs = malloc((size_t)neuronCount * (weights ? 6 : 2) * sizeof(float));
+    if (!xs) {
+        printf("Error: Out of memory building scene geometry.\n");
+        exit(EXIT_FAILURE);
+    }
+    float* zs = xs + neuronCount;
+    float* values = zs + neuronCount;
+    float* heat = weights ? values + neuronCount : NULL;
+    NeuronRow(center, neuronCount, xs, zs);
+    if (weights) {
+        WeightNeuronValues(weights, neuronCount, values);
+        for (int i = 0; i < neuronCount; i++)
+            HeatColor(values[i], &heat[i * 3]);
+    }
+    sc->openLod = LOD_MASK(LOD_FULL) | LOD_MASK(LOD_LOW_POLY);
+    for (int first = 0; first < neuronCount; first += SCENE_ELEMENT_BATCH) {
+        int count = neuronCount - first < SCENE_ELEMENT_BATCH ? neuronCount - first : SCENE_ELEMENT_BATCH;
+        EmitNeuronSpheres(sc, count, xs + first, y, zs + first, 0.3f, heat ? heat + first * 3 : NULL, color);
+        CloseSceneElement(sc);
+    }
+    free(xs);
+    sc->openLod = ribbon ? LOD_MASK_ALL : LOD_MASK(LOD_FULL);
+    double edgeStart = ProfileStart();
+    EmitFullyConnectedEdges(sc, center, neuronCount, color, weights);
+    ProfileEnd(PROF_BUILD_EDGES, edgeStart);
+    CloseSceneElement(sc);
+    if (!ribbon) {
+        sc->openLod = LOD_MASK(LOD_LOW_POLY) | LOD_MASK(LOD_COLLAPSED);
+        EmitEdgeRibbon(sc, center, neuronCount, color);
+        CloseSceneElement(sc);
+    }
+
+    // Collapsed glyph: one sphere stretched over the row's footprint.
+    float startX, endX, z;
+    NeuronPosition(center, 0, neuronCount, &startX, &z);
+    NeuronPosition(center, neuronCount - 1, neuronCount, &endX, &z);
+    MeshInstance* inst = AppendInstance(&sc->spheres);
+    float* m = inst->transform;
+    memset(m, 0, sizeof(inst->transform));
+    m[0] = (endX - startX) * 0.5f + 0.3f;
+    m[5] = 0.3f;
+    m[10] = 0.8f;
+    m[12] = center[0];
+    m[13] = y;
+    m[14] = center[2];
+    m[15] = 1.0f;
+    inst->color[0] = color[0]; inst->color[1] = color[1]; inst->color[2] = color[2];
+    sc->openLod = LOD_MASK(LOD_COLLAPSED);
+    CloseSceneElement(sc);
+    sc->openLod = LOD_MASK_ALL;
+}
+
+//-------------------------
+// Connection Edges
+//-------------------------
+
+// Neurons sit on a row centered on the layer, alternating in z so edges stay readable.
+void NeuronPosition(const float* center, int index, int neuronCount, float* x, float* z) {
+    float spacing = 1.0f;
+    float zOffset = 0.5f;
+    *x = center[0] - ((neuronCount - 1) * spacing) / 2.0f + index * spacing;
+    *z = center[2] + ((index % 2 == 0) ? -zOffset : zOffset);
+}
+
+EdgeMode ResolveEdgeMode(long long edgeCount) {
+    if (edgeSettings.mode != EDGE_MODE_AUTO)
+        return edgeSettings.mode;
+    if (edgeCount <= edgeSettings.fullEdgeLimit)
+        return EDGE_MODE_FULL;
+    if (edgeCount <= edgeSettings.ribbonEdgeLimit)
+        return EDGE_MODE_SAMPLED;
+    return EDGE_MODE_RIBBON;
+}
+
+const char* EdgeModeName(EdgeMode mode) {
+    switch (mode) {
+        case EDGE_MODE_AUTO:    return "auto";
+        case EDGE_MODE_FULL:    return "full";
+        case EDGE_MODE_SAMPLED: return "sampled";
+        case EDGE_MODE_BUNDLED: return "bundled";
+        case EDGE_MODE_RIBBON:  return "ribbon";
+        default:                return "unknown";
+    }
+}
+
+// Connect every neuron of the layer at center to every neuron one layer below.
+void EmitFullyConnectedEdges(SceneCache* sc, const float* center, int neuronCount, const float* color,
+                             const WeightSummary* weights) {
+    long long edgeCount = (long long)neuronCount * neuronCount;
+    float y = center[1];
+    float y2 = y - LAYER_SPACING;
+    if (neuronCount <= 0)
+        return;
+    
+    switch (ResolveEdgeMode(edgeCount)) {
+        case EDGE_MODE_SAMPLED:
+            EmitSampledEdges(sc, center, neuronCount, color, weights);
+            return;
+        case EDGE_MODE_BUNDLED:
+            EmitBundledEdges(sc, center, neuronCount, color, weights);
+            return;
+        case EDGE_MODE_RIBBON:
+            EmitEdgeRibbon(sc, center, neuronCount, color);
+            return;
+        default:
+            break;
+    }
+    
+    int level = weights ? WeightGridLevel(weights, neuronCount) : 0;
+    if (!edgeSettings.arrowheads && edgeCount < INT_MAX / 2)
+        ReserveGeometry(&sc->lines, (int)(edgeCount * 2), (int)(edgeCount * 2));
+    // x, z, then with weights the colors of one source's edges.
+    float* xs = malloc((size_t)neuronCount * (weights ? 5 : 2) * sizeof(float));
+    if (!xs) {
+        printf("Error: Out of memory building scene geometry.\n");
+        exit(EXIT_FAILURE);
+    }
+    float* zs = xs + neuronCount;
+    float* heat = weights ? zs + neuronCount : NULL;
+    NeuronRow(center, neuronCount, xs, zs);
+    for (int i = 0; i < neuronCount; i++) {
+        for (int j = 0; weights && j < neuronCount; j++)
+            WeightEdgeColor(weights, level, i, j, neuronCount, &heat[j * 3]);
+        EmitNeuronEdges(sc, neuronCount, xs + i, zs + i, 0, y, xs, zs, y2, heat, color);
+        CloseSceneElement(sc);
+    }
+    free(xs);
+}
+
+// Multiplying the sample index by a step coprime with the edge count walks a
+// fixed permutation of all edges, so the subset is spread evenly and stable
+// between rebuilds.
+void EmitSampledEdges(SceneCache* sc, const float* center, int neuronCount, const float* color,
+                      const WeightSummary* weights) {
+    unsigned long long edgeCount = (unsigned long long)neuronCount * neuronCount;
+    unsigned long long budget = edgeSettings.sampleBudget;
+    if (budget > edgeCount)
+        budget = edgeCount;
+    
+    unsigned long long step = 2654435761ULL % edgeCount;
+    for (;;) {
+        unsigned long long a = step, b = edgeCount;
+        while (b) {
+            unsigned long long t = a % b;
+            a = b;
+            b = t;
+        }
+        if (a == 1)
+            break;
+        step++;
+    }
+    
+    float y = center[1], y2 = y - LAYER_SPACING;
+    int level = weights ? WeightGridLevel(weights, neuronCount) : 0;
+    float* xs = malloc((size_t)neuronCount * 2 * sizeof(float));
+    if (!xs) {
+        printf("Error: Out of memory building scene geometry.\n");
+        exit(EXIT_FAILURE);
+    }
+    float* zs = xs + neuronCount;
+    NeuronRow(center, neuronCount, xs, zs);
+    float x1[SCENE_ELEMENT_BATCH], z1[SCENE_ELEMENT_BATCH], x2[SCENE_ELEMENT_BATCH], z2[SCENE_ELEMENT_BATCH];
+    float heat[SCENE_ELEMENT_BATCH * 3];
+    ReserveGeometry(&sc->lines, (int)budget * 2, (int)budget * 2);
+    for (unsigned long long k = 0; k < budget; k += SCENE_ELEMENT_BATCH) {
+        int count = budget - k < SCENE_ELEMENT_BATCH ? (int)(budget - k) : SCENE_ELEMENT_BATCH;
+        for (int b = 0; b < count; b++) {
+            unsigned long long e = ((k + b) * step) % edgeCount;
+            int from = (int)(e / neuronCount), to = (int)(e % neuronCount);
+            x1[b] = xs[from]; z1[b] = zs[from];
+            x2[b] = xs[to];   z2[b] = zs[to];
+            if (weights)
+                WeightEdgeColor(weights, level, from, to, neuronCount, &heat[b * 3]);
+        }
+        EmitNeuronEdges(sc, count, x1, z1, 1, y, x2, z2, y2, weights ? heat : NULL, color);
+        if (count == SCENE_ELEMENT_BATCH)
+            CloseSceneElement(sc);
+    }
+    free(xs);
+}
+
+// Sources are grouped into EDGE_BUNDLES contiguous runs; each source feeds its
+// group's waist point halfway down and each waist fans out to every target,
+// turning n*n segments into n + EDGE_BUNDLES*n. With weights, a fan-out
+// segment takes the color of the bundle's middle source into its target.
+void EmitBundledEdges(SceneCache* sc, const float* center, int neuronCount, const float* color,
+                      const WeightSummary* weights) {
+    int bundles = neuronCount < EDGE_BUNDLES ? neuronCount : EDGE_BUNDLES;
+    float y = center[1], y2 = y - LAYER_SPACING;
+    float waistY = y - LAYER_SPACING * 0.5f;
+    int level = weights ? WeightGridLevel(weights, neuronCount) : 0;
+    float heat[3];
+    
+    ReserveGeometry(&sc->lines, (neuronCount + bundles * neuronCount) * 2,
+                    (neuronCount + bundles * neuronCount) * 2);
+    for (int b = 0; b < bundles; b++) {
+        int first = (int)((long long)b * neuronCount / bundles);
+        int last = (int)((long long)(b + 1) * neuronCount / bundles);
+        float firstX, lastX, z;
+        NeuronPosition(center, first, neuronCount, &firstX, &z);
+        NeuronPosition(center, last - 1, neuronCount, &lastX, &z);
+        float waistX = center[0] + (firstX + lastX - 2.0f * center[0]) * 0.25f;
+        
+        for (int i = first; i < last; i++) {
+            float x1, z1;
+            NeuronPosition(center, i, neuronCount, &x1, &z1);
+            EmitLine(sc, x1, y, z1, waistX, waistY, center[2], color);
+        }
+        CloseSceneElement(sc);
+        for (int j = 0; j < neuronCount; j++) {
+            float x2, z2;
+            NeuronPosition(center, j, neuronCount, &x2, &z2);
+            if (weights)
+                WeightEdgeColor(weights, level, (first + last) / 2, j, neuronCount, heat);
+            EmitLine(sc, waistX, waistY, center[2], x2, y2, z2, weights ? heat : color);
+            if (j % SCENE_ELEMENT_BATCH == SCENE_ELEMENT_BATCH - 1)
+                CloseSceneElement(sc);
+        }
+        CloseSceneElement(sc);
+    }
+}
+
+// A single dimmed slab spanning both neuron rows stands in for all edges.
+void EmitEdgeRibbon(SceneCache* sc, const float* center, int neuronCount, const float* color) {
+    float dim[3] = { color[0] * 0.5f, color[1] * 0.5f, color[2] * 0.5f };
+    float startX, endX, z;
+    NeuronPosition(center, 0, neuronCount, &startX, &z);
+    NeuronPosition(center, neuronCount - 1, neuronCount, &endX, &z);
+    EmitBox(sc, center[0], center[1] - LAYER_SPACING * 0.5f, center[2],
+            endX - startX + 0.6f, LAYER_SPACING - 0.6f, 1.0f, dim);
+}
+
+//-------------------------
+// Geometry Kernels
+//-------------------------
+// Batch emitters for the bulk of a large scene: the neurons of fully
+// connected layers and the edges between them. Positions come in as arrays,
+// each run is reserved once, and arrowheads are computed four edges at a time
+// in SSE2 lanes. The lanes do the same float operations in the same order as
+// EmitArrow, so both paths build the same scene bit for bit. With
+// geometryKernels off every primitive goes through its own emitter, which is
+// what --bench-build measures the kernels against.
+
+// x and z of every neuron of a row, where NeuronPosition puts them.
+void NeuronRow(const float* center, int neuronCount, float* xs, float* zs) {
+    float spacing = 1.0f;
+    float zOffset = 0.5f;
+    float startX = center[0] - ((neuronCount - 1) * spacing) / 2.0f;
+    int i = 0;
+    if (!geometryKernels) {
+        for (; i < neuronCount; i++)
+            NeuronPosition(center, i, neuronCount, &xs[i], &zs[i]);
+        return;
+    }
+#if defined(__SSE2__) || defined(_M_X64)
+    const __m128 start = _mm_set1_ps(startX), step = _mm_set1_ps(spacing), four = _mm_set1_ps(4.0f);
+    const __m128 z = _mm_setr_ps(center[2] - zOffset, center[2] + zOffset, center[2] - zOffset, center[2] + zOffset);
+    __m128 index = _mm_setr_ps(0.0f, 1.0f, 2.0f, 3.0f);
+    for (; i + 4 <= neuronCount; i += 4, index = _mm_add_ps(index, four)) {
+        _mm_storeu_ps(xs + i, _mm_add_ps(start, _mm_mul_ps(index, step)));
+        _mm_storeu_ps(zs + i, z);
+    }
+#endif
+    for (; i < neuronCount; i++) {
+        xs[i] = startX + i * spacing;
+        zs[i] = center[2] + ((i % 2 == 0) ? -zOffset : zOffset);
+    }
+}
+
+// count spheres of one radius at (xs[i], y, zs[i]), colored colors[i * 3],
+// or all color when colors is NULL.
+void EmitNeuronSpheres(SceneCache* sc, int count, const float* xs, float y, const float* zs, float radius,
+                       const float* colors, const float* color) {
+    if (!geometryKernels) {
+        for (int i = 0; i < count; i++)
+            EmitSphere(sc, xs[i], y, zs[i], radius, colors ? &colors[i * 3] : color);
+        return;
+    }
+    ReserveInstances(&sc->spheres, count);
+    MeshInstance* inst = sc->spheres.items + sc->spheres.count;
+#if defined(__SSE2__) || defined(_M_X64)
+    const __m128 col0 = _mm_setr_ps(radius, 0.0f, 0.0f, 0.0f);
+    const __m128 col1 = _mm_setr_ps(0.0f, radius, 0.0f, 0.0f);
+    const __m128 col2 = _mm_setr_ps(0.0f, 0.0f, radius, 0.0f);
+#endif
+    for (int i = 0; i < count; i++, inst++) {
+        float* m = inst->transform;
+        const float* c = colors ? &colors[i * 3] : color;
+#if defined(__SSE2__) || defined(_M_X64)
+        _mm_storeu_ps(m, col0);
+        _mm_storeu_ps(m + 4, col1);
+        _mm_storeu_ps(m + 8, col2);
+        _mm_storeu_ps(m + 12, _mm_setr_ps(xs[i], y, zs[i], 1.0f));
+#else
+        memset(m, 0, sizeof(inst->transform));
+        m[0] = m[5] = m[10] = radius;
+        m[12] = xs[i]; m[13] = y; m[14] = zs[i]; m[15] = 1.0f;
+#endif
+        inst->color[0] = c[0]; inst->color[1] = c[1]; inst->color[2] = c[2];
+    }
+    sc->spheres.count += count;
+}
+
+// count edges from (x1[i * sourceStep], y1, z1[i * sourceStep]) down to
+// (x2[i], y2, z2[i]), drawn as EmitArrow or EmitLine would draw them.
+// sourceStep is 1, or 0 when every edge leaves the same neuron; colors is
+// as for EmitNeuronSpheres.
+void EmitNeuronEdges(SceneCache* sc, int count, const float* x1, const float* z1, int sourceStep, float y1,
+                     const float* x2, const float* z2, float y2, const float* colors, const float* color) {
+    GeometryBuffer* lines = &sc->lines;
+    int i = 0;
+    if (!geometryKernels) {
+        for (; i < count; i++) {
+            const float* c = colors ? &colors[i * 3] : color;
+            if (edgeSettings.arrowheads)
+                EmitArrow(sc, x1[i * sourceStep], y1, z1[i * sourceStep], x2[i], y2, z2[i], c);
+            else
+                EmitLine(sc, x1[i * sourceStep], y1, z1[i * sourceStep], x2[i], y2, z2[i], c);
+        }
+        return;
+    }
+    ReserveGeometry(lines, count * 2, count * 2);
+    if (!edgeSettings.arrowheads) {
+        for (; i < count; i++) {
+            const float* c = colors ? &colors[i * 3] : color;
+            GLuint base = (GLuint)lines->vertexCount;
+            float* v = lines->vertices + base * 3;
+            float* vc = lines->colors + base * 3;
+            v[0] = x1[i * sourceStep]; v[1] = y1; v[2] = z1[i * sourceStep];
+            v[3] = x2[i];              v[4] = y2; v[5] = z2[i];
+            vc[0] = vc[3] = c[0]; vc[1] = vc[4] = c[1]; vc[2] = vc[5] = c[2];
+            lines->indices[lines->indexCount++] = base;
+            lines->indices[lines->indexCount++] = base + 1;
+            lines->vertexCount += 2;
+        }
+        return;
+    }
+    ReserveInstances(&sc->cones, count);
+#if defined(__SSE2__) || defined(_M_X64)
+    const __m128 sign = _mm_set1_ps(-0.0f), zero = _mm_setzero_ps(), half = _mm_set1_ps(0.5f);
+    const __m128 headRadius = _mm_set1_ps(0.2f), vy1 = _mm_set1_ps(y1), dy = _mm_set1_ps(y2 - y1);
+    for (; i + 4 <= count; i += 4) {
+        __m128 sx = sourceStep ? _mm_loadu_ps(x1 + i) : _mm_set1_ps(x1[0]);
+        __m128 sz = sourceStep ? _mm_loadu_ps(z1 + i) : _mm_set1_ps(z1[0]);
+        __m128 dx = _mm_sub_ps(_mm_loadu_ps(x2 + i), sx);
+        __m128 dz = _mm_sub_ps(_mm_loadu_ps(z2 + i), sz);
+        __m128 length = _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz)));
+        if (_mm_movemask_ps(_mm_cmplt_ps(length, _mm_set1_ps(0.0001f)))) {
+            for (int k = i; k < i + 4; k++)     // Skipped by EmitArrow
+                EmitArrow(sc, x1[k * sourceStep], y1, z1[k * sourceStep], x2[k], y2, z2[k],
+                          colors ? &colors[k * 3] : color);
+            continue;
+        }
+        __m128 longer = _mm_cmpgt_ps(length, half);
+        __m128 head = _mm_or_ps(_mm_and_ps(longer, half), _mm_andnot_ps(longer, _mm_mul_ps(half, length)));
+        __m128 shaft = _mm_sub_ps(length, head);
+        __m128 dirX = _mm_div_ps(dx, length), dirY = _mm_div_ps(dy, length), dirZ = _mm_div_ps(dz, length);
+        __m128 endX = _mm_add_ps(sx, _mm_mul_ps(dirX, shaft));
+        __m128 endY = _mm_add_ps(vy1, _mm_mul_ps(dirY, shaft));
+        __m128 endZ = _mm_add_ps(sz, _mm_mul_ps(dirZ, shaft));
+        
+        // EmitArrow's basis choice as a lane mask.
+        __m128 steep = _mm_cmplt_ps(_mm_andnot_ps(sign, dirX), _mm_set1_ps(0.9f));
+        __m128 ux = _mm_andnot_ps(steep, _mm_xor_ps(dirZ, sign));
+        __m128 uy = _mm_and_ps(steep, dirZ);
+        __m128 uz = _mm_or_ps(_mm_and_ps(steep, _mm_xor_ps(dirY, sign)), _mm_andnot_ps(steep, dirX));
+        __m128 ulen = _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(ux, ux), _mm_mul_ps(uy, uy)), _mm_mul_ps(uz, uz)));
+        ux = _mm_div_ps(ux, ulen); uy = _mm_div_ps(uy, ulen); uz = _mm_div_ps(uz, ulen);
+        __m128 vx = _mm_sub_ps(_mm_mul_ps(dirY, uz), _mm_mul_ps(dirZ, uy));
+        __m128 vy = _mm_sub_ps(_mm_mul_ps(dirZ, ux), _mm_mul_ps(dirX, uz));
+        __m128 vz = _mm_sub_ps(_mm_mul_ps(dirX, uy), _mm_mul_ps(dirY, ux));
+        
+        // Lanes hold one component of four arrows; transposed, each vector is
+        // one column of one arrowhead's transform.
+        __m128 c0[4] = { _mm_mul_ps(ux, headRadius), _mm_mul_ps(uy, headRadius), _mm_mul_ps(uz, headRadius), zero };
+        __m128 c1[4] = { _mm_mul_ps(vx, headRadius), _mm_mul_ps(vy, headRadius), _mm_mul_ps(vz, headRadius), zero };
+        __m128 c2[4] = { _mm_mul_ps(dirX, head), _mm_mul_ps(dirY, head), _mm_mul_ps(dirZ, head), zero };
+        __m128 c3[4] = { endX, endY, endZ, _mm_set1_ps(1.0f) };
+        _MM_TRANSPOSE4_PS(c0[0], c0[1], c0[2], c0[3]);
+        _MM_TRANSPOSE4_PS(c1[0], c1[1], c1[2], c1[3]);
+        _MM_TRANSPOSE4_PS(c2[0], c2[1], c2[2], c2[3]);
+        _MM_TRANSPOSE4_PS(c3[0], c3[1], c3[2], c3[3]);
+        float shaftEnd[4][4];
+        for (int k = 0; k < 4; k++) {
+            MeshInstance* inst = &sc->cones.items[sc->cones.count + k];
+            const float* c = colors ? &colors[(i + k) * 3] : color;
+            _mm_storeu_ps(inst->transform, c0[k]);
+            _mm_storeu_ps(inst->transform + 4, c1[k]);
+            _mm_storeu_ps(inst->transform + 8, c2[k]);
+            _mm_storeu_ps(inst->transform + 12, c3[k]);
+            _mm_storeu_ps(shaftEnd[k], c3[k]);
+            inst->color[0] = c[0]; inst->color[1] = c[1]; inst->color[2] = c[2];
+            
+            GLuint base = (GLuint)lines->vertexCount;
+            float* v = lines->vertices + base * 3;
+            float* vc = lines->colors + base * 3;
+            v[0] = x1[(i + k) * sourceStep]; v[1] = y1; v[2] = z1[(i + k) * sourceStep];
+            v[3] = shaftEnd[k][0];           v[4] = shaftEnd[k][1]; v[5] = shaftEnd[k][2];
+            vc[0] = vc[3] = c[0]; vc[1] = vc[4] = c[1]; vc[2] = vc[5] = c[2];
+            lines->indices[lines->indexCount++] = base;
+            lines->indices[lines->indexCount++] = base + 1;
+            lines->vertexCount += 2;
+        }
+        sc->cones.count += 4;
+    }
+#endif
+    for (; i < count; i++)
+        EmitArrow(sc, x1[i * sourceStep], y1, z1[i * sourceStep], x2[i], y2, z2[i], colors ? &colors[i * 3] : color);
+}
+
+// dst[i] = src[i] + offset, for moving a part's indices behind the vertices
+// already in a buffer.
+void RebaseIndices(GLuint* dst, const GLuint* src, int count, GLuint offset) {
+    int i = 0;
+#if defined(__SSE2__) || defined(_M_X64)
+    const __m128i add = _mm_set1_epi32((int)offset);
+    for (; i + 4 <= count; i += 4)
+        _mm_storeu_si128((__m128i*)(dst + i), _mm_add_epi32(_mm_loadu_si128((const __m128i*)(src + i)), add));
+#endif
+    for (; i < count; i++)
+        dst[i] = src[i] + offset;
+}
+
+//-------------------------
+// Cached Meshes & Instancing
+//-------------------------
+
+// Tessellate every shape at every detail level once, before the first scene is drawn.
+void BuildMeshCache(void) {
+    static const int sphereDetail[MESH_DETAIL_LEVELS][2] = { {16, 16}, {10, 8}, {6, 4} };
+    static const int coneDetail[MESH_DETAIL_LEVELS] = { 12, 8, 4 };
+    for (int level = 0; level < MESH_DETAIL_LEVELS; level++) {
+        TessellateSphere(&meshCache[MESH_SPHERE][level], sphereDetail[level][0], sphereDetail[level][1]);
+        TessellateCone(&meshCache[MESH_CONE][level], coneDetail[level]);
+        TessellateBox(&meshCache[MESH_BOX][level]);
+    }
+}
+
+// Same parametrization as gluSphere: slices around z, stacks from +z to -z.
+void TessellateSphere(Mesh* mesh, int slices, int stacks) {
+    mesh->vertexCount = (slices + 1) * (stacks + 1);
+    mesh->indexCount = slices * stacks * 6;
+    mesh->vertices = malloc(mesh->vertexCount * 3 * sizeof(float));
+    mesh->indices = malloc(mesh->indexCount * sizeof(GLuint));
+    if (!mesh->vertices || !mesh->indices) {
+        printf("Error: Out of memory tessellating meshes.\n");
+        exit(EXIT_FAILURE);
+    }
+    float* v = mesh->vertices;
+    for (int j = 0; j <= stacks; j++) {
+        float phi = (float)(PI * j / stacks);
+        for (int i = 0; i <= slices; i++) {
+            float theta = (float)(2.0 * PI * i / slices);
+            *v++ = sinf(phi) * cosf(theta);
+            *v++ = sinf(phi) * sinf(theta);
+            *v++ = cosf(phi);
+        }
+    }
+    GLuint* idx = mesh->indices;
+    for (int j = 0; j < stacks; j++) {
+        for (int i = 0; i < slices; i++) {
+            GLuint a = j * (slices + 1) + i;
+            GLuint b = a + slices + 1;
+            *idx++ = a; *idx++ = b;     *idx++ = a + 1;
+            *idx++ = b; *idx++ = b + 1; *idx++ = a + 1;
+        }
+    }
+}
+
+// Open cone like gluCylinder(base 1, top 0, height 1): a base ring plus apex.
+void TessellateCone(Mesh* mesh, int slices) {
+    mesh->vertexCount = slices + 1;
+    mesh->indexCount = slices * 3;
+    mesh->vertices = malloc(mesh->vertexCount * 3 * sizeof(float));
+    mesh->indices = malloc(mesh->indexCount * sizeof(GLuint));
+    if (!mesh->vertices || !mesh->indices) {
+        printf("Error: Out of memory tessellating meshes.\n");
+        exit(EXIT_FAILURE);
+    }
+    float* v = mesh->vertices;
+    for (int i = 0; i < slices; i++) {
+        float theta = (float)(2.0 * PI * i / slices);
+        *v++ = cosf(theta);
+        *v++ = sinf(theta);
+        *v++ = 0.0f;
+    }
+    v[0] = 0.0f; v[1] = 0.0f; v[2] = 1.0f;
+    GLuint apex = (GLuint)slices;
+    for (int i = 0; i < slices; i++) {
+        mesh->indices[i * 3 + 0] = (GLuint)i;
+        mesh->indices[i * 3 + 1] = (GLuint)((i + 1) % slices);
+        mesh->indices[i * 3 + 2] = apex;
+    }
+}
+
+// The corners and faces EmitBox writes, around the origin.
+void TessellateBox(Mesh* mesh) {
+    mesh->vertexCount = 8;
+    mesh->indexCount = 36;
+    mesh->vertices = malloc(mesh->vertexCount * 3 * sizeof(float));
+    mesh->indices = malloc(mesh->indexCount * sizeof(GLuint));
+    if (!mesh->vertices || !mesh->indices) {
+        printf("Error: Out of memory tessellating meshes.\n");
+        exit(EXIT_FAILURE);
+    }
+    for (int c = 0; c < 8; c++) {
+        mesh->vertices[c * 3 + 0] = (c & 1) ? 0.5f : -0.5f;
+        mesh->vertices[c * 3 + 1] = (c & 2) ? 0.5f : -0.5f;
+        mesh->vertices[c * 3 + 2] = (c & 4) ? 0.5f : -0.5f;
+    }
+    GLuint* idx = mesh->indices;
+    for (int q = 0; q < 24; q += 4) {
+        *idx++ = boxQuads[q]; *idx++ = boxQuads[q + 1]; *idx++ = boxQuads[q + 2];
+        *idx++ = boxQuads[q]; *idx++ = boxQuads[q + 2]; *idx++ = boxQuads[q + 3];
+    }
+}
+
+#ifdef _WIN32
+void UploadMesh(Mesh* mesh) {
+    if (!pglGenBuffers)
+        return;
+    pglGenBuffers(2, mesh->vbo);
+    pglBindBuffer(GL_ARRAY_BUFFER, mesh->vbo[0]);
+    pglBufferData(GL_ARRAY_BUFFER, mesh->vertexCount * 3 * sizeof(float), mesh->vertices, GL_STATIC_DRAW);
+    pglBindBuffer(GL_ARRAY_BUFFER, 0);
+    pglBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh->vbo[1]);
+    pglBufferData(GL_ELEMENT_ARRAY_BUFFER, mesh->indexCount * sizeof(GLuint), mesh->indices, GL_STATIC_DRAW);
+    pglBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+}
+
+void UploadMeshCache(void) {
+    for (int kind = 0; kind < MESH_KIND_COUNT; kind++)
+        for (int level = 0; level < MESH_DETAIL_LEVELS; level++)
+            UploadMesh(&meshCache[kind][level]);
+}
+#endif
+
+// The returned slot is uninitialized; the caller fills transform and color.
+MeshInstance* AppendInstance(InstanceList* list) {
+    ReserveInstances(list, 1);
+    return &list->items[list->count++];
+}
+
+void ReserveInstances(InstanceList* list, int extra) {
+    if (list->count + extra <= list->capacity)
+        return;
+    if (list->fixedCapacity)
+        SliceOverflow();
+    if (list->mapped) {
+        list->items = DuplicateArray(list->items, (size_t)list->count * sizeof(MeshInstance));
+        list->mapped = 0;
+    }
+    int capacity = list->capacity ? list->capacity : 64;
+    while (capacity < list->count + extra)
+        capacity *= 2;
+    MeshInstance* items = realloc(list->items, capacity * sizeof(MeshInstance));
+    if (!items) {
+        printf("Error: Out of memory building scene geometry.\n");
+        exit(EXIT_FAILURE);
+    }
+    list->items = items;
+    list->capacity = capacity;
+}
+
+// Coarser meshes once a batch gets large enough that silhouettes stop mattering.
+int ChooseMeshDetail(int instanceCount) {
+    if (instanceCount > 20000)
+        return 2;
+    if (instanceCount > 2000)
+        return 1;
+    return 0;
+}
+
+#ifdef _WIN32
+// Replace the contents of instanceBuffer with count instances. The buffer is
+// orphaned first, so the driver need not wait for draws still reading it.
+void StreamInstances(const MeshInstance* items, int count) {
+    if (count > instanceBufferCapacity) {
+        instanceBufferCapacity = instanceBufferCapacity ? instanceBufferCapacity : 4096;
+        while (instanceBufferCapacity < count)
+            instanceBufferCapacity *= 2;
+    }
+    pglBindBuffer(GL_ARRAY_BUFFER, instanceBuffer);
+    pglBufferData(GL_ARRAY_BUFFER, (ptrdiff_t)instanceBufferCapacity * sizeof(MeshInstance), NULL, GL_STREAM_DRAW);
+    pglBufferSubData(GL_ARRAY_BUFFER, 0, (ptrdiff_t)count * sizeof(MeshInstance), items);
+    pglBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+// One instanced draw of mesh for instances [first, first + count) of what
+// StreamInstances last wrote.
+void DrawStreamedInstances(const Mesh* mesh, int first, int count) {
+    if (count == 0)
+        return;
+    size_t base = (size_t)first * sizeof(MeshInstance);
+    pglUseProgram(instanceProgram);
+    pglBindBuffer(GL_ARRAY_BUFFER, mesh->vbo[0]);
+    pglVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, (const void*)0);
+    pglEnableVertexAttribArray(0);
+    pglBindBuffer(GL_ARRAY_BUFFER, instanceBuffer);
+    for (GLuint a = 1; a <= 5; a++) {
+        size_t field = base + (a < 5 ? (a - 1) * 4 * sizeof(float) : offsetof(MeshInstance, color));
+        pglVertexAttribPointer(a, a < 5 ? 4 : 3, GL_FLOAT, GL_FALSE, sizeof(MeshInstance), (const void*)field);
+        pglEnableVertexAttribArray(a);
+        pglVertexAttribDivisor(a, 1);
+    }
+    pglBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh->vbo[1]);
+    pglDrawElementsInstanced(GL_TRIANGLES, mesh->indexCount, GL_UNSIGNED_INT, (const void*)0, count);
+    for (GLuint a = 0; a <= 5; a++) {
+        pglVertexAttribDivisor(a, 0);
+        pglDisableVertexAttribArray(a);
+    }
+    pglBindBuffer(GL_ARRAY_BUFFER, 0);
+    pglBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+    pglUseProgram(0);
+    ProfileCount(PROF_DRAW_CALLS, 1);
+    ProfileCount(PROF_INSTANCES, count);
+    ProfileCount(PROF_VERTICES, (long long)count * mesh->indexCount);
+}
+
+// One instanced draw when the driver has instancing. Otherwise fixed-function
+// GL draws each instance on its own: the mesh is bound once and an instance
+// costs a matrix, a color and an indexed draw.
+void DrawInstances(const Mesh* mesh, const InstanceList* list, int first, int count) {
+    if (count == 0)
+        return;
+    if (instanceProgram && mesh->vbo[0]) {
+        StreamInstances(list->items + first, count);
+        DrawStreamedInstances(mesh, 0, count);
+        return;
+    }
+    glEnableClientState(GL_VERTEX_ARRAY);
+    const void* indices = mesh->indices;
+    if (mesh->vbo[0]) {
+        pglBindBuffer(GL_ARRAY_BUFFER, mesh->vbo[0]);
+        glVertexPointer(3, GL_FLOAT, 0, (const void*)0);
+        pglBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh->vbo[1]);
+        indices = (const void*)0;
+    } else {
+        glVertexPointer(3, GL_FLOAT, 0, mesh->vertices);
+    }
+    for (int i = first; i < first + count; i++) {
+        const MeshInstance* inst = &list->items[i];
+        glColor3fv(inst->color);
+        glPushMatrix();
+        glMultMatrixf(inst->transform);
+        glDrawElements(GL_TRIANGLES, mesh->indexCount, GL_UNSIGNED_INT, indices);
+        glPopMatrix();
+    }
+    ProfileCount(PROF_DRAW_CALLS, count);
+    ProfileCount(PROF_INSTANCES, count);
+    ProfileCount(PROF_VERTICES, (long long)count * mesh->indexCount);
+    if (mesh->vbo[0]) {
+        pglBindBuffer(GL_ARRAY_BUFFER, 0);
+        pglBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+    }
+    glDisableClientState(GL_VERTEX_ARRAY);
+}
+#endif
+
+void ReleaseMeshCache(void) {
+    for (int kind = 0; kind < MESH_KIND_COUNT; kind++) {
+        for (int level = 0; level < MESH_DETAIL_LEVELS; level++) {
+            Mesh* mesh = &meshCache[kind][level];
+#ifdef _WIN32
+            if (mesh->vbo[0])
+                pglDeleteBuffers(2, mesh->vbo);
+#endif
+            free(mesh->vertices);
+            free(mesh->indices);
+            memset(mesh, 0, sizeof(Mesh));
+        }
+    }
+}
+
+//-------------------------
+// Retained Scene Buffers
+//-------------------------
+
+#ifdef _WIN32
+void MarkSceneDirty(void) {
+    scene.dirty = 1;
+    sceneSettings++;
+    redrawPending = 1;
+}
+#endif
+
+void ReserveGeometry(GeometryBuffer* buf, int extraVertices, int extraIndices) {
+    int grow = buf->vertexCount + extraVertices > buf->vertexCapacity || buf->indexCount + extraIndices > buf->indexCapacity;
+    if (grow && buf->fixedCapacity)
+        SliceOverflow();
+    if (grow && buf->mapped) {
+        buf->vertices = DuplicateArray(buf->vertices, (size_t)buf->vertexCount * 3 * sizeof(float));
+        buf->colors = DuplicateArray(buf->colors, (size_t)buf->vertexCount * 3 * sizeof(float));
+        buf->indices = DuplicateArray(buf->indices, (size_t)buf->indexCount * sizeof(GLuint));
+        buf->mapped = 0;
+    }
+    if (buf->vertexCount + extraVertices > buf->vertexCapacity) {
+        int capacity = buf->vertexCapacity ? buf->vertexCapacity : 256;
+        while (capacity < buf->vertexCount + extraVertices)
+            capacity *= 2;
+        buf->vertices = realloc(buf->vertices, capacity * 3 * sizeof(float));
+        buf->colors = realloc(buf->colors, capacity * 3 * sizeof(float));
+        if (!buf->vertices || !buf->colors) {
+            printf("Error: Out of memory building scene geometry.\n");
+            exit(EXIT_FAILURE);
+        }
+        buf->vertexCapacity = capacity;
+    }
+    if (buf->indexCount + extraIndices > buf->indexCapacity) {
+        int capacity = buf->indexCapacity ? buf->indexCapacity : 256;
+        while (capacity < buf->indexCount + extraIndices)
+            capacity *= 2;
+        buf->indices = realloc(buf->indices, capacity * sizeof(GLuint));
+        if (!buf->indices) {
+            printf("Error: Out of memory building scene geometry.\n");
+            exit(EXIT_FAILURE);
+        }
+        buf->indexCapacity = capacity;
+    }
+}
+
+// A part of a parallel build emitted more than SceneItemSize counted for it.
+// Growing its slice would move memory shared with the other parts.
+void SliceOverflow(void) {
+    printf("Error: Scene part outgrew the size counted for it.\n");
+    exit(EXIT_FAILURE);
+}
+
+// Caller must have reserved room with ReserveGeometry.
+void AppendVertex(GeometryBuffer* buf, float x, float y, float z, const float* color) {
+    float* v = buf->vertices + buf->vertexCount * 3;
+    float* c = buf->colors + buf->vertexCount * 3;
+    v[0] = x; v[1] = y; v[2] = z;
+    c[0] = color[0]; c[1] = color[1]; c[2] = color[2];
+    buf->vertexCount++;
+}
+
+// Widen the ranges the next UploadPatchedGeometry sends.
+void MarkPatched(GeometryBuffer* buf, int firstVertex, int endVertex, int firstIndex, int endIndex) {
+    int* v = buf->patchedVertices;
+    int* i = buf->patchedIndices;
+    if (endVertex > firstVertex) {
+        v[0] = v[1] > v[0] && v[0] < firstVertex ? v[0] : firstVertex;
+        v[1] = v[1] > endVertex ? v[1] : endVertex;
+    }
+    if (endIndex > firstIndex) {
+        i[0] = i[1] > i[0] && i[0] < firstIndex ? i[0] : firstIndex;
+        i[1] = i[1] > endIndex ? i[1] : endIndex;
+    }
+}
+
+// Widen the range of vertices whose colors alone the next upload sends.
+void MarkRecolored(GeometryBuffer* buf, int firstVertex, int endVertex) {
+    int* c = buf->patchedColors;
+    if (endVertex > firstVertex) {
+        c[0] = c[1] > c[0] && c[0] < firstVertex ? c[0] : firstVertex;
+        c[1] = c[1] > endVertex ? c[1] : endVertex;
+    }
+}
+
+#ifdef _WIN32
+// Copy the buffer into GPU buffer objects when the driver supports them.
+// They are sized to the buffer's capacity, so patches that append geometry
+// can still be uploaded piecewise.
+void UploadGeometry(GeometryBuffer* buf) {
+    memset(buf->patchedVertices, 0, sizeof(buf->patchedVertices));
+    memset(buf->patchedIndices, 0, sizeof(buf->patchedIndices));
+    memset(buf->patchedColors, 0, sizeof(buf->patchedColors));
+    if (!pglGenBuffers)
+        return;
+    if (!buf->vbo[0])
+        pglGenBuffers(3, buf->vbo);
+    pglBindBuffer(GL_ARRAY_BUFFER, buf->vbo[0]);
+    pglBufferData(GL_ARRAY_BUFFER, buf->vertexCapacity * 3 * sizeof(float), NULL, GL_STATIC_DRAW);
+    pglBufferSubData(GL_ARRAY_BUFFER, 0, buf->vertexCount * 3 * sizeof(float), buf->vertices);
+    pglBindBuffer(GL_ARRAY_BUFFER, buf->vbo[1]);
+    pglBufferData(GL_ARRAY_BUFFER, buf->vertexCapacity * 3 * sizeof(float), NULL, GL_STATIC_DRAW);
+    pglBufferSubData(GL_ARRAY_BUFFER, 0, buf->vertexCount * 3 * sizeof(float), buf->colors);
+    pglBindBuffer(GL_ARRAY_BUFFER, 0);
+    pglBindBuffer(GL_ELEMENT_ARRAY_BUFFER, buf->vbo[2]);
+    pglBufferData(GL_ELEMENT_ARRAY_BUFFER, buf->indexCapacity * sizeof(GLuint), NULL, GL_STATIC_DRAW);
+    pglBufferSubData(GL_ELEMENT_ARRAY_BUFFER, 0, buf->indexCount * sizeof(GLuint), buf->indices);
+    pglBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+    buf->gpuVertexCapacity = buf->vertexCapacity;
+    buf->gpuIndexCapacity = buf->indexCapacity;
+}
+
+// Send only the ranges patches rewrote or recolored, or everything once the
+// buffer has outgrown its buffer objects.
+void UploadPatchedGeometry(GeometryBuffer* buf) {
+    if (!buf->vbo[0] || buf->vertexCount > buf->gpuVertexCapacity || buf->indexCount > buf->gpuIndexCapacity) {
+        UploadGeometry(buf);
+        return;
+    }
+    int* v = buf->patchedVertices;
+    int* i = buf->patchedIndices;
+    if (v[1] > v[0]) {
+        pglBindBuffer(GL_ARRAY_BUFFER, buf->vbo[0]);
+        pglBufferSubData(GL_ARRAY_BUFFER, v[0] * 3 * sizeof(float), (v[1] - v[0]) * 3 * sizeof(float), buf->vertices + v[0] * 3);
+        pglBindBuffer(GL_ARRAY_BUFFER, buf->vbo[1]);
+        pglBufferSubData(GL_ARRAY_BUFFER, v[0] * 3 * sizeof(float), (v[1] - v[0]) * 3 * sizeof(float), buf->colors + v[0] * 3);
+        pglBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+    int* c = buf->patchedColors;
+    if (c[1] > c[0]) {
+        pglBindBuffer(GL_ARRAY_BUFFER, buf->vbo[1]);
+        pglBufferSubData(GL_ARRAY_BUFFER, c[0] * 3 * sizeof(float), (c[1] - c[0]) * 3 * sizeof(float), buf->colors + c[0] * 3);
+        pglBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+    if (i[1] > i[0]) {
+        pglBindBuffer(GL_ELEMENT_ARRAY_BUFFER, buf->vbo[2]);
+        pglBufferSubData(GL_ELEMENT_ARRAY_BUFFER, i[0] * sizeof(GLuint), (i[1] - i[0]) * sizeof(GLuint), buf->indices + i[0]);
+        pglBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+    }
+    v[0] = v[1] = i[0] = i[1] = c[0] = c[1] = 0;
+}
+
+// Draw the whole buffer, or only subset (indices into its vertices) when given.
+void DrawGeometry(const GeometryBuffer* buf, GLenum mode, const GLuint* subset, int subsetCount) {
+    int count = subset ? subsetCount : buf->indexCount;
+    if (count == 0)
+        return;
+    glEnableClientState(GL_VERTEX_ARRAY);
+    glEnableClientState(GL_COLOR_ARRAY);
+    if (buf->vbo[0]) {
+        pglBindBuffer(GL_ARRAY_BUFFER, buf->vbo[0]);
+        glVertexPointer(3, GL_FLOAT, 0, (const void*)0);
+        pglBindBuffer(GL_ARRAY_BUFFER, buf->vbo[1]);
+        glColorPointer(3, GL_FLOAT, 0, (const void*)0);
+        if (subset) {
+            glDrawElements(mode, count, GL_UNSIGNED_INT, subset);
+        } else {
+            pglBindBuffer(GL_ELEMENT_ARRAY_BUFFER, buf->vbo[2]);
+            glDrawElements(mode, count, GL_UNSIGNED_INT, (const void*)0);
+            pglBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+        }
+        pglBindBuffer(GL_ARRAY_BUFFER, 0);
+    } else {
+        glVertexPointer(3, GL_FLOAT, 0, buf->vertices);
+        glColorPointer(3, GL_FLOAT, 0, buf->colors);
+        glDrawElements(mode, count, GL_UNSIGNED_INT, subset ? subset : buf->indices);
+    }
+    glDisableClientState(GL_COLOR_ARRAY);
+    glDisableClientState(GL_VERTEX_ARRAY);
+    ProfileCount(PROF_DRAW_CALLS, 1);
+    ProfileCount(PROF_VERTICES, count);
+}
+#endif
+
+// Walk the network graph once and bake everything into the scene cache.
+// Arrows are emitted grouped by the layer they point into, so every layer
+// owns one run of arrows and one body that PatchScene can redo. Large graphs
+// are emitted in parts on several threads, each into its own slice of the
+// buffers, which gives the same scene as one thread would.
+void BuildScene(SceneCache* sc, const NetworkGraph* net) {
+    double profileStart = ProfileStart();
+    sc->triangles.vertexCount = sc->triangles.indexCount = 0;
+    sc->lines.vertexCount = sc->lines.indexCount = 0;
+    sc->spheres.count = 0;
+    sc->cones.count = 0;
+    sc->elementCount = 0;
+    sc->retiredElements = 0;
+    memset(sc->elementStart, 0, sizeof(sc->elementStart));
+    sc->openLayer = -1;
+    sc->openLod = LOD_MASK_ALL;
+    sc->openArrowFrom = sc->openArrowTo = -1;
+    ReserveSceneLayers(sc, net->layerCount);
+    sc->layerCount = net->layerCount;
+    
+    GroupEdgesByTarget(sc, net);
+    int threadCount = sceneBuildThreads > 0 ? sceneBuildThreads : CpuCount();
+    if (threadCount > 1 && net->layerCount >= SCENE_PART_ITEMS)
+        EmitScenePartsParallel(sc, net, threadCount);
+    else
+        EmitSceneItems(sc, net, 0, 2 * net->layerCount);
+    BuildSceneBvh(sc);
+    sc->buildCount++;
+    sc->builtRevision = net->revision;
+    sc->dirty = 0;
+    ProfileEnd(PROF_SCENE_BUILD, profileStart);
+}
+
+void ReserveSceneLayers(SceneCache* sc, int layerCount) {
+    if (layerCount <= sc->layerCapacity)
+        return;
+    LayerLodInfo* layers = SceneRealloc(sc, sc->layers, sc->layerCount * sizeof(LayerLodInfo), layerCount * sizeof(LayerLodInfo));
+    LayerSpan* spans = SceneRealloc(sc, sc->spans, sc->layerCount * sizeof(LayerSpan), layerCount * sizeof(LayerSpan));
+    if (!layers || !spans) {
+        printf("Error: Out of memory building scene geometry.\n");
+        exit(EXIT_FAILURE);
+    }
+    sc->layers = layers;
+    sc->spans = spans;
+    sc->layerCapacity = layerCount;
+}
+
+// Counting sort of the edges by target layer. It is stable, so each layer's
+// arrows keep the graph's edge order.
+void GroupEdgesByTarget(SceneCache* sc, const NetworkGraph* net) {
+    int n = net->layerCount;
+    if (n + 1 > sc->inCapacity) {
+        SceneFree(sc, sc->inStart);
+        sc->inStart = malloc((n + 1) * sizeof(int));
+        sc->inCapacity = n + 1;
+    }
+    if (net->edgeCount > sc->inEdgeCapacity) {
+        SceneFree(sc, sc->inEdges);
+        sc->inEdges = malloc(net->edgeCount * sizeof(int));
+        sc->inEdgeCapacity = net->edgeCount;
+    }
+    if (!sc->inStart || (!sc->inEdges && net->edgeCount > 0)) {
+        printf("Error: Out of memory building scene geometry.\n");
+        exit(EXIT_FAILURE);
+    }
+    memset(sc->inStart, 0, (n + 1) * sizeof(int));
+    for (int e = 0; e < net->edgeCount; e++)
+        sc->inStart[net->edgeTo[e] + 1]++;
+    for (int v = 0; v < n; v++)
+        sc->inStart[v + 1] += sc->inStart[v];
+    // Fill using each layer's start as its cursor, which leaves it at the
+    // next layer's start; shifting by one restores the offsets.
+    for (int e = 0; e < net->edgeCount; e++)
+        sc->inEdges[sc->inStart[net->edgeTo[e]]++] = e;
+    memmove(sc->inStart + 1, sc->inStart, n * sizeof(int));
+    sc->inStart[0] = 0;
+}
+
+// Build items [begin, end) in order: item i < layerCount is the arrows into
+// layer i, the rest are the layer bodies. Spans count from sc's elements.
+void EmitSceneItems(SceneCache* sc, const NetworkGraph* net, int begin, int end) {
+    int n = net->layerCount;
+    for (int k = begin; k < end; k++) {
+        ElementRange* span = k < n ? &sc->spans[k].edges : &sc->spans[k - n].body;
+        span->first = sc->elementCount;
+        if (k < n)
+            EmitIncomingEdges(sc, net, k);
+        else
+            EmitLayerBody(sc, net, k - n);
+        span->count = sc->elementCount - span->first;
+    }
+}
+
+// What EmitIncomingEdges (item < layerCount) or EmitLayerBody will add for
+// item, added to size: triangle vertices and indices, line vertices and
+// indices, spheres, cones and elements. The parts of a parallel build are
+// laid out from these counts, so they must follow the emitters exactly.
+void SceneItemSize(const SceneCache* sc, const NetworkGraph* net, int item, long long* size) {
+    int n = net->layerCount;
+    if (item < n) {
+        int routed = net->routedEdges == net->edgeCount;
+        for (int k = sc->inStart[item]; k < sc->inStart[item + 1]; k++) {
+            int e = sc->inEdges[k];
+            const float* from = &net->position[net->edgeFrom[e] * 3];
+            const float* to = &net->position[item * 3];
+            int bends = routed ? net->routeStart[e + 1] - net->routeStart[e] : 0;
+            if (bends)
+                from = &net->routePoints[(net->routeStart[e + 1] - 1) * 3];
+            int arrow = ArrowLength(from[0], from[1], from[2], to[0], to[1], to[2]) >= 0.0001f;
+            size[2] += (bends + arrow) * 2;
+            size[3] += (bends + arrow) * 2;
+            size[5] += arrow;
+            size[6] += bends + arrow > 0;
+        }
+        return;
+    }
+    int layer = item - n, neurons = net->neuronCount[layer];
+    if (net->type[layer] == LAYER_BOX) {
+        size[0] += 8;
+        size[1] += 36;
+        size[6] += 1;
+    } else if (net->type[layer] == LAYER_FC && neurons > 0) {
+        long long edges = (long long)neurons * neurons, lines = 0, cones = 0;
+        int batches = (neurons + SCENE_ELEMENT_BATCH - 1) / SCENE_ELEMENT_BATCH;
+        EdgeMode mode = ResolveEdgeMode(edges);
+        size[4] += neurons + 1;         // With the collapsed glyph
+        size[6] += batches + 1;
+        if (mode == EDGE_MODE_SAMPLED) {
+            long long budget = edgeSettings.sampleBudget < edges ? edgeSettings.sampleBudget : edges;
+            lines = cones = budget;
+            size[6] += (budget + SCENE_ELEMENT_BATCH - 1) / SCENE_ELEMENT_BATCH;
+        } else if (mode == EDGE_MODE_BUNDLED) {
+            int bundles = neurons < EDGE_BUNDLES ? neurons : EDGE_BUNDLES;
+            lines = neurons + (long long)bundles * neurons;
+            size[6] += (long long)bundles * (1 + batches);
+        } else if (mode != EDGE_MODE_RIBBON) {
+            lines = cones = edges;
+            size[6] += neurons;
+        }
+        size[0] += 8;                   // The ribbon, as the edges or beside them
+        size[1] += 36;
+        size[2] += lines * 2;
+        size[3] += lines * 2;
+        size[5] += edgeSettings.arrowheads ? cones : 0;
+        size[6] += 1;
+    }
+}
+
+// Bytes BuildScene will allocate for net's geometry, instances and elements,
+// from the same counts a parallel build lays its parts out with. Groups the
+// edges in sc, as BuildScene does first, but allocates no geometry.
+long long PredictSceneBytes(SceneCache* sc, const NetworkGraph* net) {
+    long long size[7] = {0};
+    GroupEdgesByTarget(sc, net);
+    for (int k = 0; k < 2 * net->layerCount; k++)
+        SceneItemSize(sc, net, k, size);
+    return SceneSizeBytes(size);
+}
+
+// Bytes of geometry, instances and elements for counts laid out as
+// SceneItemSize adds them up.
+long long SceneSizeBytes(const long long* size) {
+    return (size[0] + size[2]) * 6 * (long long)sizeof(float) + (size[1] + size[3]) * (long long)sizeof(GLuint) +
+           (size[4] + size[5]) * (long long)sizeof(MeshInstance) + size[6] * (long long)sizeof(SceneElement);
+}
+
+// Whether a scene of bytes is within sceneBuildLimit; says why not when not.
+int SceneWithinLimit(const char* spec, long long bytes) {
+    if (!sceneBuildLimit || bytes <= sceneBuildLimit)
+        return 1;
+    printf("Error: %s needs %.0f MB of scene, more than the %.0f MB allowed.\n", spec, bytes / (1024.0 * 1024.0),
+           sceneBuildLimit / (1024.0 * 1024.0));
+    return 0;
+}
+
+// A run of build items, the counts SceneItemSize gives for it, and where
+// they start in the scene's buffers.
+typedef struct {
+    int begin, end;
+    long long size[7];
+    int start[7];
+} ScenePart;
+
+typedef struct {
+    SceneCache* scene;
+    const NetworkGraph* net;
+    ScenePart* parts;
+    volatile long mismatched;   // Parts that did not fill their slice exactly
+} SceneBuildJob;
+
+void SizeSceneParts(void* ctx, int begin, int end) {
+    SceneBuildJob* job = ctx;
+    for (int p = begin; p < end; p++) {
+        for (int k = job->parts[p].begin; k < job->parts[p].end; k++)
+            SceneItemSize(job->scene, job->net, k, job->parts[p].size);
+    }
+}
+
+// Emit each part through a cache whose buffers are its slices of the
+// scene's, then shift indices, ranges and spans from the slice to the scene.
+// The per-layer arrays are the scene's own: an item writes only its layer's
+// LOD info and span.
+void EmitSceneParts(void* ctx, int begin, int end) {
+    SceneBuildJob* job = ctx;
+    SceneCache* sc = job->scene;
+    for (int p = begin; p < end; p++) {
+        const ScenePart* part = &job->parts[p];
+        const int* s = part->start;
+        SceneCache view;
+        memset(&view, 0, sizeof(view));
+        GeometryBuffer* slices[2] = { &view.triangles, &view.lines };
+        const GeometryBuffer* whole[2] = { &sc->triangles, &sc->lines };
+        for (int b = 0; b < 2; b++) {
+            slices[b]->vertices = whole[b]->vertices + (size_t)s[b * 2] * 3;
+            slices[b]->colors = whole[b]->colors + (size_t)s[b * 2] * 3;
+            slices[b]->indices = whole[b]->indices + s[b * 2 + 1];
+            slices[b]->vertexCapacity = (int)part->size[b * 2];
+            slices[b]->indexCapacity = (int)part->size[b * 2 + 1];
+            slices[b]->fixedCapacity = 1;
+        }
+        view.spheres.items = sc->spheres.items + s[4];
+        view.spheres.capacity = (int)part->size[4];
+        view.spheres.fixedCapacity = 1;
+        view.cones.items = sc->cones.items + s[5];
+        view.cones.capacity = (int)part->size[5];
+        view.cones.fixedCapacity = 1;
+        view.elements = sc->elements + s[6];
+        view.elementCapacity = (int)part->size[6];
+        view.fixedCapacity = 1;
+        view.layers = sc->layers;
+        view.spans = sc->spans;
+        view.inStart = sc->inStart;
+        view.inEdges = sc->inEdges;
+        view.openLayer = view.openArrowFrom = view.openArrowTo = -1;
+        view.openLod = LOD_MASK_ALL;
+        EmitSceneItems(&view, job->net, part->begin, part->end);
+        
+        long long filled[7] = { view.triangles.vertexCount, view.triangles.indexCount, view.lines.vertexCount,
+                                view.lines.indexCount, view.spheres.count, view.cones.count, view.elementCount };
+        if (memcmp(filled, part->size, sizeof(filled)) != 0) {
+            AtomicIncrement(&job->mismatched);
+            continue;
+        }
+        for (int b = 0; b < 2; b++)
+            RebaseIndices(slices[b]->indices, slices[b]->indices, slices[b]->indexCount, (GLuint)s[b * 2]);
+        for (int i = 0; i < view.elementCount; i++) {
+            SceneElement* e = &view.elements[i];
+            e->triVerts.first += s[0];
+            e->triIndices.first += s[1];
+            e->lineVerts.first += s[2];
+            e->lineIndices.first += s[3];
+            e->spheres.first += s[4];
+            e->cones.first += s[5];
+        }
+        for (int k = part->begin; k < part->end; k++) {
+            int n = job->net->layerCount;
+            ElementRange* span = k < n ? &sc->spans[k].edges : &sc->spans[k - n].body;
+            span->first += s[6];
+        }
+    }
+}
+
+// Emit all build items on several threads, straight into the scene's
+// buffers: parts are sized first, so each knows where its geometry goes.
+// There are SCENE_PARTS_PER_THREAD parts per thread, claimed as threads come
+// free, since a fully connected layer costs far more than a box.
+void EmitScenePartsParallel(SceneCache* sc, const NetworkGraph* net, int threadCount) {
+    int items = 2 * net->layerCount;
+    int partCount = threadCount * SCENE_PARTS_PER_THREAD;
+    if (partCount > items / SCENE_PART_ITEMS)
+        partCount = items / SCENE_PART_ITEMS;
+    ScenePart* parts = calloc(partCount, sizeof(ScenePart));
+    if (!parts) {
+        printf("Error: Out of memory building scene geometry.\n");
+        exit(EXIT_FAILURE);
+    }
+    for (int p = 0; p < partCount; p++) {
+        parts[p].begin = (int)((long long)items * p / partCount);
+        parts[p].end = (int)((long long)items * (p + 1) / partCount);
+    }
+    SceneBuildJob job = { sc, net, parts, 0 };
+    ParallelForThreads(partCount, 1, threadCount, SizeSceneParts, &job);
+    
+    long long total[7] = {0};
+    for (int p = 0; p < partCount; p++) {
+        for (int k = 0; k < 7; k++) {
+            parts[p].start[k] = (int)total[k];
+            total[k] += parts[p].size[k];
+        }
+    }
+    for (int k = 0; k < 7; k++) {
+        if (total[k] > INT_MAX / 3) {
+            printf("Error: Scene too large to build.\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    ReserveGeometry(&sc->triangles, (int)total[0], (int)total[1]);
+    ReserveGeometry(&sc->lines, (int)total[2], (int)total[3]);
+    ReserveInstances(&sc->spheres, (int)total[4]);
+    ReserveInstances(&sc->cones, (int)total[5]);
+    ReserveSceneElements(sc, (int)total[6]);
+    ParallelForThreads(partCount, 1, threadCount, EmitSceneParts, &job);
+    if (job.mismatched) {
+        printf("Error: Scene parts did not match their predicted sizes; building on one thread.\n");
+        EmitSceneItems(sc, net, 0, items);
+    } else {
+        sc->triangles.vertexCount = sc->elementStart[0] = (int)total[0];
+        sc->triangles.indexCount = sc->elementStart[1] = (int)total[1];
+        sc->lines.vertexCount = sc->elementStart[2] = (int)total[2];
+        sc->lines.indexCount = sc->elementStart[3] = (int)total[3];
+        sc->spheres.count = sc->elementStart[4] = (int)total[4];
+        sc->cones.count = sc->elementStart[5] = (int)total[5];
+        sc->elementCount = (int)total[6];
+    }
+    free(parts);
+}
+
+// Arrows of the edges into layer. Edges that skip ranks follow their layout
+// route; the arrowhead goes on the last leg.
+void EmitIncomingEdges(SceneCache* sc, const NetworkGraph* net, int layer) {
+    const float arrowColor[3] = { 1.0f, 1.0f, 1.0f };
+    int routed = net->routedEdges == net->edgeCount;
+    sc->openLayer = -1;
+    for (int k = sc->inStart[layer]; k < sc->inStart[layer + 1]; k++) {
+        int e = sc->inEdges[k];
+        const float* from = &net->position[net->edgeFrom[e] * 3];
+        const float* to = &net->position[layer * 3];
+        sc->openArrowFrom = net->edgeFrom[e];
+        sc->openArrowTo = layer;
+        for (int p = routed ? net->routeStart[e] : 0; routed && p < net->routeStart[e + 1]; p++) {
+            const float* bend = &net->routePoints[p * 3];
+            EmitLine(sc, from[0], from[1], from[2], bend[0], bend[1], bend[2], arrowColor);
+            from = bend;
+        }
+        EmitArrow(sc, from[0], from[1], from[2], to[0], to[1], to[2], arrowColor);
+        CloseSceneElement(sc);
+    }
+    sc->openArrowFrom = sc->openArrowTo = -1;
+}
+
+// The layer's box or neuron row, and what LOD selection needs to know of it.
+void EmitLayerBody(SceneCache* sc, const NetworkGraph* net, int layer) {
+    const float* pos = &net->position[layer * 3];
+    float color[3], size[3];
+    const WeightSummary* weights = LayerWeights(net, layer);
+    CostViewStyle(net, layer, color, size);
+    if (weights)
+        WeightLayerColor(net->weights, weights, color);
+    LayerLodInfo* info = &sc->layers[layer];
+    memcpy(info->center, pos, sizeof(info->center));
+    info->featureSize = 0.0f;
+    info->maxLod = LOD_FULL;
+    sc->openLayer = layer;
+    if (net->type[layer] == LAYER_BOX) {
+        EmitBox(sc, pos[0], pos[1], pos[2], size[0], size[1], size[2], color);
+        info->featureSize = fmaxf(size[0], fmaxf(size[1], size[2]));
+        info->maxLod = LOD_LOW_POLY;
+    } else if (net->type[layer] == LAYER_FC) {
+        EmitFullyConnectedLayer(sc, pos, net->neuronCount[layer], color, weights);
+        info->featureSize = 0.6f;
+        info->maxLod = LOD_COLLAPSED;
+    }
+    CloseSceneElement(sc);
+    sc->openLayer = -1;
+}
+
+// Bring the scene up to the graph's revision by redoing only the layers
+// journaled since it was built, the arrows into them and the arrows leaving
+// them. Returns 0, leaving the scene untouched, when the journal does not
+// reach back to the build, when the edits touch enough layers that a
+// rebuild is as cheap, or when retired elements have piled up.
+int PatchScene(SceneCache* sc, const NetworkGraph* net) {
+    int n = net->layerCount;
+    if (sc->dirty || !sc->spans || sc->builtRevision < net->journalStart ||
+        net->revision - sc->builtRevision > n / 4 + 16 || sc->retiredElements > sc->elementCount / 2)
+        return 0;
+    double profileStart = ProfileStart();
+    int oldCount = sc->layerCount, top = n > oldCount ? n : oldCount;
+    if (top > sc->patchFlagCapacity) {
+        free(sc->patchFlags);
+        sc->patchFlags = malloc(top);
+        if (!sc->patchFlags) {
+            printf("Error: Out of memory building scene geometry.\n");
+            exit(EXIT_FAILURE);
+        }
+        sc->patchFlagCapacity = top;
+    }
+    // Bit 1: the body changed, bit 2: the arrows into the layer changed.
+    unsigned char* flags = sc->patchFlags;
+    memset(flags, 0, top);
+    for (int k = sc->builtRevision - net->journalStart; k < net->journalCount; k++) {
+        if (net->journal[k] >= 0 && net->journal[k] < top)
+            flags[net->journal[k]] = 3;
+    }
+    for (int i = oldCount; i < n; i++)
+        flags[i] = 3;
+    for (int e = 0; e < net->edgeCount; e++) {
+        if (flags[net->edgeFrom[e]] & 1)
+            flags[net->edgeTo[e]] |= 2;
+    }
+    
+    ReserveSceneLayers(sc, n);
+    for (int i = oldCount; i < n; i++)
+        memset(&sc->spans[i], 0, sizeof(LayerSpan));
+    for (int i = n; i < oldCount; i++) {
+        RetireSpan(sc, &sc->spans[i].edges);
+        RetireSpan(sc, &sc->spans[i].body);
+    }
+    sc->layerCount = n;
+    sc->elementStart[0] = sc->triangles.vertexCount;
+    sc->elementStart[1] = sc->triangles.indexCount;
+    sc->elementStart[2] = sc->lines.vertexCount;
+    sc->elementStart[3] = sc->lines.indexCount;
+    sc->elementStart[4] = sc->spheres.count;
+    sc->elementStart[5] = sc->cones.count;
+    GroupEdgesByTarget(sc, net);
+    for (int i = 0; i < n; i++) {
+        if (flags[i] & 2) {
+            int first = sc->elementCount;
+            EmitIncomingEdges(sc, net, i);
+            ReplaceSpan(sc, &sc->spans[i].edges, first);
+        }
+        if (flags[i] & 1) {
+            int first = sc->elementCount;
+            EmitLayerBody(sc, net, i);
+            ReplaceSpan(sc, &sc->spans[i].body, first);
+        }
+    }
+    if (sc->elementCount - sc->bvhElementCount > sc->bvhElementCount / 8 + 64)
+        BuildSceneBvh(sc);
+    if (oldCount != n)
+        sc->buildCount++;       // New layers have no LOD state to carry over
+    sc->builtRevision = net->revision;
+    ProfileEnd(PROF_SCENE_PATCH, profileStart);
+    return 1;
+}
+
+// Give span the elements emitted since first. When they have the same shape
+// as the span's current elements they are copied over them, keeping the
+// buffers dense and the BVH valid after a refit; otherwise the old elements
+// are retired and the span moves to the new ones at the end. Returns 1 when
+// the span was replaced in place.
+int ReplaceSpan(SceneCache* sc, ElementRange* span, int first) {
+    int count = sc->elementCount - first;
+    int same = count == span->count;
+    for (int k = 0; k < count && same; k++) {
+        const SceneElement* a = &sc->elements[first + k];
+        const SceneElement* b = &sc->elements[span->first + k];
+        same = a->triVerts.count == b->triVerts.count && a->triIndices.count == b->triIndices.count &&
+               a->lineVerts.count == b->lineVerts.count && a->lineIndices.count == b->lineIndices.count &&
+               a->spheres.count == b->spheres.count && a->cones.count == b->cones.count;
+    }
+    if (!same) {
+        RetireSpan(sc, span);
+        span->first = first;
+        span->count = count;
+        if (count > 0) {
+            const SceneElement* e = &sc->elements[first];
+            MarkPatched(&sc->triangles, e->triVerts.first, sc->triangles.vertexCount,
+                        e->triIndices.first, sc->triangles.indexCount);
+            MarkPatched(&sc->lines, e->lineVerts.first, sc->lines.vertexCount,
+                        e->lineIndices.first, sc->lines.indexCount);
+        }
+        return 0;
+    }
+    if (count == 0)
+        return 1;
+    
+    const SceneElement* from = &sc->elements[first];
+    const SceneElement* to = &sc->elements[span->first];
+    GeometryBuffer* buffers[2] = { &sc->triangles, &sc->lines };
+    int vertexShift[2], indexShift[2];
+    for (int b = 0; b < 2; b++) {
+        GeometryBuffer* buf = buffers[b];
+        int srcVertex = b == 0 ? from->triVerts.first : from->lineVerts.first;
+        int srcIndex = b == 0 ? from->triIndices.first : from->lineIndices.first;
+        int dstVertex = b == 0 ? to->triVerts.first : to->lineVerts.first;
+        int dstIndex = b == 0 ? to->triIndices.first : to->lineIndices.first;
+        int vertices = buf->vertexCount - srcVertex, indices = buf->indexCount - srcIndex;
+        memcpy(buf->vertices + dstVertex * 3, buf->vertices + srcVertex * 3, vertices * 3 * sizeof(float));
+        memcpy(buf->colors + dstVertex * 3, buf->colors + srcVertex * 3, vertices * 3 * sizeof(float));
+        for (int i = 0; i < indices; i++)
+            buf->indices[dstIndex + i] = buf->indices[srcIndex + i] - srcVertex + dstVertex;
+        buf->vertexCount = srcVertex;
+        buf->indexCount = srcIndex;
+        MarkPatched(buf, dstVertex, dstVertex + vertices, dstIndex, dstIndex + indices);
+        vertexShift[b] = dstVertex - srcVertex;
+        indexShift[b] = dstIndex - srcIndex;
+    }
+    int sphereShift = to->spheres.first - from->spheres.first;
+    int coneShift = to->cones.first - from->cones.first;
+    memcpy(sc->spheres.items + to->spheres.first, sc->spheres.items + from->spheres.first,
+           (sc->spheres.count - from->spheres.first) * sizeof(MeshInstance));
+    memcpy(sc->cones.items + to->cones.first, sc->cones.items + from->cones.first,
+           (sc->cones.count - from->cones.first) * sizeof(MeshInstance));
+    sc->spheres.count = from->spheres.first;
+    sc->cones.count = from->cones.first;
+    
+    for (int k = 0; k < count; k++) {
+        SceneElement e = sc->elements[first + k];
+        e.triVerts.first += vertexShift[0];
+        e.triIndices.first += indexShift[0];
+        e.lineVerts.first += vertexShift[1];
+        e.lineIndices.first += indexShift[1];
+        e.spheres.first += sphereShift;
+        e.cones.first += coneShift;
+        sc->elements[span->first + k] = e;
+        RefitBvh(sc, span->first + k);
+    }
+    sc->elementCount = first;
+    sc->elementStart[0] = sc->triangles.vertexCount;
+    sc->elementStart[1] = sc->triangles.indexCount;
+    sc->elementStart[2] = sc->lines.vertexCount;
+    sc->elementStart[3] = sc->lines.indexCount;
+    sc->elementStart[4] = sc->spheres.count;
+    sc->elementStart[5] = sc->cones.count;
+    return 1;
+}
+
+// Stop drawing span's elements. Their geometry stays in the buffers until
+// the next full build.
+void RetireSpan(SceneCache* sc, ElementRange* span) {
+    for (int i = span->first; i < span->first + span->count; i++) {
+        SceneElement* e = &sc->elements[i];
+        e->lodMask = 0;
+        e->layer = -1;
+        e->bounds[0] = e->bounds[1] = e->bounds[2] = 1e30f;
+        e->bounds[3] = e->bounds[4] = e->bounds[5] = -1e30f;
+        RefitBvh(sc, i);
+    }
+    sc->retiredElements += span->count;
+    span->count = 0;
+}
+
+#ifdef _WIN32
+void UploadScene(SceneCache* sc) {
+    double profileStart = ProfileStart();
+    UploadGeometry(&sc->triangles);
+    UploadGeometry(&sc->lines);
+    ProfileEnd(PROF_SCENE_UPLOAD, profileStart);
+}
+
+void UploadScenePatch(SceneCache* sc) {
+    double profileStart = ProfileStart();
+    UploadPatchedGeometry(&sc->triangles);
+    UploadPatchedGeometry(&sc->lines);
+    ProfileEnd(PROF_SCENE_UPLOAD, profileStart);
+}
+
+// Gather the visible elements' instances, spheres of full-detail layers, then
+// of LOD_LOW_POLY layers, then arrowheads, and draw them in three instanced
+// draws.
+void DrawVisibleInstances(const SceneCache* sc, const VisibleSet* vis, const Mesh* sphere, const Mesh* lowSphere,
+                          const Mesh* cone) {
+    int counts[3] = {0};
+    for (int i = 0; i < vis->count; i++) {
+        const SceneElement* e = &sc->elements[vis->items[i]];
+        counts[ElementLod(vis, e) == LOD_LOW_POLY] += e->spheres.count;
+        counts[2] += e->cones.count;
+    }
+    int total = counts[0] + counts[1] + counts[2];
+    if (total > visibleInstanceCapacity) {
+        free(visibleInstances);
+        visibleInstanceCapacity = total * 2;
+        visibleInstances = malloc((size_t)visibleInstanceCapacity * sizeof(MeshInstance));
+        if (!visibleInstances) {
+            printf("Error: Out of memory culling scene.\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    int start[3] = { 0, counts[0], counts[0] + counts[1] };
+    int at[3] = { start[0], start[1], start[2] };
+    for (int i = 0; i < vis->count; i++) {
+        const SceneElement* e = &sc->elements[vis->items[i]];
+        int run = ElementLod(vis, e) == LOD_LOW_POLY;
+        memcpy(visibleInstances + at[run], sc->spheres.items + e->spheres.first,
+               e->spheres.count * sizeof(MeshInstance));
+        memcpy(visibleInstances + at[2], sc->cones.items + e->cones.first, e->cones.count * sizeof(MeshInstance));
+        at[run] += e->spheres.count;
+        at[2] += e->cones.count;
+    }
+    if (total == 0)
+        return;
+    StreamInstances(visibleInstances, total);
+    DrawStreamedInstances(sphere, start[0], counts[0]);
+    DrawStreamedInstances(lowSphere, start[1], counts[1]);
+    DrawStreamedInstances(cone, start[2], counts[2]);
+}
+
+// With everything in view the retained buffers are drawn whole; otherwise the
+// visible elements' indices are gathered so each buffer is still one draw,
+// and so are their instances when the driver can instance.
+// Neurons of layers at LOD_LOW_POLY use the coarsest sphere.
+void DrawSceneBuffers(SceneCache* sc, const VisibleSet* vis) {
+    const Mesh* sphere = &meshCache[MESH_SPHERE][ChooseMeshDetail(sc->spheres.count)];
+    const Mesh* lowSphere = &meshCache[MESH_SPHERE][MESH_DETAIL_LEVELS - 1];
+    const Mesh* cone = &meshCache[MESH_CONE][ChooseMeshDetail(sc->cones.count)];
+    if (vis->allVisible) {
+        DrawGeometry(&sc->triangles, GL_TRIANGLES, NULL, 0);
+        DrawGeometry(&sc->lines, GL_LINES, NULL, 0);
+        DrawInstances(sphere, &sc->spheres, 0, sc->spheres.count);
+        DrawInstances(cone, &sc->cones, 0, sc->cones.count);
+        return;
+    }
+    
+    int triCount = vis->stats.triangles * 3, lineCount = vis->stats.lines * 2;
+    if (triCount + lineCount > visibleIndexCapacity) {
+        free(visibleIndices);
+        visibleIndexCapacity = (triCount + lineCount) * 2;
+        visibleIndices = malloc(visibleIndexCapacity * sizeof(GLuint));
+        if (!visibleIndices) {
+            printf("Error: Out of memory culling scene.\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    GLuint* tri = visibleIndices;
+    GLuint* line = visibleIndices + triCount;
+    for (int i = 0; i < vis->count; i++) {
+        const SceneElement* e = &sc->elements[vis->items[i]];
+        memcpy(tri, sc->triangles.indices + e->triIndices.first, e->triIndices.count * sizeof(GLuint));
+        memcpy(line, sc->lines.indices + e->lineIndices.first, e->lineIndices.count * sizeof(GLuint));
+        tri += e->triIndices.count;
+        line += e->lineIndices.count;
+    }
+    DrawGeometry(&sc->triangles, GL_TRIANGLES, visibleIndices, triCount);
+    DrawGeometry(&sc->lines, GL_LINES, visibleIndices + triCount, lineCount);
+    if (instanceProgram && sphere->vbo[0]) {
+        DrawVisibleInstances(sc, vis, sphere, lowSphere, cone);
+        return;
+    }
+    for (int i = 0; i < vis->count; i++) {
+        const SceneElement* e = &sc->elements[vis->items[i]];
+        DrawInstances(ElementLod(vis, e) == LOD_LOW_POLY ? lowSphere : sphere,
+                      &sc->spheres, e->spheres.first, e->spheres.count);
+    }
+    for (int i = 0; i < vis->count; i++) {
+        const SceneElement* e = &sc->elements[vis->items[i]];
+        DrawInstances(cone, &sc->cones, e->cones.first, e->cones.count);
+    }
+}
+#endif
+
+// Delete the buffer objects the scene was uploaded to, keeping the geometry.
+void ReleaseSceneBuffers(SceneCache* sc) {
+#ifdef _WIN32
+    GeometryBuffer* buffers[2] = { &sc->triangles, &sc->lines };
+    for (int i = 0; i < 2; i++) {
+        if (buffers[i]->vbo[0])
+            pglDeleteBuffers(3, buffers[i]->vbo);
+        memset(buffers[i]->vbo, 0, sizeof(buffers[i]->vbo));
+    }
+#else
+    (void)sc;
+#endif
+}
+
+void ReleaseScene(SceneCache* sc) {
+    GeometryBuffer* buffers[2] = { &sc->triangles, &sc->lines };
+    ReleaseSceneBuffers(sc);
+    for (int i = 0; i < 2; i++) {
+        if (!buffers[i]->mapped) {
+            free(buffers[i]->vertices);
+            free(buffers[i]->colors);
+            free(buffers[i]->indices);
+        }
+        memset(buffers[i], 0, sizeof(GeometryBuffer));
+    }
+    if (!sc->spheres.mapped)
+        free(sc->spheres.items);
+    if (!sc->cones.mapped)
+        free(sc->cones.items);
+    memset(&sc->spheres, 0, sizeof(InstanceList));
+    memset(&sc->cones, 0, sizeof(InstanceList));
+    SceneFree(sc, sc->elements);
+    SceneFree(sc, sc->bvh);
+    SceneFree(sc, sc->bvhItems);
+    SceneFree(sc, sc->bvhParent);
+    SceneFree(sc, sc->elementLeaf);
+    SceneFree(sc, sc->layers);
+    SceneFree(sc, sc->spans);
+    SceneFree(sc, sc->inStart);
+    SceneFree(sc, sc->inEdges);
+    free(sc->patchFlags);
+    if (sc->cacheFile.data)
+        UnmapFile(&sc->cacheFile);
+    memset(&sc->cacheFile, 0, sizeof(MappedFile));
+    sc->elements = NULL;
+    sc->bvh = NULL;
+    sc->bvhItems = NULL;
+    sc->bvhParent = NULL;
+    sc->elementLeaf = NULL;
+    sc->layers = NULL;
+    sc->spans = NULL;
+    sc->inStart = sc->inEdges = NULL;
+    sc->patchFlags = NULL;
+    sc->elementCount = sc->elementCapacity = 0;
+    sc->bvhNodeCount = sc->bvhItemCapacity = sc->bvhElementCount = 0;
+    sc->layerCount = sc->layerCapacity = 0;
+    sc->inCapacity = sc->inEdgeCapacity = sc->patchFlagCapacity = 0;
+    sc->retiredElements = 0;
+    sc->dirty = 1;
+}
+
+// Heap bytes held by the scene's buffers, capacity included.
+size_t SceneMemory(const SceneCache* sc) {
+    const GeometryBuffer* buffers[2] = { &sc->triangles, &sc->lines };
+    size_t bytes = 0;
+    for (int i = 0; i < 2; i++) {
+        bytes += (size_t)buffers[i]->vertexCapacity * 6 * sizeof(float);
+        bytes += (size_t)buffers[i]->indexCapacity * sizeof(GLuint);
+    }
+    bytes += (size_t)(sc->spheres.capacity + sc->cones.capacity) * sizeof(MeshInstance);
+    bytes += (size_t)sc->elementCapacity * sizeof(SceneElement);
+    bytes += (size_t)sc->bvhItemCapacity * (2 * sizeof(int) + 2 * sizeof(BvhNode) + 2 * sizeof(int));
+    bytes += (size_t)sc->layerCapacity * (sizeof(LayerLodInfo) + sizeof(LayerSpan));
+    bytes += (size_t)(sc->inCapacity + sc->inEdgeCapacity) * sizeof(int) + sc->patchFlagCapacity;
+    return bytes;
+}
+
+//-------------------------
+// Live Activations
+//-------------------------
+
+// Map the named stream. Returns 0, leaving live detached, when no producer
+// has created it yet.
+int AttachLiveActivations(LiveActivations* live, const char* name) {
+    DetachLiveActivations(live);
+    memset(live, 0, sizeof(*live));
+    if (!ActivationStreamOpen(&live->stream, name))
+        return 0;
+    return 1;
+}
+
+void DetachLiveActivations(LiveActivations* live) {
+    ActivationStreamClose(&live->stream);
+    live->appliedFrame = 0;
+}
+
+// Whether the scene lacks the newest frame: one was published since, or a
+// build or patch put the layers' own colors back.
+int LiveFramePending(const LiveActivations* live, const SceneCache* sc) {
+    if (!live->stream.header)
+        return 0;
+    return live->appliedFrame != ActivationStreamLoad(&live->stream.header->published) ||
+           live->appliedRevision != sc->builtRevision || live->appliedBuild != sc->buildCount;
+}
+
+// Color layer's body from its frame values: a box by the layer's value,
+// neurons by their bins and the collapsed glyph by the layer's value. The
+// body's spheres are its neurons in order followed by the glyph. Edges keep
+// their colors.
+void RecolorLayer(SceneCache* sc, const NetworkGraph* net, int layer, const float* values, int binCount) {
+    const ElementRange* body = &sc->spans[layer].body;
+    if (body->count == 0)
+        return;
+    const SceneElement* e = &sc->elements[body->first];
+    float rgb[3];
+    // Stream values are untrusted; NaN fails both tests and maps to 0.
+    float v = values[0] > 0.0f ? (values[0] < 1.0f ? values[0] : 1.0f) : 0.0f;
+    HeatColor(v, rgb);
+    if (net->type[layer] == LAYER_BOX) {
+        GeometryBuffer* buf = &sc->triangles;
+        float* c = buf->colors + e->triVerts.first * 3;
+        for (int k = 0; k < e->triVerts.count; k++, c += 3) {
+            c[0] = rgb[0]; c[1] = rgb[1]; c[2] = rgb[2];
+        }
+        MarkRecolored(buf, e->triVerts.first, e->triVerts.first + e->triVerts.count);
+    } else if (net->type[layer] == LAYER_FC && net->neuronCount[layer] > 0) {
+        int n = net->neuronCount[layer];
+        MeshInstance* inst = sc->spheres.items + e->spheres.first;
+        for (int i = 0; i < n; i++) {
+            float b = binCount > 0 ? values[1 + (int)((long long)i * binCount / n)] : values[0];
+            HeatColor(b > 0.0f ? (b < 1.0f ? b : 1.0f) : 0.0f, inst[i].color);
+        }
+        memcpy(inst[n].color, rgb, sizeof(rgb));
+    }
+}
+
+// Recolor the scene from the newest frame when LiveFramePending. Layers
+// beyond the stream's layer count keep their colors. Returns 1 when colors
+// were written; the frame may have been torn, in which case the next call
+// tries again.
+int ApplyLiveActivations(SceneCache* sc, const NetworkGraph* net, LiveActivations* live) {
+    long long frame;
+    if (!LiveFramePending(live, sc))
+        return 0;
+    const float* values = ActivationStreamLatest(&live->stream, &frame);
+    if (!values)
+        return 0;
+    double profileStart = ProfileStart();
+    const ActivationStreamHeader* h = live->stream.header;
+    int layers = (int)h->layerCount < sc->layerCount ? (int)h->layerCount : sc->layerCount;
+    int binCount = (int)h->binCount;
+    if ((int)h->layerCount != net->layerCount && !live->mismatchReported) {
+        printf("Warning: Stream '%s' has %u layers, the network %d; coloring the first %d.\n",
+               live->stream.name, h->layerCount, net->layerCount, layers);
+        live->mismatchReported = 1;
+    }
+    for (int l = 0; l < layers; l++)
+        RecolorLayer(sc, net, l, values + (size_t)l * (1 + binCount), binCount);
+    if (ActivationStreamIntact(&live->stream, frame)) {
+        live->appliedFrame = frame;
+        live->frames++;
+    } else {
+        live->appliedFrame = 0;
+        live->torn++;
+    }
+    live->appliedRevision = sc->builtRevision;
+    live->appliedBuild = sc->buildCount;
+    ProfileEnd(PROF_LIVE_COLORS, profileStart);
+    return 1;
+}
+
+// Stand-in producer: one wave of activity travelling down the layers, each
+// layer's neurons rippling under it. Neurons are synthesized and reduced with
+// ActivationStreamSummarize like a real producer's would be; scratch holds
+// one layer's neurons.
+void FillDemoFrame(ActivationStream* stream, float* frame, long long tick, float* scratch, int neurons) {
+    static float wave[256];
+    static int waveReady = 0;
+    if (!waveReady) {
+        for (int i = 0; i < 256; i++)
+            wave[i] = 0.5f + 0.5f * sinf(i * (2.0f * 3.14159265f / 256.0f));
+        waveReady = 1;
+    }
+    int layers = (int)stream->header->layerCount;
+    for (int l = 0; l < layers; l++) {
+        float pulse = wave[(unsigned)(tick * 2 - (long long)l * 256 / layers) & 255];
+        pulse *= pulse;
+        for (int i = 0; i < neurons; i++)
+            scratch[i] = 2.0f * pulse * wave[(unsigned)(i * 9 + l * 13 + tick * 5) & 255];
+        ActivationStreamSummarize(scratch, neurons, 0.5f, ActivationStreamLayer(stream, frame, l),
+                                  (int)stream->header->binCount);
+    }
+}
+
+//-------------------------
+// Checkpoint Timeline
+//-------------------------
+
+// Natural order: runs of digits compare by value, so step_9 < step_10.
+int CompareCheckpointPaths(const void* a, const void* b) {
+    const char* x = *(const char* const*)a;
+    const char* y = *(const char* const*)b;
+    while (*x && *y) {
+        if (*x >= '0' && *x <= '9' && *y >= '0' && *y <= '9') {
+            while (*x == '0' && x[1] >= '0' && x[1] <= '9')
+                x++;
+            while (*y == '0' && y[1] >= '0' && y[1] <= '9')
+                y++;
+            int nx = 0, ny = 0;
+            while (x[nx] >= '0' && x[nx] <= '9')
+                nx++;
+            while (y[ny] >= '0' && y[ny] <= '9')
+                ny++;
+            int order = nx != ny ? nx - ny : memcmp(x, y, nx);
+            if (order)
+                return order;
+            x += nx;
+            y += ny;
+        } else if (*x != *y) {
+            return (unsigned char)*x - (unsigned char)*y;
+        } else {
+            x++;
+            y++;
+        }
+    }
+    return (unsigned char)*x - (unsigned char)*y;
+}
+
+// Keep dir/name when name is a weight file.
+void AddCheckpointPath(Timeline* tl, const char* dir, const char* name) {
+    size_t len = strlen(name);
+    if (!(len > 4 && _stricmp(name + len - 4, ".npy") == 0) &&
+        !(len > 12 && _stricmp(name + len - 12, ".safetensors") == 0))
+        return;
+    if (tl->count == tl->pathCapacity) {
+        int capacity = tl->pathCapacity ? tl->pathCapacity * 2 : 256;
+        tl->paths = ArenaGrow(&tl->arena, tl->paths, tl->pathCapacity * sizeof(char*), capacity * sizeof(char*));
+        tl->pathCapacity = capacity;
+    }
+    size_t size = strlen(dir) + len + 2;
+    char* path = ArenaAlloc(&tl->arena, size);
+    snprintf(path, size, "%s/%s", dir, name);
+    tl->paths[tl->count++] = path;
+}
+
+// Weight files directly in dir, in natural order. Returns their count.
+int ListCheckpoints(Timeline* tl, const char* dir) {
+#ifdef _WIN32
+    char pattern[300];
+    WIN32_FIND_DATA found;
+    snprintf(pattern, sizeof(pattern), "%s\\*", dir);
+    HANDLE find = FindFirstFile(pattern, &found);
+    if (find != INVALID_HANDLE_VALUE) {
+        do {
+            if (!(found.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY))
+                AddCheckpointPath(tl, dir, found.cFileName);
+        } while (FindNextFile(find, &found));
+        FindClose(find);
+    }
+#else
+    DIR* d = opendir(dir);
+    if (d) {
+        struct dirent* entry;
+        while ((entry = readdir(d)))
+            AddCheckpointPath(tl, dir, entry->d_name);
+        closedir(d);
+    }
+#endif
+    if (tl->count > 1)
+        qsort(tl->paths, tl->count, sizeof(char*), CompareCheckpointPaths);
+    return tl->count;
+}
+
+// Raw values of one checkpoint for every view from mean on: per layer the
+// whole tensor, then TIMELINE_BINS bins of its rows. A layer's tensor is
+// looked up by the name it had in the first checkpoint, or by position when
+// the name is gone (.npy tensors are named after their file). Returns 0 when
+// the file cannot be read.
+int DecodeCheckpoint(const Timeline* tl, int checkpoint, float* values, long long* bytes) {
+    WeightSet set = { .quiet = 1 };
+    NameMap names = { .arena = &set.arena };
+    memset(values, 0, (size_t)(WEIGHT_VIEW_COUNT - 1) * tl->valueCount * sizeof(float));
+    *bytes = 0;
+    if (!LoadWeightFile(&set, tl->paths[checkpoint])) {
+        ReleaseWeights(&set);
+        return 0;
+    }
+    for (int t = 0; t < set.count; t++)
+        NameMapPut(&names, set.tensors[t].name, (int)strlen(set.tensors[t].name), t);
+    for (int l = 0; l < tl->layerCount; l++) {
+        if (tl->tensor[l] < 0)
+            continue;
+        int t = NameMapGet(&names, tl->tensorName[l], (int)strlen(tl->tensorName[l]));
+        if (t < 0 && tl->tensor[l] < set.count)
+            t = tl->tensor[l];
+        if (t < 0)
+            continue;
+        const WeightSummary* w = &set.tensors[t];
+        int bins = w->rowLevels ? w->rowCount[0] : 0;
+        for (int v = 1; v < WEIGHT_VIEW_COUNT; v++) {
+            float* out = values + (size_t)(v - 1) * tl->valueCount + (size_t)l * (1 + TIMELINE_BINS);
+            out[0] = WeightStatValue(&w->total, (WeightView)v);
+            for (int b = 0; b < TIMELINE_BINS && bins > 0; b++) {
+                WeightStats s;
+                int first = (int)((long long)b * bins / TIMELINE_BINS);
+                int end = (int)((long long)(b + 1) * bins / TIMELINE_BINS);
+                WeightRowStats(w, first, end > first ? end : first + 1, &s);
+                out[1 + b] = WeightStatValue(&s, (WeightView)v);
+            }
+        }
+    }
+    *bytes = set.summarizedBytes;
+    ReleaseWeights(&set);
+    return 1;
+}
+
+// Raw values onto the run's color scale. Checkpoints beyond the range of the
+// first and last go past 1 and color as its top; NaNs land at 0.
+void NormalizeCheckpoint(const Timeline* tl, float* values) {
+    for (int v = 1; v < WEIGHT_VIEW_COUNT; v++) {
+        for (int l = 0; l < tl->layerCount; l++) {
+            float* out = values + (size_t)(v - 1) * tl->valueCount + (size_t)l * (1 + TIMELINE_BINS);
+            float layerTop = tl->layerScale[v];
+            float binTop = tl->binScale[(size_t)(v - 1) * tl->layerCount + l];
+            out[0] = layerTop > 0.0f && out[0] >= 0.0f ? out[0] / layerTop : 0.0f;
+            for (int b = 1; b <= TIMELINE_BINS; b++)
+                out[b] = binTop > 0.0f && out[b] >= 0.0f ? out[b] / binTop : 0.0f;
+        }
+    }
+}
+
+// Index dir's checkpoints of net and start decoding from the first.
+// cacheBytes bounds the decoded checkpoints kept, though never below the
+// prefetch window. Returns 0, leaving tl empty, when there are none or the
+// first or last cannot be read.
+int OpenTimeline(Timeline* tl, const NetworkGraph* net, const char* dir, size_t cacheBytes) {
+    memset(tl, 0, sizeof(*tl));
+    if (!ListCheckpoints(tl, dir)) {
+        printf("Error: No .safetensors or .npy checkpoints in '%s'.\n", dir);
+        ArenaRelease(&tl->arena);
+        return 0;
+    }
+
+    // Layers pair with tensors once, in the first checkpoint; the checkpoints
+    // of one run name their tensors alike.
+    WeightSet first = { .quiet = 1 };
+    if (!LoadWeightFile(&first, tl->paths[0])) {
+        ReleaseWeights(&first);
+        ArenaRelease(&tl->arena);
+        memset(tl, 0, sizeof(*tl));
+        return 0;
+    }
+    tl->layerCount = net->layerCount;
+    tl->tensor = ArenaAlloc(&tl->arena, (tl->layerCount + 1) * sizeof(int));
+    tl->tensorName = ArenaAlloc(&tl->arena, (tl->layerCount + 1) * sizeof(char*));
+    MatchWeights(net, &first, tl->tensor);
+    int colored = 0;
+    for (int l = 0; l < tl->layerCount; l++) {
+        tl->tensorName[l] = NULL;
+        if (tl->tensor[l] < 0)
+            continue;
+        const char* name = first.tensors[tl->tensor[l]].name;
+        size_t len = strlen(name) + 1;
+        char* copy = ArenaAlloc(&tl->arena, len);
+        memcpy(copy, name, len);
+        tl->tensorName[l] = copy;
+        colored++;
+    }
+    ReleaseWeights(&first);
+
+    tl->valueCount = tl->layerCount * (1 + TIMELINE_BINS);
+    size_t entryFloats = (size_t)(WEIGHT_VIEW_COUNT - 1) * tl->valueCount;
+    size_t slots = cacheBytes / (entryFloats * sizeof(float) + sizeof(TimelineSlot));
+    if (slots < TIMELINE_AHEAD + TIMELINE_BEHIND + 2)
+        slots = TIMELINE_AHEAD + TIMELINE_BEHIND + 2;
+    if (slots > (size_t)tl->count)
+        slots = tl->count;
+    tl->slotCount = (int)slots;
+    tl->slots = ArenaAlloc(&tl->arena, slots * sizeof(TimelineSlot));
+    float* values = ArenaAlloc(&tl->arena, slots * entryFloats * sizeof(float));
+    for (int s = 0; s < tl->slotCount; s++) {
+        tl->slots[s].checkpoint = -1;
+        tl->slots[s].state = TIMELINE_READY;
+        tl->slots[s].lastUsed = 0;
+        tl->slots[s].values = values + s * entryFloats;
+    }
+    tl->slotOf = ArenaAlloc(&tl->arena, tl->count * sizeof(int));
+    for (int c = 0; c < tl->count; c++)
+        tl->slotOf[c] = -1;
+    tl->binScale = ArenaAlloc(&tl->arena, (WEIGHT_VIEW_COUNT - 1) * tl->layerCount * sizeof(float) + 1);
+    memset(tl->binScale, 0, (WEIGHT_VIEW_COUNT - 1) * tl->layerCount * sizeof(float));
+    tl->target = ArenaAlloc(&tl->arena, tl->valueCount * sizeof(float) + 1);
+    tl->shown = ArenaAlloc(&tl->arena, tl->valueCount * sizeof(float) + 1);
+    memset(tl->target, 0, tl->valueCount * sizeof(float));
+    memset(tl->shown, 0, tl->valueCount * sizeof(float));
+
+    // The first and last checkpoints set the color scale, so a color means
+    // the same all through the run. Both are decoded now and cached.
+    int ends = tl->count > 1 ? 2 : 1;
+    for (int e = 0; e < ends; e++) {
+        long long bytes;
+        float* raw = tl->slots[e].values;
+        if (!DecodeCheckpoint(tl, e ? tl->count - 1 : 0, raw, &bytes)) {
+            ArenaRelease(&tl->arena);
+            memset(tl, 0, sizeof(*tl));
+            return 0;
+        }
+        for (int v = 1; v < WEIGHT_VIEW_COUNT; v++) {
+            for (int l = 0; l < tl->layerCount; l++) {
+                const float* layer = raw + (size_t)(v - 1) * tl->valueCount + (size_t)l * (1 + TIMELINE_BINS);
+                float* binTop = &tl->binScale[(size_t)(v - 1) * tl->layerCount + l];
+                tl->layerScale[v] = fmaxf(tl->layerScale[v], layer[0]);
+                for (int b = 1; b <= TIMELINE_BINS; b++)
+                    *binTop = fmaxf(*binTop, layer[b]);
+            }
+        }
+        tl->decoded++;
+        tl->decodedBytes += bytes;
+    }
+    for (int e = 0; e < ends; e++) {
+        NormalizeCheckpoint(tl, tl->slots[e].values);
+        tl->slots[e].checkpoint = e ? tl->count - 1 : 0;
+        tl->slotOf[tl->slots[e].checkpoint] = e;
+    }
+
+    tl->direction = 1;
+    tl->playRate = tl->count > 1 ? (tl->count - 1) / TIMELINE_PLAY_SECONDS : 1.0;
+    tl->appliedRevision = tl->appliedBuild = -1;
+    InitMutex(&tl->lock);
+    InitCondVar(&tl->wake);
+    while (tl->threadCount < TIMELINE_THREADS && StartThread(&tl->threads[tl->threadCount], TimelineWorker, tl))
+        tl->threadCount++;
+    printf("Timeline: %d checkpoints in '%s', %d layers colored, %d cached (%.1f MB)\n", tl->count, dir, colored,
+           tl->slotCount, slots * entryFloats * sizeof(float) / (1024.0 * 1024.0));
+    return 1;
+}
+
+void CloseTimeline(Timeline* tl) {
+    if (!tl->count)
+        return;
+    LockMutex(&tl->lock);
+    tl->stop = 1;
+    WakeAllCondVar(&tl->wake);
+    UnlockMutex(&tl->lock);
+    for (int i = 0; i < tl->threadCount; i++)
+        JoinThread(tl->threads[i]);
+    DestroyCondVar(&tl->wake);
+    DestroyMutex(&tl->lock);
+    ArenaRelease(&tl->arena);
+    memset(tl, 0, sizeof(*tl));
+}
+
+// Whether checkpoint is among those prefetched around the cursor.
+int InTimelineWindow(const Timeline* tl, int checkpoint) {
+    int ahead = (checkpoint - tl->cursor) * tl->direction;
+    return ahead >= -TIMELINE_BEHIND && ahead <= TIMELINE_AHEAD;
+}
+
+// Under lock: claim a slot for the most wanted checkpoint not cached yet,
+// the cursor's, then those ahead in the scrub direction, then those behind.
+// The slot is a free one or the least recently used outside the window.
+// Returns the checkpoint, or -1 when the whole window is cached or decoding.
+int NextTimelineJob(Timeline* tl, int* slot) {
+    for (int k = 0; k <= TIMELINE_AHEAD + TIMELINE_BEHIND; k++) {
+        int c = k <= TIMELINE_AHEAD ? tl->cursor + k * tl->direction
+                                    : tl->cursor - (k - TIMELINE_AHEAD) * tl->direction;
+        if (c < 0 || c >= tl->count || tl->slotOf[c] >= 0)
+            continue;
+        int best = -1;
+        for (int s = 0; s < tl->slotCount; s++) {
+            const TimelineSlot* candidate = &tl->slots[s];
+            if (candidate->checkpoint < 0) {
+                best = s;
+                break;
+            }
+            if (candidate->state != TIMELINE_LOADING && !InTimelineWindow(tl, candidate->checkpoint) &&
+                (best < 0 || candidate->lastUsed < tl->slots[best].lastUsed))
+                best = s;
+        }
+        if (best < 0)
+            return -1;
+        TimelineSlot* victim = &tl->slots[best];
+        if (victim->checkpoint >= 0)
+            tl->slotOf[victim->checkpoint] = -1;
+        victim->checkpoint = c;
+        victim->state = TIMELINE_LOADING;
+        victim->lastUsed = tl->tick;
+        tl->slotOf[c] = best;
+        *slot = best;
+        return c;
+    }
+    return -1;
+}
+
+// Decode claimed checkpoints outside the lock; a LOADING slot is neither
+// read nor evicted, so its values are the worker's alone until READY.
+void TimelineWorker(void* arg) {
+    Timeline* tl = arg;
+    LowerThreadPriority();
+    LockMutex(&tl->lock);
+    while (!tl->stop) {
+        int slot;
+        int checkpoint = NextTimelineJob(tl, &slot);
+        if (checkpoint < 0) {
+            WaitCondVar(&tl->wake, &tl->lock);
+            continue;
+        }
+        UnlockMutex(&tl->lock);
+        float* values = tl->slots[slot].values;
+        long long bytes;
+        double start = NowSeconds();
+        int ok = DecodeCheckpoint(tl, checkpoint, values, &bytes);
+        if (ok)
+            NormalizeCheckpoint(tl, values);
+        double elapsed = NowSeconds() - start;
+        LockMutex(&tl->lock);
+        tl->slots[slot].state = ok ? TIMELINE_READY : TIMELINE_FAILED;
+        tl->decoded += ok;
+        tl->failed += !ok;
+        tl->decodedBytes += bytes;
+        tl->decodeSeconds += elapsed;
+    }
+    UnlockMutex(&tl->lock);
+}
+
+// Move the scrub position, clamped to the run. Entering another checkpoint
+// re-aims the prefetch.
+void SeekTimeline(Timeline* tl, double position) {
+    if (!tl->count)
+        return;
+    if (position > tl->count - 1)
+        position = tl->count - 1;
+    if (position < 0.0)
+        position = 0.0;
+    if (position != tl->position)
+        tl->settled = 0;
+    tl->position = position;
+    int cursor = (int)position;
+    LockMutex(&tl->lock);
+    if (cursor != tl->cursor) {
+        tl->direction = cursor > tl->cursor ? 1 : -1;
+        tl->cursor = cursor;
+        WakeAllCondVar(&tl->wake);
+    }
+    UnlockMutex(&tl->lock);
+}
+
+// Ease the scene toward the scrub position: the two checkpoints around it
+// are blended, and the colors approach the blend with time constant
+// TIMELINE_FADE_SECONDS, so steps and jumps animate instead of flashing.
+// While those checkpoints are still decoding the blend stays on the last
+// ones that were cached; the frame never waits. now advances playback.
+// Returns 1 when colors were written.
+int ApplyTimeline(SceneCache* sc, const NetworkGraph* net, Timeline* tl, double now) {
+    if (!tl->count || weightView == WEIGHT_VIEW_OFF)
+        return 0;
+    double profileStart = ProfileStart();
+    double dt = tl->shownTime > 0.0 ? now - tl->shownTime : 0.0;
+    tl->shownTime = now;
+    if (tl->playing) {
+        SeekTimeline(tl, tl->position + (dt < 0.25 ? dt : 0.25) * tl->playRate);
+        tl->playing = tl->position < tl->count - 1;
+    }
+
+    int a = (int)tl->position;
+    float f = (float)(tl->position - a);
+    size_t offset = (size_t)(weightView - 1) * tl->valueCount;
+    LockMutex(&tl->lock);
+    tl->tick++;
+    int sa = tl->slotOf[a];
+    int sb = f > 0.0f ? tl->slotOf[a + 1] : sa;
+    int ready = sa >= 0 && sb >= 0 && tl->slots[sa].state == TIMELINE_READY && tl->slots[sb].state == TIMELINE_READY;
+    int resolved = sa >= 0 && sb >= 0 && tl->slots[sa].state != TIMELINE_LOADING &&
+                   tl->slots[sb].state != TIMELINE_LOADING;
+    if (ready) {
+        const float* va = tl->slots[sa].values + offset;
+        const float* vb = tl->slots[sb].values + offset;
+        for (int i = 0; i < tl->valueCount; i++)
+            tl->target[i] = va[i] + (vb[i] - va[i]) * f;
+        tl->slots[sa].lastUsed = tl->slots[sb].lastUsed = tl->tick;
+        tl->hits++;
+    } else {
+        tl->misses++;
+    }
+    UnlockMutex(&tl->lock);
+
+    float k = dt > 0.0 ? 1.0f - expf((float)(-dt / TIMELINE_FADE_SECONDS)) : 1.0f;
+    int changed = 0, moving = 0;
+    for (int i = 0; i < tl->valueCount; i++) {
+        float d = tl->target[i] - tl->shown[i];
+        if (d == 0.0f)
+            continue;
+        changed = 1;
+        if (fabsf(d) < 1e-3f) {
+            tl->shown[i] = tl->target[i];
+        } else {
+            tl->shown[i] += d * k;
+            moving = 1;
+        }
+    }
+    tl->settled = resolved && !moving && !tl->playing;
+    int rebuilt = tl->appliedRevision != sc->builtRevision || tl->appliedBuild != sc->buildCount;
+    if (changed || rebuilt) {
+        int layers = tl->layerCount < sc->layerCount ? tl->layerCount : sc->layerCount;
+        for (int l = 0; l < layers; l++)
+            if (tl->tensor[l] >= 0)
+                RecolorLayer(sc, net, l, tl->shown + (size_t)l * (1 + TIMELINE_BINS), TIMELINE_BINS);
+        tl->appliedRevision = sc->builtRevision;
+        tl->appliedBuild = sc->buildCount;
+    }
+    ProfileEnd(PROF_TIMELINE, profileStart);
+    return changed || rebuilt;
+}
+
+// Whether frames still change: playing, easing, or waiting for the
+// checkpoints at the position.
+int TimelineBusy(const Timeline* tl) {
+    return tl->count && weightView != WEIGHT_VIEW_OFF && !tl->settled;
+}
+
+void FormatTimelineStatus(Timeline* tl, char* text, size_t size) {
+    int cached = 0, decoding = 0;
+    LockMutex(&tl->lock);
+    for (int s = 0; s < tl->slotCount; s++) {
+        cached += tl->slots[s].checkpoint >= 0 && tl->slots[s].state == TIMELINE_READY;
+        decoding += tl->slots[s].state == TIMELINE_LOADING;
+    }
+    UnlockMutex(&tl->lock);
+    int current = (int)(tl->position + 0.5);
+    const char* name = tl->paths[current];
+    for (const char* c = name; *c; c++)
+        if (*c == '/' || *c == '\\')
+            name = c + 1;
+    snprintf(text, size, "Checkpoint %d/%d %s%s  cached %d/%d  decoding %d", current + 1, tl->count, name,
+             tl->playing ? " (playing)" : "", cached, tl->slotCount, decoding);
+}
+
+//-------------------------
+// Scene Cache
+//-------------------------
+// A model's laid-out graph, built scene and label layout stored in one file
+// per model and settings, so that opening the model again skips parsing,
+// layout and the scene build. The file is mapped copy-on-write and the scene
+// uses its arrays in place; the graph is small and copied into the arena.
+
+// --scene-cache DIR, or deep3d/scenes in the user's cache folder. Returns 0
+// when the cache is off.
+int SceneCacheDirectory(char* dir, size_t size) {
+    if (sceneCacheOff)
+        return 0;
+    if (sceneCacheDir[0]) {
+        snprintf(dir, size, "%s", sceneCacheDir);
+        return 1;
+    }
+#ifdef _WIN32
+    const char* base = getenv("LOCALAPPDATA");
+    if (!base || !base[0])
+        return 0;
+    snprintf(dir, size, "%s\\deep3d\\scenes", base);
+#else
+    const char* xdg = getenv("XDG_CACHE_HOME");
+    const char* home = getenv("HOME");
+    if (xdg && xdg[0])
+        snprintf(dir, size, "%s/deep3d/scenes", xdg);
+    else if (home && home[0])
+        snprintf(dir, size, "%s/.cache/deep3d/scenes", home);
+    else
+        return 0;
+#endif
+    return 1;
+}
+
+// --scene-cache DIR|off, for the window and the batch commands.
+void SetSceneCacheOption(const char* value) {
+    sceneCacheOff = strcmp(value, "off") == 0;
+    if (!sceneCacheOff)
+        snprintf(sceneCacheDir, sizeof(sceneCacheDir), "%s", value);
+}
+
+// Create path and any missing parents. Returns 0 when it is not a directory
+// afterwards.
+int MakeDirectories(const char* path) {
+    char partial[300];
+    size_t len = strlen(path);
+    if (len == 0 || len >= sizeof(partial))
+        return 0;
+    for (size_t i = 1; i <= len; i++) {
+        if (i < len && path[i] != '/' && path[i] != '\\')
+            continue;
+        memcpy(partial, path, i);
+        partial[i] = '\0';
+#ifdef _WIN32
+        CreateDirectory(partial, NULL);
+#else
+        mkdir(partial, 0755);
+#endif
+    }
+#ifdef _WIN32
+    DWORD attributes = GetFileAttributes(path);
+    return attributes != INVALID_FILE_ATTRIBUTES && (attributes & FILE_ATTRIBUTE_DIRECTORY);
+#else
+    struct stat info;
+    return stat(path, &info) == 0 && S_ISDIR(info.st_mode);
+#endif
+}
+
+// What a stored scene is filed under: this build of the program, the model
+// (a file by its full path, size and write time as finely as the system keeps
+// it, plus its inode and change time on POSIX, which a rewrite always moves)
+// and every setting the scene build reads. Returns 0 for a model file that
+// cannot be found.
+int SceneCacheKey(const char* spec, char* key, size_t size) {
+    char model[300];
+    long long fileSize = 0, fileTime = 0, changeTime = 0, fileId = 0;
+    int builtIn = _stricmp(spec, "alexnet") == 0 || _stricmp(spec, "vgg16") == 0 ||
+                  _stricmp(spec, "resnet18") == 0 || strncmp(spec, "synth:", 6) == 0;
+    if (builtIn) {
+        snprintf(model, sizeof(model), "%s", spec);
+    } else {
+#ifdef _WIN32
+        WIN32_FILE_ATTRIBUTE_DATA info;
+        if (!_fullpath(model, spec, sizeof(model)) || !GetFileAttributesEx(model, GetFileExInfoStandard, &info))
+            return 0;
+        fileSize = ((long long)info.nFileSizeHigh << 32) | info.nFileSizeLow;
+        fileTime = ((long long)info.ftLastWriteTime.dwHighDateTime << 32) | info.ftLastWriteTime.dwLowDateTime;
+#else
+        struct stat info;
+        char* full = realpath(spec, NULL);
+        if (!full || stat(full, &info) != 0) {
+            free(full);
+            return 0;
+        }
+        snprintf(model, sizeof(model), "%s", full);
+        free(full);
+        fileSize = (long long)info.st_size;
+#ifdef __APPLE__
+        fileTime = info.st_mtimespec.tv_sec * 1000000000LL + info.st_mtimespec.tv_nsec;
+        changeTime = info.st_ctimespec.tv_sec * 1000000000LL + info.st_ctimespec.tv_nsec;
+#else
+        fileTime = info.st_mtim.tv_sec * 1000000000LL + info.st_mtim.tv_nsec;
+        changeTime = info.st_ctim.tv_sec * 1000000000LL + info.st_ctim.tv_nsec;
+#endif
+        fileId = (long long)info.st_ino;
+#endif
+    }
+    int used = snprintf(key, size,
+                        "deep3d scene cache %d, built %s %s\n%s\n%lld %lld %lld %lld\nedges %d %d %lld %lld %d, cost %d\n",
+                        SCENE_CACHE_VERSION, __DATE__, __TIME__, model, fileSize, fileTime, changeTime, fileId,
+                        (int)edgeSettings.mode, edgeSettings.arrowheads, edgeSettings.fullEdgeLimit,
+                        edgeSettings.ribbonEdgeLimit, edgeSettings.sampleBudget, (int)costView);
+    return used > 0 && (size_t)used < size;
+}
+
+// Identifies an atlas by the glyph metrics a label layout depends on.
+unsigned int AtlasHash(const GlyphAtlas* atlas) {
+    return HashBytes((const char*)atlas->glyphs, sizeof(atlas->glyphs)) | 1;
+}
+
+// A heap copy of bytes of data, for arrays leaving a scene cache file.
+void* DuplicateArray(const void* data, size_t bytes) {
+    void* copy = malloc(bytes ? bytes : 1);
+    if (!copy) {
+        printf("Error: Out of memory building scene geometry.\n");
+        exit(EXIT_FAILURE);
+    }
+    if (bytes)
+        memcpy(copy, data, bytes);
+    return copy;
+}
+
+int InSceneCacheFile(const SceneCache* sc, const void* data) {
+    const unsigned char* p = data;
+    return sc->cacheFile.data && p >= sc->cacheFile.data && p < sc->cacheFile.data + sc->cacheFile.size;
+}
+
+// realloc for the scene's own arrays. One still in the cache file is copied
+// out instead, usedBytes of it.
+void* SceneRealloc(const SceneCache* sc, void* data, size_t usedBytes, size_t bytes) {
+    if (!InSceneCacheFile(sc, data))
+        return realloc(data, bytes);
+    void* copy = malloc(bytes);
+    if (copy)
+        memcpy(copy, data, usedBytes < bytes ? usedBytes : bytes);
+    return copy;
+}
+
+void SceneFree(const SceneCache* sc, void* data) {
+    if (!InSceneCacheFile(sc, data))
+        free(data);
+}
+
+// Sizes of the fixed-size arrays the header's counts imply. The key and the
+// labels are sized by what they hold.
+void CacheSectionSizes(const SceneCacheHeader* h, long long* bytes) {
+    long long layers = h->layerCount, edges = h->edgeCount;
+    bytes[CACHE_LAYER_TYPE] = layers * sizeof(LayerType);
+    bytes[CACHE_LAYER_SIZE] = layers * 3 * sizeof(float);
+    bytes[CACHE_NEURONS] = layers * sizeof(int);
+    bytes[CACHE_LAYER_COLOR] = layers * 3 * sizeof(float);
+    bytes[CACHE_POSITION] = layers * 3 * sizeof(float);
+    bytes[CACHE_RANK] = layers * sizeof(int);
+    bytes[CACHE_OPS] = layers * sizeof(LayerOp);
+    bytes[CACHE_COSTS] = layers * sizeof(LayerCost);
+    bytes[CACHE_EDGE_FROM] = edges * sizeof(int);
+    bytes[CACHE_EDGE_TO] = edges * sizeof(int);
+    bytes[CACHE_ROUTE_START] = h->routedEdges ? (h->routedEdges + 1LL) * sizeof(int) : 0;
+    bytes[CACHE_ROUTE_POINTS] = (long long)h->routePoints * 3 * sizeof(float);
+    bytes[CACHE_TRI_VERTICES] = bytes[CACHE_TRI_COLORS] = (long long)h->triVertices * 3 * sizeof(float);
+    bytes[CACHE_TRI_INDICES] = (long long)h->triIndices * sizeof(GLuint);
+    bytes[CACHE_LINE_VERTICES] = bytes[CACHE_LINE_COLORS] = (long long)h->lineVertices * 3 * sizeof(float);
+    bytes[CACHE_LINE_INDICES] = (long long)h->lineIndices * sizeof(GLuint);
+    bytes[CACHE_SPHERES] = (long long)h->spheres * sizeof(MeshInstance);
+    bytes[CACHE_CONES] = (long long)h->cones * sizeof(MeshInstance);
+    bytes[CACHE_ELEMENTS] = (long long)h->elements * sizeof(SceneElement);
+    bytes[CACHE_LAYER_LOD] = layers * sizeof(LayerLodInfo);
+    bytes[CACHE_SPANS] = layers * sizeof(LayerSpan);
+    bytes[CACHE_IN_START] = (layers + 1) * sizeof(int);
+    bytes[CACHE_IN_EDGES] = edges * sizeof(int);
+    bytes[CACHE_BVH] = (long long)h->bvhNodes * sizeof(BvhNode);
+    bytes[CACHE_BVH_ITEMS] = (long long)h->bvhElements * sizeof(int);
+    bytes[CACHE_BVH_PARENT] = (long long)h->bvhNodes * sizeof(int);
+    bytes[CACHE_ELEMENT_LEAF] = (long long)h->bvhElements * sizeof(int);
+    bytes[CACHE_LABEL_RUNS] = h->labelAtlas ? layers * LABEL_VARIANT_COUNT * sizeof(LabelRun) : 0;
+    bytes[CACHE_LABEL_GLYPHS] = (long long)h->labelGlyphs * sizeof(LaidGlyph);
+}
+
+// Write a freshly built graph and scene, and lc's layout when it is current,
+// to path. The file is written under a temporary name and renamed into place,
+// so readers only ever map complete files. Returns its size, 0 on failure or
+// when it would not fit in the cache.
+long long StoreSceneCache(const char* path, const char* key, const NetworkGraph* net, const SceneCache* sc,
+                          const LabelCache* lc) {
+    SceneCacheHeader h;
+    memset(&h, 0, sizeof(h));
+    h.magic = SCENE_CACHE_MAGIC;
+    h.version = SCENE_CACHE_VERSION;
+    h.layerCount = net->layerCount;
+    h.edgeCount = net->edgeCount;
+    h.routedEdges = net->routedEdges;
+    h.routePoints = net->routedEdges ? net->routeStart[net->routedEdges] : 0;
+    h.triVertices = sc->triangles.vertexCount;
+    h.triIndices = sc->triangles.indexCount;
+    h.lineVertices = sc->lines.vertexCount;
+    h.lineIndices = sc->lines.indexCount;
+    h.spheres = sc->spheres.count;
+    h.cones = sc->cones.count;
+    h.elements = sc->elementCount;
+    h.bvhNodes = sc->bvhNodeCount;
+    h.bvhElements = sc->bvhElementCount;
+    int labels = lc && lc->atlas && lc->builtRevision == net->revision && lc->layerCount == net->layerCount &&
+                 !lc->staleGlyphs;
+    h.labelAtlas = labels ? AtlasHash(lc->atlas) : 0;
+    h.labelGlyphs = labels ? lc->glyphCount : 0;
+    h.costLayers = net->costLayers;
+    h.totalParams = net->totalParams;
+    h.totalMacs = net->totalMacs;
+    h.totalActivationBytes = net->totalActivationBytes;
+    h.peakActivationBytes = net->peakActivationBytes;
+    memcpy(h.maxCost, net->maxCost, sizeof(h.maxCost));
+    
+    size_t labelBytes = 0;
+    for (int i = 0; i < net->layerCount; i++)
+        labelBytes += strlen(net->label[i]) + 1;
+    char* labelText = malloc(labelBytes ? labelBytes : 1);
+    if (!labelText)
+        return 0;
+    for (int i = 0, at = 0; i < net->layerCount; i++) {
+        size_t len = strlen(net->label[i]) + 1;
+        memcpy(labelText + at, net->label[i], len);
+        at += (int)len;
+    }
+    const void* data[CACHE_SECTION_COUNT] = {
+        [CACHE_KEY] = key, [CACHE_LAYER_TYPE] = net->type, [CACHE_LAYER_SIZE] = net->size,
+        [CACHE_NEURONS] = net->neuronCount, [CACHE_LAYER_COLOR] = net->color, [CACHE_POSITION] = net->position,
+        [CACHE_RANK] = net->rank, [CACHE_LABELS] = labelText, [CACHE_OPS] = net->op, [CACHE_COSTS] = net->cost,
+        [CACHE_EDGE_FROM] = net->edgeFrom, [CACHE_EDGE_TO] = net->edgeTo, [CACHE_ROUTE_START] = net->routeStart,
+        [CACHE_ROUTE_POINTS] = net->routePoints,
+        [CACHE_TRI_VERTICES] = sc->triangles.vertices, [CACHE_TRI_COLORS] = sc->triangles.colors,
+        [CACHE_TRI_INDICES] = sc->triangles.indices, [CACHE_LINE_VERTICES] = sc->lines.vertices,
+        [CACHE_LINE_COLORS] = sc->lines.colors, [CACHE_LINE_INDICES] = sc->lines.indices,
+        [CACHE_SPHERES] = sc->spheres.items, [CACHE_CONES] = sc->cones.items, [CACHE_ELEMENTS] = sc->elements,
+        [CACHE_LAYER_LOD] = sc->layers, [CACHE_SPANS] = sc->spans, [CACHE_IN_START] = sc->inStart,
+        [CACHE_IN_EDGES] = sc->inEdges, [CACHE_BVH] = sc->bvh, [CACHE_BVH_ITEMS] = sc->bvhItems,
+        [CACHE_BVH_PARENT] = sc->bvhParent, [CACHE_ELEMENT_LEAF] = sc->elementLeaf,
+        [CACHE_LABEL_RUNS] = labels ? lc->runs : NULL, [CACHE_LABEL_GLYPHS] = labels ? lc->glyphs : NULL
+    };
+    CacheSectionSizes(&h, h.bytes);
+    h.bytes[CACHE_KEY] = (long long)strlen(key);
+    h.bytes[CACHE_LABELS] = (long long)labelBytes;
+    long long size = ((long long)sizeof(h) + SCENE_CACHE_ALIGN - 1) / SCENE_CACHE_ALIGN * SCENE_CACHE_ALIGN;
+    for (int s = 0; s < CACHE_SECTION_COUNT; s++) {
+        h.offset[s] = size;
+        size = (size + h.bytes[s] + SCENE_CACHE_ALIGN - 1) / SCENE_CACHE_ALIGN * SCENE_CACHE_ALIGN;
+    }
+    if (size > (long long)SCENE_CACHE_BUDGET_MB << 20) {
+        free(labelText);
+        return 0;
+    }
+    
+    char temp[360];
+#ifdef _WIN32
+    snprintf(temp, sizeof(temp), "%s.%lu.%ld.tmp", path, GetCurrentProcessId(), AtomicIncrement(&sceneCacheWrites));
+#else
+    snprintf(temp, sizeof(temp), "%s.%ld.%ld.tmp", path, (long)getpid(), AtomicIncrement(&sceneCacheWrites));
+#endif
+    FILE* out = fopen(temp, "wb");
+    if (!out) {
+        free(labelText);
+        return 0;
+    }
+    static const char padding[SCENE_CACHE_ALIGN];
+    long long at = sizeof(h);
+    int ok = fwrite(&h, sizeof(h), 1, out) == 1;
+    for (int s = 0; s < CACHE_SECTION_COUNT && ok; s++) {
+        size_t gap = (size_t)(h.offset[s] - at), bytes = (size_t)h.bytes[s];
+        ok = fwrite(padding, 1, gap, out) == gap && (bytes == 0 || fwrite(data[s], 1, bytes, out) == bytes);
+        at = h.offset[s] + h.bytes[s];
+    }
+    ok = fclose(out) == 0 && ok;
+    free(labelText);
+#ifdef _WIN32
+    ok = ok && MoveFileEx(temp, path, MOVEFILE_REPLACE_EXISTING);
+#else
+    ok = ok && rename(temp, path) == 0;
+#endif
+    if (!ok) {
+        remove(temp);
+        return 0;
+    }
+    return at;
+}
+
+int RangeWithin(ElementRange r, long long count) {
+    return r.first >= 0 && r.count >= 0 && (long long)r.first + r.count <= count;
+}
+
+// Whether every index a scene cache file holds points into the array it
+// indexes, and every enum is one this build knows, so a damaged file cannot
+// send a draw, cull, pick or recolor outside the mapping. Section sizes are
+// checked before this. Reads the index arrays whole, so a hit faults their
+// pages in up front.
+int SceneCacheConsistent(const SceneCacheHeader* h, void* const* array) {
+    int layers = h->layerCount, edges = h->edgeCount, nodes = h->bvhNodes;
+    const LayerType* type = array[CACHE_LAYER_TYPE];
+    const int* neurons = array[CACHE_NEURONS];
+    const LayerOp* ops = array[CACHE_OPS];
+    const int* from = array[CACHE_EDGE_FROM];
+    const int* to = array[CACHE_EDGE_TO];
+    const int* inStart = array[CACHE_IN_START];
+    const int* inEdges = array[CACHE_IN_EDGES];
+    const SceneElement* elements = array[CACHE_ELEMENTS];
+    const LayerLodInfo* lod = array[CACHE_LAYER_LOD];
+    const LayerSpan* spans = array[CACHE_SPANS];
+    const BvhNode* bvh = array[CACHE_BVH];
+    const int* bvhItems = array[CACHE_BVH_ITEMS];
+    const int* bvhParent = array[CACHE_BVH_PARENT];
+    const int* elementLeaf = array[CACHE_ELEMENT_LEAF];
+    if (h->bvhElements > h->elements)
+        return 0;
+    
+    // Graph: layers, edges, routes and the edges grouped by target.
+    for (int v = 0; v < layers; v++) {
+        if ((type[v] != LAYER_BOX && type[v] != LAYER_FC) || neurons[v] < 0 || ops[v].kind < 0 ||
+            ops[v].kind >= OP_KIND_COUNT || lod[v].maxLod < 0 || lod[v].maxLod >= LOD_LEVEL_COUNT ||
+            !RangeWithin(spans[v].edges, h->elements) || !RangeWithin(spans[v].body, h->elements))
+            return 0;
+        // A recolor writes the neurons and the glyph after them.
+        if (type[v] == LAYER_FC && neurons[v] > 0 && spans[v].body.count > 0 &&
+            (long long)elements[spans[v].body.first].spheres.first + neurons[v] + 1 > h->spheres)
+            return 0;
+    }
+    for (int e = 0; e < edges; e++) {
+        if (from[e] < 0 || from[e] >= layers || to[e] < 0 || to[e] >= layers || inEdges[e] < 0 || inEdges[e] >= edges)
+            return 0;
+    }
+    if (inStart[0] != 0 || inStart[layers] != edges)
+        return 0;
+    for (int v = 0; v < layers; v++) {
+        if (inStart[v + 1] < inStart[v])
+            return 0;
+    }
+    if (h->routedEdges) {
+        const int* routeStart = array[CACHE_ROUTE_START];
+        if (routeStart[0] != 0 || routeStart[h->routedEdges] != h->routePoints)
+            return 0;
+        for (int e = 0; e < h->routedEdges; e++) {
+            if (routeStart[e + 1] < routeStart[e])
+                return 0;
+        }
+    }
+    
+    // Scene: indices, elements' ranges and the BVH.
+    const GLuint* indices[2] = { array[CACHE_TRI_INDICES], array[CACHE_LINE_INDICES] };
+    int indexCount[2] = { h->triIndices, h->lineIndices };
+    GLuint vertexCount[2] = { (GLuint)h->triVertices, (GLuint)h->lineVertices };
+    for (int b = 0; b < 2; b++) {
+        GLuint worst = 0;
+        for (int i = 0; i < indexCount[b]; i++)
+            worst = indices[b][i] > worst ? indices[b][i] : worst;
+        if (indexCount[b] > 0 && worst >= vertexCount[b])
+            return 0;
+    }
+    for (int i = 0; i < h->elements; i++) {
+        const SceneElement* e = &elements[i];
+        if (!RangeWithin(e->triVerts, h->triVertices) || !RangeWithin(e->triIndices, h->triIndices) ||
+            !RangeWithin(e->lineVerts, h->lineVertices) || !RangeWithin(e->lineIndices, h->lineIndices) ||
+            !RangeWithin(e->spheres, h->spheres) || !RangeWithin(e->cones, h->cones) ||
+            e->layer < -1 || e->layer >= layers || e->arrowFrom < -1 || e->arrowFrom >= layers ||
+            e->arrowTo < -1 || e->arrowTo >= layers)
+            return 0;
+    }
+    // Children come after their parent, so a walk always ends.
+    for (int n = 0; n < nodes; n++) {
+        const BvhNode* node = &bvh[n];
+        int inner = node->count == 0;
+        if (node->count < 0 || bvhParent[n] < -1 || bvhParent[n] >= nodes)
+            return 0;
+        if (inner ? node->first <= n || node->first + 1 >= nodes
+                  : !RangeWithin((ElementRange){ node->first, node->count }, h->bvhElements))
+            return 0;
+    }
+    for (int i = 0; i < h->bvhElements; i++) {
+        if (bvhItems[i] < 0 || bvhItems[i] >= h->elements || elementLeaf[i] < -1 || elementLeaf[i] >= nodes)
+            return 0;
+    }
+    
+    // Label layout: runs within the glyphs, glyphs within the atlas.
+    if (h->labelAtlas) {
+        const LabelRun* runs = array[CACHE_LABEL_RUNS];
+        for (long long r = 0; r < (long long)layers * LABEL_VARIANT_COUNT; r++) {
+            if (!RangeWithin((ElementRange){ runs[r].first, runs[r].count }, h->labelGlyphs))
+                return 0;
+        }
+    }
+    const LaidGlyph* glyphs = array[CACHE_LABEL_GLYPHS];
+    for (int g = 0; g < h->labelGlyphs; g++) {
+        if (glyphs[g].glyph >= ATLAS_GLYPH_COUNT)
+            return 0;
+    }
+    return 1;
+}
+
+// Map path and take what it stores in place of a load, layout and build. The
+// graph is copied into net; the scene's arrays stay in the file, which the
+// scene keeps mapped until it is released. The label layout is copied into
+// lc when it was made with atlas. Returns 0, leaving net and sc alone, when
+// the file is missing, was stored under another key or does not add up.
+int LoadSceneCache(const char* path, const char* key, NetworkGraph* net, SceneCache* sc, LabelCache* lc,
+                   const GlyphAtlas* atlas) {
+    MappedFile file;
+    if (!MapFileView(path, &file, 1))
+        return 0;
+    const SceneCacheHeader* h = (const SceneCacheHeader*)file.data;
+    long long expected[CACHE_SECTION_COUNT];
+    int ok = file.data && file.size >= sizeof(SceneCacheHeader) && h->magic == SCENE_CACHE_MAGIC &&
+             h->version == SCENE_CACHE_VERSION;
+    ok = ok && h->layerCount >= 0 && h->edgeCount >= 0 && h->routePoints >= 0 && h->triVertices >= 0 &&
+         h->triIndices >= 0 && h->lineVertices >= 0 && h->lineIndices >= 0 && h->spheres >= 0 && h->cones >= 0 &&
+         h->elements >= 0 && h->bvhNodes >= 0 && h->bvhElements >= 0 && h->labelGlyphs >= 0 &&
+         (h->routedEdges == 0 || h->routedEdges == h->edgeCount);
+    if (ok) {
+        CacheSectionSizes(h, expected);
+        expected[CACHE_KEY] = (long long)strlen(key);
+        expected[CACHE_LABELS] = h->bytes[CACHE_LABELS];
+        for (int s = 0; s < CACHE_SECTION_COUNT && ok; s++) {
+            ok = h->bytes[s] == expected[s] && h->offset[s] >= (long long)sizeof(SceneCacheHeader) &&
+                 h->offset[s] % SCENE_CACHE_ALIGN == 0 && h->offset[s] + h->bytes[s] <= (long long)file.size;
+        }
+    }
+    ok = ok && memcmp(file.data + h->offset[CACHE_KEY], key, strlen(key)) == 0;
+    // Every label ends in a NUL, and there is one per layer.
+    const char* labelText = ok ? (const char*)file.data + h->offset[CACHE_LABELS] : NULL;
+    long long labelEnds = 0;
+    for (long long i = 0; ok && i < h->bytes[CACHE_LABELS]; i++)
+        labelEnds += labelText[i] == '\0';
+    ok = ok && labelEnds == h->layerCount && (h->layerCount == 0 || labelText[h->bytes[CACHE_LABELS] - 1] == '\0');
+    if (!ok) {
+        UnmapFile(&file);
+        return 0;
+    }
+    unsigned char* base = (unsigned char*)file.data;
+    void* array[CACHE_SECTION_COUNT];
+    for (int s = 0; s < CACHE_SECTION_COUNT; s++)
+        array[s] = base + h->offset[s];
+    if (!SceneCacheConsistent(h, array)) {
+        UnmapFile(&file);
+        return 0;
+    }
+    
+    int layers = h->layerCount, edges = h->edgeCount;
+    ResetNetwork(net);
+    ReserveLayers(net, layers > 0 ? layers : 1);
+    ReserveConnections(net, edges > 0 ? edges : 1);
+    memcpy(net->type, array[CACHE_LAYER_TYPE], h->bytes[CACHE_LAYER_TYPE]);
+    memcpy(net->size, array[CACHE_LAYER_SIZE], h->bytes[CACHE_LAYER_SIZE]);
+    memcpy(net->neuronCount, array[CACHE_NEURONS], h->bytes[CACHE_NEURONS]);
+    memcpy(net->color, array[CACHE_LAYER_COLOR], h->bytes[CACHE_LAYER_COLOR]);
+    memcpy(net->position, array[CACHE_POSITION], h->bytes[CACHE_POSITION]);
+    memcpy(net->rank, array[CACHE_RANK], h->bytes[CACHE_RANK]);
+    memcpy(net->op, array[CACHE_OPS], h->bytes[CACHE_OPS]);
+    memcpy(net->cost, array[CACHE_COSTS], h->bytes[CACHE_COSTS]);
+    memset(net->weight, 0xff, layers * sizeof(int));
+    for (int i = 0; i < layers; i++) {
+        size_t len = strlen(labelText);
+        net->label[i] = InternLabelRange(net, labelText, len);
+        labelText += len + 1;
+    }
+    memcpy(net->edgeFrom, array[CACHE_EDGE_FROM], h->bytes[CACHE_EDGE_FROM]);
+    memcpy(net->edgeTo, array[CACHE_EDGE_TO], h->bytes[CACHE_EDGE_TO]);
+    if (h->routedEdges) {
+        ReserveRoutes(net, edges, h->routePoints);
+        memcpy(net->routeStart, array[CACHE_ROUTE_START], h->bytes[CACHE_ROUTE_START]);
+        memcpy(net->routePoints, array[CACHE_ROUTE_POINTS], h->bytes[CACHE_ROUTE_POINTS]);
+    }
+    net->layerCount = layers;
+    net->edgeCount = edges;
+    net->routedEdges = h->routedEdges;
+    net->costLayers = h->costLayers;
+    net->totalParams = h->totalParams;
+    net->totalMacs = h->totalMacs;
+    net->totalActivationBytes = h->totalActivationBytes;
+    net->peakActivationBytes = h->peakActivationBytes;
+    memcpy(net->maxCost, h->maxCost, sizeof(net->maxCost));
+    MarkGraphChanged(net);
+    
+    int buildCount = sc->buildCount;
+    ReleaseScene(sc);
+    GeometryBuffer* buffers[2] = { &sc->triangles, &sc->lines };
+    const int* counts[2] = { &h->triVertices, &h->lineVertices };
+    for (int b = 0; b < 2; b++) {
+        CacheSection first = b ? CACHE_LINE_VERTICES : CACHE_TRI_VERTICES;
+        buffers[b]->vertices = array[first];
+        buffers[b]->colors = array[first + 1];
+        buffers[b]->indices = array[first + 2];
+        buffers[b]->vertexCount = buffers[b]->vertexCapacity = counts[b][0];
+        buffers[b]->indexCount = buffers[b]->indexCapacity = counts[b][1];
+        buffers[b]->mapped = 1;
+    }
+    sc->spheres.items = array[CACHE_SPHERES];
+    sc->spheres.count = sc->spheres.capacity = h->spheres;
+    sc->spheres.mapped = 1;
+    sc->cones.items = array[CACHE_CONES];
+    sc->cones.count = sc->cones.capacity = h->cones;
+    sc->cones.mapped = 1;
+    sc->elements = array[CACHE_ELEMENTS];
+    sc->elementCount = sc->elementCapacity = h->elements;
+    sc->elementStart[0] = h->triVertices;
+    sc->elementStart[1] = h->triIndices;
+    sc->elementStart[2] = h->lineVertices;
+    sc->elementStart[3] = h->lineIndices;
+    sc->elementStart[4] = h->spheres;
+    sc->elementStart[5] = h->cones;
+    sc->layers = array[CACHE_LAYER_LOD];
+    sc->spans = array[CACHE_SPANS];
+    sc->layerCount = sc->layerCapacity = layers;
+    sc->inStart = array[CACHE_IN_START];
+    sc->inEdges = array[CACHE_IN_EDGES];
+    sc->inCapacity = layers + 1;
+    sc->inEdgeCapacity = edges;
+    // No spare room for a rebuild in place: BuildSceneBvh allocates anew.
+    sc->bvh = array[CACHE_BVH];
+    sc->bvhItems = array[CACHE_BVH_ITEMS];
+    sc->bvhParent = array[CACHE_BVH_PARENT];
+    sc->elementLeaf = array[CACHE_ELEMENT_LEAF];
+    sc->bvhNodeCount = h->bvhNodes;
+    sc->bvhElementCount = h->bvhElements;
+    sc->bvhItemCapacity = 0;
+    sc->openLayer = sc->openArrowFrom = sc->openArrowTo = -1;
+    sc->openLod = LOD_MASK_ALL;
+    sc->retiredElements = 0;
+    sc->builtRevision = net->revision;
+    sc->buildCount = buildCount + 1;
+    sc->dirty = 0;
+    sc->cacheFile = file;
+    
+    if (lc && atlas && h->labelAtlas == AtlasHash(atlas)) {
+        int runCount = layers * LABEL_VARIANT_COUNT;
+        if (runCount > lc->runCapacity) {
+            free(lc->runs);
+            lc->runs = DuplicateArray(array[CACHE_LABEL_RUNS], h->bytes[CACHE_LABEL_RUNS]);
+            lc->runCapacity = runCount;
+        } else {
+            memcpy(lc->runs, array[CACHE_LABEL_RUNS], h->bytes[CACHE_LABEL_RUNS]);
+        }
+        if (h->labelGlyphs > lc->glyphCapacity) {
+            free(lc->glyphs);
+            lc->glyphs = DuplicateArray(array[CACHE_LABEL_GLYPHS], h->bytes[CACHE_LABEL_GLYPHS]);
+            lc->glyphCapacity = h->labelGlyphs;
+        } else {
+            memcpy(lc->glyphs, array[CACHE_LABEL_GLYPHS], h->bytes[CACHE_LABEL_GLYPHS]);
+        }
+        lc->glyphCount = h->labelGlyphs;
+        lc->staleGlyphs = 0;
+        lc->atlas = atlas;
+        lc->layerCount = layers;
+        lc->builtRevision = net->revision;
+    }
+    return 1;
+}
+
+typedef struct {
+    char name[64];
+    long long bytes, time;
+} CacheFileInfo;
+
+int CompareCacheFilesNewestFirst(const void* a, const void* b) {
+    const CacheFileInfo* x = a;
+    const CacheFileInfo* y = b;
+    return (x->time < y->time) - (x->time > y->time);
+}
+
+void AddCacheFile(CacheFileInfo** files, int* count, int* capacity, const char* name, long long bytes, long long time) {
+    size_t len = strlen(name);
+    if (len < 7 || len >= sizeof((*files)->name) || strcmp(name + len - 6, ".scene") != 0)
+        return;
+    if (*count == *capacity) {
+        int grown = *capacity ? *capacity * 2 : 64;
+        CacheFileInfo* list = realloc(*files, grown * sizeof(CacheFileInfo));
+        if (!list)
+            return;
+        *files = list;
+        *capacity = grown;
+    }
+    CacheFileInfo* f = &(*files)[(*count)++];
+    snprintf(f->name, sizeof(f->name), "%s", name);
+    f->bytes = bytes;
+    f->time = time;
+}
+
+// Delete the scene files of dir that were written longest ago until the rest
+// fit in SCENE_CACHE_BUDGET_MB.
+void TrimSceneCache(const char* dir) {
+    CacheFileInfo* files = NULL;
+    int count = 0, capacity = 0;
+#ifdef _WIN32
+    char pattern[320];
+    WIN32_FIND_DATA found;
+    snprintf(pattern, sizeof(pattern), "%s\\*.scene", dir);
+    HANDLE find = FindFirstFile(pattern, &found);
+    if (find != INVALID_HANDLE_VALUE) {
+        do {
+            long long bytes = ((long long)found.nFileSizeHigh << 32) | found.nFileSizeLow;
+            long long time = ((long long)found.ftLastWriteTime.dwHighDateTime << 32) | found.ftLastWriteTime.dwLowDateTime;
+            AddCacheFile(&files, &count, &capacity, found.cFileName, bytes, time);
+        } while (FindNextFile(find, &found));
+        FindClose(find);
+    }
+#else
+    DIR* d = opendir(dir);
+    if (d) {
+        struct dirent* entry;
+        while ((entry = readdir(d))) {
+            char path[400];
+            struct stat info;
+            snprintf(path, sizeof(path), "%s/%s", dir, entry->d_name);
+            if (stat(path, &info) == 0 && S_ISREG(info.st_mode))
+                AddCacheFile(&files, &count, &capacity, entry->d_name, (long long)info.st_size, (long long)info.st_mtime);
+        }
+        closedir(d);
+    }
+#endif
+    if (count > 1)
+        qsort(files, count, sizeof(CacheFileInfo), CompareCacheFilesNewestFirst);
+    long long kept = 0;
+    for (int i = 0; i < count; i++) {
+        kept += files[i].bytes;
+        if (i > 0 && kept > (long long)SCENE_CACHE_BUDGET_MB << 20) {
+            char path[400];
+            snprintf(path, sizeof(path), "%s/%s", dir, files[i].name);
+            remove(path);       // Fails harmlessly for a file another process has mapped on Windows
+        }
+    }
+    free(files);
+}
+
+// Where spec's scene is stored. Returns 0 when the cache is off or the model
+// file does not exist.
+int SceneCachePath(const char* spec, char* dir, size_t dirSize, char* path, size_t pathSize, char* key, size_t keySize) {
+    if (!SceneCacheDirectory(dir, dirSize) || !SceneCacheKey(spec, key, keySize))
+        return 0;
+    snprintf(path, pathSize, "%s/%08x.scene", dir, HashBytes(key, strlen(key)));
+    return 1;
+}
+
+// LoadModelSpec, AttachWeights and BuildScene in one, through the scene cache
+// unless weights are given, since they color the scene. A hit maps what an
+// earlier load stored; a miss loads and builds, then stores the graph, the
+// scene and, when lc and atlas are given, the label layout, for loads that
+// took long enough to be worth a file. Each load reports which it was and
+// what it took. Returns 0 when spec cannot be loaded, or when its scene would
+// take more than sceneBuildLimit.
+int LoadModelScene(NetworkGraph* net, SceneCache* sc, LabelCache* lc, const GlyphAtlas* atlas, const char* spec,
+                   const WeightSet* weights) {
+    char dir[300], path[340], key[700];
+    double start = NowSeconds();
+    int cached = !weights && SceneCachePath(spec, dir, sizeof(dir), path, sizeof(path), key, sizeof(key));
+    if (cached) {
+        double profileStart = ProfileStart();
+        int hit = LoadSceneCache(path, key, net, sc, lc, atlas);
+        ProfileEnd(PROF_SCENE_CACHE, profileStart);
+        if (hit) {
+            // Held to the same limit as a build, counted the same way.
+            long long size[7] = { sc->triangles.vertexCount, sc->triangles.indexCount, sc->lines.vertexCount,
+                                  sc->lines.indexCount, sc->spheres.count, sc->cones.count, sc->elementCount };
+            if (!SceneWithinLimit(spec, SceneSizeBytes(size))) {
+                ReleaseScene(sc);
+                return 0;
+            }
+            printf("Scene cache hit: %s, %.1f MB mapped in %.1f ms\n", spec, sc->cacheFile.size / (1024.0 * 1024.0),
+                   (NowSeconds() - start) * 1000.0);
+            return 1;
+        }
+    }
+    // Not built over the pages of a file mapped by an earlier hit.
+    if (sc->cacheFile.data)
+        ReleaseScene(sc);
+    if (!LoadModelSpec(net, spec))
+        return 0;
+    if (weights)
+        AttachWeights(net, weights);
+    if (sceneBuildLimit && !SceneWithinLimit(spec, PredictSceneBytes(sc, net)))
+        return 0;
+    BuildScene(sc, net);
+    double seconds = NowSeconds() - start;
+    if (!cached)
+        return 1;
+    if (seconds < SCENE_CACHE_MIN_SECONDS) {
+        printf("Scene cache miss: %s, built in %.1f ms, too quick to be worth storing\n", spec, seconds * 1000.0);
+        return 1;
+    }
+    if (lc && atlas)
+        LayoutLabels(lc, atlas, net);
+    double profileStart = ProfileStart(), storeStart = NowSeconds();
+    long long bytes = MakeDirectories(dir) ? StoreSceneCache(path, key, net, sc, lc) : 0;
+    if (bytes)
+        TrimSceneCache(dir);
+    ProfileEnd(PROF_SCENE_CACHE, profileStart);
+    if (bytes)
+        printf("Scene cache miss: %s, built in %.2f s, stored %.1f MB in %.2f s\n", spec, seconds,
+               bytes / (1024.0 * 1024.0), NowSeconds() - storeStart);
+    else
+        printf("Scene cache miss: %s, built in %.2f s, could not store it in %s\n", spec, seconds, dir);
+    return 1;
+}
+
+//-------------------------
+// Input Queue & Background Loading
+//-------------------------
+
+// Producer side. Returns 0, dropping e, when the ring is full.
+int PushInput(InputQueue* q, const InputEvent* e) {
+    long tail = q->tail;
+    if (tail - AtomicLoad(&q->head) >= INPUT_QUEUE_SIZE)
+        return 0;
+    q->events[tail & (INPUT_QUEUE_SIZE - 1)] = *e;
+    AtomicStore(&q->tail, tail + 1);
+    return 1;
+}
+
+// Consumer side. Returns 0 when the ring is empty.
+int PopInput(InputQueue* q, InputEvent* e) {
+    long head = q->head;
+    if (head == AtomicLoad(&q->tail))
+        return 0;
+    *e = q->events[head & (INPUT_QUEUE_SIZE - 1)];
+    AtomicStore(&q->head, head + 1);
+    return 1;
+}
+
+// Everything a load costs, on the loader thread. The scene emitters read the
+// edge, cost and weight view settings without a lock; job->settings lets the
+// render thread rebuild a snapshot whose settings changed during the build.
+void BuildSnapshot(const LoadJob* job, SceneSnapshot* snap) {
+    double start = NowSeconds();
+    snap->job = *job;
+    snap->status = LOAD_FAILED;
+    if (job->reload) {
+        if (!LoadModelFile(&snap->net, job->spec))
+            return;
+        InferLayerCosts(&snap->net);
+        if (TopologyHash(&snap->net) == job->topology) {
+            snap->status = LOAD_EDITS;
+            snap->seconds = NowSeconds() - start;
+            return;
+        }
+        LayoutNetwork(&snap->net);
+    }
+    if (job->loadWeights && LoadSiblingWeights(&snap->weights, job->spec))
+        snap->hasWeights = 1;
+    const WeightSet* weights = snap->hasWeights ? &snap->weights : job->weights;
+    if (job->reload) {
+        if (weights)
+            AttachWeights(&snap->net, weights);
+        BuildScene(&snap->scene, &snap->net);
+    } else if (!LoadModelScene(&snap->net, &snap->scene, &snap->labels, job->atlas, job->spec, weights)) {
+        return;
+    }
+    snap->status = LOAD_BUILT;
+    snap->seconds = NowSeconds() - start;
+}
+
+// The scene was never uploaded, so this is safe on any thread.
+void ReleaseSnapshot(SceneSnapshot* snap) {
+    ReleaseScene(&snap->scene);
+    ArenaRelease(&snap->net.arena);
+    ReleaseWeights(&snap->weights);
+    ReleaseLabelCache(&snap->labels);
+    free(snap);
+}
+
+// Exchange net and sc with a built snapshot, which is left holding the old
+// graph and scene for RetireSnapshot: freeing a large scene takes longer than
+// a frame. The revision and build count carry on from the replaced ones, so
+// caches keyed on them see a change rather than a stale match. The old
+// scene's buffer objects are deleted, so this runs on the thread that owns
+// the GL context. Weights the snapshot loaded stay in it, and net->weights
+// points at them until the caller moves them out.
+void SwapInSnapshot(NetworkGraph* net, SceneCache* sc, SceneSnapshot* snap) {
+    NetworkGraph oldNet = *net;
+    SceneCache oldScene = *sc;
+    ReleaseSceneBuffers(&oldScene);
+    *net = snap->net;
+    *sc = snap->scene;
+    net->revision = oldNet.revision;
+    MarkGraphChanged(net);
+    sc->builtRevision = net->revision;
+    sc->buildCount = oldScene.buildCount + 1;
+    snap->net = oldNet;
+    snap->scene = oldScene;
+}
+
+// Loads run behind the frames, like timeline decodes. A load in progress is
+// not interrupted; its snapshot is dropped if a newer one finished first.
+void LoaderWorker(void* arg) {
+    SceneLoader* loader = arg;
+    LowerThreadPriority();
+    LockMutex(&loader->lock);
+    while (!loader->stop) {
+        if (loader->retired) {
+            SceneSnapshot* old = loader->retired;
+            loader->retired = old->next;
+            UnlockMutex(&loader->lock);
+            ReleaseSnapshot(old);
+            LockMutex(&loader->lock);
+            continue;
+        }
+        if (!loader->queued) {
+            WaitCondVar(&loader->wake, &loader->lock);
+            continue;
+        }
+        LoadJob job = loader->job;
+        loader->queued = 0;
+        loader->running++;
+        UnlockMutex(&loader->lock);
+        
+        SceneSnapshot* snap = calloc(1, sizeof(SceneSnapshot));
+        if (!snap) {
+            printf("Error: Out of memory loading a model.\n");
+            exit(EXIT_FAILURE);
+        }
+        BuildSnapshot(&job, snap);
+        
+        LockMutex(&loader->lock);
+        loader->running--;
+        SceneSnapshot* stale = snap;
+        if (!loader->ready || loader->ready->job.generation < snap->job.generation) {
+            stale = loader->ready;
+            loader->ready = snap;
+        }
+        UnlockMutex(&loader->lock);
+        if (stale)
+            ReleaseSnapshot(stale);
+        if (loader->notify)
+            loader->notify();
+        LockMutex(&loader->lock);
+    }
+    UnlockMutex(&loader->lock);
+}
+
+void StartLoader(SceneLoader* loader, void (*notify)(void)) {
+    memset(loader, 0, sizeof(*loader));
+    loader->notify = notify;
+    InitMutex(&loader->lock);
+    InitCondVar(&loader->wake);
+    while (loader->threadCount < LOADER_THREADS &&
+           StartThread(&loader->threads[loader->threadCount], LoaderWorker, loader))
+        loader->threadCount++;
+}
+
+// Waits for loads in progress to finish.
+void StopLoader(SceneLoader* loader) {
+    LockMutex(&loader->lock);
+    loader->stop = 1;
+    WakeAllCondVar(&loader->wake);
+    UnlockMutex(&loader->lock);
+    for (int i = 0; i < loader->threadCount; i++)
+        JoinThread(loader->threads[i]);
+    if (loader->ready)
+        ReleaseSnapshot(loader->ready);
+    while (loader->retired) {
+        SceneSnapshot* old = loader->retired;
+        loader->retired = old->next;
+        ReleaseSnapshot(old);
+    }
+    DestroyCondVar(&loader->wake);
+    DestroyMutex(&loader->lock);
+    memset(loader, 0, sizeof(*loader));
+}
+
+// Queue job, replacing one that no thread has started yet.
+void SubmitLoad(SceneLoader* loader, const LoadJob* job) {
+    LockMutex(&loader->lock);
+    loader->job = *job;
+    loader->queued = 1;
+    WakeAllCondVar(&loader->wake);
+    UnlockMutex(&loader->lock);
+}
+
+// The newest finished snapshot, now the caller's, or NULL. busy is set while
+// a job is still queued or running.
+SceneSnapshot* TakeSnapshot(SceneLoader* loader, int* busy) {
+    LockMutex(&loader->lock);
+    SceneSnapshot* snap = loader->ready;
+    loader->ready = NULL;
+    *busy = loader->queued || loader->running > 0;
+    UnlockMutex(&loader->lock);
+    return snap;
+}
+
+// Hand a snapshot that is no longer needed to the loader threads to free.
+// Its scene must have no buffer objects left.
+void RetireSnapshot(SceneLoader* loader, SceneSnapshot* snap) {
+    LockMutex(&loader->lock);
+    snap->next = loader->retired;
+    loader->retired = snap;
+    WakeAllCondVar(&loader->wake);
+    UnlockMutex(&loader->lock);
+}
+
+//-------------------------
+// Scene Culling
+//-------------------------
+
+// Turn everything emitted since the previous call into one culling element
+// with its own bounds. Emitters call this after each item, or after every
+// SCENE_ELEMENT_BATCH items of long runs, so elements stay spatially compact.
+void CloseSceneElement(SceneCache* sc) {
+    SceneElement e;
+    e.triVerts.first = sc->elementStart[0];
+    e.triVerts.count = sc->triangles.vertexCount - e.triVerts.first;
+    e.triIndices.first = sc->elementStart[1];
+    e.triIndices.count = sc->triangles.indexCount - e.triIndices.first;
+    e.lineVerts.first = sc->elementStart[2];
+    e.lineVerts.count = sc->lines.vertexCount - e.lineVerts.first;
+    e.lineIndices.first = sc->elementStart[3];
+    e.lineIndices.count = sc->lines.indexCount - e.lineIndices.first;
+    e.spheres.first = sc->elementStart[4];
+    e.spheres.count = sc->spheres.count - e.spheres.first;
+    e.cones.first = sc->elementStart[5];
+    e.cones.count = sc->cones.count - e.cones.first;
+    e.layer = sc->openLayer;
+    e.arrowFrom = sc->openArrowFrom;
+    e.arrowTo = sc->openArrowTo;
+    e.lodMask = sc->openLod;
+    sc->elementStart[0] = sc->triangles.vertexCount;
+    sc->elementStart[1] = sc->triangles.indexCount;
+    sc->elementStart[2] = sc->lines.vertexCount;
+    sc->elementStart[3] = sc->lines.indexCount;
+    sc->elementStart[4] = sc->spheres.count;
+    sc->elementStart[5] = sc->cones.count;
+    if (!e.triIndices.count && !e.lineIndices.count && !e.spheres.count && !e.cones.count)
+        return;
+
+    float* b = e.bounds;
+    b[0] = b[1] = b[2] = 1e30f;
+    b[3] = b[4] = b[5] = -1e30f;
+    const GeometryBuffer* buffers[2] = { &sc->triangles, &sc->lines };
+    const ElementRange* verts[2] = { &e.triVerts, &e.lineVerts };
+    const InstanceList* lists[2] = { &sc->spheres, &sc->cones };
+    const ElementRange* ranges[2] = { &e.spheres, &e.cones };
+    // Both unit meshes fit in the unit ball, whose image under the instance
+    // transform has half-extent |row k of the 3x3 part| along axis k.
+#if defined(__SSE2__) || defined(_M_X64)
+    // Lanes x, y, z and one ignored. A vertex is loaded with the next one's x,
+    // so the last of a run is loaded on its own; a transform's columns have
+    // 0 in that lane, so one square root gives all three extents.
+    __m128 lo = _mm_set1_ps(1e30f), hi = _mm_set1_ps(-1e30f);
+    for (int i = 0; i < 2; i++) {
+        const float* p = buffers[i]->vertices + verts[i]->first * 3;
+        for (int v = 0; v < verts[i]->count; v++, p += 3) {
+            __m128 q = v + 1 < verts[i]->count ? _mm_loadu_ps(p) : _mm_setr_ps(p[0], p[1], p[2], 0.0f);
+            lo = _mm_min_ps(lo, q);
+            hi = _mm_max_ps(hi, q);
+        }
+    }
+    for (int i = 0; i < 2; i++) {
+        for (int n = ranges[i]->first; n < ranges[i]->first + ranges[i]->count; n++) {
+            const float* m = lists[i]->items[n].transform;
+            __m128 c0 = _mm_loadu_ps(m), c1 = _mm_loadu_ps(m + 4), c2 = _mm_loadu_ps(m + 8);
+            __m128 extent = _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(c0, c0), _mm_mul_ps(c1, c1)), _mm_mul_ps(c2, c2)));
+            __m128 center = _mm_loadu_ps(m + 12);
+            lo = _mm_min_ps(lo, _mm_sub_ps(center, extent));
+            hi = _mm_max_ps(hi, _mm_add_ps(center, extent));
+        }
+    }
+    float lanes[2][4];
+    _mm_storeu_ps(lanes[0], lo);
+    _mm_storeu_ps(lanes[1], hi);
+    for (int k = 0; k < 3; k++) {
+        b[k] = lanes[0][k];
+        b[3 + k] = lanes[1][k];
+    }
+#else
+    for (int i = 0; i < 2; i++) {
+        for (int v = verts[i]->first; v < verts[i]->first + verts[i]->count; v++) {
+            const float* p = &buffers[i]->vertices[v * 3];
+            for (int k = 0; k < 3; k++) {
+                b[k] = fminf(b[k], p[k]);
+                b[3 + k] = fmaxf(b[3 + k], p[k]);
+            }
+        }
+    }
+    for (int i = 0; i < 2; i++) {
+        for (int n = ranges[i]->first; n < ranges[i]->first + ranges[i]->count; n++) {
+            const float* m = lists[i]->items[n].transform;
+            for (int k = 0; k < 3; k++) {
+                float extent = sqrtf(m[k] * m[k] + m[4 + k] * m[4 + k] + m[8 + k] * m[8 + k]);
+                b[k] = fminf(b[k], m[12 + k] - extent);
+                b[3 + k] = fmaxf(b[3 + k], m[12 + k] + extent);
+            }
+        }
+    }
+#endif
+
+    ReserveSceneElements(sc, 1);
+    sc->elements[sc->elementCount++] = e;
+}
+
+void ReserveSceneElements(SceneCache* sc, int extra) {
+    if (sc->elementCount + extra <= sc->elementCapacity)
+        return;
+    if (sc->fixedCapacity)
+        SliceOverflow();
+    int capacity = sc->elementCapacity ? sc->elementCapacity : 256;
+    while (capacity < sc->elementCount + extra)
+        capacity *= 2;
+    SceneElement* elements = SceneRealloc(sc, sc->elements, sc->elementCount * sizeof(SceneElement),
+                                          capacity * sizeof(SceneElement));
+    if (!elements) {
+        printf("Error: Out of memory building scene geometry.\n");
+        exit(EXIT_FAILURE);
+    }
+    sc->elements = elements;
+    sc->elementCapacity = capacity;
+}
+
+// Build the subtree for items[first, first + count) into node. Splits at
+// the midpoint of the longest centroid axis, falling back to an even split
+// when every centroid lands on one side. The items carry copies of their
+// elements' bounds, so each level scans memory in order rather than
+// gathering from the element array.
+void BuildBvhNode(SceneCache* sc, BvhBuildItem* items, int node, int first, int count) {
+    BvhNode* n = &sc->bvh[node];
+    float* b = n->bounds;
+    float centerMin[3] = { 1e30f, 1e30f, 1e30f }, centerMax[3] = { -1e30f, -1e30f, -1e30f };
+    b[0] = b[1] = b[2] = 1e30f;
+    b[3] = b[4] = b[5] = -1e30f;
+    // Comparisons rather than fminf, which compilers leave as a call to keep
+    // its NaN rules; a NaN bound is skipped either way.
+    for (int i = first; i < first + count; i++) {
+        const BvhBuildItem* it = &items[i];
+        for (int k = 0; k < 3; k++) {
+            b[k] = it->bounds[k] < b[k] ? it->bounds[k] : b[k];
+            b[3 + k] = it->bounds[3 + k] > b[3 + k] ? it->bounds[3 + k] : b[3 + k];
+            centerMin[k] = it->center[k] < centerMin[k] ? it->center[k] : centerMin[k];
+            centerMax[k] = it->center[k] > centerMax[k] ? it->center[k] : centerMax[k];
+        }
+    }
+    if (count <= BVH_LEAF_SIZE) {
+        n->first = first;
+        n->count = count;
+        for (int i = first; i < first + count; i++) {
+            sc->bvhItems[i] = items[i].element;
+            sc->elementLeaf[items[i].element] = node;
+        }
+        return;
+    }
+
+    int axis = 0;
+    for (int k = 1; k < 3; k++) {
+        if (centerMax[k] - centerMin[k] > centerMax[axis] - centerMin[axis])
+            axis = k;
+    }
+    float split = (centerMin[axis] + centerMax[axis]) * 0.5f;
+    int lo = first, hi = first + count - 1;
+    while (lo <= hi) {
+        if (items[lo].center[axis] < split) {
+            lo++;
+        } else {
+            BvhBuildItem t = items[lo];
+            items[lo] = items[hi];
+            items[hi--] = t;
+        }
+    }
+    int leftCount = lo - first;
+    if (leftCount == 0 || leftCount == count)
+        leftCount = count / 2;
+
+    int left = sc->bvhNodeCount;
+    sc->bvhNodeCount += 2;
+    n->first = left;
+    n->count = 0;
+    sc->bvhParent[left] = sc->bvhParent[left + 1] = node;
+    BuildBvhNode(sc, items, left, first, leftCount);
+    BuildBvhNode(sc, items, left + 1, first + leftCount, count - leftCount);
+}
+
+// Rebuilt with the scene, so only graph or build-setting changes pay for it;
+// patches refit it or rebuild it once enough elements sit outside it.
+// Retired elements are left out.
+void BuildSceneBvh(SceneCache* sc) {
+    int count = 0;
+    sc->bvhNodeCount = 0;
+    sc->bvhElementCount = sc->elementCount;
+    if (sc->elementCount == 0)
+        return;
+    if (sc->elementCount > sc->bvhItemCapacity) {
+        SceneFree(sc, sc->bvhItems);
+        SceneFree(sc, sc->bvh);
+        SceneFree(sc, sc->bvhParent);
+        SceneFree(sc, sc->elementLeaf);
+        sc->bvhItems = malloc(sc->elementCount * sizeof(int));
+        sc->bvh = malloc(2 * sc->elementCount * sizeof(BvhNode));   // A binary tree with n leaves or fewer
+        sc->bvhParent = malloc(2 * sc->elementCount * sizeof(int));
+        sc->elementLeaf = malloc(sc->elementCount * sizeof(int));
+        if (!sc->bvhItems || !sc->bvh || !sc->bvhParent || !sc->elementLeaf) {
+            printf("Error: Out of memory building scene geometry.\n");
+            exit(EXIT_FAILURE);
+        }
+        sc->bvhItemCapacity = sc->elementCount;
+    }
+    BvhBuildItem* items = malloc(sc->elementCount * sizeof(BvhBuildItem));
+    if (!items) {
+        printf("Error: Out of memory building scene geometry.\n");
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < sc->elementCount; i++) {
+        sc->elementLeaf[i] = -1;
+        if (!sc->elements[i].lodMask)
+            continue;
+        BvhBuildItem* it = &items[count++];
+        const float* eb = sc->elements[i].bounds;
+        memcpy(it->bounds, eb, sizeof(it->bounds));
+        for (int k = 0; k < 3; k++)
+            it->center[k] = (eb[k] + eb[3 + k]) * 0.5f;
+        it->element = i;
+    }
+    if (count > 0) {
+        sc->bvhNodeCount = 1;
+        sc->bvhParent[0] = -1;
+        BuildBvhNode(sc, items, 0, 0, count);
+    }
+    free(items);
+}
+
+// Recompute the bounds from element's leaf up to the root after the element
+// was patched. Elements outside the BVH are culled on their own bounds.
+void RefitBvh(SceneCache* sc, int element) {
+    if (element >= sc->bvhElementCount)
+        return;
+    for (int node = sc->elementLeaf[element]; node >= 0; node = sc->bvhParent[node]) {
+        BvhNode* n = &sc->bvh[node];
+        float* b = n->bounds;
+        b[0] = b[1] = b[2] = 1e30f;
+        b[3] = b[4] = b[5] = -1e30f;
+        for (int i = 0; i < (n->count > 0 ? n->count : 2); i++) {
+            const float* cb = n->count > 0 ? sc->elements[sc->bvhItems[n->first + i]].bounds : sc->bvh[n->first + i].bounds;
+            for (int k = 0; k < 3; k++) {
+                b[k] = fminf(b[k], cb[k]);
+                b[3 + k] = fmaxf(b[3 + k], cb[3 + k]);
+            }
+        }
+    }
+}
+
+// Frustum planes (a, b, c, d), inside where ax + by + cz + d >= 0, read off
+// the rows of a column-major clip matrix.
+void ExtractFrustum(const float* m, float planes[6][4]) {
+    for (int i = 0; i < 3; i++) {
+        for (int k = 0; k < 4; k++) {
+            planes[i * 2][k] = m[k * 4 + 3] + m[k * 4 + i];
+            planes[i * 2 + 1][k] = m[k * 4 + 3] - m[k * 4 + i];
+        }
+    }
+}
+
+// 0 when the box is outside some plane, 2 when inside all of them, else 1.
+int ClassifyBox(const float planes[6][4], const float* bounds) {
+    int result = 2;
+    for (int i = 0; i < 6; i++) {
+        const float* p = planes[i];
+        float maxDist = p[3], minDist = p[3];
+        for (int k = 0; k < 3; k++) {
+            maxDist += p[k] * (p[k] > 0.0f ? bounds[3 + k] : bounds[k]);
+            minDist += p[k] * (p[k] > 0.0f ? bounds[k] : bounds[3 + k]);
+        }
+        if (maxDist < 0.0f)
+            return 0;
+        if (minDist < 0.0f)
+            result = 1;
+    }
+    return result;
+}
+
+void AppendVisible(VisibleSet* vis, int element) {
+    if (vis->count == vis->capacity) {
+        int capacity = vis->capacity ? vis->capacity * 2 : 256;
+        int* items = realloc(vis->items, capacity * sizeof(int));
+        if (!items) {
+            printf("Error: Out of memory culling scene.\n");
+            exit(EXIT_FAILURE);
+        }
+        vis->items = items;
+        vis->capacity = capacity;
+    }
+    vis->items[vis->count++] = element;
+}
+
+int CompareInts(const void* a, const void* b) {
+    int x = *(const int*)a, y = *(const int*)b;
+    return (x > y) - (x < y);
+}
+
+// Pick each layer's level from the pixels its feature spans at the layer
+// center. Levels only change once the size clears a threshold by
+// LOD_HYSTERESIS, so a layer sitting on a boundary does not pop every frame.
+void UpdateLayerLod(const SceneCache* sc, const float* viewProj, int viewportHeight, VisibleSet* vis) {
+    static const float minPixels[LOD_LEVEL_COUNT - 1] = { 8.0f, 2.0f };    // For LOD_FULL, LOD_LOW_POLY
+    int fresh = vis->lodBuild != sc->buildCount;
+    if (sc->layerCount > vis->layerLodCapacity) {
+        unsigned char* levels = realloc(vis->layerLod, sc->layerCount);
+        if (!levels) {
+            printf("Error: Out of memory culling scene.\n");
+            exit(EXIT_FAILURE);
+        }
+        vis->layerLod = levels;
+        vis->layerLodCapacity = sc->layerCount;
+    }
+    // Length of the clip-space y row: the focal scale, whatever the rotation.
+    float focal = sqrtf(viewProj[1] * viewProj[1] + viewProj[5] * viewProj[5] + viewProj[9] * viewProj[9]);
+    for (int i = 0; i < sc->layerCount; i++) {
+        const LayerLodInfo* info = &sc->layers[i];
+        const float* c = info->center;
+        float w = viewProj[3] * c[0] + viewProj[7] * c[1] + viewProj[11] * c[2] + viewProj[15];
+        float pixels = w > 1e-3f ? info->featureSize * focal * viewportHeight * 0.5f / w : 1e30f;
+        int lod = LOD_FULL;
+        if (fresh) {
+            while (lod < info->maxLod && pixels < minPixels[lod])
+                lod++;
+        } else {
+            lod = vis->layerLod[i];
+            while (lod > LOD_FULL && pixels > minPixels[lod - 1] * LOD_HYSTERESIS)
+                lod--;
+            while (lod < info->maxLod && pixels < minPixels[lod] / LOD_HYSTERESIS)
+                lod++;
+        }
+        vis->layerLod[i] = (unsigned char)lod;
+        vis->stats.layersAtLod[lod]++;
+    }
+    vis->lodBuild = sc->buildCount;
+}
+
+// Forget the previous frame's levels; views that are not a continuous camera
+// path, like a batch of export cameras, call this before each one.
+void ResetLayerLod(VisibleSet* vis) {
+    vis->lodBuild = -1;
+}
+
+int ElementLod(const VisibleSet* vis, const SceneElement* e) {
+    return e->layer < 0 ? LOD_FULL : vis->layerLod[e->layer];
+}
+
+// Label text for a layer at its current level, LABEL_NONE when it would not
+// be legible.
+LabelVariant LayerLabelVariant(const NetworkGraph* net, const VisibleSet* vis, int layer) {
+    int lod = vis->layerLod[layer];
+    if (net->type[layer] == LAYER_BOX)
+        return lod == LOD_FULL ? LABEL_NAME : LABEL_NONE;
+    return lod == LOD_COLLAPSED ? LABEL_COUNT : LABEL_NAME;
+}
+
+// Collect the elements whose bounds touch the view frustum and that belong
+// to their layer's current level, in build order so depth ties resolve
+// exactly as they would without culling. Subtrees fully inside the frustum
+// are taken without further plane tests.
+void CullScene(const SceneCache* sc, const float* viewProj, int viewportHeight, VisibleSet* vis) {
+    float planes[6][4];
+    int stack[BVH_MAX_DEPTH];
+    int depth = 0;
+    double profileStart = ProfileStart();
+    ExtractFrustum(viewProj, planes);
+    vis->count = 0;
+    memset(&vis->stats, 0, sizeof(CullStats));
+    vis->stats.elements = sc->elementCount;
+    UpdateLayerLod(sc, viewProj, viewportHeight, vis);
+    if (sc->bvhNodeCount > 0)
+        stack[depth++] = 0;
+    while (depth > 0) {
+        const BvhNode* n = &sc->bvh[stack[--depth]];
+        vis->stats.nodesVisited++;
+        int inside = ClassifyBox(planes, n->bounds);
+        if (inside == 0)
+            continue;
+        if (n->count > 0 || inside == 2 || depth + 2 > BVH_MAX_DEPTH) {
+            // Whole subtree: its items are one contiguous run of bvhItems.
+            const BvhNode* lo = n;
+            const BvhNode* hi = n;
+            while (lo->count == 0)
+                lo = &sc->bvh[lo->first];
+            while (hi->count == 0)
+                hi = &sc->bvh[hi->first + 1];
+            for (int i = lo->first; i < hi->first + hi->count; i++) {
+                int element = sc->bvhItems[i];
+                const SceneElement* e = &sc->elements[element];
+                if (!(e->lodMask & LOD_MASK(ElementLod(vis, e))))
+                    continue;
+                if (inside == 2 || ClassifyBox(planes, e->bounds))
+                    AppendVisible(vis, element);
+            }
+            continue;
+        }
+        stack[depth++] = n->first + 1;
+        stack[depth++] = n->first;
+    }
+    // Elements patches added since the BVH was built.
+    for (int element = sc->bvhElementCount; element < sc->elementCount; element++) {
+        const SceneElement* e = &sc->elements[element];
+        if ((e->lodMask & LOD_MASK(ElementLod(vis, e))) && ClassifyBox(planes, e->bounds))
+            AppendVisible(vis, element);
+    }
+    vis->allVisible = vis->count == sc->elementCount;
+    if (!vis->allVisible)
+        qsort(vis->items, vis->count, sizeof(int), CompareInts);
+
+    CullStats* st = &vis->stats;
+    st->visibleElements = vis->count;
+    for (int i = 0; i < vis->count; i++) {
+        const SceneElement* e = &sc->elements[vis->items[i]];
+        st->triangles += e->triIndices.count / 3;
+        st->lines += e->lineIndices.count / 2;
+        st->instances += e->spheres.count + e->cones.count;
+    }
+    ProfileCount(PROF_ELEMENTS_CULLED, sc->elementCount - vis->count);
+    ProfileEnd(PROF_CULL, profileStart);
+}
+
+void ReleaseVisibleSet(VisibleSet* vis) {
+    free(vis->items);
+    free(vis->layerLod);
+    memset(vis, 0, sizeof(VisibleSet));
+}
+
+void FormatCullStats(const CullStats* st, char* text, size_t size) {
+    snprintf(text, size, "%d/%d elements drawn (%.1f%% culled, %d BVH nodes): %d triangles, %d lines, %d instances; "
+             "layers full/low/collapsed %d/%d/%d; %d labels (%d hidden)",
+             st->visibleElements, st->elements,
+             st->elements ? 100.0 * (st->elements - st->visibleElements) / st->elements : 0.0,
+             st->nodesVisited, st->triangles, st->lines, st->instances,
+             st->layersAtLod[LOD_FULL], st->layersAtLod[LOD_LOW_POLY], st->layersAtLod[LOD_COLLAPSED],
+             st->labels, st->labelsHidden);
+}
+
+//-------------------------
+// Picking
+//-------------------------
+
+// Ray from the near plane through pixel position (x, y), measured from the
+// top-left corner, of a width x height view with clip matrix viewProj.
+// Returns 0 when the matrix cannot be inverted.
+int MakePickRay(const float* viewProj, int width, int height, float x, float y, PickRay* ray) {
+    float inverse[16], ends[2][4], length = 0.0f;
+    if (width <= 0 || height <= 0 || !Mat4Invert(viewProj, inverse))
+        return 0;
+    float ndcX = 2.0f * x / width - 1.0f, ndcY = 1.0f - 2.0f * y / height;
+    TransformPoint(inverse, ndcX, ndcY, -1.0f, ends[0]);
+    TransformPoint(inverse, ndcX, ndcY, 1.0f, ends[1]);
+    if (fabsf(ends[0][3]) < 1e-12f || fabsf(ends[1][3]) < 1e-12f)
+        return 0;
+    for (int k = 0; k < 3; k++) {
+        ray->origin[k] = ends[0][k] / ends[0][3];
+        ray->dir[k] = ends[1][k] / ends[1][3] - ray->origin[k];
+        length += ray->dir[k] * ray->dir[k];
+    }
+    length = sqrtf(length);
+    if (length <= 0.0f)
+        return 0;
+    for (int k = 0; k < 3; k++) {
+        ray->dir[k] /= length;
+        ray->invDir[k] = 1.0f / ray->dir[k];
+    }
+    ray->length = length;
+    // World size of PICK_LINE_PIXELS at the far plane, which bounds the eye
+    // depth by the near-to-far length plus the near distance.
+    float focal = sqrtf(viewProj[1] * viewProj[1] + viewProj[5] * viewProj[5] + viewProj[9] * viewProj[9]);
+    ray->margin = PICK_LINE_PIXELS * 2.0f * (length + 1.0f) / (focal * height);
+    ray->viewProj = viewProj;
+    ray->x = x;
+    ray->y = y;
+    ray->width = width;
+    ray->height = height;
+    return 1;
+}
+
+// Ray parameter where the ray enters bounds grown by margin on every side,
+// or -1 when it misses them or only enters beyond limit.
+float RayBoxEntry(const PickRay* ray, const float* bounds, float margin, float limit) {
+    float enter = 0.0f, leave = limit;
+    for (int k = 0; k < 3; k++) {
+        float t0 = (bounds[k] - margin - ray->origin[k]) * ray->invDir[k];
+        float t1 = (bounds[3 + k] + margin - ray->origin[k]) * ray->invDir[k];
+        enter = fmaxf(enter, fminf(t0, t1));
+        leave = fminf(leave, fmaxf(t0, t1));
+    }
+    return enter <= leave ? enter : -1.0f;
+}
+
+// Moller-Trumbore, either winding. Returns the ray parameter or -1.
+float RayTriangle(const PickRay* ray, const float* a, const float* b, const float* c) {
+    float e1[3], e2[3], p[3], q[3], s[3];
+    for (int k = 0; k < 3; k++) {
+        e1[k] = b[k] - a[k];
+        e2[k] = c[k] - a[k];
+        s[k] = ray->origin[k] - a[k];
+    }
+    const float* d = ray->dir;
+    p[0] = d[1] * e2[2] - d[2] * e2[1];
+    p[1] = d[2] * e2[0] - d[0] * e2[2];
+    p[2] = d[0] * e2[1] - d[1] * e2[0];
+    float det = e1[0] * p[0] + e1[1] * p[1] + e1[2] * p[2];
+    if (fabsf(det) < 1e-12f)
+        return -1.0f;
+    float inv = 1.0f / det;
+    float u = (s[0] * p[0] + s[1] * p[1] + s[2] * p[2]) * inv;
+    if (u < 0.0f || u > 1.0f)
+        return -1.0f;
+    q[0] = s[1] * e1[2] - s[2] * e1[1];
+    q[1] = s[2] * e1[0] - s[0] * e1[2];
+    q[2] = s[0] * e1[1] - s[1] * e1[0];
+    float v = (d[0] * q[0] + d[1] * q[1] + d[2] * q[2]) * inv;
+    if (v < 0.0f || u + v > 1.0f)
+        return -1.0f;
+    float t = (e2[0] * q[0] + e2[1] * q[1] + e2[2] * q[2]) * inv;
+    return t >= 0.0f ? t : -1.0f;
+}
+
+// Hit with the unit ball under an instance transform: a neuron sphere or a
+// stretched row glyph exactly, an arrowhead by the ellipsoid around its unit
+// cone. The ray is taken into the instance's space, which keeps its
+// parameter. Returns the parameter or -1.
+float RayInstance(const PickRay* ray, const float* m) {
+    // Inverse of the 3x3 part from its cofactors.
+    float c[9] = {
+        m[5] * m[10] - m[6] * m[9], m[6] * m[8] - m[4] * m[10], m[4] * m[9] - m[5] * m[8],
+        m[2] * m[9] - m[1] * m[10], m[0] * m[10] - m[2] * m[8], m[1] * m[8] - m[0] * m[9],
+        m[1] * m[6] - m[2] * m[5], m[2] * m[4] - m[0] * m[6], m[0] * m[5] - m[1] * m[4]
+    };
+    float det = m[0] * c[0] + m[1] * c[1] + m[2] * c[2];
+    if (fabsf(det) < 1e-12f)
+        return -1.0f;
+    float rel[3] = { ray->origin[0] - m[12], ray->origin[1] - m[13], ray->origin[2] - m[14] };
+    float o[3], d[3];
+    for (int k = 0; k < 3; k++) {
+        o[k] = (c[k * 3] * rel[0] + c[k * 3 + 1] * rel[1] + c[k * 3 + 2] * rel[2]) / det;
+        d[k] = (c[k * 3] * ray->dir[0] + c[k * 3 + 1] * ray->dir[1] + c[k * 3 + 2] * ray->dir[2]) / det;
+    }
+    float a = d[0] * d[0] + d[1] * d[1] + d[2] * d[2];
+    float b = o[0] * d[0] + o[1] * d[1] + o[2] * d[2];
+    float disc = b * b - a * (o[0] * o[0] + o[1] * o[1] + o[2] * o[2] - 1.0f);
+    if (disc < 0.0f || a <= 0.0f)
+        return -1.0f;
+    float root = sqrtf(disc);
+    float t = (-b - root) / a;
+    if (t < 0.0f)
+        t = (-b + root) / a;     // Starting inside
+    return t >= 0.0f ? t : -1.0f;
+}
+
+// Lines are a pixel wide, so they are hit on screen: segment ab counts when
+// it passes within PICK_LINE_PIXELS of the cursor, at the ray parameter of
+// its point nearest the cursor. Returns the parameter or -1.
+float RaySegment(const PickRay* ray, const float* a, const float* b) {
+    float ca[4], cb[4], ends[2][2], w[2];
+    // Reject first in space: a segment farther from the ray's line than the
+    // margin is farther than PICK_LINE_PIXELS on screen. Distance along the
+    // segment is convex, so clamping the closest point of its whole line to
+    // the segment gives the closest point of the segment.
+    float u[3], r[3], uu = 0.0f, ud = 0.0f, ur = 0.0f, rd = 0.0f;
+    for (int k = 0; k < 3; k++) {
+        u[k] = b[k] - a[k];
+        r[k] = a[k] - ray->origin[k];
+        uu += u[k] * u[k];
+        ud += u[k] * ray->dir[k];
+        ur += u[k] * r[k];
+        rd += r[k] * ray->dir[k];
+    }
+    float denom = uu - ud * ud, gapSq = 0.0f;
+    float s = denom > 1e-12f ? fminf(fmaxf((ud * rd - ur) / denom, 0.0f), 1.0f) : 0.0f;
+    float along = rd + s * ud;
+    for (int k = 0; k < 3; k++) {
+        float g = r[k] + s * u[k] - along * ray->dir[k];
+        gapSq += g * g;
+    }
+    if (gapSq > ray->margin * ray->margin)
+        return -1.0f;
+    TransformPoint(ray->viewProj, a[0], a[1], a[2], ca);
+    TransformPoint(ray->viewProj, b[0], b[1], b[2], cb);
+    // Clip to the near plane, z >= -w.
+    float da = ca[2] + ca[3], db = cb[2] + cb[3];
+    float s0 = 0.0f, s1 = 1.0f;
+    if (da < 0.0f && db < 0.0f)
+        return -1.0f;
+    if (da < 0.0f)
+        s0 = da / (da - db);
+    else if (db < 0.0f)
+        s1 = da / (da - db);
+    for (int i = 0; i < 2; i++) {
+        float at = i ? s1 : s0, clip[4];
+        for (int k = 0; k < 4; k++)
+            clip[k] = ca[k] + (cb[k] - ca[k]) * at;
+        if (clip[3] <= 1e-6f)
+            return -1.0f;
+        w[i] = clip[3];
+        ends[i][0] = (clip[0] / clip[3] * 0.5f + 0.5f) * ray->width;
+        ends[i][1] = (0.5f - clip[1] / clip[3] * 0.5f) * ray->height;
+    }
+    float ex = ends[1][0] - ends[0][0], ey = ends[1][1] - ends[0][1];
+    float lengthSq = ex * ex + ey * ey;
+    float f = lengthSq > 0.0f ? ((ray->x - ends[0][0]) * ex + (ray->y - ends[0][1]) * ey) / lengthSq : 0.0f;
+    f = fminf(fmaxf(f, 0.0f), 1.0f);
+    float dx = ends[0][0] + ex * f - ray->x, dy = ends[0][1] + ey * f - ray->y;
+    if (dx * dx + dy * dy > PICK_LINE_PIXELS * PICK_LINE_PIXELS)
+        return -1.0f;
+    // Back from the screen to the segment: f is affine on screen, not in space.
+    float v = f * w[0] / (f * w[0] + (1.0f - f) * w[1]), t = 0.0f;
+    s = s0 + (s1 - s0) * v;
+    for (int k = 0; k < 3; k++)
+        t += (r[k] + u[k] * s) * ray->dir[k];
+    return t >= 0.0f ? t : -1.0f;
+}
+
+// Test an element's primitives, keeping the nearest hit so far in hit.
+void PickElement(const SceneCache* sc, const PickRay* ray, int element, PickHit* hit) {
+    const SceneElement* e = &sc->elements[element];
+    const float* verts = sc->triangles.vertices;
+    hit->elementsTested++;
+    for (int i = e->triIndices.first; i + 2 < e->triIndices.first + e->triIndices.count; i += 3) {
+        const GLuint* idx = &sc->triangles.indices[i];
+        float t = RayTriangle(ray, &verts[idx[0] * 3], &verts[idx[1] * 3], &verts[idx[2] * 3]);
+        if (t >= 0.0f && t < hit->distance) {
+            hit->distance = t;
+            hit->element = element;
+            hit->instance = -1;
+        }
+    }
+    verts = sc->lines.vertices;
+    for (int i = e->lineIndices.first; i + 1 < e->lineIndices.first + e->lineIndices.count; i += 2) {
+        const GLuint* idx = &sc->lines.indices[i];
+        float t = RaySegment(ray, &verts[idx[0] * 3], &verts[idx[1] * 3]);
+        if (t >= 0.0f && t < hit->distance) {
+            hit->distance = t;
+            hit->element = element;
+            hit->instance = -1;
+        }
+    }
+    const InstanceList* lists[2] = { &sc->spheres, &sc->cones };
+    const ElementRange* ranges[2] = { &e->spheres, &e->cones };
+    for (int l = 0; l < 2; l++) {
+        for (int n = ranges[l]->first; n < ranges[l]->first + ranges[l]->count; n++) {
+            float t = RayInstance(ray, lists[l]->items[n].transform);
+            if (t >= 0.0f && t < hit->distance) {
+                hit->distance = t;
+                hit->element = element;
+                hit->instance = l == 0 ? n : -1;
+            }
+        }
+    }
+}
+
+// Whether element is drawn at its layer's current level, so a pick only
+// finds what is on screen.
+int PickableElement(const SceneCache* sc, const VisibleSet* vis, int element) {
+    const SceneElement* e = &sc->elements[element];
+    return (e->lodMask & LOD_MASK(ElementLod(vis, e))) != 0;
+}
+
+// Name what the hit primitive belongs to. Body spheres are the layer's
+// neurons in order, then the collapsed glyph.
+void ClassifyPick(const SceneCache* sc, const NetworkGraph* net, PickHit* hit) {
+    const SceneElement* e = &sc->elements[hit->element];
+    if (e->arrowTo >= 0) {
+        hit->kind = PICK_CONNECTION;
+        hit->layer = e->arrowTo;
+        hit->from = e->arrowFrom;
+        return;
+    }
+    hit->layer = e->layer;
+    if (e->layer < 0 || e->layer >= net->layerCount || e->layer >= sc->layerCount) {
+        hit->kind = PICK_NONE;
+    } else if (net->type[e->layer] == LAYER_BOX) {
+        hit->kind = PICK_LAYER;
+    } else if (hit->instance >= 0) {
+        hit->neuron = hit->instance - sc->elements[sc->spans[e->layer].body.first].spheres.first;
+        hit->kind = hit->neuron < net->neuronCount[e->layer] ? PICK_NEURON : PICK_ROW;
+    } else {
+        hit->kind = PICK_LAYER_EDGES;
+    }
+}
+
+// Nearest element under pixel position (x, y) of a view culled into vis,
+// among the elements drawn at its current levels and in front of the far
+// plane. The BVH is walked near child first, so once something is hit,
+// subtrees entered beyond it are skipped. Boxes are grown by the ray's
+// margin, so lines passing near the cursor are reached.
+// Returns 0 when nothing is hit or the view has not been culled yet.
+int PickScene(const SceneCache* sc, const NetworkGraph* net, const VisibleSet* vis, const float* viewProj,
+              int width, int height, float x, float y, PickHit* hit) {
+    PickRay ray;
+    int stack[BVH_MAX_DEPTH];
+    float entry[BVH_MAX_DEPTH];
+    int depth = 0;
+    memset(hit, 0, sizeof(PickHit));
+    hit->kind = PICK_NONE;
+    hit->element = hit->instance = hit->layer = hit->from = hit->neuron = -1;
+    hit->distance = 1e30f;
+    if (vis->lodBuild != sc->buildCount || vis->layerLodCapacity < sc->layerCount || sc->elementCount == 0 ||
+        !MakePickRay(viewProj, width, height, x, y, &ray))
+        return 0;
+    double profileStart = ProfileStart();
+    hit->distance = ray.length;
+    if (sc->bvhNodeCount > 0 && (entry[0] = RayBoxEntry(&ray, sc->bvh[0].bounds, ray.margin, ray.length)) >= 0.0f)
+        stack[depth++] = 0;
+    while (depth > 0) {
+        depth--;
+        if (entry[depth] > hit->distance)
+            continue;
+        const BvhNode* n = &sc->bvh[stack[depth]];
+        hit->nodesVisited++;
+        if (n->count > 0 || depth + 2 > BVH_MAX_DEPTH) {
+            // Whole subtree: its items are one contiguous run of bvhItems.
+            const BvhNode* lo = n;
+            const BvhNode* hi = n;
+            while (lo->count == 0)
+                lo = &sc->bvh[lo->first];
+            while (hi->count == 0)
+                hi = &sc->bvh[hi->first + 1];
+            for (int i = lo->first; i < hi->first + hi->count; i++) {
+                int element = sc->bvhItems[i];
+                if (PickableElement(sc, vis, element) &&
+                    RayBoxEntry(&ray, sc->elements[element].bounds, ray.margin, hit->distance) >= 0.0f)
+                    PickElement(sc, &ray, element, hit);
+            }
+            continue;
+        }
+        float t[2];
+        for (int c = 0; c < 2; c++)
+            t[c] = RayBoxEntry(&ray, sc->bvh[n->first + c].bounds, ray.margin, hit->distance);
+        int nearer = t[1] >= 0.0f && (t[0] < 0.0f || t[1] < t[0]);
+        for (int c = 0; c < 2; c++) {
+            int child = c == 0 ? !nearer : nearer;      // Farther first, so the nearer pops first
+            if (t[child] >= 0.0f) {
+                stack[depth] = n->first + child;
+                entry[depth++] = t[child];
+            }
+        }
+    }
+    // Elements patches added since the BVH was built.
+    for (int element = sc->bvhElementCount; element < sc->elementCount; element++) {
+        if (PickableElement(sc, vis, element) &&
+            RayBoxEntry(&ray, sc->elements[element].bounds, ray.margin, hit->distance) >= 0.0f)
+            PickElement(sc, &ray, element, hit);
+    }
+    if (hit->element >= 0)
+        ClassifyPick(sc, net, hit);
+    ProfileEnd(PROF_PICK, profileStart);
+    return hit->kind != PICK_NONE;
+}
+
+// Tooltip text for a pick: what was hit, its output shape and costs, and
+// the weights behind it when a checkpoint is attached.
+void FormatPickInfo(const NetworkGraph* net, const PickHit* hit, char* text, size_t size) {
+    char shape[48], params[32], macs[32], bytes[32];
+    int l = hit->layer;
+    text[0] = '\0';
+    if (hit->kind == PICK_NONE || l < 0 || l >= net->layerCount)
+        return;
+    if (hit->kind == PICK_CONNECTION) {
+        if (hit->from < 0 || hit->from >= net->layerCount)
+            return;
+        const TensorShape* out = &net->cost[hit->from].out;
+        int used = snprintf(text, size, "%s -> %s", net->label[hit->from], net->label[l]);
+        if (out->rank) {
+            FormatShape(out, shape, sizeof(shape));
+            FormatQuantity((double)ShapeElements(out) * 4.0, "B", bytes, sizeof(bytes));
+            snprintf(text + used, used < (int)size ? size - used : 0, "\nCarries %s (%s)", shape, bytes);
+        }
+        return;
+    }
+    const LayerCost* c = &net->cost[l];
+    int used = snprintf(text, size, "%s (%s)", net->label[l], OpKindName(net->op[l].kind));
+    if (c->out.rank) {
+        FormatShape(&c->out, shape, sizeof(shape));
+        FormatQuantity((double)c->params, "", params, sizeof(params));
+        FormatQuantity((double)c->macs, "MACs", macs, sizeof(macs));
+        FormatQuantity((double)c->activationBytes, "B", bytes, sizeof(bytes));
+        used += snprintf(text + used, used < (int)size ? size - used : 0, "\nOutput %s\n%s params, %s, %s written",
+                         shape, params, macs, bytes);
+    }
+    int neurons = net->neuronCount[l];
+    if (hit->kind == PICK_NEURON)
+        used += snprintf(text + used, used < (int)size ? size - used : 0, "\nNeuron %d of %d", hit->neuron + 1, neurons);
+    else if (hit->kind == PICK_ROW)
+        used += snprintf(text + used, used < (int)size ? size - used : 0, "\n%d neurons, collapsed", neurons);
+    else if (hit->kind == PICK_LAYER_EDGES)
+        used += snprintf(text + used, used < (int)size ? size - used : 0, "\nEdges: %s",
+                         EdgeModeName(ResolveEdgeMode((long long)neurons * neurons)));
+    if (net->weights && net->weight[l] >= 0) {
+        const WeightSummary* w = &net->weights->tensors[net->weight[l]];
+        WeightStats s = w->total;
+        int rows = hit->kind == PICK_NEURON && w->rowLevels > 0 && neurons > 0;
+        if (rows) {
+            // The row bins the neuron stands for, as its color was chosen.
+            int bins = w->rowCount[0];
+            int first = (int)((long long)hit->neuron * bins / neurons);
+            int end = (int)((long long)(hit->neuron + 1) * bins / neurons);
+            WeightRowStats(w, first, end > first ? end : first + 1, &s);
+        }
+        snprintf(text + used, used < (int)size ? size - used : 0, "\n%s%s: mean |w| %.4g, max |w| %.4g, norm %.4g",
+                 w->name, rows ? " rows" : "", WeightStatValue(&s, WEIGHT_VIEW_MEAN),
+                 WeightStatValue(&s, WEIGHT_VIEW_MAX), WeightStatValue(&s, WEIGHT_VIEW_NORM));
+    }
+}
+
+//-------------------------
+// Camera Transforms
+//-------------------------
+
+// out = a * b, column-major like OpenGL; out may alias either input.
+void Mat4Multiply(const float* a, const float* b, float* out) {
+    float r[16];
+    for (int col = 0; col < 4; col++) {
+        for (int row = 0; row < 4; row++) {
+            r[col * 4 + row] = a[row] * b[col * 4] + a[4 + row] * b[col * 4 + 1] +
+                               a[8 + row] * b[col * 4 + 2] + a[12 + row] * b[col * 4 + 3];
+        }
+    }
+    memcpy(out, r, sizeof(r));
+}
+
+// m = m * rotation about the unit axis (x, y, z), the same as glRotatef.
+void Mat4Rotate(float* m, float angle, float x, float y, float z) {
+    float rad = (float)(angle * PI / 180.0);
+    float c = cosf(rad), s = sinf(rad), t = 1.0f - c;
+    float r[16] = {
+        x * x * t + c,     y * x * t + z * s, x * z * t - y * s, 0.0f,
+        x * y * t - z * s, y * y * t + c,     y * z * t + x * s, 0.0f,
+        x * z * t + y * s, y * z * t - x * s, z * z * t + c,     0.0f,
+        0.0f,              0.0f,              0.0f,              1.0f
+    };
+    Mat4Multiply(m, r, m);
+}
+
+// out = m^-1 by cofactor expansion; returns 0, leaving out alone, when m is
+// singular. out may alias m.
+int Mat4Invert(const float* m, float* out) {
+    float inv[16];
+    inv[0] = m[5] * m[10] * m[15] - m[5] * m[11] * m[14] - m[9] * m[6] * m[15] +
+             m[9] * m[7] * m[14] + m[13] * m[6] * m[11] - m[13] * m[7] * m[10];
+    inv[4] = -m[4] * m[10] * m[15] + m[4] * m[11] * m[14] + m[8] * m[6] * m[15] -
+             m[8] * m[7] * m[14] - m[12] * m[6] * m[11] + m[12] * m[7] * m[10];
+    inv[8] = m[4] * m[9] * m[15] - m[4] * m[11] * m[13] - m[8] * m[5] * m[15] +
+             m[8] * m[7] * m[13] + m[12] * m[5] * m[11] - m[12] * m[7] * m[9];
+    inv[12] = -m[4] * m[9] * m[14] + m[4] * m[10] * m[13] + m[8] * m[5] * m[14] -
+              m[8] * m[6] * m[13] - m[12] * m[5] * m[10] + m[12] * m[6] * m[9];
+    inv[1] = -m[1] * m[10] * m[15] + m[1] * m[11] * m[14] + m[9] * m[2] * m[15] -
+             m[9] * m[3] * m[14] - m[13] * m[2] * m[11] + m[13] * m[3] * m[10];
+    inv[5] = m[0] * m[10] * m[15] - m[0] * m[11] * m[14] - m[8] * m[2] * m[15] +
+             m[8] * m[3] * m[14] + m[12] * m[2] * m[11] - m[12] * m[3] * m[10];
+    inv[9] = -m[0] * m[9] * m[15] + m[0] * m[11] * m[13] + m[8] * m[1] * m[15] -
+             m[8] * m[3] * m[13] - m[12] * m[1] * m[11] + m[12] * m[3] * m[9];
+    inv[13] = m[0] * m[9] * m[14] - m[0] * m[10] * m[13] - m[8] * m[1] * m[14] +
+              m[8] * m[2] * m[13] + m[12] * m[1] * m[10] - m[12] * m[2] * m[9];
+    inv[2] = m[1] * m[6] * m[15] - m[1] * m[7] * m[14] - m[5] * m[2] * m[15] +
+             m[5] * m[3] * m[14] + m[13] * m[2] * m[7] - m[13] * m[3] * m[6];
+    inv[6] = -m[0] * m[6] * m[15] + m[0] * m[7] * m[14] + m[4] * m[2] * m[15] -
+             m[4] * m[3] * m[14] - m[12] * m[2] * m[7] + m[12] * m[3] * m[6];
+    inv[10] = m[0] * m[5] * m[15] - m[0] * m[7] * m[13] - m[4] * m[1] * m[15] +
+              m[4] * m[3] * m[13] + m[12] * m[1] * m[7] - m[12] * m[3] * m[5];
+    inv[14] = -m[0] * m[5] * m[14] + m[0] * m[6] * m[13] + m[4] * m[1] * m[14] -
+              m[4] * m[2] * m[13] - m[12] * m[1] * m[6] + m[12] * m[2] * m[5];
+    inv[3] = -m[1] * m[6] * m[11] + m[1] * m[7] * m[10] + m[5] * m[2] * m[11] -
+             m[5] * m[3] * m[10] - m[9] * m[2] * m[7] + m[9] * m[3] * m[6];
+    inv[7] = m[0] * m[6] * m[11] - m[0] * m[7] * m[10] - m[4] * m[2] * m[11] +
+             m[4] * m[3] * m[10] + m[8] * m[2] * m[7] - m[8] * m[3] * m[6];
+    inv[11] = -m[0] * m[5] * m[11] + m[0] * m[7] * m[9] + m[4] * m[1] * m[11] -
+              m[4] * m[3] * m[9] - m[8] * m[1] * m[7] + m[8] * m[3] * m[5];
+    inv[15] = m[0] * m[5] * m[10] - m[0] * m[6] * m[9] - m[4] * m[1] * m[10] +
+              m[4] * m[2] * m[9] + m[8] * m[1] * m[6] - m[8] * m[2] * m[5];
+    float det = m[0] * inv[0] + m[1] * inv[4] + m[2] * inv[8] + m[3] * inv[12];
+    if (det == 0.0f)
+        return 0;
+    for (int i = 0; i < 16; i++)
+        out[i] = inv[i] / det;
+    return 1;
+}
+
+// Projection * view * model for the camera, matching the window's
+// gluPerspective(45, aspect, 1, 100), gluLookAt and glRotatef calls.
+void CameraMatrix(const Camera* cam, float aspect, float* out) {
+    const float nearZ = 1.0f, farZ = 100.0f;
+    float f = 1.0f / tanf((float)(45.0 * 0.5 * PI / 180.0));
+    float proj[16] = {
+        f / aspect, 0.0f, 0.0f, 0.0f,
+        0.0f, f, 0.0f, 0.0f,
+        0.0f, 0.0f, (farZ + nearZ) / (nearZ - farZ), -1.0f,
+        0.0f, 0.0f, 2.0f * farZ * nearZ / (nearZ - farZ), 0.0f
+    };
+    // Looking down -y from (0, 20 / zoom, 0) with -z up: eye space is
+    // (x, -z, y - distance).
+    float view[16] = {
+        1.0f, 0.0f, 0.0f, 0.0f,
+        0.0f, 0.0f, 1.0f, 0.0f,
+        0.0f, -1.0f, 0.0f, 0.0f,
+        0.0f, 0.0f, -20.0f / cam->zoom, 1.0f
+    };
+    Mat4Multiply(proj, view, out);
+    Mat4Rotate(out, cam->rotX, 1.0f, 0.0f, 0.0f);
+    Mat4Rotate(out, cam->rotY, 0.0f, 1.0f, 0.0f);
+}
+
+void TransformPoint(const float* m, float x, float y, float z, float* clip) {
+    for (int row = 0; row < 4; row++)
+        clip[row] = m[row] * x + m[4 + row] * y + m[8 + row] * z + m[12 + row];
+}
+
+//-------------------------
+// Label Text
+//-------------------------
+
+// Give every glyph a cell of its width, packed left to right in rows of an
+// ATLAS_WIDTH atlas, and allocate the cleared coverage image. widths[i] is
+// the cell width of ASCII 32 + i; the caller sets advances and the ascent.
+void AllocateGlyphAtlas(GlyphAtlas* atlas, const int* widths, int cellHeight) {
+    int x = 0, y = 0;
+    atlas->cellHeight = cellHeight;
+    for (int i = 0; i < ATLAS_GLYPH_COUNT; i++) {
+        int width = widths[i] < ATLAS_WIDTH ? widths[i] : ATLAS_WIDTH;
+        if (x + width > ATLAS_WIDTH) {
+            x = 0;
+            y += cellHeight + 1;
+        }
+        atlas->glyphs[i].x = x;
+        atlas->glyphs[i].y = y;
+        atlas->glyphs[i].width = width;
+        x += width + 1;     // Gap so neighbors never bleed into a sampled cell
+    }
+    atlas->width = ATLAS_WIDTH;
+    atlas->height = 1;
+    while (atlas->height < y + cellHeight)
+        atlas->height *= 2;
+    atlas->pixels = calloc((size_t)atlas->width * atlas->height, 1);
+    if (!atlas->pixels) {
+        printf("Error: Out of memory building the glyph atlas.\n");
+        exit(EXIT_FAILURE);
+    }
+}
+
+// Scale the embedded font up by GLYPH_SCALE into an atlas. Glyphs sit wholly
+// above the baseline, one blank column apart.
+void BuildEmbeddedAtlas(GlyphAtlas* atlas) {
+    int widths[ATLAS_GLYPH_COUNT];
+    for (int i = 0; i < ATLAS_GLYPH_COUNT; i++)
+        widths[i] = GLYPH_WIDTH * GLYPH_SCALE;
+    AllocateGlyphAtlas(atlas, widths, GLYPH_HEIGHT * GLYPH_SCALE);
+    atlas->ascent = GLYPH_HEIGHT * GLYPH_SCALE;
+    for (int i = 0; i < ATLAS_GLYPH_COUNT; i++) {
+        AtlasGlyph* glyph = &atlas->glyphs[i];
+        glyph->advance = (GLYPH_WIDTH + 1) * GLYPH_SCALE;
+        for (int py = 0; py < atlas->cellHeight; py++) {
+            unsigned char* dst = atlas->pixels + (size_t)(glyph->y + py) * atlas->width + glyph->x;
+            for (int px = 0; px < glyph->width; px++) {
+                if (glyphRows[i][py / GLYPH_SCALE] & (0x10 >> (px / GLYPH_SCALE)))
+                    dst[px] = 255;
+            }
+        }
+    }
+}
+
+void ReleaseGlyphAtlas(GlyphAtlas* atlas) {
+#ifdef _WIN32
+    if (atlas->texture)
+        glDeleteTextures(1, &atlas->texture);
+#endif
+    free(atlas->pixels);
+    memset(atlas, 0, sizeof(GlyphAtlas));
+}
+
+void FormatLayerLabel(const NetworkGraph* net, int layer, LabelVariant variant, char* buf, size_t size) {
+    int used;
+    if (variant == LABEL_NAME)
+        used = snprintf(buf, size, "%s", net->label[layer]);
+    else if (net->label[layer][0])
+        used = snprintf(buf, size, "%s (%d neurons)", net->label[layer], net->neuronCount[layer]);
+    else
+        used = snprintf(buf, size, "%d neurons", net->neuronCount[layer]);
+    // The heat map adds the layer's value, the weight view its tensor's.
+    if (costView != COST_VIEW_OFF && net->cost[layer].out.rank && used >= 0 && (size_t)used < size) {
+        char cost[48];
+        FormatLayerCost(net, layer, costView, cost, sizeof(cost));
+        used += snprintf(buf + used, size - used, "  %s", cost);
+    }
+    const WeightSummary* weights = LayerWeights(net, layer);
+    if (weights && used >= 0 && (size_t)used < size)
+        snprintf(buf + used, size - used, "  %s %.3g", WeightViewName(weightView), WeightStatValue(&weights->total, weightView));
+}
+
+// Lay out every variant of every layer's label as glyph cells relative to the
+// anchor. Only graph changes pay for this; frames just look runs up.
+void LayoutLabels(LabelCache* lc, const GlyphAtlas* atlas, const NetworkGraph* net) {
+    int runCount = net->layerCount * LABEL_VARIANT_COUNT;
+    if (runCount > lc->runCapacity) {
+        LabelRun* runs = realloc(lc->runs, runCount * sizeof(LabelRun));
+        if (!runs) {
+            printf("Error: Out of memory laying out labels.\n");
+            exit(EXIT_FAILURE);
+        }
+        lc->runs = runs;
+        lc->runCapacity = runCount;
+    }
+    lc->glyphCount = 0;
+    lc->staleGlyphs = 0;
+    for (int i = 0; i < net->layerCount; i++)
+        LayoutLayerLabels(lc, atlas, net, i);
+    lc->atlas = atlas;
+    lc->layerCount = net->layerCount;
+    lc->builtRevision = net->revision;
+}
+
+// Append the glyphs of layer's label variants and point its runs at them.
+void LayoutLayerLabels(LabelCache* lc, const GlyphAtlas* atlas, const NetworkGraph* net, int layer) {
+    for (int variant = 0; variant < LABEL_VARIANT_COUNT; variant++) {
+        char text[128];
+        LabelRun* run = &lc->runs[layer * LABEL_VARIANT_COUNT + variant];
+        FormatLayerLabel(net, layer, (LabelVariant)variant, text, sizeof(text));
+        int length = (int)strlen(text);
+        if (lc->glyphCount + length > lc->glyphCapacity) {
+            int capacity = lc->glyphCapacity ? lc->glyphCapacity : 1024;
+            while (capacity < lc->glyphCount + length)
+                capacity *= 2;
+            LaidGlyph* glyphs = realloc(lc->glyphs, capacity * sizeof(LaidGlyph));
+            if (!glyphs) {
+                printf("Error: Out of memory laying out labels.\n");
+                exit(EXIT_FAILURE);
+            }
+            // Zeroed so the padding byte of each glyph is stored as 0 in the scene cache.
+            memset(glyphs + lc->glyphCapacity, 0, (capacity - lc->glyphCapacity) * sizeof(LaidGlyph));
+            lc->glyphs = glyphs;
+            lc->glyphCapacity = capacity;
+        }
+        // Characters without a glyph still advance the pen, like a space.
+        int pen = 0;
+        run->first = lc->glyphCount;
+        for (const char* ch = text; *ch; ch++) {
+            int index = (unsigned char)*ch - ATLAS_FIRST_CHAR;
+            if (index < 0 || index >= ATLAS_GLYPH_COUNT) {
+                pen += atlas->glyphs[0].advance;
+                continue;
+            }
+            LaidGlyph* g = &lc->glyphs[lc->glyphCount++];
+            g->x = (short)pen;
+            g->glyph = (unsigned char)index;
+            pen += atlas->glyphs[index].advance;
+        }
+        run->count = lc->glyphCount - run->first;
+        run->width = pen;
+    }
+}
+
+// Redo the labels of the layers journaled since the last layout, like
+// PatchScene. Returns 0 when a full LayoutLabels is needed.
+int PatchLabels(LabelCache* lc, const GlyphAtlas* atlas, const NetworkGraph* net) {
+    int n = net->layerCount;
+    if (lc->atlas != atlas || lc->builtRevision < net->journalStart ||
+        net->revision - lc->builtRevision > n / 4 + 16 || lc->staleGlyphs > lc->glyphCount / 2)
+        return 0;
+    if (n * LABEL_VARIANT_COUNT > lc->runCapacity) {
+        int capacity = n * 2 * LABEL_VARIANT_COUNT;
+        LabelRun* runs = realloc(lc->runs, capacity * sizeof(LabelRun));
+        if (!runs) {
+            printf("Error: Out of memory laying out labels.\n");
+            exit(EXIT_FAILURE);
+        }
+        lc->runs = runs;
+        lc->runCapacity = capacity;
+    }
+    for (int k = lc->builtRevision - net->journalStart; k < net->journalCount; k++) {
+        int layer = net->journal[k];
+        if (layer < 0 || layer >= n || layer >= lc->layerCount)
+            continue;
+        for (int variant = 0; variant < LABEL_VARIANT_COUNT; variant++)
+            lc->staleGlyphs += lc->runs[layer * LABEL_VARIANT_COUNT + variant].count;
+        LayoutLayerLabels(lc, atlas, net, layer);
+    }
+    for (int i = lc->layerCount; i < n; i++)
+        LayoutLayerLabels(lc, atlas, net, i);
+    lc->layerCount = n;
+    lc->builtRevision = net->revision;
+    return 1;
+}
+
+// Nearest first; ties keep layer order so placement is deterministic.
+int ComparePlacedLabels(const void* a, const void* b) {
+    const PlacedLabel* x = a;
+    const PlacedLabel* y = b;
+    if (x->depth != y->depth)
+        return x->depth < y->depth ? -1 : 1;
+    return (x->run > y->run) - (x->run < y->run);
+}
+
+// Decide which labels this frame draws. Anchors outside the frustum are
+// dropped like a clipped glRasterPos, as are labels entirely off screen or
+// hidden by their layer's LOD. The rest claim cells of a LABEL_CELL_SIZE
+// grid nearest first, and a label touching a claimed cell is skipped, so
+// dense views thin out instead of piling text up.
+void PlaceLabels(LabelCache* lc, const GlyphAtlas* atlas, const NetworkGraph* net, VisibleSet* vis,
+                 const float* viewProj, int width, int height) {
+    if ((lc->atlas != atlas || lc->builtRevision != net->revision) && !PatchLabels(lc, atlas, net))
+        LayoutLabels(lc, atlas, net);
+    if (net->layerCount > lc->placedCapacity) {
+        PlacedLabel* placed = realloc(lc->placed, net->layerCount * sizeof(PlacedLabel));
+        if (!placed) {
+            printf("Error: Out of memory placing labels.\n");
+            exit(EXIT_FAILURE);
+        }
+        lc->placed = placed;
+        lc->placedCapacity = net->layerCount;
+    }
+    lc->placedCount = 0;
+    for (int i = 0; i < net->layerCount; i++) {
+        LabelVariant variant = LayerLabelVariant(net, vis, i);
+        if (variant == LABEL_NONE)
+            continue;
+        int run = i * LABEL_VARIANT_COUNT + variant;
+        if (lc->runs[run].count == 0)
+            continue;
+        const float* pos = &net->position[i * 3];
+        float clip[4];
+        TransformPoint(viewProj, pos[0] + TEXT_OFFSET_X, pos[1], pos[2], clip);
+        if (clip[3] <= 0.0f || fabsf(clip[0]) > clip[3] || fabsf(clip[1]) > clip[3] || fabsf(clip[2]) > clip[3])
+            continue;
+        float invW = 1.0f / clip[3];
+        int x = (int)((clip[0] * invW * 0.5f + 0.5f) * width);
+        int y = (int)((0.5f - clip[1] * invW * 0.5f) * height);
+        if (x >= width || x + lc->runs[run].width <= 0 || y - atlas->ascent >= height ||
+            y - atlas->ascent + atlas->cellHeight <= 0)
+            continue;
+        PlacedLabel* pl = &lc->placed[lc->placedCount++];
+        pl->run = run;
+        pl->x = x;
+        pl->y = y;
+        pl->depth = clip[2] * invW * 0.5f + 0.5f;
+    }
+    // placed stays NULL until a network with layers comes by, and qsort must
+    // not be handed a NULL array even for no elements.
+    if (lc->placedCount > 1)
+        qsort(lc->placed, lc->placedCount, sizeof(PlacedLabel), ComparePlacedLabels);
+    
+    int cols = (width + LABEL_CELL_SIZE - 1) / LABEL_CELL_SIZE;
+    int rows = (height + LABEL_CELL_SIZE - 1) / LABEL_CELL_SIZE;
+    if (cols * rows > lc->gridCapacity) {
+        free(lc->grid);
+        lc->grid = malloc(cols * rows);
+        if (!lc->grid) {
+            printf("Error: Out of memory placing labels.\n");
+            exit(EXIT_FAILURE);
+        }
+        lc->gridCapacity = cols * rows;
+    }
+    memset(lc->grid, 0, cols * rows);
+    int kept = 0;
+    for (int i = 0; i < lc->placedCount; i++) {
+        const PlacedLabel* pl = &lc->placed[i];
+        int top = pl->y - atlas->ascent;
+        int c0 = pl->x < 0 ? 0 : pl->x / LABEL_CELL_SIZE;
+        int r0 = top < 0 ? 0 : top / LABEL_CELL_SIZE;
+        int c1 = (pl->x + lc->runs[pl->run].width - 1) / LABEL_CELL_SIZE;
+        int r1 = (top + atlas->cellHeight - 1) / LABEL_CELL_SIZE;
+        if (c1 >= cols)
+            c1 = cols - 1;
+        if (r1 >= rows)
+            r1 = rows - 1;
+        int clear = 1;
+        for (int r = r0; r <= r1 && clear; r++) {
+            for (int c = c0; c <= c1; c++) {
+                if (lc->grid[r * cols + c]) {
+                    clear = 0;
+                    break;
+                }
+            }
+        }
+        if (!clear)
+            continue;
+        for (int r = r0; r <= r1; r++)
+            memset(lc->grid + r * cols + c0, 1, c1 - c0 + 1);
+        lc->placed[kept++] = *pl;
+    }
+    vis->stats.labels = kept;
+    vis->stats.labelsHidden = net->layerCount - kept;
+    lc->placedCount = kept;
+}
+
+// Exchange the label layouts of a and b, leaving each its per-frame scratch.
+void SwapLabelLayouts(LabelCache* a, LabelCache* b) {
+    LabelCache saved = *a;
+    a->glyphs = b->glyphs;
+    a->glyphCount = b->glyphCount;
+    a->glyphCapacity = b->glyphCapacity;
+    a->runs = b->runs;
+    a->runCapacity = b->runCapacity;
+    a->atlas = b->atlas;
+    a->builtRevision = b->builtRevision;
+    a->layerCount = b->layerCount;
+    a->staleGlyphs = b->staleGlyphs;
+    b->glyphs = saved.glyphs;
+    b->glyphCount = saved.glyphCount;
+    b->glyphCapacity = saved.glyphCapacity;
+    b->runs = saved.runs;
+    b->runCapacity = saved.runCapacity;
+    b->atlas = saved.atlas;
+    b->builtRevision = saved.builtRevision;
+    b->layerCount = saved.layerCount;
+    b->staleGlyphs = saved.staleGlyphs;
+}
+
+void ReleaseLabelCache(LabelCache* lc) {
+    free(lc->glyphs);
+    free(lc->runs);
+    free(lc->placed);
+    free(lc->grid);
+    free(lc->vertices);
+    memset(lc, 0, sizeof(LabelCache));
+}
+
+#ifdef _WIN32
+// Rasterize the window font once with GDI, white on black into a DIB, and
+// keep one channel as coverage. Returns 0 when GDI cannot provide it.
+int BuildFontAtlas(GlyphAtlas* atlas) {
+    HFONT font = CreateFont(-16, 0, 0, 0, FW_BOLD, FALSE, FALSE, FALSE,
+                            ANSI_CHARSET, OUT_TT_PRECIS, CLIP_DEFAULT_PRECIS,
+                            ANTIALIASED_QUALITY, FF_DONTCARE | DEFAULT_PITCH, "Arial");
+    HDC dc = CreateCompatibleDC(hDC);
+    if (!font || !dc) {
+        if (font)
+            DeleteObject(font);
+        if (dc)
+            DeleteDC(dc);
+        return 0;
+    }
+    HGDIOBJ oldFont = SelectObject(dc, font);
+    TEXTMETRIC metrics;
+    int widths[ATLAS_GLYPH_COUNT];
+    GetTextMetrics(dc, &metrics);
+    for (int i = 0; i < ATLAS_GLYPH_COUNT; i++) {
+        char ch = (char)(ATLAS_FIRST_CHAR + i);
+        SIZE extent;
+        widths[i] = GetTextExtentPoint32(dc, &ch, 1, &extent) ? extent.cx : 0;
+    }
+    AllocateGlyphAtlas(atlas, widths, metrics.tmHeight);
+    atlas->ascent = metrics.tmAscent;
+    for (int i = 0; i < ATLAS_GLYPH_COUNT; i++)
+        atlas->glyphs[i].advance = widths[i];
+    
+    BITMAPINFO info = {0};
+    info.bmiHeader.biSize = sizeof(BITMAPINFOHEADER);
+    info.bmiHeader.biWidth = atlas->width;
+    info.bmiHeader.biHeight = -atlas->height;  // Top-down rows
+    info.bmiHeader.biPlanes = 1;
+    info.bmiHeader.biBitCount = 32;
+    info.bmiHeader.biCompression = BI_RGB;
+    void* bits = NULL;
+    HBITMAP bitmap = CreateDIBSection(dc, &info, DIB_RGB_COLORS, &bits, NULL, 0);
+    int ok = bitmap && bits;
+    if (ok) {
+        HGDIOBJ oldBitmap = SelectObject(dc, bitmap);
+        memset(bits, 0, (size_t)atlas->width * atlas->height * 4);
+        SetBkMode(dc, TRANSPARENT);
+        SetTextColor(dc, RGB(255, 255, 255));
+        for (int i = 0; i < ATLAS_GLYPH_COUNT; i++) {
+            char ch = (char)(ATLAS_FIRST_CHAR + i);
+            TextOut(dc, atlas->glyphs[i].x, atlas->glyphs[i].y, &ch, 1);
+        }
+        GdiFlush();
+        const unsigned char* src = bits;
+        for (size_t p = 0; p < (size_t)atlas->width * atlas->height; p++)
+            atlas->pixels[p] = src[p * 4 + 1];
+        SelectObject(dc, oldBitmap);
+        DeleteObject(bitmap);
+    } else {
+        ReleaseGlyphAtlas(atlas);
+    }
+    SelectObject(dc, oldFont);
+    DeleteObject(font);
+    DeleteDC(dc);
+    return ok;
+}
+
+void UploadGlyphAtlas(GlyphAtlas* atlas) {
+    glGenTextures(1, &atlas->texture);
+    glBindTexture(GL_TEXTURE_2D, atlas->texture);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_ALPHA, atlas->width, atlas->height, 0,
+                 GL_ALPHA, GL_UNSIGNED_BYTE, atlas->pixels);
+    glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+// Every placed glyph becomes a textured quad in one client-side array, drawn
+// with a single call in a pixel-aligned orthographic projection whose z is
+// the window depth, so labels are still hidden behind nearer geometry.
+// Append one glyph quad of 5-float vertices (x, y, depth, u, v) with its cell's
+// top-left corner at (x, top).
+float* PutGlyphQuad(float* v, const GlyphAtlas* atlas, int index, float x, float top, float depth) {
+    const AtlasGlyph* glyph = &atlas->glyphs[index];
+    float su = 1.0f / atlas->width, sv = 1.0f / atlas->height;
+    float x1 = x + glyph->width, y1 = top + atlas->cellHeight;
+    float u0 = glyph->x * su, u1 = (glyph->x + glyph->width) * su;
+    float v0 = glyph->y * sv, v1 = (glyph->y + atlas->cellHeight) * sv;
+    float corners[4][4] = { { x, top, u0, v0 }, { x1, top, u1, v0 }, { x1, y1, u1, v1 }, { x, y1, u0, v1 } };
+    for (int k = 0; k < 4; k++, v += 5) {
+        v[0] = corners[k][0];
+        v[1] = corners[k][1];
+        v[2] = depth;
+        v[3] = corners[k][2];
+        v[4] = corners[k][3];
+    }
+    return v;
+}
+
+// Grow a glyph vertex scratch to hold quads quads.
+void ReserveGlyphQuads(float** vertices, int* capacity, int quads) {
+    if (quads * 4 <= *capacity)
+        return;
+    free(*vertices);
+    *capacity = quads * 8;
+    *vertices = malloc(*capacity * 5 * sizeof(float));
+    if (!*vertices) {
+        printf("Error: Out of memory drawing text.\n");
+        exit(EXIT_FAILURE);
+    }
+}
+
+// Draw glyph quads in window pixels, y down, as a single batch. Without
+// depthTest the text goes over everything, as overlays need.
+void DrawGlyphQuads(const GlyphAtlas* atlas, const float* vertices, int quads, int depthTest) {
+    glMatrixMode(GL_PROJECTION);
+    glPushMatrix();
+    glLoadIdentity();
+    glOrtho(0.0, windowWidth, windowHeight, 0.0, 0.0, -1.0);
+    glMatrixMode(GL_MODELVIEW);
+    glPushMatrix();
+    glLoadIdentity();
+    glPushAttrib(GL_ENABLE_BIT);
+    if (!depthTest)
+        glDisable(GL_DEPTH_TEST);
+    glEnable(GL_TEXTURE_2D);
+    glEnable(GL_BLEND);
+    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    glEnable(GL_ALPHA_TEST);
+    glAlphaFunc(GL_GREATER, 0.0f);
+    glBindTexture(GL_TEXTURE_2D, atlas->texture);
+    glTexEnvi(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_MODULATE);
+    glColor3f(1.0f, 1.0f, 1.0f);
+    glEnableClientState(GL_VERTEX_ARRAY);
+    glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+    glVertexPointer(3, GL_FLOAT, 5 * sizeof(float), vertices);
+    glTexCoordPointer(2, GL_FLOAT, 5 * sizeof(float), vertices + 3);
+    glDrawArrays(GL_QUADS, 0, quads * 4);
+    glDisableClientState(GL_TEXTURE_COORD_ARRAY);
+    glDisableClientState(GL_VERTEX_ARRAY);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glPopAttrib();
+    glPopMatrix();
+    glMatrixMode(GL_PROJECTION);
+    glPopMatrix();
+    glMatrixMode(GL_MODELVIEW);
+    ProfileCount(PROF_DRAW_CALLS, 1);
+    ProfileCount(PROF_VERTICES, quads * 4);
+}
+
+void DrawLabels(const GlyphAtlas* atlas, LabelCache* lc) {
+    int quads = 0;
+    for (int i = 0; i < lc->placedCount; i++)
+        quads += lc->runs[lc->placed[i].run].count;
+    if (quads == 0)
+        return;
+    ReserveGlyphQuads(&lc->vertices, &lc->vertexCapacity, quads);
+    float* v = lc->vertices;
+    for (int i = 0; i < lc->placedCount; i++) {
+        const PlacedLabel* pl = &lc->placed[i];
+        const LabelRun* run = &lc->runs[pl->run];
+        float top = (float)(pl->y - atlas->ascent);
+        for (int g = run->first; g < run->first + run->count; g++) {
+            v = PutGlyphQuad(v, atlas, lc->glyphs[g].glyph, (float)(pl->x + lc->glyphs[g].x), top, pl->depth);
+        }
+    }
+    DrawGlyphQuads(atlas, lc->vertices, quads, 1);
+    ProfileCount(PROF_LABELS_DRAWN, lc->placedCount);
+}
+
+// Overlay text with its top-left corner at (x, y); '\n' starts a new line.
+void DrawScreenText(const GlyphAtlas* atlas, const char* text, int x, int y) {
+    static float* vertices = NULL;
+    static int capacity = 0;
+    int quads = 0;
+    float penX = (float)x, top = (float)y;
+    ReserveGlyphQuads(&vertices, &capacity, (int)strlen(text));
+    float* v = vertices;
+    for (const char* c = text; *c; c++) {
+        if (*c == '\n') {
+            penX = (float)x;
+            top += atlas->cellHeight + 2;
+            continue;
+        }
+        int index = (unsigned char)*c - ATLAS_FIRST_CHAR;
+        if (index < 0 || index >= ATLAS_GLYPH_COUNT)
+            continue;
+        if (*c != ' ') {
+            v = PutGlyphQuad(v, atlas, index, penX, top, 0.0f);
+            quads++;
+        }
+        penX += atlas->glyphs[index].advance;
+    }
+    if (quads > 0)
+        DrawGlyphQuads(atlas, vertices, quads, 0);
+}
+#endif
+
+//-------------------------
+// CPU Rasterizer
+//-------------------------
+
+// Returns 0 when the buffers cannot be allocated.
+int InitFramebuffer(Framebuffer* fb, int width, int height) {
+    fb->width = width;
+    fb->height = height;
+    fb->color = malloc((size_t)width * height * 3);
+    fb->depth = malloc((size_t)width * height * sizeof(float));
+    if (!fb->color || !fb->depth) {
+        ReleaseFramebuffer(fb);
+        return 0;
+    }
+    return 1;
+}
+
+void ReleaseFramebuffer(Framebuffer* fb) {
+    free(fb->color);
+    free(fb->depth);
+    memset(fb, 0, sizeof(Framebuffer));
+}
+
+// Clip space to pixel coordinates (y down) plus window depth.
+void ProjectToScreen(const Framebuffer* fb, const float* clip, float* screen) {
+    float invW = 1.0f / clip[3];
+    screen[0] = (clip[0] * invW * 0.5f + 0.5f) * fb->width;
+    screen[1] = (0.5f - clip[1] * invW * 0.5f) * fb->height;
+    screen[2] = clip[2] * invW * 0.5f + 0.5f;
+}
+
+unsigned int PackColor(const float* color) {
+    unsigned int packed = 0;
+    for (int i = 0; i < 3; i++)
+        packed |= (unsigned int)(fminf(fmaxf(color[i], 0.0f), 1.0f) * 255.0f + 0.5f) << (8 * i);
+    return packed;
+}
+
+// The rasterizer runs in two passes. Setup transforms, clips and projects
+// everything on the calling thread and files each primitive into the bin of
+// every TILE_SIZE square its bounds touch. Tiles are then rasterized
+// independently, in parallel, into cache-resident color and depth buffers and
+// copied out; bins keep submission order so depth ties resolve like GL.
+void InitRasterizer(Rasterizer* r, int threadCount) {
+    memset(r, 0, sizeof(Rasterizer));
+    InitMutex(&r->lock);
+    InitCondVar(&r->wake);
+    InitCondVar(&r->done);
+    if (threadCount > 1) {
+        r->threads = malloc((threadCount - 1) * sizeof(Thread));
+        while (r->threads && r->threadCount < threadCount - 1 &&
+               StartThread(&r->threads[r->threadCount], RasterWorker, r))
+            r->threadCount++;
+    }
+}
+
+void ReleaseRasterizer(Rasterizer* r) {
+    LockMutex(&r->lock);
+    r->quit = 1;
+    WakeAllCondVar(&r->wake);
+    UnlockMutex(&r->lock);
+    for (int i = 0; i < r->threadCount; i++)
+        JoinThread(r->threads[i]);
+    for (int i = 0; i < r->binCapacity; i++)
+        free(r->bins[i].items);
+    free(r->bins);
+    free(r->threads);
+    free(r->prims);
+    free(r->clip);
+    ReleaseVisibleSet(&r->visible);
+    ReleaseLabelCache(&r->labels);
+    DestroyCondVar(&r->wake);
+    DestroyCondVar(&r->done);
+    DestroyMutex(&r->lock);
+    memset(r, 0, sizeof(Rasterizer));
+}
+
+// Scratch space for one batch of clip-space vertices.
+float* ClipScratch(Rasterizer* r, int vertexCount) {
+    if (vertexCount > r->clipCapacity) {
+        free(r->clip);
+        r->clip = malloc(vertexCount * 4 * sizeof(float));
+        if (!r->clip) {
+            printf("Error: Out of memory rendering scene.\n");
+            exit(EXIT_FAILURE);
+        }
+        r->clipCapacity = vertexCount;
+    }
+    return r->clip;
+}
+
+RasterPrim* AppendPrim(Rasterizer* r) {
+    if (r->primCount == r->primCapacity) {
+        int capacity = r->primCapacity ? r->primCapacity * 2 : 1024;
+        RasterPrim* prims = realloc(r->prims, capacity * sizeof(RasterPrim));
+        if (!prims) {
+            printf("Error: Out of memory rendering scene.\n");
+            exit(EXIT_FAILURE);
+        }
+        r->prims = prims;
+        r->primCapacity = capacity;
+    }
+    return &r->prims[r->primCount++];
+}
+
+// Queue a screen-space triangle, dropping degenerate and off-screen ones.
+void QueueTriangle(Rasterizer* r, const float* a, const float* b, const float* c, unsigned int color) {
+    float area = (b[0] - a[0]) * (c[1] - a[1]) - (b[1] - a[1]) * (c[0] - a[0]);
+    if (fabsf(area) < 1e-8f)
+        return;
+    float minX = fminf(a[0], fminf(b[0], c[0])), maxX = fmaxf(a[0], fmaxf(b[0], c[0]));
+    float minY = fminf(a[1], fminf(b[1], c[1])), maxY = fmaxf(a[1], fmaxf(b[1], c[1]));
+    if (maxX < 0.0f || maxY < 0.0f || minX >= r->target->width || minY >= r->target->height)
+        return;
+    RasterPrim* prim = AppendPrim(r);
+    const float* v[3] = { a, b, c };
+    for (int i = 0; i < 3; i++) {
+        prim->x[i] = v[i][0];
+        prim->y[i] = v[i][1];
+        prim->z[i] = v[i][2];
+    }
+    prim->color = color;
+    prim->isLine = 0;
+    r->triangleCount++;
+}
+
+// Clip a clip-space triangle against the near plane (z >= -w), then fan the
+// remaining polygon. Other planes are handled by the tile bounds and the
+// depth range check.
+void DrawClippedTriangle(Rasterizer* r, const float* a, const float* b, const float* c, unsigned int color) {
+    const float* in[3] = { a, b, c };
+    float out[4][4];
+    int count = 0;
+    for (int i = 0; i < 3; i++) {
+        const float* p = in[i];
+        const float* q = in[(i + 1) % 3];
+        float dp = p[2] + p[3], dq = q[2] + q[3];
+        if (dp >= 0.0f)
+            memcpy(out[count++], p, 4 * sizeof(float));
+        if ((dp >= 0.0f) != (dq >= 0.0f)) {
+            float t = dp / (dp - dq);
+            for (int k = 0; k < 4; k++)
+                out[count][k] = p[k] + (q[k] - p[k]) * t;
+            count++;
+        }
+    }
+    if (count < 3)
+        return;
+    float screen[4][3];
+    for (int i = 0; i < count; i++)
+        ProjectToScreen(r->target, out[i], screen[i]);
+    for (int i = 1; i + 1 < count; i++)
+        QueueTriangle(r, screen[0], screen[i], screen[i + 1], color);
+}
+
+// One-pixel line between two clip-space points, clipped to the near plane.
+void DrawClippedLine(Rasterizer* r, const float* a, const float* b, unsigned int color) {
+    float p[4], q[4];
+    float da = a[2] + a[3], db = b[2] + b[3];
+    if (da < 0.0f && db < 0.0f)
+        return;
+    memcpy(p, a, sizeof(p));
+    memcpy(q, b, sizeof(q));
+    if (da < 0.0f || db < 0.0f) {
+        float t = da / (da - db);
+        float* moved = da < 0.0f ? p : q;
+        for (int k = 0; k < 4; k++)
+            moved[k] = a[k] + (b[k] - a[k]) * t;
+    }
+    float sp[3], sq[3];
+    ProjectToScreen(r->target, p, sp);
+    ProjectToScreen(r->target, q, sq);
+    if (fmaxf(sp[0], sq[0]) < 0.0f || fmaxf(sp[1], sq[1]) < 0.0f ||
+        fminf(sp[0], sq[0]) >= r->target->width || fminf(sp[1], sq[1]) >= r->target->height)
+        return;
+    RasterPrim* prim = AppendPrim(r);
+    prim->x[0] = sp[0]; prim->y[0] = sp[1]; prim->z[0] = sp[2];
+    prim->x[1] = sq[0]; prim->y[1] = sq[1]; prim->z[1] = sq[2];
+    prim->color = color;
+    prim->isLine = 1;
+}
+
+// Software counterpart of DrawInstances: every instance transforms the shared
+// unit mesh once and queues its triangles.
+void RasterMesh(Rasterizer* r, const float* viewProj, const Mesh* mesh, const InstanceList* list, int first, int count) {
+    if (count == 0)
+        return;
+    float* clip = ClipScratch(r, mesh->vertexCount);
+    for (int i = first; i < first + count; i++) {
+        const MeshInstance* inst = &list->items[i];
+        unsigned int color = PackColor(inst->color);
+        float mvp[16];
+        Mat4Multiply(viewProj, inst->transform, mvp);
+        for (int v = 0; v < mesh->vertexCount; v++) {
+            const float* p = &mesh->vertices[v * 3];
+            TransformPoint(mvp, p[0], p[1], p[2], &clip[v * 4]);
+        }
+        for (int t = 0; t < mesh->indexCount; t += 3) {
+            DrawClippedTriangle(r, &clip[mesh->indices[t] * 4], &clip[mesh->indices[t + 1] * 4],
+                                &clip[mesh->indices[t + 2] * 4], color);
+        }
+    }
+}
+
+// File every queued primitive into the bins of the tiles its bounds overlap.
+void BinPrimitives(Rasterizer* r) {
+    int tileCount = r->tilesX * r->tilesY;
+    if (tileCount > r->binCapacity) {
+        r->bins = realloc(r->bins, tileCount * sizeof(TileBin));
+        if (!r->bins) {
+            printf("Error: Out of memory rendering scene.\n");
+            exit(EXIT_FAILURE);
+        }
+        memset(r->bins + r->binCapacity, 0, (tileCount - r->binCapacity) * sizeof(TileBin));
+        r->binCapacity = tileCount;
+    }
+    for (int i = 0; i < tileCount; i++)
+        r->bins[i].count = 0;
+    for (int p = 0; p < r->primCount; p++) {
+        const RasterPrim* prim = &r->prims[p];
+        int corners = prim->isLine ? 2 : 3;
+        float minX = prim->x[0], maxX = prim->x[0], minY = prim->y[0], maxY = prim->y[0];
+        for (int i = 1; i < corners; i++) {
+            minX = fminf(minX, prim->x[i]);
+            maxX = fmaxf(maxX, prim->x[i]);
+            minY = fminf(minY, prim->y[i]);
+            maxY = fmaxf(maxY, prim->y[i]);
+        }
+        int tx0 = minX < 0.0f ? 0 : (int)minX / TILE_SIZE;
+        int ty0 = minY < 0.0f ? 0 : (int)minY / TILE_SIZE;
+        int tx1 = maxX >= r->target->width ? r->tilesX - 1 : (int)maxX / TILE_SIZE;
+        int ty1 = maxY >= r->target->height ? r->tilesY - 1 : (int)maxY / TILE_SIZE;
+        for (int ty = ty0; ty <= ty1; ty++) {
+            for (int tx = tx0; tx <= tx1; tx++) {
+                TileBin* bin = &r->bins[ty * r->tilesX + tx];
+                if (bin->count == bin->capacity) {
+                    int capacity = bin->capacity ? bin->capacity * 2 : 256;
+                    bin->items = realloc(bin->items, capacity * sizeof(int));
+                    if (!bin->items) {
+                        printf("Error: Out of memory rendering scene.\n");
+                        exit(EXIT_FAILURE);
+                    }
+                    bin->capacity = capacity;
+                }
+                bin->items[bin->count++] = p;
+            }
+        }
+    }
+}
+
+// Rasterize one triangle into a tile buffer whose top-left pixel is (ox, oy).
+// Barycentric weights of a and b are plane equations in x and y, normalized by
+// the signed area so "inside" is the same test for either winding; SSE2
+// evaluates four pixels per step.
+void RasterTileTriangle(const RasterPrim* prim, int ox, int oy, int width, int height,
+                        unsigned int* color, float* depth) {
+    const float *x = prim->x, *y = prim->y, *z = prim->z;
+    float inv = 1.0f / ((x[1] - x[0]) * (y[2] - y[0]) - (y[1] - y[0]) * (x[2] - x[0]));
+    float aX = -(y[2] - y[1]) * inv, aY = (x[2] - x[1]) * inv;
+    float aC = -(aX * (x[1] - ox) + aY * (y[1] - oy));
+    float bX = -(y[0] - y[2]) * inv, bY = (x[0] - x[2]) * inv;
+    float bC = -(bX * (x[2] - ox) + bY * (y[2] - oy));
+    float zA = z[0] - z[2], zB = z[1] - z[2];
+
+    float minX = fminf(x[0], fminf(x[1], x[2])) - ox, maxX = fmaxf(x[0], fmaxf(x[1], x[2])) - ox;
+    float minY = fminf(y[0], fminf(y[1], y[2])) - oy, maxY = fmaxf(y[0], fmaxf(y[1], y[2])) - oy;
+    int x0 = minX < 0.0f ? 0 : (int)minX & ~3;
+    int y0 = minY < 0.0f ? 0 : (int)minY;
+    int x1 = maxX >= width ? width - 1 : (int)maxX;
+    int y1 = maxY >= height ? height - 1 : (int)maxY;
+
+#if defined(__SSE2__) || defined(_M_X64)
+    const __m128 zero = _mm_setzero_ps(), one = _mm_set1_ps(1.0f);
+    const __m128 lanes = _mm_setr_ps(0.5f, 1.5f, 2.5f, 3.5f);
+    const __m128 stepA = _mm_set1_ps(4.0f * aX), stepB = _mm_set1_ps(4.0f * bX);
+    const __m128 vzA = _mm_set1_ps(zA), vzB = _mm_set1_ps(zB), vzC = _mm_set1_ps(z[2]);
+    const __m128i rgb = _mm_set1_epi32((int)prim->color);
+    for (int py = y0; py <= y1; py++) {
+        float rowY = py + 0.5f;
+        __m128 px = _mm_add_ps(_mm_set1_ps((float)x0), lanes);
+        __m128 wa = _mm_add_ps(_mm_mul_ps(px, _mm_set1_ps(aX)), _mm_set1_ps(aY * rowY + aC));
+        __m128 wb = _mm_add_ps(_mm_mul_ps(px, _mm_set1_ps(bX)), _mm_set1_ps(bY * rowY + bC));
+        float* depthRow = depth + py * TILE_SIZE;
+        unsigned int* colorRow = color + py * TILE_SIZE;
+        for (int px0 = x0; px0 <= x1; px0 += 4, wa = _mm_add_ps(wa, stepA), wb = _mm_add_ps(wb, stepB)) {
+            __m128 wc = _mm_sub_ps(_mm_sub_ps(one, wa), wb);
+            __m128 inside = _mm_and_ps(_mm_and_ps(_mm_cmpge_ps(wa, zero), _mm_cmpge_ps(wb, zero)),
+                                       _mm_cmpge_ps(wc, zero));
+            if (!_mm_movemask_ps(inside))
+                continue;
+            __m128 zv = _mm_add_ps(vzC, _mm_add_ps(_mm_mul_ps(wa, vzA), _mm_mul_ps(wb, vzB)));
+            __m128 old = _mm_loadu_ps(depthRow + px0);
+            __m128 pass = _mm_and_ps(inside, _mm_and_ps(_mm_cmplt_ps(zv, old), _mm_cmpge_ps(zv, zero)));
+            if (!_mm_movemask_ps(pass))
+                continue;
+            _mm_storeu_ps(depthRow + px0, _mm_or_ps(_mm_and_ps(pass, zv), _mm_andnot_ps(pass, old)));
+            __m128i mask = _mm_castps_si128(pass);
+            __m128i oldColor = _mm_loadu_si128((const __m128i*)(colorRow + px0));
+            _mm_storeu_si128((__m128i*)(colorRow + px0),
+                             _mm_or_si128(_mm_and_si128(mask, rgb), _mm_andnot_si128(mask, oldColor)));
+        }
+    }
+#else
+    for (int py = y0; py <= y1; py++) {
+        float rowY = py + 0.5f;
+        for (int px = x0; px <= x1; px++) {
+            float wa = aX * (px + 0.5f) + aY * rowY + aC;
+            float wb = bX * (px + 0.5f) + bY * rowY + bC;
+            if (wa < 0.0f || wb < 0.0f || 1.0f - wa - wb < 0.0f)
+                continue;
+            float zv = z[2] + wa * zA + wb * zB;
+            int pixel = py * TILE_SIZE + px;
+            if (zv < 0.0f || zv >= depth[pixel])
+                continue;
+            depth[pixel] = zv;
+            color[pixel] = prim->color;
+        }
+    }
+#endif
+}
+
+// Step the whole line as the single-buffer renderer would, but only over the
+// span of steps that can land inside this tile.
+void RasterTileLine(const RasterPrim* prim, int ox, int oy, int width, int height,
+                    unsigned int* color, float* depth) {
+    float dx = prim->x[1] - prim->x[0], dy = prim->y[1] - prim->y[0];
+    float length = fmaxf(fabsf(dx), fabsf(dy));
+    int steps = length > 1.0f ? (int)ceilf(length) : 1;
+    float tMin = 0.0f, tMax = 1.0f;
+    const float start[2] = { prim->x[0] - ox, prim->y[0] - oy };
+    const float delta[2] = { dx, dy };
+    const float limit[2] = { (float)width, (float)height };
+    for (int axis = 0; axis < 2; axis++) {
+        if (delta[axis] == 0.0f) {
+            if (start[axis] < 0.0f || start[axis] >= limit[axis])
+                return;
+            continue;
+        }
+        float t0 = (0.0f - start[axis]) / delta[axis];
+        float t1 = (limit[axis] - start[axis]) / delta[axis];
+        tMin = fmaxf(tMin, fminf(t0, t1));
+        tMax = fminf(tMax, fmaxf(t0, t1));
+    }
+    if (tMin > tMax)
+        return;
+    int first = (int)floorf(tMin * steps) - 1, last = (int)ceilf(tMax * steps) + 1;
+    if (first < 0)
+        first = 0;
+    if (last > steps)
+        last = steps;
+    for (int i = first; i <= last; i++) {
+        float t = (float)i / steps;
+        float fx = prim->x[0] + dx * t - ox, fy = prim->y[0] + dy * t - oy;
+        if (fx < 0.0f || fy < 0.0f || fx >= width || fy >= height)
+            continue;
+        float zv = prim->z[0] + (prim->z[1] - prim->z[0]) * t;
+        int pixel = (int)fy * TILE_SIZE + (int)fx;
+        if (zv < 0.0f || zv >= depth[pixel])
+            continue;
+        depth[pixel] = zv;
+        color[pixel] = prim->color;
+    }
+}
+
+void RasterTile(Rasterizer* r, int tile) {
+    unsigned int color[TILE_SIZE * TILE_SIZE];
+    float depth[TILE_SIZE * TILE_SIZE];
+    Framebuffer* fb = r->target;
+    int ox = (tile % r->tilesX) * TILE_SIZE, oy = (tile / r->tilesX) * TILE_SIZE;
+    int width = fb->width - ox < TILE_SIZE ? fb->width - ox : TILE_SIZE;
+    int height = fb->height - oy < TILE_SIZE ? fb->height - oy : TILE_SIZE;
+    memset(color, 0, sizeof(color));
+    for (int i = 0; i < TILE_SIZE * TILE_SIZE; i++)
+        depth[i] = 1.0f;
+
+    const TileBin* bin = &r->bins[tile];
+    for (int i = 0; i < bin->count; i++) {
+        const RasterPrim* prim = &r->prims[bin->items[i]];
+        if (prim->isLine)
+            RasterTileLine(prim, ox, oy, width, height, color, depth);
+        else
+            RasterTileTriangle(prim, ox, oy, width, height, color, depth);
+    }
+
+    for (int y = 0; y < height; y++) {
+        unsigned char* dst = fb->color + ((size_t)(oy + y) * fb->width + ox) * 3;
+        const unsigned int* src = color + y * TILE_SIZE;
+        for (int x = 0; x < width; x++) {
+            dst[x * 3 + 0] = (unsigned char)src[x];
+            dst[x * 3 + 1] = (unsigned char)(src[x] >> 8);
+            dst[x * 3 + 2] = (unsigned char)(src[x] >> 16);
+        }
+        memcpy(fb->depth + (size_t)(oy + y) * fb->width + ox, depth + y * TILE_SIZE, width * sizeof(float));
+    }
+}
+
+// Claim tiles until none are left; run by the caller and every pool thread.
+void RasterTiles(Rasterizer* r) {
+    int tileCount = r->tilesX * r->tilesY;
+    for (;;) {
+        long tile = AtomicIncrement(&r->nextTile) - 1;
+        if (tile >= tileCount)
+            break;
+        RasterTile(r, (int)tile);
+    }
+}
+
+// Pool thread: sleep until the frame generation changes, help with the
+// tiles, and report back when done.
+void RasterWorker(void* arg) {
+    Rasterizer* r = arg;
+    int seen = 0;
+    LockMutex(&r->lock);
+    for (;;) {
+        while (r->generation == seen && !r->quit)
+            WaitCondVar(&r->wake, &r->lock);
+        if (r->quit)
+            break;
+        seen = r->generation;
+        UnlockMutex(&r->lock);
+        RasterTiles(r);
+        LockMutex(&r->lock);
+        if (--r->busy == 0)
+            WakeAllCondVar(&r->done);
+    }
+    UnlockMutex(&r->lock);
+}
+
+// Blit the placed labels in white, each glyph pixel depth-tested at its
+// label's anchor depth like a GL bitmap.
+void RasterLabels(Framebuffer* fb, const GlyphAtlas* atlas, const LabelCache* lc) {
+    for (int i = 0; i < lc->placedCount; i++) {
+        const PlacedLabel* pl = &lc->placed[i];
+        const LabelRun* run = &lc->runs[pl->run];
+        int top = pl->y - atlas->ascent;
+        for (int g = run->first; g < run->first + run->count; g++) {
+            const AtlasGlyph* glyph = &atlas->glyphs[lc->glyphs[g].glyph];
+            int left = pl->x + lc->glyphs[g].x;
+            for (int row = 0; row < atlas->cellHeight; row++) {
+                int py = top + row;
+                if (py < 0 || py >= fb->height)
+                    continue;
+                const unsigned char* coverage = atlas->pixels + (size_t)(glyph->y + row) * atlas->width + glyph->x;
+                for (int col = 0; col < glyph->width; col++) {
+                    int px = left + col;
+                    if (coverage[col] < 128 || px < 0 || px >= fb->width)
+                        continue;
+                    size_t pixel = (size_t)py * fb->width + px;
+                    if (pl->depth >= fb->depth[pixel])
+                        continue;
+                    fb->color[pixel * 3 + 0] = 255;
+                    fb->color[pixel * 3 + 1] = 255;
+                    fb->color[pixel * 3 + 2] = 255;
+                }
+            }
+        }
+    }
+}
+
+// Text in screen pixels from the top-left corner, over everything, like
+// DrawScreenText; '\n' starts a new line.
+void RasterScreenText(Framebuffer* fb, const GlyphAtlas* atlas, const char* text, int x, int y) {
+    int penX = x, top = y;
+    for (const char* c = text; *c; c++) {
+        if (*c == '\n') {
+            penX = x;
+            top += atlas->cellHeight + 2;
+            continue;
+        }
+        int index = (unsigned char)*c - ATLAS_FIRST_CHAR;
+        if (index < 0 || index >= ATLAS_GLYPH_COUNT)
+            continue;
+        const AtlasGlyph* glyph = &atlas->glyphs[index];
+        for (int row = 0; row < atlas->cellHeight; row++) {
+            int py = top + row;
+            if (py < 0 || py >= fb->height)
+                continue;
+            const unsigned char* coverage = atlas->pixels + (size_t)(glyph->y + row) * atlas->width + glyph->x;
+            for (int col = 0; col < glyph->width; col++) {
+                int px = penX + col;
+                if (coverage[col] < 128 || px < 0 || px >= fb->width)
+                    continue;
+                memset(&fb->color[((size_t)py * fb->width + px) * 3], 255, 3);
+            }
+        }
+        penX += glyph->advance;
+    }
+}
+
+// Draw a built scene the way DrawNetwork does, without a GL context.
+void RasterScene(Rasterizer* r, Framebuffer* fb, const SceneCache* sc, const NetworkGraph* net, const Camera* cam) {
+    float viewProj[16];
+    double profileStart = ProfileStart();
+    CameraMatrix(cam, (float)fb->width / fb->height, viewProj);
+    r->target = fb;
+    r->primCount = 0;
+    r->triangleCount = 0;
+    r->tilesX = (fb->width + TILE_SIZE - 1) / TILE_SIZE;
+    r->tilesY = (fb->height + TILE_SIZE - 1) / TILE_SIZE;
+
+    CullScene(sc, viewProj, fb->height, &r->visible);
+    const VisibleSet* vis = &r->visible;
+
+    // Only vertices of visible elements are transformed; the scratch is
+    // indexed like the whole buffer so element indices apply unchanged.
+    for (int pass = 0; pass < 2; pass++) {
+        const GeometryBuffer* buf = pass == 0 ? &sc->triangles : &sc->lines;
+        if (buf->indexCount == 0)
+            continue;
+        float* clip = ClipScratch(r, buf->vertexCount);
+        for (int i = 0; i < vis->count; i++) {
+            const SceneElement* e = &sc->elements[vis->items[i]];
+            const ElementRange* verts = pass == 0 ? &e->triVerts : &e->lineVerts;
+            for (int v = verts->first; v < verts->first + verts->count; v++) {
+                const float* p = &buf->vertices[v * 3];
+                TransformPoint(viewProj, p[0], p[1], p[2], &clip[v * 4]);
+            }
+        }
+        // Primitives are flat colored, so the first vertex carries the color.
+        for (int i = 0; i < vis->count; i++) {
+            const SceneElement* e = &sc->elements[vis->items[i]];
+            const ElementRange* range = pass == 0 ? &e->triIndices : &e->lineIndices;
+            for (int t = range->first; t < range->first + range->count; t += pass == 0 ? 3 : 2) {
+                const GLuint* idx = &buf->indices[t];
+                if (pass == 0) {
+                    DrawClippedTriangle(r, &clip[idx[0] * 4], &clip[idx[1] * 4], &clip[idx[2] * 4],
+                                        PackColor(&buf->colors[idx[0] * 3]));
+                } else {
+                    DrawClippedLine(r, &clip[idx[0] * 4], &clip[idx[1] * 4], PackColor(&buf->colors[idx[0] * 3]));
+                }
+            }
+        }
+    }
+    const Mesh* sphere = &meshCache[MESH_SPHERE][ChooseMeshDetail(sc->spheres.count)];
+    const Mesh* lowSphere = &meshCache[MESH_SPHERE][MESH_DETAIL_LEVELS - 1];
+    const Mesh* cone = &meshCache[MESH_CONE][ChooseMeshDetail(sc->cones.count)];
+    for (int i = 0; i < vis->count; i++) {
+        const SceneElement* e = &sc->elements[vis->items[i]];
+        RasterMesh(r, viewProj, ElementLod(vis, e) == LOD_LOW_POLY ? lowSphere : sphere,
+                   &sc->spheres, e->spheres.first, e->spheres.count);
+    }
+    for (int i = 0; i < vis->count; i++) {
+        const SceneElement* e = &sc->elements[vis->items[i]];
+        RasterMesh(r, viewProj, cone, &sc->cones, e->cones.first, e->cones.count);
+    }
+
+    BinPrimitives(r);
+    ProfileEnd(PROF_RASTER_SETUP, profileStart);
+    ProfileCount(PROF_PRIMITIVES, r->primCount);
+    profileStart = ProfileStart();
+    r->nextTile = 0;
+    if (r->threadCount > 0) {
+        LockMutex(&r->lock);
+        r->busy = r->threadCount;
+        r->generation++;
+        WakeAllCondVar(&r->wake);
+        UnlockMutex(&r->lock);
+    }
+    RasterTiles(r);
+    if (r->threadCount > 0) {
+        LockMutex(&r->lock);
+        while (r->busy > 0)
+            WaitCondVar(&r->done, &r->lock);
+        UnlockMutex(&r->lock);
+    }
+    ProfileEnd(PROF_RASTER_TILES, profileStart);
+
+    // Labels go on top of the finished frame.
+    profileStart = ProfileStart();
+    PlaceLabels(&r->labels, &embeddedAtlas, net, &r->visible, viewProj, fb->width, fb->height);
+    RasterLabels(fb, &embeddedAtlas, &r->labels);
+    ProfileCount(PROF_LABELS_DRAWN, r->labels.placedCount);
+    ProfileEnd(PROF_LABELS, profileStart);
+}
+
+// deep3d --bench-raster: time the CPU renderer on one model at 800x600 and
+// 4K, single-threaded and with the whole pool, while the camera orbits.
+int RunRasterBenchmark(int argc, char** argv) {
+    static const int sizes[2][2] = { { 800, 600 }, { 3840, 2160 } };
+    const char* spec = "vgg16";
+    const char* profilePath = NULL;
+    int frames = 60, threadCount = CpuCount();
+    for (int i = 2; i < argc; i++) {
+        if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc)
+            frames = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--profile") == 0 && i + 1 < argc)
+            profilePath = argv[++i];
+        else if (strcmp(argv[i], "--jobs") == 0 && i + 1 < argc)
+            threadCount = atoi(argv[++i]);
+        else
+            spec = argv[i];
+    }
+    if (frames < 1)
+        frames = 1;
+    if (threadCount < 1)
+        threadCount = 1;
+
+    NetworkGraph net = {0};
+    SceneCache sc = {0};
+    if (profilePath)
+        EnableProfiler(1);
+    if (!LoadModelSpec(&net, spec))
+        return EXIT_FAILURE;
+    BuildMeshCache();
+    BuildEmbeddedAtlas(&embeddedAtlas);
+    BuildScene(&sc, &net);
+    printf("Raster benchmark: %s, %d frames per run\n", spec, frames);
+
+    int runs = threadCount > 1 ? 2 : 1;
+    for (int s = 0; s < 2; s++) {
+        Framebuffer fb;
+        if (!InitFramebuffer(&fb, sizes[s][0], sizes[s][1])) {
+            printf("Error: Out of memory allocating a %dx%d framebuffer.\n", sizes[s][0], sizes[s][1]);
+            return EXIT_FAILURE;
+        }
+        for (int run = 0; run < runs; run++) {
+            Rasterizer r;
+            InitRasterizer(&r, run == 0 ? 1 : threadCount);
+            Camera cam = { 20.0f, 0.0f, 1.0f };
+            RasterScene(&r, &fb, &sc, &net, &cam);      // Warm caches and bins
+            long long triangles = 0, visible = 0;
+            double start = NowSeconds();
+            for (int f = 0; f < frames; f++) {
+                double frameStart = ProfileStart();
+                cam.rotY = 360.0f * f / frames;
+                RasterScene(&r, &fb, &sc, &net, &cam);
+                ProfileEnd(PROF_FRAME, frameStart);
+                ProfileFrameEnd();
+                triangles += r.triangleCount;
+                visible += r.visible.count;
+            }
+            double elapsed = NowSeconds() - start;
+            printf("  %4dx%-4d %2d thread%s: %8.2f ms/frame %8.1f fps %8.2f Mtri/s, %lld/%d elements visible\n",
+                   fb.width, fb.height, r.threadCount + 1, r.threadCount ? "s" : " ",
+                   elapsed * 1000.0 / frames, frames / elapsed, triangles / elapsed / 1e6,
+                   visible / frames, sc.elementCount);
+            ReleaseRasterizer(&r);
+        }
+        ReleaseFramebuffer(&fb);
+    }
+    ReleaseScene(&sc);
+    ReleaseMeshCache();
+    ReleaseGlyphAtlas(&embeddedAtlas);
+    ArenaRelease(&net.arena);
+    if (profilePath && !WriteProfile(profilePath))
+        return EXIT_FAILURE;
+    return EXIT_SUCCESS;
+}
+
+//-------------------------
+// Benchmark Suite
+//-------------------------
+
+// One model replayed along one camera path.
+struct BenchResult {
+    char model[128];
+    CameraPath path;
+    int frames;
+    double buildMs;             // Fastest of three builds
+    double meanMs, p50Ms, p95Ms, p99Ms, maxMs;
+    long long triangles;        // Queued over the whole path; fixed for a given build
+    size_t networkBytes, sceneBytes;
+    size_t peakBytes;           // Process high-water mark once the run finished
+};
+
+// Pose at t in [0, 1) along a path. Paths are pure functions of t, so every
+// run renders exactly the same frames.
+void CameraPathPose(CameraPath path, float t, Camera* cam) {
+    const float turn = 6.2831853f * t;
+    cam->rotX = 20.0f;
+    cam->rotY = 0.0f;
+    cam->zoom = 1.0f;
+    if (path == PATH_ORBIT) {
+        cam->rotY = 360.0f * t;
+    } else if (path == PATH_TILT) {
+        cam->rotX = 70.0f * sinf(turn);
+        cam->rotY = 30.0f;
+    } else {
+        cam->rotX = 10.0f;
+        cam->rotY = 90.0f * t;
+        cam->zoom = 0.5f * powf(16.0f, t);
+    }
+}
+
+const char* CameraPathName(CameraPath path) {
+    static const char* names[PATH_COUNT] = { "orbit", "tilt", "dive" };
+    return names[path];
+}
+
+int CompareDoubles(const void* a, const void* b) {
+    double x = *(const double*)a, y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+// Nearest-rank percentile of an ascending array.
+double Percentile(const double* sorted, int count, double p) {
+    int rank = (int)ceil(p / 100.0 * count);
+    if (rank < 1)
+        rank = 1;
+    return sorted[rank - 1];
+}
+
+int WriteBenchmarkCsv(const BenchResult* results, int count, const char* path) {
+    FILE* file = fopen(path, "w");
+    if (!file)
+        return 0;
+    fprintf(file, "model,path,frames,build_ms,mean_ms,p50_ms,p95_ms,p99_ms,max_ms,triangles,network_kb,scene_kb,peak_kb\n");
+    for (int i = 0; i < count; i++) {
+        const BenchResult* b = &results[i];
+        fprintf(file, "%s,%s,%d,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f,%lld,%zu,%zu,%zu\n",
+                b->model, CameraPathName(b->path), b->frames, b->buildMs, b->meanMs, b->p50Ms, b->p95Ms,
+                b->p99Ms, b->maxMs, b->triangles, b->networkBytes / 1024, b->sceneBytes / 1024, b->peakBytes / 1024);
+    }
+    return fclose(file) == 0;
+}
+
+// Compare against a CSV written by an earlier run. Build time, median and
+// p95 frame time and scene memory regress when they grow by more than
+// threshold (a fraction) and, for times, by more than 0.05 ms, which keeps
+// timer noise on tiny scenes out. p99 and max are reported but not gated.
+// A run whose workload differs from its row, or that has no row, fails too,
+// since its timings cannot be compared. Returns the number of failures, or
+// -1 when the baseline is unreadable.
+int CheckBenchmarkBaseline(const BenchResult* results, int count, const char* path, double threshold) {
+    FILE* file = fopen(path, "r");
+    char line[1024];
+    int regressions = 0, matched = 0;
+    if (!file)
+        return -1;
+    char* seen = calloc(count ? count : 1, 1);
+    if (!seen) {
+        printf("Error: Out of memory reading the baseline.\n");
+        exit(EXIT_FAILURE);
+    }
+    while (fgets(line, sizeof(line), file)) {
+        char model[128], pathName[32];
+        int frames;
+        double buildMs, meanMs, p50Ms, p95Ms, p99Ms, maxMs;
+        long long triangles;
+        size_t networkKb, sceneKb, peakKb;
+        if (sscanf(line, "%127[^,],%31[^,],%d,%lf,%lf,%lf,%lf,%lf,%lf,%lld,%zu,%zu,%zu", model, pathName, &frames,
+                   &buildMs, &meanMs, &p50Ms, &p95Ms, &p99Ms, &maxMs, &triangles, &networkKb, &sceneKb, &peakKb) != 13)
+            continue;
+        for (int i = 0; i < count; i++) {
+            const BenchResult* b = &results[i];
+            if (strcmp(b->model, model) != 0 || strcmp(CameraPathName(b->path), pathName) != 0)
+                continue;
+            if (!seen[i]) {
+                seen[i] = 1;
+                matched++;
+            }
+            if (b->triangles != triangles || b->frames != frames) {
+                printf("  MISMATCH %s %s: workload differs from the baseline (%lld triangles over %d frames, was %lld over %d)\n",
+                       model, pathName, b->triangles, b->frames, triangles, frames);
+                regressions++;
+                continue;
+            }
+            const char* names[4] = { "build", "p50", "p95", "scene memory" };
+            double now[4] = { b->buildMs, b->p50Ms, b->p95Ms, (double)(b->sceneBytes / 1024) };
+            double was[4] = { buildMs, p50Ms, p95Ms, (double)sceneKb };
+            for (int m = 0; m < 4; m++) {
+                double floor = m < 3 ? 0.05 : 0.0;
+                if (now[m] > was[m] * (1.0 + threshold) && now[m] - was[m] > floor) {
+                    printf("  REGRESSION %s %s: %s %.3f -> %.3f (+%.1f%%)\n", model, pathName, names[m],
+                           was[m], now[m], was[m] > 0.0 ? (now[m] / was[m] - 1.0) * 100.0 : 100.0);
+                    regressions++;
+                }
+            }
+        }
+    }
+    fclose(file);
+    for (int i = 0; i < count; i++) {
+        if (!seen[i]) {
+            printf("  MISSING %s %s: no row in the baseline\n", results[i].model, CameraPathName(results[i].path));
+            regressions++;
+        }
+    }
+    free(seen);
+    printf("Baseline %s: %d of %d runs compared, %d failure%s (regressions beyond %.0f%%, changed or missing runs)\n",
+           path, matched, count, regressions, regressions == 1 ? "" : "s", threshold * 100.0);
+    return regressions;
+}
+
+// deep3d --bench: replay fixed camera paths over generated and built-in
+// networks with the headless renderer and report frame-time percentiles,
+// scene build time and memory. Everything but the timings is deterministic,
+// and the default single tile thread keeps the timings comparable across
+// machines with different core counts.
+int RunBenchmarkSuite(int argc, char** argv) {
+    static const char* defaultModels[] = {
+        "vgg16", "synth:200x64:chain", "synth:2000x128:residual", "synth:10000x256:dense"
+    };
+    const char** models = malloc(argc * sizeof(char*));
+    int modelCount = 0, frames = 120, threadCount = 1, width = 800, height = 600;
+    const char* outPath = NULL;
+    const char* baselinePath = NULL;
+    double threshold = 0.10;
+    if (!models) {
+        printf("Error: Out of memory parsing arguments.\n");
+        return EXIT_FAILURE;
+    }
+    for (int i = 2; i < argc; i++) {
+        const char* opt = argv[i];
+        const char* value = i + 1 < argc ? argv[i + 1] : NULL;
+        if (strncmp(opt, "--", 2) != 0) {
+            models[modelCount++] = opt;
+            continue;
+        }
+        if (!value) {
+            printf("Error: Missing value for %s.\n", opt);
+            return EXIT_FAILURE;
+        }
+        i++;
+        if (strcmp(opt, "--frames") == 0)
+            frames = atoi(value) > 0 ? atoi(value) : 1;
+        else if (strcmp(opt, "--jobs") == 0)
+            threadCount = atoi(value) > 0 ? atoi(value) : 1;
+        else if (strcmp(opt, "--size") == 0) {
+            if (sscanf(value, "%dx%d", &width, &height) != 2 || width <= 0 || height <= 0) {
+                printf("Error: Bad size '%s', expected WxH.\n", value);
+                return EXIT_FAILURE;
+            }
+        } else if (strcmp(opt, "--out") == 0)
+            outPath = value;
+        else if (strcmp(opt, "--baseline") == 0)
+            baselinePath = value;
+        else if (strcmp(opt, "--threshold") == 0)
+            threshold = atof(value) / 100.0;
+        else {
+            printf("Error: Unknown option '%s'.\n", opt);
+            PrintExportUsage();
+            return EXIT_FAILURE;
+        }
+    }
+    if (modelCount == 0) {
+        modelCount = sizeof(defaultModels) / sizeof(defaultModels[0]);
+        memcpy(models, defaultModels, sizeof(defaultModels));
+    }
+
+    BenchResult* results = calloc((size_t)modelCount * PATH_COUNT, sizeof(BenchResult));
+    double* times = malloc(frames * sizeof(double));
+    Framebuffer fb;
+    if (!results || !times || !InitFramebuffer(&fb, width, height)) {
+        printf("Error: Out of memory setting up the benchmark.\n");
+        return EXIT_FAILURE;
+    }
+    BuildMeshCache();
+    BuildEmbeddedAtlas(&embeddedAtlas);
+    Rasterizer r;
+    InitRasterizer(&r, threadCount);
+    printf("Benchmark: %d models x %d camera paths, %d frames each at %dx%d on %d thread%s\n",
+           modelCount, PATH_COUNT, frames, width, height, threadCount, threadCount == 1 ? "" : "s");
+    printf("  %-28s %-6s %9s %9s %9s %9s %9s %10s %10s\n",
+           "model", "path", "build ms", "mean ms", "p50 ms", "p95 ms", "p99 ms", "scene KB", "peak KB");
+
+    int resultCount = 0, failures = 0;
+    for (int m = 0; m < modelCount; m++) {
+        NetworkGraph net = {0};
+        SceneCache sc = {0};
+        if (!LoadModelSpec(&net, models[m])) {
+            failures++;
+            continue;
+        }
+        // Best of a few builds: the first also pays for growing the buffers,
+        // later ones show the rebuild cost an edit or settings change sees.
+        double buildMs = 0.0;
+        for (int run = 0; run < 3; run++) {
+            double start = NowSeconds();
+            BuildScene(&sc, &net);
+            double ms = (NowSeconds() - start) * 1000.0;
+            if (run == 0 || ms < buildMs)
+                buildMs = ms;
+        }
+        for (CameraPath path = 0; path < PATH_COUNT; path++) {
+            BenchResult* b = &results[resultCount++];
+            snprintf(b->model, sizeof(b->model), "%s", models[m]);
+            b->path = path;
+            b->frames = frames;
+            b->buildMs = buildMs;
+            Camera cam;
+            CameraPathPose(path, 0.0f, &cam);
+            ResetLayerLod(&r.visible);
+            RasterScene(&r, &fb, &sc, &net, &cam);      // Warm caches and bins
+            double total = 0.0;
+            for (int f = 0; f < frames; f++) {
+                CameraPathPose(path, (float)f / frames, &cam);
+                double frameStart = NowSeconds();
+                RasterScene(&r, &fb, &sc, &net, &cam);
+                times[f] = (NowSeconds() - frameStart) * 1000.0;
+                total += times[f];
+                b->triangles += r.triangleCount;
+            }
+            qsort(times, frames, sizeof(double), CompareDoubles);
+            b->meanMs = total / frames;
+            b->p50Ms = Percentile(times, frames, 50.0);
+            b->p95Ms = Percentile(times, frames, 95.0);
+            b->p99Ms = Percentile(times, frames, 99.0);
+            b->maxMs = times[frames - 1];
+            b->networkBytes = net.arena.usedBytes;
+            b->sceneBytes = SceneMemory(&sc);
+            b->peakBytes = PeakMemoryBytes();
+            printf("  %-28.28s %-6s %9.3f %9.3f %9.3f %9.3f %9.3f %10zu %10zu\n",
+                   b->model, CameraPathName(path), b->buildMs, b->meanMs, b->p50Ms, b->p95Ms, b->p99Ms,
+                   b->sceneBytes / 1024, b->peakBytes / 1024);
+        }
+        ReleaseScene(&sc);
+        ArenaRelease(&net.arena);
+    }
+    ReleaseRasterizer(&r);
+    ReleaseFramebuffer(&fb);
+    ReleaseMeshCache();
+    ReleaseGlyphAtlas(&embeddedAtlas);
+
+    if (outPath) {
+        if (WriteBenchmarkCsv(results, resultCount, outPath))
+            printf("Results written to %s\n", outPath);
+        else {
+            printf("Error: Cannot write results '%s'.\n", outPath);
+            failures++;
+        }
+    }
+    if (baselinePath) {
+        int regressions = CheckBenchmarkBaseline(results, resultCount, baselinePath, threshold);
+        if (regressions < 0) {
+            printf("Error: Cannot read baseline '%s'.\n", baselinePath);
+            failures++;
+        }
+        else
+            failures += regressions;
+    }
+    free(results);
+    free(times);
+    free(models);
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+// Count pixels that differ between two frames of the same size.
+long long CountPixelDifferences(const Framebuffer* a, const Framebuffer* b) {
+    long long differ = 0;
+    size_t pixels = (size_t)a->width * a->height;
+    for (size_t p = 0; p < pixels; p++)
+        differ += memcmp(&a->color[p * 3], &b->color[p * 3], 3) != 0;
+    return differ;
+}
+
+// deep3d --bench-edit: apply a fixed sequence of layer edits to a built scene,
+// timing the scene and label patches against a full rebuild, then check that
+// the patched scene renders exactly like one built from scratch.
+int RunEditBenchmark(int argc, char** argv) {
+    static const char* kinds[5] = { "recolor", "resize", "rename", "insert", "remove" };
+    static const Camera views[2] = { { 20.0f, 0.0f, 1.0f }, { 90.0f, 0.0f, 0.05f } };
+    const char* spec = "synth:10000x64:residual";
+    int edits = 500;
+    for (int i = 2; i < argc; i++) {
+        if (strcmp(argv[i], "--edits") == 0 && i + 1 < argc)
+            edits = atoi(argv[++i]);
+        else
+            spec = argv[i];
+    }
+    if (edits < 1)
+        edits = 1;
+
+    NetworkGraph net = {0};
+    SceneCache patched = {0}, fresh = {0};
+    LabelCache lc = {0};
+    Framebuffer a, b;
+    Rasterizer ra, rb;
+    if (!LoadModelSpec(&net, spec))
+        return EXIT_FAILURE;
+    if (!InitFramebuffer(&a, 800, 600) || !InitFramebuffer(&b, 800, 600)) {
+        printf("Error: Out of memory setting up the benchmark.\n");
+        return EXIT_FAILURE;
+    }
+    BuildMeshCache();
+    BuildEmbeddedAtlas(&embeddedAtlas);
+    InitRasterizer(&ra, 1);
+    InitRasterizer(&rb, 1);
+    BuildScene(&patched, &net);
+    double start = NowSeconds();
+    BuildScene(&patched, &net);
+    double buildMs = (NowSeconds() - start) * 1000.0;
+    start = NowSeconds();
+    LayoutLabels(&lc, &embeddedAtlas, &net);
+    double labelMs = (NowSeconds() - start) * 1000.0;
+    for (int v = 0; v < 2; v++)
+        RasterScene(&ra, &a, &patched, &net, &views[v]);     // Lay out the rasterizer's labels before editing
+    printf("Edit benchmark: %s, %d layers, %d edits\n", spec, net.layerCount, edits);
+    printf("  full rebuild: scene %.3f ms, labels %.3f ms\n", buildMs, labelMs);
+
+    double total[5] = {0}, worst[5] = {0};
+    int count[5] = {0}, rebuilt[5] = {0};
+    unsigned int seed = 12345;
+    for (int k = 0; k < edits; k++) {
+        int kind = k % 5;
+        seed = seed * 1103515245u + 12345u;
+        int layer = (int)((seed >> 8) % (unsigned int)net.layerCount);
+        if (kind == 0) {
+            float rgb[3];
+            DefaultLayerColor(1 + k % 7, rgb);
+            SetLayerColor(&net, layer, rgb);
+        } else if (kind == 1 && net.type[layer] == LAYER_FC) {
+            int n = net.neuronCount[layer];
+            SetLayerNeurons(&net, layer, k / 5 % 2 ? n + (n + 3) / 4 : (n * 4 / 5 > 0 ? n * 4 / 5 : 1));
+        } else if (kind == 1) {
+            float size[3], scale = k / 5 % 2 ? 1.25f : 0.8f;
+            for (int c = 0; c < 3; c++)
+                size[c] = net.size[layer * 3 + c] * scale;
+            SetLayerSize(&net, layer, size);
+        } else if (kind == 2) {
+            char label[32];
+            snprintf(label, sizeof(label), "Edited %d", k);
+            SetLayerLabel(&net, layer, label);
+        } else if (kind == 3)
+            InsertLayerBelow(&net, layer);
+        else if (net.layerCount > 1)
+            RemoveLayer(&net, layer);
+        start = NowSeconds();
+        if (!PatchScene(&patched, &net)) {
+            BuildScene(&patched, &net);
+            rebuilt[kind]++;
+        }
+        if (!PatchLabels(&lc, &embeddedAtlas, &net))
+            LayoutLabels(&lc, &embeddedAtlas, &net);
+        double ms = (NowSeconds() - start) * 1000.0;
+        total[kind] += ms;
+        if (ms > worst[kind])
+            worst[kind] = ms;
+        count[kind]++;
+    }
+    for (int kind = 0; kind < 5; kind++) {
+        if (count[kind])
+            printf("  %-8s %5d edits: %8.3f ms mean %8.3f ms max, %d rebuilt\n",
+                   kinds[kind], count[kind], total[kind] / count[kind], worst[kind], rebuilt[kind]);
+    }
+
+    BuildScene(&fresh, &net);
+    long long differ = 0;
+    for (int v = 0; v < 2; v++) {
+        RasterScene(&ra, &a, &patched, &net, &views[v]);
+        RasterScene(&rb, &b, &fresh, &net, &views[v]);
+        differ += CountPixelDifferences(&a, &b);
+    }
+    if (differ)
+        printf("  patched scene differs from a rebuild in %lld pixels\n", differ);
+    else
+        printf("  patched scene renders identically to a rebuild\n");
+
+    ReleaseRasterizer(&ra);
+    ReleaseRasterizer(&rb);
+    ReleaseFramebuffer(&a);
+    ReleaseFramebuffer(&b);
+    ReleaseLabelCache(&lc);
+    ReleaseScene(&patched);
+    ReleaseScene(&fresh);
+    ReleaseMeshCache();
+    ReleaseGlyphAtlas(&embeddedAtlas);
+    ArenaRelease(&net.arena);
+    return differ ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+// deep3d --stream-demo: publish synthetic activations sized to a model, so
+// live mode can be tried without a training process.
+int RunStreamDemo(int argc, char** argv) {
+    const char* spec = "alexnet";
+    const char* name = ACTIVATION_STREAM_DEFAULT_NAME;
+    int bins = 64;
+    double rate = 60.0, seconds = 0.0;
+    for (int i = 2; i < argc; i++) {
+        if (strcmp(argv[i], "--name") == 0 && i + 1 < argc)
+            name = argv[++i];
+        else if (strcmp(argv[i], "--bins") == 0 && i + 1 < argc)
+            bins = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--rate") == 0 && i + 1 < argc)
+            rate = atof(argv[++i]);
+        else if (strcmp(argv[i], "--seconds") == 0 && i + 1 < argc)
+            seconds = atof(argv[++i]);
+        else
+            spec = argv[i];
+    }
+    if (bins < 0)
+        bins = 0;
+
+    NetworkGraph net = {0};
+    ActivationStream stream;
+    if (!LoadModelSpec(&net, spec))
+        return EXIT_FAILURE;
+    int neurons = bins * 4 > 64 ? bins * 4 : 64;
+    float* scratch = malloc(neurons * sizeof(float));
+    if (!scratch) {
+        printf("Error: Out of memory setting up the stream.\n");
+        return EXIT_FAILURE;
+    }
+    if (!ActivationStreamCreate(&stream, name, net.layerCount, bins)) {
+        printf("Error: Cannot create shared memory stream '%s'.\n", name);
+        return EXIT_FAILURE;
+    }
+    printf("Streaming %s: %d layers x %d bins to '%s'", spec, net.layerCount, bins, name);
+    if (rate > 0.0)
+        printf(" at %g frames/s", rate);
+    printf("%s\n", seconds > 0.0 ? "" : ", until interrupted");
+
+    double start = NowSeconds(), next = start;
+    long long tick = 0;
+    for (; seconds <= 0.0 || NowSeconds() - start < seconds; tick++) {
+        float* frame = ActivationStreamBegin(&stream);
+        FillDemoFrame(&stream, frame, tick, scratch, neurons);
+        ActivationStreamPublish(&stream);
+        if (rate > 0.0) {
+            next += 1.0 / rate;
+            SleepSeconds(next - NowSeconds());
+        }
+    }
+    printf("Published %lld frames in %.2f s.\n", tick, NowSeconds() - start);
+    ActivationStreamClose(&stream);
+    free(scratch);
+    ArenaRelease(&net.arena);
+    return EXIT_SUCCESS;
+}
+
+typedef struct {
+    ActivationStream* stream;
+    int neurons;
+    volatile long stop;
+    long long published;
+} StreamProducer;
+
+// Publish frames back to back until told to stop.
+void StreamProducerThread(void* arg) {
+    StreamProducer* p = arg;
+    float* scratch = malloc(p->neurons * sizeof(float));
+    if (!scratch)
+        return;
+    while (!p->stop) {
+        float* frame = ActivationStreamBegin(p->stream);
+        FillDemoFrame(p->stream, frame, p->published, scratch, p->neurons);
+        ActivationStreamPublish(p->stream);
+        p->published++;
+    }
+    free(scratch);
+}
+
+// deep3d --bench-stream: a producer thread publishes frames as fast as it
+// can while the consumer maps the stream separately and recolors a built
+// scene from each new frame. The consumer passes when its time per update
+// sustains --min-rate; the observed rate is also bounded by the producer,
+// which shares the cores. Finally the scene must show the last frame.
+int RunStreamBenchmark(int argc, char** argv) {
+    const char* spec = "synth:1000x64";
+    int bins = 64;
+    double seconds = 2.0, minRate = 1000.0;
+    for (int i = 2; i < argc; i++) {
+        if (strcmp(argv[i], "--bins") == 0 && i + 1 < argc)
+            bins = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--seconds") == 0 && i + 1 < argc)
+            seconds = atof(argv[++i]);
+        else if (strcmp(argv[i], "--min-rate") == 0 && i + 1 < argc)
+            minRate = atof(argv[++i]);
+        else
+            spec = argv[i];
+    }
+    if (bins < 0)
+        bins = 0;
+
+    NetworkGraph net = {0};
+    SceneCache sc = {0};
+    LiveActivations live = {0};
+    ActivationStream stream;
+    char name[64];
+    if (!LoadModelSpec(&net, spec))
+        return EXIT_FAILURE;
+    snprintf(name, sizeof(name), "deep3d-bench-%lu", CurrentThreadId() % 1000000ul);
+    if (!ActivationStreamCreate(&stream, name, net.layerCount, bins) || !AttachLiveActivations(&live, name)) {
+        printf("Error: Cannot create shared memory stream '%s'.\n", name);
+        return EXIT_FAILURE;
+    }
+    BuildScene(&sc, &net);
+    int capacity = 4096, updates = 0;
+    double* times = malloc(capacity * sizeof(double));
+    StreamProducer producer = { &stream, bins > 64 ? bins : 64, 0, 0 };
+    Thread thread;
+    if (!times || !StartThread(&thread, StreamProducerThread, &producer)) {
+        printf("Error: Cannot start the producer.\n");
+        return EXIT_FAILURE;
+    }
+    printf("Stream benchmark: %s, %d layers x %d bins, %.1f s\n", spec, net.layerCount, bins, seconds);
+
+    double start = NowSeconds(), elapsed = 0.0;
+    while ((elapsed = NowSeconds() - start) < seconds) {
+        if (!LiveFramePending(&live, &sc)) {
+            YieldThread();
+            continue;
+        }
+        double t = NowSeconds();
+        if (!ApplyLiveActivations(&sc, &net, &live))
+            continue;
+        if (updates == capacity) {
+            capacity *= 2;
+            times = realloc(times, capacity * sizeof(double));
+            if (!times) {
+                printf("Error: Out of memory recording timings.\n");
+                exit(EXIT_FAILURE);
+            }
+        }
+        times[updates++] = (NowSeconds() - t) * 1000.0;
+    }
+    producer.stop = 1;
+    JoinThread(thread);
+
+    // The producer is gone, so the newest frame holds still: the scene must
+    // show exactly it.
+    long long frame;
+    ApplyLiveActivations(&sc, &net, &live);
+    const float* values = ActivationStreamLatest(&live.stream, &frame);
+    long long wrong = 0;
+    for (int l = 0; values && l < net.layerCount; l++) {
+        const float* v = values + (size_t)l * (1 + bins);
+        const SceneElement* e = &sc.elements[sc.spans[l].body.first];
+        float rgb[3];
+        if (net.type[l] == LAYER_BOX) {
+            HeatColor(v[0], rgb);
+            for (int k = 0; k < e->triVerts.count; k++)
+                wrong += memcmp(sc.triangles.colors + (e->triVerts.first + k) * 3, rgb, sizeof(rgb)) != 0;
+        } else {
+            int n = net.neuronCount[l];
+            for (int i = 0; i < n; i++) {
+                HeatColor(bins > 0 ? v[1 + (int)((long long)i * bins / n)] : v[0], rgb);
+                wrong += memcmp(sc.spheres.items[e->spheres.first + i].color, rgb, sizeof(rgb)) != 0;
+            }
+        }
+    }
+
+    qsort(times, updates, sizeof(double), CompareDoubles);
+    double sum = 0.0;
+    for (int i = 0; i < updates; i++)
+        sum += times[i];
+    double sustained = sum > 0.0 ? updates * 1000.0 / sum : 0.0;
+    printf("  producer: %lld frames, %.0f frames/s\n", producer.published, producer.published / elapsed);
+    printf("  consumer: %d updates, %.0f updates/s observed, %lld torn reads redone\n",
+           updates, updates / elapsed, live.torn);
+    if (updates > 0)
+        printf("  update:   %.3f ms mean, %.3f ms p99, %.3f ms max, sustains %.0f updates/s\n",
+               sum / updates, Percentile(times, updates, 99.0), times[updates - 1], sustained);
+    if (wrong || !values)
+        printf("  scene does not show the final frame: %lld colors differ\n", wrong);
+    else
+        printf("  scene shows the final frame exactly\n");
+    int ok = !wrong && values && sustained >= minRate;
+    if (sustained < minRate)
+        printf("  below the required %.0f updates/s\n", minRate);
+
+    DetachLiveActivations(&live);
+    ActivationStreamClose(&stream);
+    free(times);
+    ReleaseScene(&sc);
+    ArenaRelease(&net.arena);
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+// Scrub a checkpoint directory at 60 frames per second, sweeping end to end
+// and back, and time what each frame spends on the timeline. Decoding runs
+// behind, so the frame cost must stay flat however far the scrub outruns it.
+int RunTimelineBenchmark(int argc, char** argv) {
+    const char* dir = NULL;
+    const char* spec = "alexnet";
+    double seconds = 10.0, sweep = 4.0, maxFrameMs = 2.0, cacheMb = TIMELINE_CACHE_BYTES / (1024.0 * 1024.0);
+    for (int i = 2; i < argc; i++) {
+        if (strcmp(argv[i], "--cache") == 0 && i + 1 < argc)
+            cacheMb = atof(argv[++i]);
+        else if (strcmp(argv[i], "--seconds") == 0 && i + 1 < argc)
+            seconds = atof(argv[++i]);
+        else if (strcmp(argv[i], "--sweep") == 0 && i + 1 < argc)
+            sweep = atof(argv[++i]);
+        else if (strcmp(argv[i], "--max-frame-ms") == 0 && i + 1 < argc)
+            maxFrameMs = atof(argv[++i]);
+        else if (!dir)
+            dir = argv[i];
+        else
+            spec = argv[i];
+    }
+    if (!dir) {
+        PrintExportUsage();
+        return EXIT_FAILURE;
+    }
+    if (sweep <= 0.0)
+        sweep = 4.0;
+
+    NetworkGraph net = {0};
+    SceneCache sc = {0};
+    Timeline tl;
+    if (!LoadModelSpec(&net, spec))
+        return EXIT_FAILURE;
+    if (!OpenTimeline(&tl, &net, dir, (size_t)(cacheMb * 1024.0 * 1024.0))) {
+        ArenaRelease(&net.arena);
+        return EXIT_FAILURE;
+    }
+    weightView = WEIGHT_VIEW_MEAN;
+    BuildScene(&sc, &net);
+    int frames = (int)(seconds * 60.0) + 1;
+    double* times = malloc(frames * sizeof(double));
+    float* expected = malloc((WEIGHT_VIEW_COUNT - 1) * tl.valueCount * sizeof(float) + 1);
+    if (!times || !expected) {
+        printf("Error: Out of memory recording timings.\n");
+        exit(EXIT_FAILURE);
+    }
+    printf("Timeline benchmark: %s, %d checkpoints, %d cache slots, %.1f s sweeps for %.1f s\n",
+           spec, tl.count, tl.slotCount, sweep, seconds);
+
+    double start = NowSeconds();
+    for (int f = 0; f < frames; f++) {
+        double phase = fmod(f / 60.0 / sweep, 2.0);
+        double frameStart = NowSeconds();
+        SeekTimeline(&tl, (phase < 1.0 ? phase : 2.0 - phase) * (tl.count - 1));
+        ApplyTimeline(&sc, &net, &tl, frameStart);
+        times[f] = (NowSeconds() - frameStart) * 1000.0;
+        double wait = start + (f + 1) / 60.0 - NowSeconds();
+        if (wait > 0.0)
+            SleepSeconds(wait);
+    }
+
+    // Hold still mid-run: once decoded and eased in, the scene must show
+    // that checkpoint exactly.
+    int middle = tl.count / 2;
+    double now = NowSeconds(), settleStart = now;
+    SeekTimeline(&tl, middle);
+    while (!tl.settled && NowSeconds() - settleStart < 30.0) {
+        ApplyTimeline(&sc, &net, &tl, now += 1.0);
+        SleepSeconds(0.001);
+    }
+    long long bytes, wrong = -1;
+    if (DecodeCheckpoint(&tl, middle, expected, &bytes)) {
+        NormalizeCheckpoint(&tl, expected);
+        wrong = 0;
+        for (int l = 0; l < tl.layerCount; l++) {
+            if (tl.tensor[l] < 0 || sc.spans[l].body.count == 0)
+                continue;
+            const float* v = expected + (size_t)l * (1 + TIMELINE_BINS);
+            const SceneElement* e = &sc.elements[sc.spans[l].body.first];
+            float rgb[3];
+            if (net.type[l] == LAYER_BOX) {
+                HeatColor(v[0], rgb);
+                for (int k = 0; k < e->triVerts.count; k++)
+                    wrong += memcmp(sc.triangles.colors + (e->triVerts.first + k) * 3, rgb, sizeof(rgb)) != 0;
+            } else {
+                int n = net.neuronCount[l];
+                for (int i = 0; i < n; i++) {
+                    HeatColor(v[1 + (int)((long long)i * TIMELINE_BINS / n)], rgb);
+                    wrong += memcmp(sc.spheres.items[e->spheres.first + i].color, rgb, sizeof(rgb)) != 0;
+                }
+            }
+        }
+    }
+
+    qsort(times, frames, sizeof(double), CompareDoubles);
+    LockMutex(&tl.lock);
+    long long hits = tl.hits, misses = tl.misses, decoded = tl.decoded, failed = tl.failed;
+    double decodeSeconds = tl.decodeSeconds, decodedMb = tl.decodedBytes / (1024.0 * 1024.0);
+    UnlockMutex(&tl.lock);
+    double p99 = Percentile(times, frames, 99.0);
+    printf("  frames:   %d, %.3f ms p50, %.3f ms p99, %.3f ms max on the timeline\n",
+           frames, Percentile(times, frames, 50.0), p99, times[frames - 1]);
+    printf("  cache:    %lld frames blended decoded checkpoints, %lld held the last ones (%.0f%%)\n",
+           hits, misses, hits + misses ? 100.0 * hits / (hits + misses) : 0.0);
+    printf("  decode:   %lld checkpoints, %lld failed, %.1f MB, %.2f ms each\n",
+           decoded, failed, decodedMb, decoded ? decodeSeconds * 1000.0 / decoded : 0.0);
+    if (wrong)
+        printf("  scene does not show checkpoint %d: %lld colors differ\n", middle + 1, wrong);
+    else
+        printf("  scene shows checkpoint %d exactly\n", middle + 1);
+    int ok = wrong == 0 && p99 <= maxFrameMs;
+    if (p99 > maxFrameMs)
+        printf("  p99 above the allowed %.1f ms\n", maxFrameMs);
+
+    CloseTimeline(&tl);
+    free(times);
+    free(expected);
+    ReleaseScene(&sc);
+    ArenaRelease(&net.arena);
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+// deep3d --bench-pick: time picks under the cursor on a large scene from a
+// few cameras, half of them aimed at layers and half at random pixels, and
+// check the first ones of each view against testing every element.
+int RunPickBenchmark(int argc, char** argv) {
+    static const Camera views[3] = { { 0.0f, 0.0f, 1.0f }, { 35.0f, 20.0f, 0.25f }, { 70.0f, -30.0f, 4.0f } };
+    const char* spec = "synth:60000x64:residual";
+    const int width = 1280, height = 720, checks = 32;
+    int picks = 20000;
+    double maxPickMs = 0.5;
+    for (int i = 2; i < argc; i++) {
+        if (strcmp(argv[i], "--picks") == 0 && i + 1 < argc)
+            picks = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--max-pick-ms") == 0 && i + 1 < argc)
+            maxPickMs = atof(argv[++i]);
+        else
+            spec = argv[i];
+    }
+    if (picks < checks)
+        picks = checks;
+
+    NetworkGraph net = {0};
+    SceneCache sc = {0};
+    VisibleSet vis = {0};
+    if (!LoadModelSpec(&net, spec))
+        return EXIT_FAILURE;
+    double start = NowSeconds();
+    BuildScene(&sc, &net);
+    double buildMs = (NowSeconds() - start) * 1000.0;
+    double* times = malloc(picks * sizeof(double));
+    if (!times) {
+        printf("Error: Out of memory recording timings.\n");
+        exit(EXIT_FAILURE);
+    }
+    long long primitives = sc.triangles.indexCount / 3 + sc.lines.indexCount / 2 + sc.spheres.count + sc.cones.count;
+    printf("Pick benchmark: %s, %d layers, %d elements, %lld primitives (scene built in %.0f ms)\n",
+           spec, net.layerCount, sc.elementCount, primitives, buildMs);
+
+    int ok = 1;
+    long long wrong = 0;
+    unsigned int seed = 12345u;
+    for (int v = 0; v < 3; v++) {
+        float viewProj[16];
+        CameraMatrix(&views[v], (float)width / height, viewProj);
+        CullScene(&sc, viewProj, height, &vis);
+        int hits = 0;
+        long long nodes = 0, tested = 0;
+        char example[512] = "";
+        for (int p = 0; p < picks; p++) {
+            float x, y, clip[4];
+            seed = seed * 1103515245u + 12345u;
+            const float* c = &net.position[(seed >> 8) % (unsigned int)net.layerCount * 3];
+            TransformPoint(viewProj, c[0], c[1], c[2], clip);
+            seed = seed * 1103515245u + 12345u;
+            if (p % 2 == 0 && clip[3] > 0.0f && fabsf(clip[0]) < clip[3] && fabsf(clip[1]) < clip[3]) {
+                x = (clip[0] / clip[3] * 0.5f + 0.5f) * width;
+                y = (0.5f - clip[1] / clip[3] * 0.5f) * height;
+            } else {
+                x = (seed >> 8) % (unsigned int)width + 0.5f;
+                y = (seed >> 20) % (unsigned int)height + 0.5f;
+            }
+            PickHit hit;
+            double pickStart = NowSeconds();
+            int found = PickScene(&sc, &net, &vis, viewProj, width, height, x, y, &hit);
+            times[p] = (NowSeconds() - pickStart) * 1000.0;
+            hits += found;
+            if (found && !example[0])
+                FormatPickInfo(&net, &hit, example, sizeof(example));
+            nodes += hit.nodesVisited;
+            tested += hit.elementsTested;
+            if (p < checks) {
+                PickRay ray;
+                PickHit all;
+                memset(&all, 0, sizeof(all));
+                all.element = all.instance = -1;
+                MakePickRay(viewProj, width, height, x, y, &ray);
+                all.distance = ray.length;
+                for (int e = 0; e < sc.elementCount; e++) {
+                    if (PickableElement(&sc, &vis, e))
+                        PickElement(&sc, &ray, e, &all);
+                }
+                wrong += all.distance != hit.distance || all.instance != hit.instance;
+            }
+        }
+        qsort(times, picks, sizeof(double), CompareDoubles);
+        double p99 = Percentile(times, picks, 99.0);
+        printf("  view %.0f,%.0f zoom %.2f: %d picks, %.0f%% hit, %.4f ms p50, %.4f ms p99, %.4f ms max; "
+               "%.0f nodes, %.1f elements tested per pick\n",
+               views[v].rotX, views[v].rotY, views[v].zoom, picks, 100.0 * hits / picks,
+               Percentile(times, picks, 50.0), p99, times[picks - 1], (double)nodes / picks, (double)tested / picks);
+        for (char* c = example; *c; c++)
+            *c = *c == '\n' ? ';' : *c;
+        if (example[0])
+            printf("    first hit: %s\n", example);
+        if (p99 > maxPickMs) {
+            printf("  p99 above the allowed %.2f ms\n", maxPickMs);
+            ok = 0;
+        }
+    }
+    if (wrong)
+        printf("  %lld of %d checked picks differ from testing every element\n", wrong, 3 * checks);
+    else
+        printf("  %d checked picks match testing every element\n", 3 * checks);
+
+    free(times);
+    ReleaseVisibleSet(&vis);
+    ReleaseScene(&sc);
+    ArenaRelease(&net.arena);
+    return ok && !wrong ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+typedef struct {
+    InputQueue* queue;
+    double period;
+    volatile long stop;
+    long long pushed, dropped;
+} InputFeed;
+
+// Stands in for the window thread: a small camera turn every period.
+void InputFeedThread(void* arg) {
+    InputFeed* feed = arg;
+    while (!AtomicLoad(&feed->stop)) {
+        InputEvent e = { 1, 0, 1, NowSeconds() };
+        if (PushInput(feed->queue, &e))
+            feed->pushed++;
+        else
+            feed->dropped++;
+        SleepSeconds(feed->period);
+    }
+}
+
+// deep3d --bench-input: how long camera input waits for a frame that shows
+// it while a model is imported. A feed thread queues a turn every 4 ms and
+// the benchmark, as the render thread, drains the queue and rasterizes
+// AlexNet at up to 60 frames per second. The import runs first between two
+// frames, as it did on the window's single thread, then on the loader
+// threads; only events that arrived during the import count. Swapping the
+// finished snapshot in is timed separately, the GL upload excluded. Fails
+// when the threaded p99 exceeds --max-latency-ms.
+int RunInputBenchmark(int argc, char** argv) {
+    static const char* modeNames[2] = { "inline", "threaded" };
+    const char* spec = "synth:20000x64:residual";
+    const int width = 640, height = 360, settleFrames = 10;
+    double maxLatencyMs = 50.0;
+    for (int i = 2; i < argc; i++) {
+        if (strcmp(argv[i], "--max-latency-ms") == 0 && i + 1 < argc)
+            maxLatencyMs = atof(argv[++i]);
+        else
+            spec = argv[i];
+    }
+    // Both modes must import the model, not map what the first one stored.
+    sceneCacheOff = 1;
+
+    static InputQueue queue;
+    InputFeed feed = { &queue, 0.004, 0, 0, 0 };
+    NetworkGraph net = {0};
+    SceneCache sc = {0};
+    Framebuffer fb;
+    Rasterizer r;
+    NetworkGraph shown = {0};
+    SceneCache shownScene = {0};
+    SceneLoader loader;
+    Camera cam = { 30.0f, 0.0f, 1.0f };
+    int capacity = 4096, ok = 1;
+    double* latency = malloc(capacity * sizeof(double));
+    if (!latency || !InitFramebuffer(&fb, width, height)) {
+        printf("Error: Out of memory setting up the benchmark.\n");
+        return EXIT_FAILURE;
+    }
+    BuildMeshCache();
+    BuildEmbeddedAtlas(&embeddedAtlas);
+    InitRasterizer(&r, CpuCount());
+    if (!LoadModelSpec(&net, "alexnet"))
+        return EXIT_FAILURE;
+    BuildScene(&sc, &net);
+    StartLoader(&loader, NULL);
+    Thread feeder;
+    if (!StartThread(&feeder, InputFeedThread, &feed)) {
+        printf("Error: Could not start the input thread.\n");
+        return EXIT_FAILURE;
+    }
+    printf("Input benchmark: importing %s behind %dx%d frames, one turn queued every %.0f ms\n",
+           spec, width, height, feed.period * 1000.0);
+
+    for (int mode = 0; mode < 2 && ok; mode++) {
+        LoadJob job = {0};
+        snprintf(job.spec, sizeof(job.spec), "%s", spec);
+        job.generation = mode + 1;
+        SceneSnapshot* snap = NULL;
+        double importStart = 0.0, importEnd = 0.0, swapMs = 0.0, seconds = 0.0;
+        double next = NowSeconds();
+        int frames = 0, importFrames = 0, doneFrame = -1, samples = 0, busy = 1;
+        InputEvent e;
+        while (PopInput(&queue, &e))
+            ;
+        while (doneFrame < 0 || frames < doneFrame + settleFrames) {
+            double pending[INPUT_QUEUE_SIZE];
+            int count = 0;
+            while (PopInput(&queue, &e)) {
+                cam.rotY += e.lParam * 0.5f;
+                pending[count++] = e.time;
+            }
+            if (frames == settleFrames) {
+                importStart = NowSeconds();
+                if (mode == 0) {
+                    snap = calloc(1, sizeof(SceneSnapshot));
+                    if (snap)
+                        BuildSnapshot(&job, snap);
+                } else {
+                    SubmitLoad(&loader, &job);
+                }
+            } else if (frames > settleFrames && doneFrame < 0) {
+                snap = TakeSnapshot(&loader, &busy);
+            }
+            if (snap) {
+                if (snap->status != LOAD_BUILT) {
+                    ok = 0;
+                    ReleaseSnapshot(snap);
+                    break;
+                }
+                importEnd = NowSeconds();
+                seconds = snap->seconds;
+                // Swapped into a scratch scene: AlexNet stays on screen, so
+                // every frame costs the same in both modes.
+                double swapStart = NowSeconds();
+                SwapInSnapshot(&shown, &shownScene, snap);
+                RetireSnapshot(&loader, snap);
+                swapMs = (NowSeconds() - swapStart) * 1000.0;
+                snap = NULL;
+                doneFrame = frames;
+            } else if (mode == 1 && !busy && doneFrame < 0) {
+                ok = 0;
+                break;
+            }
+            RasterScene(&r, &fb, &sc, &net, &cam);
+            double end = NowSeconds();
+            for (int k = 0; k < count; k++) {
+                if (importStart > 0.0 && pending[k] >= importStart && (doneFrame < 0 || pending[k] <= importEnd)) {
+                    if (samples == capacity) {
+                        capacity *= 2;
+                        double* grown = realloc(latency, capacity * sizeof(double));
+                        if (!grown) {
+                            printf("Error: Out of memory recording latencies.\n");
+                            exit(EXIT_FAILURE);
+                        }
+                        latency = grown;
+                    }
+                    latency[samples++] = (end - pending[k]) * 1000.0;
+                }
+            }
+            importFrames += importStart > 0.0 && doneFrame < 0;
+            frames++;
+            next += 1.0 / 60.0;
+            if (next > end)
+                SleepSeconds(next - end);
+            else
+                next = end;
+        }
+        ReleaseScene(&shownScene);
+        ArenaRelease(&shown.arena);
+        memset(&shown, 0, sizeof(shown));
+        memset(&shownScene, 0, sizeof(shownScene));
+        if (!ok) {
+            printf("  %s: the import failed\n", modeNames[mode]);
+            break;
+        }
+        qsort(latency, samples, sizeof(double), CompareDoubles);
+        double p99 = samples ? Percentile(latency, samples, 99.0) : 0.0;
+        printf("  %-8s import %.2f s (%.2f s of work), %d frames drawn meanwhile; %d events, latency %.1f ms p50, "
+               "%.1f ms p99, %.1f ms max; swapped in in %.2f ms\n",
+               modeNames[mode], importEnd - importStart, seconds, importFrames, samples,
+               samples ? Percentile(latency, samples, 50.0) : 0.0, p99, samples ? latency[samples - 1] : 0.0, swapMs);
+        if (mode == 1 && p99 > maxLatencyMs) {
+            printf("  p99 above the allowed %.1f ms\n", maxLatencyMs);
+            ok = 0;
+        }
+    }
+    AtomicStore(&feed.stop, 1);
+    JoinThread(feeder);
+    if (feed.dropped)
+        printf("  %lld of %lld events dropped by the full queue\n", feed.dropped, feed.pushed + feed.dropped);
+
+    StopLoader(&loader);
+    ReleaseRasterizer(&r);
+    ReleaseFramebuffer(&fb);
+    ReleaseScene(&sc);
+    ArenaRelease(&net.arena);
+    free(latency);
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+// Largest difference between the coordinates, colors and bounds of two
+// scenes, or -1 when they differ in anything else: a count, an index, a range.
+double SceneDifference(const SceneCache* a, const SceneCache* b) {
+    const GeometryBuffer* ga[2] = { &a->triangles, &a->lines };
+    const GeometryBuffer* gb[2] = { &b->triangles, &b->lines };
+    const InstanceList* ia[2] = { &a->spheres, &a->cones };
+    const InstanceList* ib[2] = { &b->spheres, &b->cones };
+    double worst = 0.0;
+    if (a->elementCount != b->elementCount || a->layerCount != b->layerCount ||
+        memcmp(a->spans, b->spans, a->layerCount * sizeof(LayerSpan)) != 0 ||
+        memcmp(a->layers, b->layers, a->layerCount * sizeof(LayerLodInfo)) != 0)
+        return -1.0;
+    for (int k = 0; k < 2; k++) {
+        if (ga[k]->vertexCount != gb[k]->vertexCount || ga[k]->indexCount != gb[k]->indexCount ||
+            memcmp(ga[k]->indices, gb[k]->indices, ga[k]->indexCount * sizeof(GLuint)) != 0 ||
+            ia[k]->count != ib[k]->count)
+            return -1.0;
+        for (long long i = 0; i < ga[k]->vertexCount * 3LL; i++) {
+            worst = fmax(worst, fabs(ga[k]->vertices[i] - gb[k]->vertices[i]));
+            worst = fmax(worst, fabs(ga[k]->colors[i] - gb[k]->colors[i]));
+        }
+        for (int i = 0; i < ia[k]->count; i++) {
+            for (int c = 0; c < 16; c++)
+                worst = fmax(worst, fabs(ia[k]->items[i].transform[c] - ib[k]->items[i].transform[c]));
+            for (int c = 0; c < 3; c++)
+                worst = fmax(worst, fabs(ia[k]->items[i].color[c] - ib[k]->items[i].color[c]));
+        }
+    }
+    for (int i = 0; i < a->elementCount; i++) {
+        SceneElement ea = a->elements[i], eb = b->elements[i];
+        for (int c = 0; c < 6; c++)
+            worst = fmax(worst, fabs(ea.bounds[c] - eb.bounds[c]));
+        memset(ea.bounds, 0, sizeof(ea.bounds));
+        memset(eb.bounds, 0, sizeof(eb.bounds));
+        if (memcmp(&ea, &eb, sizeof(SceneElement)) != 0)
+            return -1.0;
+    }
+    return worst;
+}
+
+// deep3d --bench-build: build one large scene emitting every primitive on its
+// own, with the batch kernels on one thread, and with the kernels on every
+// core, and check that all three builds are the same scene. The default has
+// a million neurons: 1,000 fully connected layers of 1,000.
+int RunBuildBenchmark(int argc, char** argv) {
+    static const char* pathNames[3] = { "per-primitive", "kernels", "kernels" };
+    const char* spec = "synth:8000x1000:chain";
+    int runs = 3, threadCount = CpuCount();
+    for (int i = 2; i < argc; i++) {
+        if (strcmp(argv[i], "--runs") == 0 && i + 1 < argc)
+            runs = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--jobs") == 0 && i + 1 < argc)
+            threadCount = atoi(argv[++i]);
+        else
+            spec = argv[i];
+    }
+    if (runs < 1)
+        runs = 1;
+    if (threadCount < 1)
+        threadCount = 1;
+
+    NetworkGraph net = {0};
+    SceneCache scenes[3];
+    memset(scenes, 0, sizeof(scenes));
+    if (!LoadModelSpec(&net, spec))
+        return EXIT_FAILURE;
+    long long neurons = 0;
+    for (int i = 0; i < net.layerCount; i++)
+        neurons += net.type[i] == LAYER_FC ? net.neuronCount[i] : 0;
+    
+    int savedKernels = geometryKernels, savedThreads = sceneBuildThreads, ok = 1;
+    double best[3] = {0};
+    int pathCount = threadCount > 1 ? 3 : 2;
+    for (int path = 0; path < pathCount; path++) {
+        geometryKernels = path > 0;
+        sceneBuildThreads = path == 2 ? threadCount : 1;
+        for (int run = 0; run < runs; run++) {
+            double start = NowSeconds();
+            BuildScene(&scenes[path], &net);
+            double ms = (NowSeconds() - start) * 1000.0;
+            if (run == 0 || ms < best[path])
+                best[path] = ms;
+        }
+    }
+    geometryKernels = savedKernels;
+    sceneBuildThreads = savedThreads;
+    double bvhMs = 0.0;
+    for (int run = 0; run < runs; run++) {
+        double start = NowSeconds();
+        BuildSceneBvh(&scenes[0]);
+        double ms = (NowSeconds() - start) * 1000.0;
+        if (run == 0 || ms < bvhMs)
+            bvhMs = ms;
+    }
+    
+    const SceneCache* sc = &scenes[0];
+    long long primitives = sc->triangles.indexCount / 3 + sc->lines.indexCount / 2 + sc->spheres.count + sc->cones.count;
+    printf("Build benchmark: %s, %d layers, %lld neurons, %lld primitives in %d elements; best of %d\n",
+           spec, net.layerCount, neurons, primitives, sc->elementCount, runs);
+    for (int path = 0; path < pathCount; path++) {
+        printf("  %-14s %2d thread%s %9.1f ms (geometry %.1f ms, BVH %.1f ms)  %5.2fx",
+               pathNames[path], path == 2 ? threadCount : 1, path == 2 ? "s" : " ", best[path],
+               best[path] - bvhMs, bvhMs, best[0] / best[path]);
+        if (path > 0) {
+            double diff = SceneDifference(&scenes[0], &scenes[path]);
+            if (diff < 0.0 || diff > 1e-3)
+                ok = 0;
+            if (diff < 0.0)
+                printf("  scene differs");
+            else if (diff > 0.0)
+                printf("  coordinates differ by up to %g", diff);
+            else
+                printf("  same scene");
+        }
+        printf("\n");
+    }
+    if (threadCount == 1)
+        printf("  one core: pass --jobs N to split the build anyway\n");
+    for (int path = 0; path < 3; path++)
+        ReleaseScene(&scenes[path]);
+    ArenaRelease(&net.arena);
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+// Whether two graphs hold the same layers, labels, edges, routes and costs.
+int SameGraph(const NetworkGraph* a, const NetworkGraph* b) {
+    int layers = a->layerCount, edges = a->edgeCount;
+    if (layers != b->layerCount || edges != b->edgeCount || a->routedEdges != b->routedEdges ||
+        a->costLayers != b->costLayers || a->totalParams != b->totalParams || a->totalMacs != b->totalMacs ||
+        a->totalActivationBytes != b->totalActivationBytes || a->peakActivationBytes != b->peakActivationBytes ||
+        memcmp(a->maxCost, b->maxCost, sizeof(a->maxCost)) != 0)
+        return 0;
+    if (memcmp(a->type, b->type, layers * sizeof(LayerType)) != 0 ||
+        memcmp(a->size, b->size, layers * 3 * sizeof(float)) != 0 ||
+        memcmp(a->neuronCount, b->neuronCount, layers * sizeof(int)) != 0 ||
+        memcmp(a->color, b->color, layers * 3 * sizeof(float)) != 0 ||
+        memcmp(a->position, b->position, layers * 3 * sizeof(float)) != 0 ||
+        memcmp(a->rank, b->rank, layers * sizeof(int)) != 0 ||
+        memcmp(a->op, b->op, layers * sizeof(LayerOp)) != 0 ||
+        memcmp(a->cost, b->cost, layers * sizeof(LayerCost)) != 0 ||
+        memcmp(a->edgeFrom, b->edgeFrom, edges * sizeof(int)) != 0 ||
+        memcmp(a->edgeTo, b->edgeTo, edges * sizeof(int)) != 0)
+        return 0;
+    for (int i = 0; i < layers; i++) {
+        if (strcmp(a->label[i], b->label[i]) != 0)
+            return 0;
+    }
+    if (a->routedEdges) {
+        int points = a->routeStart[a->routedEdges];
+        if (memcmp(a->routeStart, b->routeStart, (a->routedEdges + 1) * sizeof(int)) != 0 ||
+            memcmp(a->routePoints, b->routePoints, points * 3 * sizeof(float)) != 0)
+            return 0;
+    }
+    return 1;
+}
+
+// deep3d --bench-cache: load a large model once with an empty scene cache,
+// building and storing its scene, then again from the cache, and check that
+// the cached graph, scene, BVH and labels are the built ones. A rebuild over
+// the mapped scene must come out the same as well. The default has 50,000
+// layers with skip connections, so the layout routes edges around layers.
+int RunCacheBenchmark(int argc, char** argv) {
+    const char* spec = "synth:50000x4:dense";
+    int runs = 5;
+    for (int i = 2; i < argc; i++) {
+        if (strcmp(argv[i], "--runs") == 0 && i + 1 < argc)
+            runs = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--scene-cache") == 0 && i + 1 < argc)
+            SetSceneCacheOption(argv[++i]);
+        else
+            spec = argv[i];
+    }
+    if (runs < 1)
+        runs = 1;
+    char dir[300], path[340], key[700];
+    if (!SceneCachePath(spec, dir, sizeof(dir), path, sizeof(path), key, sizeof(key))) {
+        printf("Error: The scene cache is off, or there is no model '%s'.\n", spec);
+        return EXIT_FAILURE;
+    }
+    BuildEmbeddedAtlas(&embeddedAtlas);
+    remove(path);
+    
+    NetworkGraph built = {0}, net = {0};
+    SceneCache builtScene = {0}, sc = {0};
+    LabelCache builtLabels = {0}, labels = {0};
+    double start = NowSeconds();
+    if (!LoadModelScene(&built, &builtScene, &builtLabels, &embeddedAtlas, spec, NULL))
+        return EXIT_FAILURE;
+    double coldMs = (NowSeconds() - start) * 1000.0, best = 0.0, worst = 0.0, touchMs = 0.0;
+    int hits = 0;
+    // Quick builds are never stored, so there is no file to load or compare.
+    FILE* stored = fopen(path, "rb");
+    if (stored) {
+        fclose(stored);
+    } else if (coldMs < SCENE_CACHE_MIN_SECONDS * 1000.0) {
+        printf("Scene cache benchmark: %s not stored: builds in %.1f ms, faster than the %.0f ms threshold\n", spec,
+               coldMs, SCENE_CACHE_MIN_SECONDS * 1000.0);
+        ReleaseScene(&builtScene);
+        ReleaseLabelCache(&builtLabels);
+        ArenaRelease(&built.arena);
+        return EXIT_SUCCESS;
+    }
+    for (int run = 0; run < runs; run++) {
+        start = NowSeconds();
+        LoadModelScene(&net, &sc, &labels, &embeddedAtlas, spec, NULL);
+        double ms = (NowSeconds() - start) * 1000.0;
+        best = run == 0 || ms < best ? ms : best;
+        worst = ms > worst ? ms : worst;
+        hits += sc.cacheFile.data != NULL;
+    }
+    // What the first frame pays on top: faulting in every page of the file.
+    start = NowSeconds();
+    volatile unsigned char sum = 0;
+    for (size_t at = 0; at < sc.cacheFile.size; at += 4096)
+        sum += sc.cacheFile.data[at];
+    touchMs = (NowSeconds() - start) * 1000.0;
+    
+    int ok = hits == runs;
+    int sameGraph = SameGraph(&built, &net);
+    double sceneDiff = SceneDifference(&builtScene, &sc);
+    int sameBvh = builtScene.bvhNodeCount == sc.bvhNodeCount && builtScene.bvhElementCount == sc.bvhElementCount &&
+                  memcmp(builtScene.bvh, sc.bvh, sc.bvhNodeCount * sizeof(BvhNode)) == 0 &&
+                  memcmp(builtScene.bvhItems, sc.bvhItems, sc.bvhElementCount * sizeof(int)) == 0;
+    int sameLabels = labels.atlas == &embeddedAtlas && labels.glyphCount == builtLabels.glyphCount &&
+                     memcmp(labels.runs, builtLabels.runs, net.layerCount * LABEL_VARIANT_COUNT * sizeof(LabelRun)) == 0 &&
+                     memcmp(labels.glyphs, builtLabels.glyphs, labels.glyphCount * sizeof(LaidGlyph)) == 0;
+    double mb = sc.cacheFile.size / (1024.0 * 1024.0);
+    BuildScene(&sc, &net);
+    double rebuildDiff = SceneDifference(&builtScene, &sc);
+    ok = ok && sameGraph && sceneDiff == 0.0 && sameBvh && sameLabels && rebuildDiff == 0.0;
+    
+    printf("Scene cache benchmark: %s, %d layers, %d edges, %d elements; %.1f MB in %s\n", spec, net.layerCount,
+           net.edgeCount, sc.elementCount, mb, dir);
+    printf("  miss: load, layout, build and store  %9.1f ms\n", coldMs);
+    printf("  hit:  map and copy the graph         %9.1f ms best, %.1f ms worst of %d (%d hit%s)  %.0fx\n", best,
+           worst, runs, hits, hits == 1 ? "" : "s", best > 0.0 ? coldMs / best : 0.0);
+    printf("        then touch every page          %9.1f ms\n", touchMs);
+    printf("  graph %s, scene %s, BVH %s, labels %s, rebuilt over the mapping %s\n", sameGraph ? "same" : "differs",
+           sceneDiff == 0.0 ? "same" : "differs", sameBvh ? "same" : "differs", sameLabels ? "same" : "differ",
+           rebuildDiff == 0.0 ? "same" : "differs");
+    remove(path);
+    ReleaseScene(&builtScene);
+    ReleaseScene(&sc);
+    ReleaseLabelCache(&builtLabels);
+    ReleaseLabelCache(&labels);
+    ArenaRelease(&built.arena);
+    ArenaRelease(&net.arena);
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+// deep3d --bench-gltf: build one large scene, by default a million neurons,
+// and export it as binary glTF. Reports the export time and the file size
+// against the same scene as float meshes with one copy per instance. Checks
+// the file's header and chunks, and that it holds every instance and shaft
+// of the finest level. Exits with 1 when a check fails or the export takes
+// longer than --max-seconds or more than --max-mb.
+int RunGltfBenchmark(int argc, char** argv) {
+    const char* spec = "synth:8000x1000:chain";
+    const char* out = NULL;
+    double maxSeconds = 10.0, maxMb = 256.0;
+    for (int i = 2; i < argc; i++) {
+        if (strcmp(argv[i], "--out") == 0 && i + 1 < argc)
+            out = argv[++i];
+        else if (strcmp(argv[i], "--max-seconds") == 0 && i + 1 < argc)
+            maxSeconds = atof(argv[++i]);
+        else if (strcmp(argv[i], "--max-mb") == 0 && i + 1 < argc)
+            maxMb = atof(argv[++i]);
+        else
+            spec = argv[i];
+    }
+    const char* path = out ? out : "deep3d-bench.glb";
+    NetworkGraph net = {0};
+    SceneCache sc = {0};
+    if (!LoadModelSpec(&net, spec))
+        return EXIT_FAILURE;
+    BuildMeshCache();
+    double start = NowSeconds();
+    BuildScene(&sc, &net);
+    double buildMs = (NowSeconds() - start) * 1000.0;
+    long long neurons = 0, expected[MESH_KIND_COUNT] = {0}, lineVertices = 0;
+    for (int i = 0; i < net.layerCount; i++)
+        neurons += net.type[i] == LAYER_FC ? net.neuronCount[i] : 0;
+    for (int i = 0; i < sc.elementCount; i++) {
+        const SceneElement* e = &sc.elements[i];
+        if (!GltfWritesElement(e))
+            continue;
+        expected[MESH_SPHERE] += e->spheres.count;
+        expected[MESH_CONE] += e->cones.count;
+        expected[MESH_BOX] += e->triVerts.count / 8;
+        lineVertices += e->lineIndices.count;
+    }
+
+    GltfStats stats;
+    start = NowSeconds();
+    int ok = WriteGltfScene(&sc, path, &stats);
+    double seconds = NowSeconds() - start;
+    const char* problem = ok ? NULL : "not written";
+    FILE* f = ok ? fopen(path, "rb") : NULL;
+    unsigned char header[28];
+    if (ok && (!f || fread(header, 1, 20, f) != 20 || memcmp(header, "glTF", 4) != 0 ||
+               ReadLittle32(header + 4) != 2 || ReadLittle32(header + 8) != stats.fileBytes ||
+               ReadLittle32(header + 12) != stats.jsonBytes || memcmp(header + 16, "JSON", 4) != 0))
+        problem = "bad header or JSON chunk";
+    if (!problem && (fseek(f, (long)(20 + stats.jsonBytes), SEEK_SET) != 0 || fread(header, 1, 8, f) != 8 ||
+                     ReadLittle32(header) != stats.binaryBytes || memcmp(header + 4, "BIN\0", 4) != 0))
+        problem = "bad binary chunk";
+    if (!problem && (fseek(f, 0, SEEK_END) != 0 || ftell(f) != (long)stats.fileBytes))
+        problem = "file size differs from the header";
+    for (int shape = 0; shape < MESH_KIND_COUNT && !problem; shape++) {
+        if (stats.instances[shape] != expected[shape])
+            problem = "instance count differs from the scene";
+    }
+    if (!problem && stats.lineVertices != lineVertices)
+        problem = "shaft count differs from the scene";
+    if (f)
+        fclose(f);
+
+    printf("glTF benchmark: %s, %d layers, %lld neurons; scene built in %.1f ms\n", spec, net.layerCount, neurons,
+           buildMs);
+    printf("  %lld spheres, %lld arrowheads, %lld boxes in %d instanced nodes; %lld shafts in %d line chunks; "
+           "%d materials\n", stats.instances[MESH_SPHERE], stats.instances[MESH_CONE], stats.instances[MESH_BOX],
+           stats.groups, stats.lineVertices / 2, stats.chunks, stats.materials);
+    printf("  %.1f MB (JSON %.1f KB) in %.2f s, %.1f MB/s; %.0f MB as float meshes, %.0fx smaller\n",
+           stats.fileBytes / (1024.0 * 1024.0), stats.jsonBytes / 1024.0, seconds,
+           seconds > 0.0 ? stats.fileBytes / (1024.0 * 1024.0) / seconds : 0.0, stats.meshBytes / (1024.0 * 1024.0),
+           stats.fileBytes ? (double)stats.meshBytes / stats.fileBytes : 0.0);
+    if (problem)
+        printf("  %s\n", problem);
+    if (seconds > maxSeconds)
+        printf("  slower than the allowed %.1f s\n", maxSeconds);
+    if (stats.fileBytes > maxMb * 1024.0 * 1024.0)
+        printf("  larger than the allowed %.0f MB\n", maxMb);
+    ok = !problem && seconds <= maxSeconds && stats.fileBytes <= maxMb * 1024.0 * 1024.0;
+    if (!out)
+        remove(path);
+    ReleaseScene(&sc);
+    ArenaRelease(&net.arena);
+    ReleaseMeshCache();
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+//-------------------------
+// Image Output
+//-------------------------
+
+int WritePPM(const Framebuffer* fb, const char* path) {
+    FILE* out = fopen(path, "wb");
+    if (!out)
+        return 0;
+    fprintf(out, "P6\n%d %d\n255\n", fb->width, fb->height);
+    size_t bytes = (size_t)fb->width * fb->height * 3;
+    int ok = fwrite(fb->color, 1, bytes, out) == bytes;
+    return fclose(out) == 0 && ok;
+}
+
+// CRC-32 as used by PNG chunks, four bits at a time from a constant table.
+unsigned int Crc32(unsigned int crc, const unsigned char* data, size_t len) {
+    static const unsigned int nibble[16] = {
+        0x00000000, 0x1DB71064, 0x3B6E20C8, 0x26D930AC, 0x76DC4190, 0x6B6B51F4, 0x4DB26158, 0x5005713C,
+        0xEDB88320, 0xF00F9344, 0xD6D6A3E8, 0xCB61B38C, 0x9B64C2B0, 0x86D3D2D4, 0xA00AE278, 0xBDBDF21C
+    };
+    crc = ~crc;
+    for (size_t i = 0; i < len; i++) {
+        crc ^= data[i];
+        crc = (crc >> 4) ^ nibble[crc & 15];
+        crc = (crc >> 4) ^ nibble[crc & 15];
+    }
+    return ~crc;
+}
+
+// Growable byte buffer with an LSB-first bit writer for deflate output.
+struct ByteWriter {
+    unsigned char* data;
+    size_t size, capacity;
+    unsigned int bits;
+    int bitCount;
+};
+
+void PutByte(ByteWriter* w, unsigned char value) {
+    if (w->size == w->capacity) {
+        size_t capacity = w->capacity ? w->capacity * 2 : 4096;
+        unsigned char* data = realloc(w->data, capacity);
+        if (!data) {
+            printf("Error: Out of memory encoding image.\n");
+            exit(EXIT_FAILURE);
+        }
+        w->data = data;
+        w->capacity = capacity;
+    }
+    w->data[w->size++] = value;
+}
+
+void PutBytes(ByteWriter* w, const void* data, size_t size) {
+    if (w->size + size > w->capacity) {
+        size_t capacity = w->capacity ? w->capacity : 4096;
+        while (capacity < w->size + size)
+            capacity *= 2;
+        unsigned char* grown = realloc(w->data, capacity);
+        if (!grown) {
+            printf("Error: Out of memory encoding image.\n");
+            exit(EXIT_FAILURE);
+        }
+        w->data = grown;
+        w->capacity = capacity;
+    }
+    memcpy(w->data + w->size, data, size);
+    w->size += size;
+}
+
+void PutBig32(ByteWriter* w, unsigned int value) {
+    PutByte(w, (unsigned char)(value >> 24));
+    PutByte(w, (unsigned char)(value >> 16));
+    PutByte(w, (unsigned char)(value >> 8));
+    PutByte(w, (unsigned char)value);
+}
+
+void PutBits(ByteWriter* w, unsigned int value, int count) {
+    w->bits |= value << w->bitCount;
+    w->bitCount += count;
+    while (w->bitCount >= 8) {
+        PutByte(w, (unsigned char)w->bits);
+        w->bits >>= 8;
+        w->bitCount -= 8;
+    }
+}
+
+// Huffman codes are defined MSB first but deflate packs bits LSB first.
+void PutCode(ByteWriter* w, unsigned int code, int length) {
+    unsigned int reversed = 0;
+    for (int i = 0; i < length; i++)
+        reversed |= ((code >> i) & 1) << (length - 1 - i);
+    PutBits(w, reversed, length);
+}
+
+// Literal/length symbol with the fixed Huffman code of RFC 1951 3.2.6.
+void PutFixedSymbol(ByteWriter* w, int symbol) {
+    if (symbol < 144)
+        PutCode(w, 0x30 + symbol, 8);
+    else if (symbol < 256)
+        PutCode(w, 0x190 + symbol - 144, 9);
+    else if (symbol < 280)
+        PutCode(w, symbol - 256, 7);
+    else
+        PutCode(w, 0xC0 + symbol - 280, 8);
+}
+
+void PutMatch(ByteWriter* w, int length, int distance) {
+    static const int lengthBase[29] = {
+        3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+        35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258
+    };
+    static const int lengthExtra[29] = {
+        0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0
+    };
+    static const int distBase[30] = {
+        1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+        257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577
+    };
+    static const int distExtra[30] = {
+        0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13
+    };
+    int code = 28;
+    while (lengthBase[code] > length)
+        code--;
+    PutFixedSymbol(w, 257 + code);
+    PutBits(w, length - lengthBase[code], lengthExtra[code]);
+    code = 29;
+    while (distBase[code] > distance)
+        code--;
+    PutCode(w, code, 5);
+    PutBits(w, distance - distBase[code], distExtra[code]);
+}
+
+// zlib stream of one fixed-Huffman deflate block with hash-chained LZ77
+// matching. Rendered diagrams are mostly flat color, so runs of identical
+// pixels collapse into long matches even without dynamic tables.
+void Deflate(ByteWriter* w, const unsigned char* data, size_t size) {
+    int* head = malloc(DEFLATE_HASH_SIZE * sizeof(int));
+    int* prev = malloc(DEFLATE_WINDOW * sizeof(int));
+    if (!head || !prev) {
+        printf("Error: Out of memory encoding image.\n");
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < DEFLATE_HASH_SIZE; i++)
+        head[i] = -1;
+
+    PutByte(w, 0x78);   // Deflate, 32K window
+    PutByte(w, 0x01);   // Fastest compression level, no dictionary
+    PutBits(w, 1, 1);   // BFINAL
+    PutBits(w, 1, 2);   // BTYPE = fixed Huffman
+    size_t pos = 0;
+    while (pos < size) {
+        int bestLength = 0, bestDistance = 0;
+        unsigned int hash = 0;
+        if (pos + 3 <= size) {
+            hash = ((data[pos] << 16 | data[pos + 1] << 8 | data[pos + 2]) * 2654435761u) >> 16;
+            size_t maxLength = size - pos < 258 ? size - pos : 258;
+            int candidate = head[hash];
+            for (int chain = 0; candidate >= 0 && chain < DEFLATE_MAX_CHAIN; chain++) {
+                size_t distance = pos - (size_t)candidate;
+                if (distance > DEFLATE_WINDOW - 1)
+                    break;
+                size_t length = 0;
+                while (length < maxLength && data[candidate + length] == data[pos + length])
+                    length++;
+                if ((int)length > bestLength) {
+                    bestLength = (int)length;
+                    bestDistance = (int)distance;
+                    if (length == maxLength)
+                        break;
+                }
+                candidate = prev[candidate % DEFLATE_WINDOW];
+            }
+        }
+        int advance = 1;
+        if (bestLength >= 3) {
+            PutMatch(w, bestLength, bestDistance);
+            advance = bestLength;
+        } else {
+            PutFixedSymbol(w, data[pos]);
+        }
+        // Index every position consumed so later matches can reference it.
+        for (int i = 0; i < advance; i++, pos++) {
+            if (pos + 3 > size)
+                continue;
+            hash = ((data[pos] << 16 | data[pos + 1] << 8 | data[pos + 2]) * 2654435761u) >> 16;
+            prev[pos % DEFLATE_WINDOW] = head[hash];
+            head[hash] = (int)pos;
+        }
+    }
+    PutFixedSymbol(w, 256);
+    if (w->bitCount > 0)
+        PutBits(w, 0, 8 - w->bitCount);
+
+    unsigned int s1 = 1, s2 = 0;
+    for (size_t i = 0; i < size; i++) {
+        s1 = (s1 + data[i]) % 65521;
+        s2 = (s2 + s1) % 65521;
+    }
+    PutBig32(w, (s2 << 16) | s1);
+    free(head);
+    free(prev);
+}
+
+// 8-bit RGB PNG, appended to png; every row uses the Sub filter, which turns
+// flat spans into zero runs. Returns 0 when out of memory.
+int EncodePNG(const Framebuffer* fb, ByteWriter* png) {
+    static const unsigned char signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+    size_t stride = (size_t)fb->width * 3;
+    unsigned char* filtered = malloc((stride + 1) * fb->height);
+    if (!filtered)
+        return 0;
+    for (int y = 0; y < fb->height; y++) {
+        const unsigned char* src = fb->color + y * stride;
+        unsigned char* dst = filtered + y * (stride + 1);
+        dst[0] = 1;
+        for (size_t x = 0; x < stride; x++)
+            dst[1 + x] = (unsigned char)(src[x] - (x >= 3 ? src[x - 3] : 0));
+    }
+
+    for (int i = 0; i < 8; i++)
+        PutByte(png, signature[i]);
+    PutBig32(png, 13);
+    size_t chunk = png->size;
+    PutBig32(png, 0x49484452);      // IHDR
+    PutBig32(png, (unsigned int)fb->width);
+    PutBig32(png, (unsigned int)fb->height);
+    PutByte(png, 8);                // Bit depth
+    PutByte(png, 2);                // Truecolor
+    PutByte(png, 0);
+    PutByte(png, 0);
+    PutByte(png, 0);
+    PutBig32(png, Crc32(0, png->data + chunk, png->size - chunk));
+
+    size_t lengthAt = png->size;
+    PutBig32(png, 0);               // Patched once the stream length is known
+    chunk = png->size;
+    PutBig32(png, 0x49444154);      // IDAT
+    Deflate(png, filtered, (stride + 1) * fb->height);
+    unsigned int idatLength = (unsigned int)(png->size - chunk - 4);
+    for (int i = 0; i < 4; i++)
+        png->data[lengthAt + i] = (unsigned char)(idatLength >> (24 - 8 * i));
+    PutBig32(png, Crc32(0, png->data + chunk, png->size - chunk));
+
+    PutBig32(png, 0);
+    chunk = png->size;
+    PutBig32(png, 0x49454E44);      // IEND
+    PutBig32(png, Crc32(0, png->data + chunk, png->size - chunk));
+    free(filtered);
+    return 1;
+}
+
+int WritePNG(const Framebuffer* fb, const char* path) {
+    ByteWriter png = {0};
+    if (!EncodePNG(fb, &png))
+        return 0;
+    FILE* out = fopen(path, "wb");
+    int ok = out && fwrite(png.data, 1, png.size, out) == png.size;
+    if (out && fclose(out) != 0)
+        ok = 0;
+    free(png.data);
+    return ok;
+}
+
+//-------------------------
+// glTF Export
+//-------------------------
+// --export --format glb writes each model's built scene as binary glTF 2.0
+// instead of images. Neurons, arrowheads and layer boxes are meshes written
+// once per size and placed with EXT_mesh_gpu_instancing. Instances of one
+// size and color share a node, a mesh and a material, so each carries only
+// its translation and, for arrowheads, a rotation quantized to bytes. Sizes
+// and colors too rare to get a node of their own go to a node per shape and
+// color rounded to GLTF_COLOR_LEVELS a channel, whose instances also carry a
+// scale. Colors are always materials, which every viewer shows. Arrow
+// shafts are LINES in chunks spanning at most GLTF_CHUNK_EXTENT per axis,
+// stored as 16-bit positions (KHR_mesh_quantization) that the chunk's node
+// scales back. Only the finest level of detail is written, and no labels.
+//
+// The file is streamed: a first pass over the scene groups the instances
+// and sizes every array, the JSON is written from that, and a second pass
+// writes the binary chunk through a small buffer. Beyond the scene itself
+// this takes six bytes per instance.
+
+int GltfWritesElement(const SceneElement* e) {
+    return (e->lodMask & LOD_MASK(LOD_FULL)) != 0;
+}
+
+// Rotation matrix, given by its columns, as an x, y, z, w quaternion.
+void GltfQuaternion(const float column[3][3], float* q) {
+    float trace = column[0][0] + column[1][1] + column[2][2];
+    if (trace > 0.0f) {
+        float s = sqrtf(trace + 1.0f) * 2.0f;
+        q[0] = (column[1][2] - column[2][1]) / s;
+        q[1] = (column[2][0] - column[0][2]) / s;
+        q[2] = (column[0][1] - column[1][0]) / s;
+        q[3] = 0.25f * s;
+    } else if (column[0][0] > column[1][1] && column[0][0] > column[2][2]) {
+        float s = sqrtf(1.0f + column[0][0] - column[1][1] - column[2][2]) * 2.0f;
+        q[0] = 0.25f * s;
+        q[1] = (column[1][0] + column[0][1]) / s;
+        q[2] = (column[2][0] + column[0][2]) / s;
+        q[3] = (column[1][2] - column[2][1]) / s;
+    } else if (column[1][1] > column[2][2]) {
+        float s = sqrtf(1.0f + column[1][1] - column[0][0] - column[2][2]) * 2.0f;
+        q[0] = (column[1][0] + column[0][1]) / s;
+        q[1] = 0.25f * s;
+        q[2] = (column[2][1] + column[1][2]) / s;
+        q[3] = (column[2][0] - column[0][2]) / s;
+    } else {
+        float s = sqrtf(1.0f + column[2][2] - column[0][0] - column[1][1]) * 2.0f;
+        q[0] = (column[2][0] + column[0][2]) / s;
+        q[1] = (column[2][1] + column[1][2]) / s;
+        q[2] = 0.25f * s;
+        q[3] = (column[0][1] - column[1][0]) / s;
+    }
+}
+
+// Instance item of a shape, taken apart the way glTF places it. Boxes are
+// the scene's triangles, eight corners each, since EmitBox writes all of them.
+void GltfInstanceAt(const SceneCache* sc, int shape, long long item, GltfInstance* out) {
+    if (shape == MESH_BOX) {
+        const float* low = sc->triangles.vertices + item * 24;     // Corner 0: -x, -y, -z
+        const float* high = low + 21;                               // Corner 7: +x, +y, +z
+        for (int k = 0; k < 3; k++) {
+            out->translation[k] = (low[k] + high[k]) * 0.5f;
+            out->scale[k] = high[k] - low[k];
+            out->color[k] = sc->triangles.colors[item * 24 + k];
+            out->rotation[k] = 0.0f;
+        }
+        out->rotation[3] = 1.0f;
+        return;
+    }
+    const MeshInstance* inst = &(shape == MESH_SPHERE ? sc->spheres.items : sc->cones.items)[item];
+    const float* m = inst->transform;
+    float column[3][3];
+    for (int c = 0; c < 3; c++) {
+        float length = sqrtf(m[c * 4] * m[c * 4] + m[c * 4 + 1] * m[c * 4 + 1] + m[c * 4 + 2] * m[c * 4 + 2]);
+        for (int k = 0; k < 3; k++)
+            column[c][k] = length > 0.0f ? m[c * 4 + k] / length : (float)(c == k);
+        out->scale[c] = length;
+        out->translation[c] = m[12 + c];
+        out->color[c] = inst->color[c];
+    }
+    GltfQuaternion(column, out->rotation);
+}
+
+unsigned char GltfColorByte(float value) {
+    return (unsigned char)lrintf((value < 0.0f ? 0.0f : value > 1.0f ? 1.0f : value) * 255.0f);
+}
+
+// glTF colors are linear; the scene's are displayed as they are, so sRGB.
+float GltfLinear(unsigned char srgb) {
+    float c = srgb / 255.0f;
+    return c <= 0.04045f ? c / 12.92f : powf((c + 0.055f) / 1.055f, 2.4f);
+}
+
+// Slot of the key for an instance's shape, size and color, counting it.
+// Returns GLTF_OVERFLOW once the table is three quarters full.
+unsigned short GltfKeySlot(GltfExport* ex, int shape, const GltfInstance* inst) {
+    int scale[3];
+    unsigned char color[3];
+    unsigned int hash = 2166136261u ^ shape;
+    for (int k = 0; k < 3; k++) {
+        scale[k] = (int)lrintf(inst->scale[k] * GLTF_SCALE_STEP);
+        color[k] = GltfColorByte(inst->color[k]);
+        hash = (hash ^ (unsigned int)scale[k]) * 16777619u;
+        hash = (hash ^ color[k]) * 16777619u;
+    }
+    for (unsigned int slot = hash % GLTF_KEY_SLOTS;; slot = (slot + 1) % GLTF_KEY_SLOTS) {
+        GltfKey* key = &ex->keys[slot];
+        if (key->count == 0) {
+            if (ex->keyCount >= GLTF_KEY_SLOTS / 4 * 3)
+                return GLTF_OVERFLOW;
+            key->shape = shape;
+            memcpy(key->scale, scale, sizeof(scale));
+            memcpy(key->color, color, sizeof(color));
+            ex->keyCount++;
+        } else if (key->shape != shape || memcmp(key->scale, scale, sizeof(scale)) != 0 ||
+                   memcmp(key->color, color, sizeof(color)) != 0) {
+            continue;
+        }
+        key->count++;
+        return (unsigned short)slot;
+    }
+}
+
+// Overflow group of a shape for a color rounded to GLTF_COLOR_LEVELS a
+// channel, created with its material on first use.
+int GltfOverflowGroup(GltfExport* ex, int shape, const unsigned char* color) {
+    unsigned char rounded[3];
+    int index = 0;
+    for (int k = 0; k < 3; k++) {
+        int level = (color[k] * (GLTF_COLOR_LEVELS - 1) + 127) / 255;
+        rounded[k] = (unsigned char)(level * 255 / (GLTF_COLOR_LEVELS - 1));
+        index = index * GLTF_COLOR_LEVELS + level;
+    }
+    int* group = &ex->overflowGroup[shape][index];
+    if (*group < 0) {
+        GltfGroup* g = &ex->groups[ex->groupCount];
+        memset(g, 0, sizeof(GltfGroup));
+        g->shape = shape;
+        g->overflow = 1;
+        g->scale[0] = g->scale[1] = g->scale[2] = (int)GLTF_SCALE_STEP;
+        g->material = GltfMaterial(ex, rounded);
+        *group = ex->groupCount++;
+    }
+    return *group;
+}
+
+// Add the arrow shafts of element to the open chunk, or start a new one
+// when they would stretch it past GLTF_CHUNK_EXTENT or change its color.
+void GltfAddLines(GltfExport* ex, int element) {
+    const SceneElement* e = &ex->sc->elements[element];
+    const GeometryBuffer* lines = &ex->sc->lines;
+    float bounds[6] = { FLT_MAX, FLT_MAX, FLT_MAX, -FLT_MAX, -FLT_MAX, -FLT_MAX };
+    int color = -2;
+    for (int i = e->lineIndices.first; i < e->lineIndices.first + e->lineIndices.count; i++) {
+        const float* v = lines->vertices + (size_t)lines->indices[i] * 3;
+        const float* c = lines->colors + (size_t)lines->indices[i] * 3;
+        int rgb = GltfColorByte(c[0]) << 16 | GltfColorByte(c[1]) << 8 | GltfColorByte(c[2]);
+        color = color == -2 || color == rgb ? rgb : -1;
+        for (int k = 0; k < 3; k++) {
+            bounds[k] = v[k] < bounds[k] ? v[k] : bounds[k];
+            bounds[3 + k] = v[k] > bounds[3 + k] ? v[k] : bounds[3 + k];
+        }
+    }
+    GltfChunk* chunk = ex->chunkCount ? &ex->chunks[ex->chunkCount - 1] : NULL;
+    int joins = chunk && chunk->color == color;
+    for (int k = 0; k < 3 && joins; k++) {
+        float low = bounds[k] < chunk->bounds[k] ? bounds[k] : chunk->bounds[k];
+        float high = bounds[3 + k] > chunk->bounds[3 + k] ? bounds[3 + k] : chunk->bounds[3 + k];
+        joins = high - low <= GLTF_CHUNK_EXTENT;
+    }
+    if (!joins) {
+        if (ex->chunkCount == ex->chunkCapacity) {
+            ex->chunkCapacity = ex->chunkCapacity ? ex->chunkCapacity * 2 : 64;
+            ex->chunks = realloc(ex->chunks, ex->chunkCapacity * sizeof(GltfChunk));
+            if (!ex->chunks) {
+                printf("Error: Out of memory exporting glTF.\n");
+                exit(EXIT_FAILURE);
+            }
+        }
+        chunk = &ex->chunks[ex->chunkCount++];
+        memset(chunk, 0, sizeof(GltfChunk));
+        chunk->firstElement = element;
+        chunk->color = color;
+        memcpy(chunk->bounds, bounds, sizeof(bounds));
+    }
+    for (int k = 0; k < 3; k++) {
+        chunk->bounds[k] = bounds[k] < chunk->bounds[k] ? bounds[k] : chunk->bounds[k];
+        chunk->bounds[3 + k] = bounds[3 + k] > chunk->bounds[3 + k] ? bounds[3 + k] : chunk->bounds[3 + k];
+    }
+    chunk->endElement = element + 1;
+    chunk->vertexCount += e->lineIndices.count;
+}
+
+short GltfQuantize(const GltfChunk* chunk, const float* v, int axis) {
+    long q = lrintf((v[axis] - chunk->center[axis]) / chunk->step[axis]);
+    return (short)(q < -32767 ? -32767 : q > 32767 ? 32767 : q);
+}
+
+int GltfMaterial(GltfExport* ex, const unsigned char* color) {
+    for (int i = 0; i < ex->materialCount; i++) {
+        if (memcmp(ex->materials[i], color, 3) == 0)
+            return i;
+    }
+    if (ex->materialCount == ex->materialCapacity) {
+        ex->materialCapacity = ex->materialCapacity ? ex->materialCapacity * 2 : 64;
+        ex->materials = realloc(ex->materials, ex->materialCapacity * 3);
+        if (!ex->materials) {
+            printf("Error: Out of memory exporting glTF.\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    memcpy(ex->materials[ex->materialCount], color, 3);
+    return ex->materialCount++;
+}
+
+int CompareGltfKeys(const void* a, const void* b) {
+    const GltfKey* ka = *(const GltfKey* const*)a;
+    const GltfKey* kb = *(const GltfKey* const*)b;
+    if (ka->count != kb->count)
+        return ka->count > kb->count ? -1 : 1;
+    if (ka->shape != kb->shape)
+        return ka->shape - kb->shape;
+    int scale = memcmp(ka->scale, kb->scale, sizeof(ka->scale));
+    return scale ? scale : memcmp(ka->color, kb->color, sizeof(ka->color));
+}
+
+// First pass: key every written instance, chunk the arrow shafts, then give
+// the commonest keys groups of their own and lay out every array.
+void GltfPlan(GltfExport* ex) {
+    const SceneCache* sc = ex->sc;
+    ex->itemCount[MESH_SPHERE] = sc->spheres.count;
+    ex->itemCount[MESH_CONE] = sc->cones.count;
+    ex->itemCount[MESH_BOX] = sc->triangles.vertexCount / 8;
+    for (int shape = 0; shape < MESH_KIND_COUNT; shape++) {
+        ex->slots[shape] = malloc((ex->itemCount[shape] + 1) * sizeof(unsigned short));
+        if (!ex->slots[shape]) {
+            printf("Error: Out of memory exporting glTF.\n");
+            exit(EXIT_FAILURE);
+        }
+        for (long long i = 0; i < ex->itemCount[shape]; i++)
+            ex->slots[shape][i] = GLTF_SKIP;
+        for (int c = 0; c < GLTF_OVERFLOW_COLORS; c++)
+            ex->overflowGroup[shape][c] = -1;
+    }
+    for (int el = 0; el < sc->elementCount; el++) {
+        const SceneElement* e = &sc->elements[el];
+        if (!GltfWritesElement(e))
+            continue;
+        const ElementRange* ranges[MESH_KIND_COUNT] = { &e->spheres, &e->cones, &e->triVerts };
+        for (int shape = 0; shape < MESH_KIND_COUNT; shape++) {
+            int step = shape == MESH_BOX ? 8 : 1;
+            for (int i = ranges[shape]->first; i + step <= ranges[shape]->first + ranges[shape]->count; i += step) {
+                GltfInstance inst;
+                GltfInstanceAt(sc, shape, i / step, &inst);
+                ex->slots[shape][i / step] = GltfKeySlot(ex, shape, &inst);
+                ex->stats.instances[shape]++;
+            }
+        }
+        if (e->lineIndices.count > 0)
+            GltfAddLines(ex, el);
+    }
+
+    // Groups: the commonest keys, then per shape and rounded color one for
+    // the rest. From here on an instance's slot holds its group.
+    GltfKey* ranked[GLTF_KEY_SLOTS];
+    int rankedCount = 0;
+    for (int slot = 0; slot < GLTF_KEY_SLOTS; slot++) {
+        ex->keys[slot].group = -1;
+        if (ex->keys[slot].count > 0)
+            ranked[rankedCount++] = &ex->keys[slot];
+    }
+    qsort(ranked, rankedCount, sizeof(GltfKey*), CompareGltfKeys);
+    GltfMaterial(ex, (const unsigned char[3]){ 255, 255, 255 });    // Material 0 shows COLOR_0 as it is
+    for (int i = 0; i < rankedCount; i++) {
+        GltfKey* key = ranked[i];
+        if (key->count >= GLTF_MIN_GROUP && ex->groupCount < GLTF_KEY_GROUPS) {
+            GltfGroup* g = &ex->groups[ex->groupCount];
+            memset(g, 0, sizeof(GltfGroup));
+            g->shape = key->shape;
+            memcpy(g->scale, key->scale, sizeof(g->scale));
+            g->material = GltfMaterial(ex, key->color);
+            key->group = ex->groupCount++;
+        }
+    }
+    for (int shape = 0; shape < MESH_KIND_COUNT; shape++) {
+        for (long long i = 0; i < ex->itemCount[shape]; i++) {
+            unsigned short slot = ex->slots[shape][i];
+            if (slot == GLTF_SKIP)
+                continue;
+            int group = slot == GLTF_OVERFLOW ? -1 : ex->keys[slot].group;
+            if (group < 0) {
+                GltfInstance inst;
+                unsigned char color[3];
+                if (slot == GLTF_OVERFLOW) {
+                    GltfInstanceAt(sc, shape, i, &inst);
+                    for (int k = 0; k < 3; k++)
+                        color[k] = GltfColorByte(inst.color[k]);
+                } else {
+                    memcpy(color, ex->keys[slot].color, sizeof(color));
+                }
+                group = GltfOverflowGroup(ex, shape, color);
+                if (slot != GLTF_OVERFLOW)
+                    ex->keys[slot].group = group;
+            }
+            ex->slots[shape][i] = (unsigned short)group;
+            ex->groups[group].count++;
+        }
+    }
+    // Counting sort of each shape's instances by group, so the second pass
+    // reads every group's members in one run.
+    for (int shape = 0; shape < MESH_KIND_COUNT; shape++) {
+        long long start = 0;
+        ex->order[shape] = malloc((ex->itemCount[shape] + 1) * sizeof(int));
+        if (!ex->order[shape]) {
+            printf("Error: Out of memory exporting glTF.\n");
+            exit(EXIT_FAILURE);
+        }
+        for (int i = 0; i < ex->groupCount; i++) {
+            GltfGroup* g = &ex->groups[i];
+            if (g->shape != shape)
+                continue;
+            g->start = start;
+            start += g->count;
+            g->count = 0;
+        }
+        for (long long i = 0; i < ex->itemCount[shape]; i++) {
+            if (ex->slots[shape][i] == GLTF_SKIP)
+                continue;
+            GltfGroup* g = &ex->groups[ex->slots[shape][i]];
+            ex->order[shape][g->start + g->count++] = (int)i;
+        }
+    }
+
+    // Layout of the binary chunk, one buffer view per kind of array.
+    int indexOffset[MESH_KIND_COUNT];
+    for (int shape = 0; shape < MESH_KIND_COUNT; shape++)
+        indexOffset[shape] = -1;
+    for (int i = 0; i < ex->groupCount; i++) {
+        GltfGroup* g = &ex->groups[i];
+        const Mesh* mesh = &meshCache[g->shape][0];
+        g->variant = i;
+        for (int j = 0; j < i; j++) {
+            if (ex->groups[j].shape == g->shape && memcmp(ex->groups[j].scale, g->scale, sizeof(g->scale)) == 0) {
+                g->variant = ex->groups[j].variant;
+                break;
+            }
+        }
+        if (g->variant == i) {
+            g->offset[GLTF_VIEW_MESH_POSITIONS] = ex->viewSize[GLTF_VIEW_MESH_POSITIONS];
+            ex->viewSize[GLTF_VIEW_MESH_POSITIONS] += (long long)mesh->vertexCount * 12;
+        }
+        if (indexOffset[g->shape] < 0) {
+            indexOffset[g->shape] = (int)ex->viewSize[GLTF_VIEW_MESH_INDICES];
+            ex->viewSize[GLTF_VIEW_MESH_INDICES] += ((long long)mesh->indexCount * 2 + 3) & ~3LL;
+        }
+        g->offset[GLTF_VIEW_MESH_INDICES] = indexOffset[g->shape];
+        g->offset[GLTF_VIEW_TRANSLATIONS] = ex->viewSize[GLTF_VIEW_TRANSLATIONS];
+        ex->viewSize[GLTF_VIEW_TRANSLATIONS] += g->count * 12;
+        if (g->shape == MESH_CONE) {
+            g->offset[GLTF_VIEW_ROTATIONS] = ex->viewSize[GLTF_VIEW_ROTATIONS];
+            ex->viewSize[GLTF_VIEW_ROTATIONS] += g->count * 4;
+        }
+        if (g->overflow) {
+            g->offset[GLTF_VIEW_SCALES] = ex->viewSize[GLTF_VIEW_SCALES];
+            ex->viewSize[GLTF_VIEW_SCALES] += g->count * 12;
+        }
+    }
+    for (int i = 0; i < ex->chunkCount; i++) {
+        GltfChunk* chunk = &ex->chunks[i];
+        const GeometryBuffer* lines = &sc->lines;
+        for (int k = 0; k < 3; k++) {
+            chunk->center[k] = (chunk->bounds[k] + chunk->bounds[3 + k]) * 0.5f;
+            chunk->step[k] = (chunk->bounds[3 + k] - chunk->bounds[k]) / 65534.0f;
+            if (!(chunk->step[k] > 0.0f))
+                chunk->step[k] = 1.0f;
+            chunk->low[k] = 32767;
+            chunk->high[k] = -32767;
+        }
+        // Accessor bounds must be exact, so quantize once here as well.
+        for (int el = chunk->firstElement; el < chunk->endElement; el++) {
+            const SceneElement* e = &sc->elements[el];
+            if (!GltfWritesElement(e))
+                continue;
+            for (int j = e->lineIndices.first; j < e->lineIndices.first + e->lineIndices.count; j++) {
+                const float* v = lines->vertices + (size_t)lines->indices[j] * 3;
+                for (int k = 0; k < 3; k++) {
+                    short q = GltfQuantize(chunk, v, k);
+                    chunk->low[k] = q < chunk->low[k] ? q : chunk->low[k];
+                    chunk->high[k] = q > chunk->high[k] ? q : chunk->high[k];
+                }
+            }
+        }
+        chunk->offset = ex->viewSize[GLTF_VIEW_LINE_POSITIONS];
+        ex->viewSize[GLTF_VIEW_LINE_POSITIONS] += chunk->vertexCount * 8;
+        if (chunk->color < 0) {
+            chunk->colorOffset = ex->viewSize[GLTF_VIEW_LINE_COLORS];
+            ex->viewSize[GLTF_VIEW_LINE_COLORS] += chunk->vertexCount * 4;
+            chunk->material = 0;
+        } else {
+            unsigned char rgb[3] = { chunk->color >> 16, chunk->color >> 8 & 255, chunk->color & 255 };
+            chunk->material = GltfMaterial(ex, rgb);
+        }
+        ex->stats.lineVertices += chunk->vertexCount;
+    }
+}
+
+void PutText(ByteWriter* w, const char* format, ...) {
+    char text[512];
+    va_list args;
+    va_start(args, format);
+    int length = vsnprintf(text, sizeof(text), format, args);
+    va_end(args);
+    PutBytes(w, text, length < (int)sizeof(text) ? (size_t)length : sizeof(text) - 1);
+}
+
+// Append an accessor; returns its index.
+int GltfAccessor(ByteWriter* w, int* count, int view, long long offset, int componentType, int normalized,
+                 long long items, const char* type) {
+    PutText(w, "%s{\"bufferView\":%d,\"byteOffset\":%lld,\"componentType\":%d,%s\"count\":%lld,\"type\":\"%s\"",
+            *count ? "," : "", view, offset, componentType, normalized ? "\"normalized\":true," : "", items, type);
+    return (*count)++;
+}
+
+// The JSON chunk, from the plan.
+void GltfWriteJson(GltfExport* ex, ByteWriter* json) {
+    static const char* viewNames[GLTF_VIEW_COUNT] = {
+        "mesh positions", "mesh indices", "instance translations", "instance rotations", "instance scales",
+        "line positions", "line colors"
+    };
+    static const int viewStrides[GLTF_VIEW_COUNT] = { 12, 0, 12, 4, 12, 8, 4 };
+    ByteWriter nodes = {0}, meshes = {0}, accessors = {0};
+    int view[GLTF_VIEW_COUNT], viewCount = 0, accessorCount = 0, meshCount = 0;
+    int positions[GLTF_MAX_GROUPS], indices[MESH_KIND_COUNT];
+    long long viewOffset = 0;
+    for (int v = 0; v < GLTF_VIEW_COUNT; v++) {
+        view[v] = ex->viewSize[v] > 0 ? viewCount++ : -1;
+        ex->viewOffset[v] = viewOffset;
+        viewOffset += ex->viewSize[v];
+    }
+    ex->binarySize = viewOffset;
+    for (int shape = 0; shape < MESH_KIND_COUNT; shape++)
+        indices[shape] = -1;
+
+    for (int i = 0; i < ex->groupCount; i++) {
+        const GltfGroup* g = &ex->groups[i];
+        const Mesh* mesh = &meshCache[g->shape][0];
+        if (g->variant == i) {
+            float low[3] = { FLT_MAX, FLT_MAX, FLT_MAX }, high[3] = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+            for (int v = 0; v < mesh->vertexCount; v++) {
+                for (int k = 0; k < 3; k++) {
+                    float x = mesh->vertices[v * 3 + k] * (g->scale[k] / GLTF_SCALE_STEP);
+                    low[k] = x < low[k] ? x : low[k];
+                    high[k] = x > high[k] ? x : high[k];
+                }
+            }
+            positions[i] = GltfAccessor(&accessors, &accessorCount, view[GLTF_VIEW_MESH_POSITIONS],
+                                        g->offset[GLTF_VIEW_MESH_POSITIONS], 5126, 0, mesh->vertexCount, "VEC3");
+            PutText(&accessors, ",\"min\":[%.9g,%.9g,%.9g],\"max\":[%.9g,%.9g,%.9g]}", low[0], low[1], low[2],
+                    high[0], high[1], high[2]);
+        } else {
+            positions[i] = positions[g->variant];
+        }
+        if (indices[g->shape] < 0) {
+            indices[g->shape] = GltfAccessor(&accessors, &accessorCount, view[GLTF_VIEW_MESH_INDICES],
+                                             g->offset[GLTF_VIEW_MESH_INDICES], 5123, 0, mesh->indexCount, "SCALAR");
+            PutText(&accessors, "}");
+        }
+        PutText(&meshes, "%s{\"primitives\":[{\"attributes\":{\"POSITION\":%d},\"indices\":%d,\"material\":%d}]}",
+                meshCount ? "," : "", positions[i], indices[g->shape], g->material);
+        int translation = GltfAccessor(&accessors, &accessorCount, view[GLTF_VIEW_TRANSLATIONS],
+                                       g->offset[GLTF_VIEW_TRANSLATIONS], 5126, 0, g->count, "VEC3");
+        PutText(&accessors, "}");
+        PutText(&nodes, "%s{\"mesh\":%d,\"extensions\":{\"EXT_mesh_gpu_instancing\":{\"attributes\":{\"TRANSLATION\":%d",
+                i ? "," : "", meshCount++, translation);
+        if (g->shape == MESH_CONE) {
+            int rotation = GltfAccessor(&accessors, &accessorCount, view[GLTF_VIEW_ROTATIONS],
+                                        g->offset[GLTF_VIEW_ROTATIONS], 5120, 1, g->count, "VEC4");
+            PutText(&accessors, "}");
+            PutText(&nodes, ",\"ROTATION\":%d", rotation);
+        }
+        if (g->overflow) {
+            int scale = GltfAccessor(&accessors, &accessorCount, view[GLTF_VIEW_SCALES],
+                                     g->offset[GLTF_VIEW_SCALES], 5126, 0, g->count, "VEC3");
+            PutText(&accessors, "}");
+            PutText(&nodes, ",\"SCALE\":%d", scale);
+        }
+        PutText(&nodes, "}}}}");
+    }
+    for (int i = 0; i < ex->chunkCount; i++) {
+        const GltfChunk* chunk = &ex->chunks[i];
+        int position = GltfAccessor(&accessors, &accessorCount, view[GLTF_VIEW_LINE_POSITIONS], chunk->offset, 5122,
+                                    0, chunk->vertexCount, "VEC3");
+        PutText(&accessors, ",\"min\":[%d,%d,%d],\"max\":[%d,%d,%d]}", chunk->low[0], chunk->low[1], chunk->low[2],
+                chunk->high[0], chunk->high[1], chunk->high[2]);
+        PutText(&meshes, "%s{\"primitives\":[{\"attributes\":{\"POSITION\":%d", meshCount ? "," : "", position);
+        if (chunk->color < 0) {
+            int color = GltfAccessor(&accessors, &accessorCount, view[GLTF_VIEW_LINE_COLORS], chunk->colorOffset,
+                                     5121, 1, chunk->vertexCount, "VEC4");
+            PutText(&accessors, "}");
+            PutText(&meshes, ",\"COLOR_0\":%d", color);
+        }
+        PutText(&meshes, "},\"mode\":1,\"material\":%d}]}", chunk->material);
+        PutText(&nodes, "%s{\"mesh\":%d,\"translation\":[%.9g,%.9g,%.9g],\"scale\":[%.9g,%.9g,%.9g]}",
+                ex->groupCount + i ? "," : "", meshCount++, chunk->center[0], chunk->center[1], chunk->center[2],
+                chunk->step[0], chunk->step[1], chunk->step[2]);
+    }
+
+    int nodeCount = ex->groupCount + ex->chunkCount;
+    PutText(json, "{\"asset\":{\"version\":\"2.0\",\"generator\":\"deep3d\"},");
+    PutText(json, "\"extensionsUsed\":[\"EXT_mesh_gpu_instancing\"%s],",
+            ex->chunkCount ? ",\"KHR_mesh_quantization\"" : "");
+    if (ex->chunkCount)
+        PutText(json, "\"extensionsRequired\":[\"KHR_mesh_quantization\"],");
+    PutText(json, "\"scene\":0,\"scenes\":[{\"nodes\":[");
+    for (int i = 0; i < nodeCount; i++)
+        PutText(json, i ? ",%d" : "%d", i);
+    PutText(json, "]}],\"nodes\":[");
+    PutBytes(json, nodes.data, nodes.size);
+    PutText(json, "],\"meshes\":[");
+    PutBytes(json, meshes.data, meshes.size);
+    PutText(json, "],\"materials\":[");
+    for (int i = 0; i < ex->materialCount; i++) {
+        const unsigned char* c = ex->materials[i];
+        PutText(json, "%s{\"pbrMetallicRoughness\":{\"baseColorFactor\":[%.6g,%.6g,%.6g,1],\"metallicFactor\":0,"
+                "\"roughnessFactor\":1},\"doubleSided\":true}", i ? "," : "", GltfLinear(c[0]), GltfLinear(c[1]),
+                GltfLinear(c[2]));
+    }
+    PutText(json, "],\"accessors\":[");
+    PutBytes(json, accessors.data, accessors.size);
+    PutText(json, "],\"bufferViews\":[");
+    for (int v = 0; v < GLTF_VIEW_COUNT; v++) {
+        if (view[v] < 0)
+            continue;
+        PutText(json, "%s{\"buffer\":0,\"byteOffset\":%lld,\"byteLength\":%lld", view[v] ? "," : "", ex->viewOffset[v],
+                ex->viewSize[v]);
+        if (viewStrides[v])
+            PutText(json, ",\"byteStride\":%d,\"target\":34962", viewStrides[v]);
+        else
+            PutText(json, ",\"target\":34963");
+        PutText(json, ",\"name\":\"%s\"}", viewNames[v]);
+    }
+    PutText(json, "],\"buffers\":[{\"byteLength\":%lld}]}", ex->binarySize);
+    while (json->size % 4)
+        PutByte(json, ' ');
+    free(nodes.data);
+    free(meshes.data);
+    free(accessors.data);
+    ex->stats.groups = ex->groupCount;
+    ex->stats.chunks = ex->chunkCount;
+    ex->stats.materials = ex->materialCount;
+}
+
+void GltfFlush(GltfExport* ex) {
+    if (ex->used && fwrite(ex->buffer, 1, ex->used, ex->file) != ex->used)
+        ex->failed = 1;
+    ex->used = 0;
+}
+
+void GltfWrite(GltfExport* ex, const void* data, size_t size) {
+    if (ex->used + size > sizeof(ex->buffer))
+        GltfFlush(ex);
+    if (size > sizeof(ex->buffer)) {
+        if (fwrite(data, 1, size, ex->file) != size)
+            ex->failed = 1;
+        return;
+    }
+    memcpy(ex->buffer + ex->used, data, size);
+    ex->used += size;
+}
+
+// Second pass: the binary chunk, view by view in the order GltfPlan laid out.
+void GltfWriteBinary(GltfExport* ex) {
+    const SceneCache* sc = ex->sc;
+    int indicesWritten[MESH_KIND_COUNT] = {0};
+    for (int i = 0; i < ex->groupCount; i++) {
+        const GltfGroup* g = &ex->groups[i];
+        const Mesh* mesh = &meshCache[g->shape][0];
+        for (int v = 0; v < mesh->vertexCount && g->variant == i; v++) {
+            float x[3];
+            for (int k = 0; k < 3; k++)
+                x[k] = mesh->vertices[v * 3 + k] * (g->scale[k] / GLTF_SCALE_STEP);
+            GltfWrite(ex, x, sizeof(x));
+        }
+    }
+    for (int i = 0; i < ex->groupCount; i++) {
+        const Mesh* mesh = &meshCache[ex->groups[i].shape][0];
+        if (indicesWritten[ex->groups[i].shape]++)
+            continue;
+        for (int k = 0; k < mesh->indexCount; k++) {
+            unsigned short index = (unsigned short)mesh->indices[k];
+            GltfWrite(ex, &index, sizeof(index));
+        }
+        if (mesh->indexCount % 2)
+            GltfWrite(ex, "\0\0", 2);
+    }
+    for (int view = GLTF_VIEW_TRANSLATIONS; view <= GLTF_VIEW_SCALES; view++) {
+        for (int i = 0; i < ex->groupCount; i++) {
+            const GltfGroup* g = &ex->groups[i];
+            if ((view == GLTF_VIEW_ROTATIONS && g->shape != MESH_CONE) || (view == GLTF_VIEW_SCALES && !g->overflow))
+                continue;
+            for (long long m = g->start; m < g->start + g->count; m++) {
+                GltfInstance inst;
+                GltfInstanceAt(sc, g->shape, ex->order[g->shape][m], &inst);
+                if (view == GLTF_VIEW_TRANSLATIONS) {
+                    GltfWrite(ex, inst.translation, 12);
+                } else if (view == GLTF_VIEW_ROTATIONS) {
+                    signed char q[4];
+                    for (int k = 0; k < 4; k++)
+                        q[k] = (signed char)lrintf(inst.rotation[k] * 127.0f);
+                    GltfWrite(ex, q, 4);
+                } else {
+                    GltfWrite(ex, inst.scale, 12);
+                }
+            }
+        }
+    }
+    const GeometryBuffer* lines = &sc->lines;
+    for (int pass = 0; pass < 2; pass++) {
+        for (int i = 0; i < ex->chunkCount; i++) {
+            const GltfChunk* chunk = &ex->chunks[i];
+            if (pass == 1 && chunk->color >= 0)
+                continue;
+            for (int el = chunk->firstElement; el < chunk->endElement; el++) {
+                const SceneElement* e = &sc->elements[el];
+                if (!GltfWritesElement(e))
+                    continue;
+                for (int j = e->lineIndices.first; j < e->lineIndices.first + e->lineIndices.count; j++) {
+                    size_t v = lines->indices[j];
+                    if (pass == 0) {
+                        short q[4] = { GltfQuantize(chunk, lines->vertices + v * 3, 0),
+                                       GltfQuantize(chunk, lines->vertices + v * 3, 1),
+                                       GltfQuantize(chunk, lines->vertices + v * 3, 2), 0 };
+                        GltfWrite(ex, q, sizeof(q));
+                    } else {
+                        unsigned char c[4] = { 0, 0, 0, 255 };
+                        for (int k = 0; k < 3; k++)
+                            c[k] = GltfColorByte(GltfLinear(GltfColorByte(lines->colors[v * 3 + k])));
+                        GltfWrite(ex, c, 4);
+                    }
+                }
+            }
+        }
+    }
+}
+
+void PutLittle32(unsigned char* out, unsigned int value) {
+    out[0] = (unsigned char)value;
+    out[1] = (unsigned char)(value >> 8);
+    out[2] = (unsigned char)(value >> 16);
+    out[3] = (unsigned char)(value >> 24);
+}
+
+unsigned int ReadLittle32(const unsigned char* in) {
+    return in[0] | (unsigned int)in[1] << 8 | (unsigned int)in[2] << 16 | (unsigned int)in[3] << 24;
+}
+
+// Write the finest level of sc to path as binary glTF. Returns 0 when the
+// file cannot be written or would pass the format's 4 GB limit.
+int WriteGltfScene(const SceneCache* sc, const char* path, GltfStats* stats) {
+    GltfExport* ex = calloc(1, sizeof(GltfExport));
+    ByteWriter json = {0};
+    if (!ex) {
+        printf("Error: Out of memory exporting glTF.\n");
+        exit(EXIT_FAILURE);
+    }
+    ex->sc = sc;
+    GltfPlan(ex);
+    GltfWriteJson(ex, &json);
+    long long total = 12 + 8 + (long long)json.size + 8 + ex->binarySize;
+    int ok = total <= 0xFFFFFFFFLL;
+    if (!ok)
+        printf("Error: '%s' would take %.1f GB, more than binary glTF allows.\n", path, total / 1e9);
+    ex->file = ok ? fopen(path, "wb") : NULL;
+    if (ok && !ex->file) {
+        printf("Error: Cannot write '%s'.\n", path);
+        ok = 0;
+    }
+    if (ok) {
+        unsigned char header[20];
+        memcpy(header, "glTF", 4);
+        PutLittle32(header + 4, 2);
+        PutLittle32(header + 8, (unsigned int)total);
+        PutLittle32(header + 12, (unsigned int)json.size);
+        memcpy(header + 16, "JSON", 4);
+        GltfWrite(ex, header, sizeof(header));
+        GltfWrite(ex, json.data, json.size);
+        PutLittle32(header, (unsigned int)ex->binarySize);
+        memcpy(header + 4, "BIN\0", 4);
+        GltfWrite(ex, header, 8);
+        GltfWriteBinary(ex);
+        GltfFlush(ex);
+        ok = fclose(ex->file) == 0 && !ex->failed;
+        if (!ok) {
+            printf("Error: Cannot write '%s'.\n", path);
+            remove(path);
+        }
+    }
+    if (stats) {
+        *stats = ex->stats;
+        stats->jsonBytes = (long long)json.size;
+        stats->binaryBytes = ex->binarySize;
+        stats->fileBytes = total;
+        for (int shape = 0; shape < MESH_KIND_COUNT; shape++) {
+            const Mesh* mesh = &meshCache[shape][0];
+            stats->meshBytes += stats->instances[shape] * (mesh->vertexCount * 12LL + mesh->indexCount * 4LL);
+        }
+        stats->meshBytes += stats->lineVertices * 12;
+    }
+    for (int shape = 0; shape < MESH_KIND_COUNT; shape++) {
+        free(ex->slots[shape]);
+        free(ex->order[shape]);
+    }
+    free(ex->chunks);
+    free(ex->materials);
+    free(json.data);
+    free(ex);
+    return ok;
+}
+
+//-------------------------
+// Headless Export
+//-------------------------
+
+void PrintExportUsage(void) {
+    printf("Usage: deep3d --export [options] model...\n");
+    printf("  model              .txt spec, .onnx file, or alexnet/vgg16/resnet18\n");
+    printf("  --camera RX,RY[,Z] Rotation in degrees and zoom; repeat for several views\n");
+    printf("  --size WxH         Image size (default 800x600)\n");
+    printf("  --format png|ppm|glb  Image format (default png), or glb for the scene as binary glTF\n");
+    printf("  --out DIR          Output directory (default .)\n");
+    printf("  --jobs N           Worker threads (default: one per core)\n");
+    printf("  --list FILE        Read further models from FILE, one per line\n");
+    printf("  --profile FILE     Write per-stage timings: Chrome trace (.json) or summary (.csv)\n");
+    printf("  --cost macs|params|memory  Heat-map layers by that cost and print the totals on the image\n");
+    printf("  --live NAME        Color layers by the newest frame of an activation stream\n");
+    printf("  --weights FILE     Color layers, neurons and edges by trained weights (.npy or .safetensors); repeatable\n");
+    printf("  --weight-view mean|max|norm  Weight statistic shown (default mean)\n");
+    printf("  --scene-cache DIR|off  Where built scenes are kept for the next load (default: the user's cache folder)\n");
+    printf("Usage: deep3d --bench-raster [--frames N] [--jobs N] [--profile FILE] [model]\n");
+    printf("Usage: deep3d --bench [options] [model...]\n");
+    printf("  model              As above, or synth:LAYERS[xWIDTH][:chain|residual|dense|inception]\n");
+    printf("  --frames N         Frames per camera path (default 120)\n");
+    printf("  --jobs N           Tile threads (default 1, for comparable timings)\n");
+    printf("  --size WxH         Image size (default 800x600)\n");
+    printf("  --out FILE         Write results as CSV\n");
+    printf("  --baseline FILE    Fail when results regress against an earlier --out file\n");
+    printf("  --threshold PCT    Allowed regression in percent (default 10)\n");
+    printf("Usage: deep3d --bench-edit [--edits N] [model]\n");
+    printf("Usage: deep3d --costs model...  Print inferred shapes, parameters, MACs and activation memory\n");
+    printf("Usage: deep3d --stream-demo [--name NAME] [--bins N] [--rate HZ] [--seconds S] [model]\n");
+    printf("Usage: deep3d --bench-stream [--bins N] [--seconds S] [--min-rate N] [model]\n");
+    printf("Usage: deep3d --weight-stats file...  Summarize weight files and report throughput and memory\n");
+    printf("Usage: deep3d --bench-timeline DIR [--cache MB] [--seconds S] [--sweep S] [--max-frame-ms MS] [model]\n");
+    printf("Usage: deep3d --bench-pick [--picks N] [--max-pick-ms MS] [model]\n");
+    printf("Usage: deep3d --bench-input [--max-latency-ms MS] [model]\n");
+    printf("Usage: deep3d --bench-build [--runs N] [--jobs N] [model]\n");
+    printf("Usage: deep3d --bench-cache [--runs N] [--scene-cache DIR] [model]\n");
+    printf("Usage: deep3d --bench-gltf [--out FILE] [--max-seconds S] [--max-mb MB] [model]\n");
+    printf("Usage: deep3d --serve [options]  Render models on request at http://127.0.0.1:PORT/render?model=ID\n");
+    printf("  --port N           Port to listen on (default %d)\n", SERVE_PORT);
+    printf("  --jobs N           Render workers (default: one per core)\n");
+    printf("  --cache MB         Memory for loaded models (default %d)\n", SERVE_CACHE_MB);
+    printf("  --models DIR       Folder of model files; ids other than built-ins and synth: specs are files in it\n");
+    printf("  --seconds S        Stop after S seconds (default: run until interrupted)\n");
+    printf("  --cost, --scene-cache  As for --export\n");
+    printf("Usage: deep3d --bench-serve [--clients N] [--requests N] [--jobs N] [--size WxH] [--min-rate N] [model...]\n");
+}
+
+int ParseCostView(const char* name, CostView* view) {
+    static const char* names[COST_VIEW_COUNT] = { "off", "macs", "params", "memory" };
+    for (int v = 0; v < COST_VIEW_COUNT; v++) {
+        if (_stricmp(name, names[v]) == 0) {
+            *view = (CostView)v;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// deep3d --costs: every layer's op, inferred output shape and costs, then the
+// totals and the layers that dominate compute and memory.
+int RunCostReport(int argc, char** argv) {
+    int failures = 0;
+    if (argc < 3) {
+        PrintExportUsage();
+        return EXIT_FAILURE;
+    }
+    for (int m = 2; m < argc; m++) {
+        NetworkGraph net = {0};
+        if (!LoadModelSpec(&net, argv[m])) {
+            failures++;
+            continue;
+        }
+        printf("%s: %d layers\n", argv[m], net.layerCount);
+        printf("  %-24s %-11s %-16s %12s %12s %12s\n", "layer", "op", "output", "params", "MACs", "activations");
+        for (int v = 0; v < net.layerCount; v++) {
+            const LayerCost* c = &net.cost[v];
+            char shape[48], params[32], macs[32], bytes[32];
+            FormatShape(&c->out, shape, sizeof(shape));
+            FormatQuantity((double)c->params, "", params, sizeof(params));
+            FormatQuantity((double)c->macs, "", macs, sizeof(macs));
+            FormatQuantity((double)c->activationBytes, "B", bytes, sizeof(bytes));
+            printf("  %-24.24s %-11s %-16s %12s %12s %12s\n",
+                   net.label[v], OpKindName(net.op[v].kind), shape, params, macs, bytes);
+        }
+        for (CostView view = COST_VIEW_MACS; view < COST_VIEW_COUNT; view++) {
+            char summary[2048];
+            FormatCostSummary(&net, view, 5, summary, sizeof(summary));
+            // The totals head every summary; print them once.
+            printf("%s\n", view == COST_VIEW_MACS ? summary : strstr(summary, "\nTop") ? strstr(summary, "\nTop") + 1 : "");
+        }
+        printf("  exact: %lld params, %lld MACs, %lld activation bytes\n\n",
+               net.totalParams, net.totalMacs, net.totalActivationBytes);
+        ArenaRelease(&net.arena);
+    }
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+// deep3d --weight-stats: summarize weight files as the viewer would and list
+// every tensor's statistics, then how fast the pass ran and how much memory
+// it needed. Resident memory after the pass is what a viewer keeps.
+int RunWeightStats(int argc, char** argv) {
+    WeightSet set = {0};
+    int failures = 0;
+    if (argc < 3) {
+        PrintExportUsage();
+        return EXIT_FAILURE;
+    }
+    for (int f = 2; f < argc; f++)
+        failures += !LoadWeightFile(&set, argv[f]);
+    printf("  %-40s %-5s %-22s %12s %12s %12s\n", "tensor", "dtype", "shape", "mean |w|", "max |w|", "L2 norm");
+    for (int t = 0; t < set.count; t++) {
+        const WeightSummary* w = &set.tensors[t];
+        char shape[64];
+        int used = snprintf(shape, sizeof(shape), w->rank ? "" : "scalar");
+        for (int d = 0; d < w->rank && used < (int)sizeof(shape); d++)
+            used += snprintf(shape + used, sizeof(shape) - used, d ? "x%lld" : "%lld", w->dims[d]);
+        printf("  %-40.40s %-5s %-22.22s %12.5g %12.5g %12.5g\n", w->name, WeightDtypeName(w->dtype), shape,
+               WeightStatValue(&w->total, WEIGHT_VIEW_MEAN), WeightStatValue(&w->total, WEIGHT_VIEW_MAX),
+               WeightStatValue(&w->total, WEIGHT_VIEW_NORM));
+    }
+    printf("%d tensors, %.2f GB summarized in %.2f s (%.2f GB/s) on %d threads\n", set.count,
+           set.summarizedBytes / 1e9, set.summarizeSeconds,
+           set.summarizeSeconds > 0.0 ? set.summarizedBytes / set.summarizeSeconds / 1e9 : 0.0, CpuCount());
+    printf("Summaries %.1f KB; peak resident %.1f MB, resident after %.1f MB\n", set.arena.reservedBytes / 1024.0,
+           PeakMemoryBytes() / (1024.0 * 1024.0), ResidentMemoryBytes() / (1024.0 * 1024.0));
+    ReleaseWeights(&set);
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+// Commands that run to completion without opening a window. Returns 0 when
+// argv does not name one.
+int RunBatchCommand(int argc, char** argv, int* exitCode) {
+    if (argc < 2)
+        return 0;
+    if (strcmp(argv[1], "--export") == 0)
+        *exitCode = RunExport(argc, argv);
+    else if (strcmp(argv[1], "--bench-raster") == 0)
+        *exitCode = RunRasterBenchmark(argc, argv);
+    else if (strcmp(argv[1], "--bench") == 0)
+        *exitCode = RunBenchmarkSuite(argc, argv);
+    else if (strcmp(argv[1], "--bench-edit") == 0)
+        *exitCode = RunEditBenchmark(argc, argv);
+    else if (strcmp(argv[1], "--costs") == 0)
+        *exitCode = RunCostReport(argc, argv);
+    else if (strcmp(argv[1], "--stream-demo") == 0)
+        *exitCode = RunStreamDemo(argc, argv);
+    else if (strcmp(argv[1], "--bench-stream") == 0)
+        *exitCode = RunStreamBenchmark(argc, argv);
+    else if (strcmp(argv[1], "--weight-stats") == 0)
+        *exitCode = RunWeightStats(argc, argv);
+    else if (strcmp(argv[1], "--bench-timeline") == 0)
+        *exitCode = RunTimelineBenchmark(argc, argv);
+    else if (strcmp(argv[1], "--bench-pick") == 0)
+        *exitCode = RunPickBenchmark(argc, argv);
+    else if (strcmp(argv[1], "--bench-input") == 0)
+        *exitCode = RunInputBenchmark(argc, argv);
+    else if (strcmp(argv[1], "--bench-build") == 0)
+        *exitCode = RunBuildBenchmark(argc, argv);
+    else if (strcmp(argv[1], "--bench-cache") == 0)
+        *exitCode = RunCacheBenchmark(argc, argv);
+    else if (strcmp(argv[1], "--bench-gltf") == 0)
+        *exitCode = RunGltfBenchmark(argc, argv);
+    else if (strcmp(argv[1], "--serve") == 0)
+        *exitCode = RunServer(argc, argv);
+    else if (strcmp(argv[1], "--bench-serve") == 0)
+        *exitCode = RunServeBenchmark(argc, argv);
+    else
+        return 0;
+    return 1;
+}
+
+// A built-in network name, a synthetic network spec or a model file path.
+int LoadModelSpec(NetworkGraph* net, const char* spec) {
+    double profileStart = ProfileStart();
+    int ok = 1;
+    ResetNetwork(net);
+    if (_stricmp(spec, "alexnet") == 0)
+        SetupAlexNet(net);
+    else if (_stricmp(spec, "vgg16") == 0)
+        SetupVGG16(net);
+    else if (_stricmp(spec, "resnet18") == 0)
+        SetupResNet18(net);
+    else if (strncmp(spec, "synth:", 6) == 0) {
+        ok = SetupSyntheticNetwork(net, spec);
+        if (!ok)
+            printf("Error: Bad synthetic network '%s', expected synth:LAYERS[xWIDTH][:chain|residual|dense|inception].\n", spec);
+    } else
+        ok = LoadModelFile(net, spec);
+    if (ok) {
+        InferLayerCosts(net);
+        LayoutNetwork(net);
+    }
+    ProfileEnd(PROF_SETUP, profileStart);
+    return ok;
+}
+
+// File name without directory or extension, used to name the images.
+// Characters Windows does not allow in file names become '_'.
+void ModelStem(const char* spec, char* stem, size_t size) {
+    const char* start = spec;
+    for (const char* p = spec; *p; p++) {
+        if (*p == '/' || *p == '\\')
+            start = p + 1;
+    }
+    const char* end = strrchr(start, '.');
+    size_t len = end && end != start ? (size_t)(end - start) : strlen(start);
+    if (len >= size)
+        len = size - 1;
+    for (size_t i = 0; i < len; i++) {
+        unsigned char c = (unsigned char)start[i];
+        stem[i] = c < 32 || strchr(":*?\"<>|", c) ? '_' : (char)c;
+    }
+    stem[len] = '\0';
+}
+
+// Output name of each model: its stem, with _2, _3, ... appended when an
+// earlier model already took the name. Names are compared ignoring case, as
+// the Windows file system does, so a/model.txt and b/Model.onnx do not
+// overwrite each other's images.
+char** UniqueStems(const char** models, int count, Arena* arena) {
+    NameMap taken = { NULL, 0, 0, arena };
+    char** stems = ArenaAlloc(arena, count * sizeof(char*));
+    for (int i = 0; i < count; i++) {
+        char stem[256], name[272];
+        ModelStem(models[i], stem, sizeof(stem));
+        snprintf(name, sizeof(name), "%s", stem);
+        for (int suffix = 2;; suffix++) {
+            int len = (int)strlen(name);
+            char* key = ArenaAlloc(arena, len + 1);
+            for (int c = 0; c <= len; c++)
+                key[c] = name[c] >= 'A' && name[c] <= 'Z' ? (char)(name[c] - 'A' + 'a') : name[c];
+            if (NameMapGet(&taken, key, len) < 0) {
+                NameMapPut(&taken, key, len, i);
+                break;
+            }
+            snprintf(name, sizeof(name), "%s_%d", stem, suffix);
+        }
+        stems[i] = ArenaAlloc(arena, strlen(name) + 1);
+        strcpy(stems[i], name);
+    }
+    return stems;
+}
+
+// Each worker owns its graph, scene and framebuffer and claims whole models,
+// so the only shared state is the job counters and the read-only mesh cache.
+void ExportWorker(void* arg) {
+    ExportJob* job = arg;
+    NetworkGraph net = {0};
+    SceneCache sc = {0};
+    LiveActivations live = {0};
+    Framebuffer fb;
+    Rasterizer r;
+    if (job->liveName)
+        AttachLiveActivations(&live, job->liveName);
+    if (!InitFramebuffer(&fb, job->width, job->height)) {
+        printf("Error: Out of memory allocating a %dx%d framebuffer.\n", job->width, job->height);
+        AtomicIncrement(&job->failures);
+        return;
+    }
+    InitRasterizer(&r, job->tileThreads);
+    for (;;) {
+        long index = AtomicIncrement(&job->nextModel) - 1;
+        if (index >= job->modelCount)
+            break;
+        const char* spec = job->models[index];
+        if (!LoadModelScene(&net, &sc, &r.labels, &embeddedAtlas, spec, job->weights->count ? job->weights : NULL)) {
+            AtomicIncrement(&job->failures);
+            continue;
+        }
+        ApplyLiveActivations(&sc, &net, &live);
+
+        const char* stem = job->stems[index];
+        char path[1024];
+        if (job->gltf) {
+            GltfStats stats;
+            double start = NowSeconds();
+            snprintf(path, sizeof(path), "%s/%s.glb", job->outDir, stem);
+            if (!WriteGltfScene(&sc, path, &stats)) {
+                AtomicIncrement(&job->failures);
+                continue;
+            }
+            printf("Wrote %s: %lld instances in %d nodes, %lld shafts in %d chunks, %.0f KB in %.2f s\n", path,
+                   stats.instances[MESH_SPHERE] + stats.instances[MESH_CONE] + stats.instances[MESH_BOX],
+                   stats.groups, stats.lineVertices / 2, stats.chunks, stats.fileBytes / 1024.0,
+                   NowSeconds() - start);
+            continue;
+        }
+        for (int c = 0; c < job->cameraCount; c++) {
+            double frameStart = ProfileStart();
+            ResetLayerLod(&r.visible);
+            RasterScene(&r, &fb, &sc, &net, &job->cameras[c]);
+            if (costView != COST_VIEW_OFF) {
+                char summary[1024];
+                FormatCostSummary(&net, costView, 5, summary, sizeof(summary));
+                RasterScreenText(&fb, &embeddedAtlas, summary, 8, 8);
+            }
+            const char* ext = job->png ? "png" : "ppm";
+            if (job->cameraCount > 1)
+                snprintf(path, sizeof(path), "%s/%s_%d.%s", job->outDir, stem, c, ext);
+            else
+                snprintf(path, sizeof(path), "%s/%s.%s", job->outDir, stem, ext);
+            double writeStart = ProfileStart();
+            int ok = job->png ? WritePNG(&fb, path) : WritePPM(&fb, path);
+            ProfileEnd(PROF_IMAGE_WRITE, writeStart);
+            ProfileEnd(PROF_FRAME, frameStart);
+            ProfileFrameEnd();
+            if (!ok) {
+                printf("Error: Cannot write image '%s'.\n", path);
+                AtomicIncrement(&job->failures);
+            }
+        }
+    }
+    ReleaseRasterizer(&r);
+    ReleaseFramebuffer(&fb);
+    ReleaseScene(&sc);
+    DetachLiveActivations(&live);
+    ArenaRelease(&net.arena);
+}
+
+// deep3d --export: render every model from every camera preset into image
+// files, spreading models across worker threads. Returns the process exit code.
+int RunExport(int argc, char** argv) {
+    ExportJob job = {0};
+    WeightSet weights = {0};
+    job.width = 800;
+    job.height = 600;
+    job.png = 1;
+    job.outDir = ".";
+    const char* profilePath = NULL;
+    int threadCount = CpuCount();
+    int modelCapacity = argc;
+    const char** models = malloc(modelCapacity * sizeof(char*));
+    Camera* cameras = malloc(argc * sizeof(Camera));
+    char** listed = NULL;   // Lines read from --list files, owned here
+    int listedCount = 0;
+    if (!models || !cameras) {
+        printf("Error: Out of memory parsing arguments.\n");
+        return EXIT_FAILURE;
+    }
+
+    for (int i = 2; i < argc; i++) {
+        const char* opt = argv[i];
+        const char* value = i + 1 < argc ? argv[i + 1] : NULL;
+        if (strncmp(opt, "--", 2) != 0) {
+            models[job.modelCount++] = opt;
+            continue;
+        }
+        if (!value) {
+            printf("Error: Missing value for %s.\n", opt);
+            return EXIT_FAILURE;
+        }
+        i++;
+        if (strcmp(opt, "--camera") == 0) {
+            Camera* cam = &cameras[job.cameraCount];
+            cam->zoom = 1.0f;
+            if (sscanf(value, "%f,%f,%f", &cam->rotX, &cam->rotY, &cam->zoom) < 2 || cam->zoom <= 0.0f) {
+                printf("Error: Bad camera '%s', expected RX,RY or RX,RY,ZOOM.\n", value);
+                return EXIT_FAILURE;
+            }
+            job.cameraCount++;
+        } else if (strcmp(opt, "--size") == 0) {
+            if (sscanf(value, "%dx%d", &job.width, &job.height) != 2 || job.width <= 0 || job.height <= 0) {
+                printf("Error: Bad size '%s', expected WxH.\n", value);
+                return EXIT_FAILURE;
+            }
+        } else if (strcmp(opt, "--format") == 0) {
+            if (_stricmp(value, "png") == 0)
+                job.png = 1;
+            else if (_stricmp(value, "ppm") == 0)
+                job.png = 0;
+            else if (_stricmp(value, "glb") == 0)
+                job.gltf = 1;
+            else {
+                printf("Error: Unknown image format '%s'.\n", value);
+                return EXIT_FAILURE;
+            }
+        } else if (strcmp(opt, "--out") == 0) {
+            job.outDir = value;
+        } else if (strcmp(opt, "--profile") == 0) {
+            profilePath = value;
+        } else if (strcmp(opt, "--cost") == 0) {
+            if (!ParseCostView(value, &costView)) {
+                printf("Error: Unknown cost '%s', expected macs, params or memory.\n", value);
+                return EXIT_FAILURE;
+            }
+        } else if (strcmp(opt, "--live") == 0) {
+            LiveActivations probe = {0};
+            if (!AttachLiveActivations(&probe, value)) {
+                printf("Error: No activation stream '%s'.\n", value);
+                return EXIT_FAILURE;
+            }
+            DetachLiveActivations(&probe);
+            job.liveName = value;
+        } else if (strcmp(opt, "--weights") == 0) {
+            if (!LoadWeightFile(&weights, value))
+                return EXIT_FAILURE;
+        } else if (strcmp(opt, "--weight-view") == 0) {
+            if (!ParseWeightView(value, &weightView)) {
+                printf("Error: Unknown weight view '%s', expected mean, max or norm.\n", value);
+                return EXIT_FAILURE;
+            }
+        } else if (strcmp(opt, "--jobs") == 0) {
+            threadCount = atoi(value);
+            if (threadCount < 1)
+                threadCount = 1;
+        } else if (strcmp(opt, "--scene-cache") == 0) {
+            SetSceneCacheOption(value);
+        } else if (strcmp(opt, "--list") == 0) {
+            FILE* list = fopen(value, "r");
+            char line[1024];
+            if (!list) {
+                printf("Error: Cannot open model list '%s'.\n", value);
+                return EXIT_FAILURE;
+            }
+            while (fgets(line, sizeof(line), list)) {
+                size_t len = strcspn(line, "\r\n");
+                line[len] = '\0';
+                if (len == 0 || line[0] == '#')
+                    continue;
+                if (job.modelCount == modelCapacity) {
+                    modelCapacity *= 2;
+                    models = realloc(models, modelCapacity * sizeof(char*));
+                }
+                listed = realloc(listed, (listedCount + 1) * sizeof(char*));
+                char* copy = malloc(len + 1);
+                if (!models || !listed || !copy) {
+                    printf("Error: Out of memory reading model list.\n");
+                    return EXIT_FAILURE;
+                }
+                memcpy(copy, line, len + 1);
+                listed[listedCount++] = copy;
+                models[job.modelCount++] = copy;
+            }
+            fclose(list);
+        } else {
+            printf("Error: Unknown option '%s'.\n", opt);
+            PrintExportUsage();
+            return EXIT_FAILURE;
+        }
+    }
+    if (job.modelCount == 0) {
+        PrintExportUsage();
+        return EXIT_FAILURE;
+    }
+    if (job.cameraCount == 0) {
+        cameras[0].rotX = cameras[0].rotY = 0.0f;
+        cameras[0].zoom = 1.0f;
+        job.cameraCount = 1;
+    }
+    Arena stemArena = {0};
+    job.models = models;
+    job.stems = UniqueStems(models, job.modelCount, &stemArena);
+    job.cameras = cameras;
+    job.weights = &weights;
+    if (weights.count && weightView == WEIGHT_VIEW_OFF)
+        weightView = WEIGHT_VIEW_MEAN;
+    int workerCount = threadCount < job.modelCount ? threadCount : job.modelCount;
+    job.tileThreads = threadCount / workerCount;
+
+    if (profilePath)
+        EnableProfiler(1);
+    double start = NowSeconds();
+    BuildMeshCache();
+    BuildEmbeddedAtlas(&embeddedAtlas);
+    Thread* threads = malloc(workerCount * sizeof(Thread));
+    int started = 0;
+    while (threads && started < workerCount - 1 && StartThread(&threads[started], ExportWorker, &job))
+        started++;
+    ExportWorker(&job);
+    for (int i = 0; i < started; i++)
+        JoinThread(threads[i]);
+    double elapsed = NowSeconds() - start;
+
+    int images = job.modelCount * job.cameraCount;
+    if (job.gltf)
+        printf("Exported %d models as glTF in %.2f s on %d workers, %ld failed.\n", job.modelCount, elapsed,
+               started + 1, job.failures);
+    else
+        printf("Exported %d models x %d cameras in %.2f s on %d workers x %d tile threads (%.1f images/s), %ld failed.\n",
+               job.modelCount, job.cameraCount, elapsed, started + 1, job.tileThreads,
+               elapsed > 0.0 ? images / elapsed : 0.0, job.failures);
+    ReleaseMeshCache();
+    ReleaseGlyphAtlas(&embeddedAtlas);
+    ReleaseWeights(&weights);
+    free(threads);
+    ArenaRelease(&stemArena);
+    for (int i = 0; i < listedCount; i++)
+        free(listed[i]);
+    free(listed);
+    free(models);
+    free(cameras);
+    if (profilePath && !WriteProfile(profilePath))
+        return EXIT_FAILURE;
+    return job.failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+//-------------------------
+// Render Server
+//-------------------------
+// deep3d --serve keeps models loaded and renders them on request over HTTP
+// on 127.0.0.1, so a preview costs one render rather than a process start, a
+// load and a scene build:
+//
+//   GET /render?model=ID[&camera=RX,RY[,ZOOM]][&size=WxH][&format=png|ppm]
+//   GET /stats
+//
+// The acceptor thread reads and parses requests into a queue, waiting on all
+// connections at once so a client that is slow to send its request holds up
+// no one else. A worker takes
+// the oldest one together with the others queued for the same model, renders
+// them back to back on its own rasterizer, and answers requests for the same
+// view with one image. A model is loaded, through the scene cache, by the
+// first request that names it. Loaded models stay until they no longer fit
+// in --cache MB, least recently used first out.
+
+void SetSocketTimeouts(Socket s, int ms) {
+#ifdef _WIN32
+    DWORD timeout = (DWORD)ms;
+#else
+    struct timeval timeout = { ms / 1000, (ms % 1000) * 1000 };
+#endif
+    int noDelay = 1;
+    setsockopt(s, SOL_SOCKET, SO_RCVTIMEO, (const char*)&timeout, sizeof(timeout));
+    setsockopt(s, SOL_SOCKET, SO_SNDTIMEO, (const char*)&timeout, sizeof(timeout));
+    // A response is sent as a header and a body; without this the body waits
+    // for the client's delayed ACK of the header.
+    setsockopt(s, IPPROTO_TCP, TCP_NODELAY, (const char*)&noDelay, sizeof(noDelay));
+}
+
+int SendAll(Socket s, const void* data, size_t size) {
+    const char* p = data;
+    while (size > 0) {
+        int chunk = size > (1 << 20) ? (1 << 20) : (int)size;
+        int sent = send(s, p, chunk, 0);
+        if (sent <= 0)
+            return 0;
+        p += sent;
+        size -= sent;
+    }
+    return 1;
+}
+
+const char* HttpStatusText(int status) {
+    switch (status) {
+        case 200: return "OK";
+        case 400: return "Bad Request";
+        case 404: return "Not Found";
+        case 405: return "Method Not Allowed";
+        case 503: return "Service Unavailable";
+        default:  return "Internal Server Error";
+    }
+}
+
+int SendHttpResponse(Socket s, int status, const char* type, const void* body, size_t size) {
+    char header[256];
+    int length = snprintf(header, sizeof(header),
+                          "HTTP/1.1 %d %s\r\nContent-Type: %s\r\nContent-Length: %zu\r\nConnection: close\r\n\r\n",
+                          status, HttpStatusText(status), type, size);
+    return SendAll(s, header, length) && SendAll(s, body, size);
+}
+
+void SendHttpError(Socket s, int status, const char* message) {
+    char body[400];
+    int length = snprintf(body, sizeof(body), "%s\n", message);
+    SendHttpResponse(s, status, "text/plain", body, length);
+}
+
+// Append what has arrived of a request's line and headers to buf, with one
+// recv, so call it once the socket is readable. Returns 1 when the headers
+// are complete, 0 when more is to come, and -1 when the client hung up or
+// overflowed buf.
+int ReadHttpRequest(Socket s, char* buf, int* used, int size) {
+    int got = recv(s, buf + *used, size - 1 - *used, 0);
+    if (got <= 0)
+        return -1;
+    *used += got;
+    buf[*used] = '\0';
+    if (strstr(buf, "\r\n\r\n") || strstr(buf, "\n\n"))
+        return 1;
+    return *used < size - 1 ? 0 : -1;
+}
+
+int HexDigit(char c) {
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F')
+        return c - 'A' + 10;
+    return -1;
+}
+
+// Copy the %-decoded value of name in an &-separated query into value.
+// Returns 0 when the query does not have it.
+int QueryValue(const char* query, const char* name, char* value, size_t size) {
+    size_t nameLength = strlen(name);
+    for (const char* p = query; p && *p; p = strchr(p, '&') ? strchr(p, '&') + 1 : NULL) {
+        if (strncmp(p, name, nameLength) != 0 || p[nameLength] != '=')
+            continue;
+        size_t used = 0;
+        for (const char* c = p + nameLength + 1; *c && *c != '&' && used + 1 < size; c++) {
+            if (*c == '%' && HexDigit(c[1]) >= 0 && HexDigit(c[2]) >= 0) {
+                value[used++] = (char)(HexDigit(c[1]) * 16 + HexDigit(c[2]));
+                c += 2;
+            } else {
+                value[used++] = *c == '+' ? ' ' : *c;
+            }
+        }
+        value[used] = '\0';
+        return 1;
+    }
+    return 0;
+}
+
+// The spec a model id loads: built-in names and synth: specs as they are,
+// anything else as a file in --models DIR. Ids that could reach outside that
+// folder are refused.
+int ResolveServedModel(const RenderServer* server, const char* id, char* spec, size_t size) {
+    if (_stricmp(id, "alexnet") == 0 || _stricmp(id, "vgg16") == 0 || _stricmp(id, "resnet18") == 0 ||
+        strncmp(id, "synth:", 6) == 0) {
+        snprintf(spec, size, "%s", id);
+        return 1;
+    }
+    if (!server->modelDir || !id[0] || id[0] == '.' || strpbrk(id, "/\\:"))
+        return 0;
+    int used = snprintf(spec, size, "%s/%s", server->modelDir, id);
+    return used > 0 && (size_t)used < size;
+}
+
+// Fill req from the target of a GET /render. Returns the HTTP status to
+// answer with, 200 when the request can be queued; message says why not.
+int ParseRenderRequest(const RenderServer* server, const char* target, RenderRequest* req, char* message,
+                       size_t size) {
+    const char* query = strchr(target, '?');
+    char value[300];
+    query = query ? query + 1 : "";
+    if (!QueryValue(query, "model", value, sizeof(value))) {
+        snprintf(message, size, "Missing model");
+        return 400;
+    }
+    int layers = 0, width = 0;
+    if (sscanf(value, "synth:%dx%d", &layers, &width) >= 1 &&
+        (layers > SERVE_MAX_SYNTH_LAYERS || width > SERVE_MAX_SYNTH_WIDTH)) {
+        snprintf(message, size, "Synthetic networks are limited to %d layers of %d neurons", SERVE_MAX_SYNTH_LAYERS,
+                 SERVE_MAX_SYNTH_WIDTH);
+        return 400;
+    }
+    if (!ResolveServedModel(server, value, req->spec, sizeof(req->spec))) {
+        snprintf(message, size, "Unknown model '%s'", value);
+        return 404;
+    }
+    req->camera.rotX = req->camera.rotY = 0.0f;
+    req->camera.zoom = 1.0f;
+    req->width = 320;
+    req->height = 240;
+    req->png = 1;
+    if (QueryValue(query, "camera", value, sizeof(value)) &&
+        (sscanf(value, "%f,%f,%f", &req->camera.rotX, &req->camera.rotY, &req->camera.zoom) < 2 ||
+         !(req->camera.zoom > 0.0f))) {
+        snprintf(message, size, "Bad camera '%s', expected RX,RY or RX,RY,ZOOM", value);
+        return 400;
+    }
+    if (QueryValue(query, "size", value, sizeof(value)) &&
+        (sscanf(value, "%dx%d", &req->width, &req->height) != 2 || req->width <= 0 || req->height <= 0 ||
+         req->width > SERVE_MAX_SIZE || req->height > SERVE_MAX_SIZE)) {
+        snprintf(message, size, "Bad size '%s', expected WxH up to %d", value, SERVE_MAX_SIZE);
+        return 400;
+    }
+    if (QueryValue(query, "format", value, sizeof(value))) {
+        if (_stricmp(value, "png") == 0)
+            req->png = 1;
+        else if (_stricmp(value, "ppm") == 0)
+            req->png = 0;
+        else {
+            snprintf(message, size, "Unknown image format '%s'", value);
+            return 400;
+        }
+    }
+    return 200;
+}
+
+// Requests served, rate, latency percentiles over the most recent requests,
+// and the model cache. Called with the lock held.
+void FormatServeStats(const RenderServer* server, char* text, size_t size) {
+    static double sorted[SERVE_LATENCY_SAMPLES];
+    int count = server->served < SERVE_LATENCY_SAMPLES ? (int)server->served : SERVE_LATENCY_SAMPLES;
+    memcpy(sorted, server->latency, count * sizeof(double));
+    qsort(sorted, count, sizeof(double), CompareDoubles);
+    double seconds = NowSeconds() - server->started;
+    snprintf(text, size,
+             "%lld requests (%lld failed, %lld turned away, %lld sharing an image) in %.1f s, %.1f/s; "
+             "latency %.1f ms p50, %.1f ms p95, %.1f ms p99, %.1f ms max over the last %d; "
+             "%d models cached in %.1f MB, %lld hits, %lld loads, %lld evicted; %.2f requests per batch",
+             server->served, server->failed, server->rejected, server->shared, seconds,
+             seconds > 0.0 ? server->served / seconds : 0.0, count ? Percentile(sorted, count, 50.0) : 0.0,
+             count ? Percentile(sorted, count, 95.0) : 0.0, count ? Percentile(sorted, count, 99.0) : 0.0,
+             count ? sorted[count - 1] : 0.0, count, server->modelCount, server->modelBytes / (1024.0 * 1024.0),
+             server->hits, server->misses, server->evictions,
+             server->batches ? (double)server->batched / server->batches : 0.0);
+}
+
+// Take the oldest request and up to SERVE_BATCH - 1 more queued for the same
+// model, as a list in arrival order. Called with the lock held.
+RenderRequest* TakeRequestBatch(RenderServer* server) {
+    const RenderRequest* first = server->queue;
+    RenderRequest* batch = NULL;
+    RenderRequest** batchTail = &batch;
+    RenderRequest** link = &server->queue;
+    int taken = 0;
+    server->queueTail = NULL;
+    while (*link) {
+        RenderRequest* req = *link;
+        if (taken < SERVE_BATCH && strcmp(req->spec, first->spec) == 0) {
+            *link = req->next;
+            *batchTail = req;
+            batchTail = &req->next;
+            taken++;
+        } else {
+            server->queueTail = req;
+            link = &req->next;
+        }
+    }
+    *batchTail = NULL;
+    server->queued -= taken;
+    return batch;
+}
+
+size_t ServedModelBytes(const ServedModel* model) {
+    const SceneCache* sc = &model->scene;
+    size_t bytes = sc->cacheFile.data ? sc->cacheFile.size : SceneMemory(sc);
+    bytes += model->net.arena.reservedBytes;
+    bytes += (size_t)model->labels.glyphCapacity * sizeof(LaidGlyph) + (size_t)model->labels.runCapacity * sizeof(LabelRun);
+    return bytes;
+}
+
+void UnlinkServedModel(RenderServer* server, ServedModel* model) {
+    ServedModel** link = &server->models;
+    while (*link != model)
+        link = &(*link)->next;
+    *link = model->next;
+    server->modelCount--;
+}
+
+// Free a list of unlinked models.
+void FreeServedModels(ServedModel* model) {
+    while (model) {
+        ServedModel* next = model->next;
+        ReleaseScene(&model->scene);
+        ReleaseLabelCache(&model->labels);
+        ArenaRelease(&model->net.arena);
+        free(model);
+        model = next;
+    }
+}
+
+// Called with the lock held. A model that failed to load goes once the last
+// worker waiting for it lets go.
+void ReleaseServedModel(RenderServer* server, ServedModel* model) {
+    model->users--;
+    model->lastUse = NowSeconds();
+    if (model->ready < 0 && model->users == 0) {
+        UnlinkServedModel(server, model);
+        model->next = NULL;
+        FreeServedModels(model);
+    }
+}
+
+// The model spec names, loaded by this worker when no other has it. Returns
+// NULL when it cannot be loaded. Called with the lock held, which is let go
+// while loading or waiting for another worker's load.
+ServedModel* AcquireServedModel(RenderServer* server, const char* spec) {
+    ServedModel* model = server->models;
+    while (model && strcmp(model->spec, spec) != 0)
+        model = model->next;
+    if (model) {
+        model->users++;
+        while (model->ready == 0)
+            WaitCondVar(&server->loaded, &server->lock);
+        if (model->ready < 0) {
+            ReleaseServedModel(server, model);
+            return NULL;
+        }
+        server->hits++;
+        return model;
+    }
+    model = calloc(1, sizeof(ServedModel));
+    if (!model)
+        return NULL;
+    snprintf(model->spec, sizeof(model->spec), "%s", spec);
+    model->users = 1;
+    model->next = server->models;
+    server->models = model;
+    server->modelCount++;
+    server->misses++;
+    UnlockMutex(&server->lock);
+    int ok = LoadModelScene(&model->net, &model->scene, &model->labels, &embeddedAtlas, spec, NULL);
+    if (ok && (model->labels.atlas != &embeddedAtlas || model->labels.builtRevision != model->net.revision))
+        LayoutLabels(&model->labels, &embeddedAtlas, &model->net);
+    size_t bytes = ok ? ServedModelBytes(model) : 0;
+    LockMutex(&server->lock);
+    model->ready = ok ? 1 : -1;
+    model->bytes = bytes;
+    server->modelBytes += bytes;
+    WakeAllCondVar(&server->loaded);
+    if (!ok) {
+        ReleaseServedModel(server, model);
+        return NULL;
+    }
+    return model;
+}
+
+// Unlink the least recently used models nobody holds until the rest fit in
+// the cache. The caller frees them once it has let go of the lock.
+ServedModel* EvictServedModels(RenderServer* server) {
+    ServedModel* evicted = NULL;
+    while (server->modelBytes > server->cacheBytes) {
+        ServedModel* oldest = NULL;
+        for (ServedModel* m = server->models; m; m = m->next) {
+            if (m->ready == 1 && m->users == 0 && (!oldest || m->lastUse < oldest->lastUse))
+                oldest = m;
+        }
+        if (!oldest)
+            break;
+        UnlinkServedModel(server, oldest);
+        server->modelBytes -= oldest->bytes;
+        server->evictions++;
+        oldest->next = evicted;
+        evicted = oldest;
+    }
+    return evicted;
+}
+
+int SameRenderView(const RenderRequest* a, const RenderRequest* b) {
+    return a->camera.rotX == b->camera.rotX && a->camera.rotY == b->camera.rotY && a->camera.zoom == b->camera.zoom &&
+           a->width == b->width && a->height == b->height && a->png == b->png;
+}
+
+// Render req's view of model into fb and append it to out, encoded. The
+// model's label layout is lent to the rasterizer for the frame. Returns 0
+// when out of memory.
+int RenderServedImage(Rasterizer* r, Framebuffer* fb, const ServedModel* model, const RenderRequest* req,
+                      ByteWriter* out) {
+    if (fb->width != req->width || fb->height != req->height) {
+        ReleaseFramebuffer(fb);
+        if (!InitFramebuffer(fb, req->width, req->height))
+            return 0;
+    }
+    LabelCache layout = model->labels;
+    ResetLayerLod(&r->visible);
+    SwapLabelLayouts(&r->labels, &layout);
+    RasterScene(r, fb, &model->scene, &model->net, &req->camera);
+    SwapLabelLayouts(&r->labels, &layout);
+    if (costView != COST_VIEW_OFF) {
+        char summary[1024];
+        FormatCostSummary(&model->net, costView, 5, summary, sizeof(summary));
+        RasterScreenText(fb, &embeddedAtlas, summary, 8, 8);
+    }
+    if (req->png)
+        return EncodePNG(fb, out);
+    char header[64];
+    int length = snprintf(header, sizeof(header), "P6\n%d %d\n255\n", fb->width, fb->height);
+    PutBytes(out, header, length);
+    PutBytes(out, fb->color, (size_t)fb->width * fb->height * 3);
+    return 1;
+}
+
+// Answer batches of queued requests until the server stops and the queue is
+// empty. Each worker has its own rasterizer, framebuffer and image buffers.
+void ServeWorker(void* arg) {
+    RenderServer* server = arg;
+    Rasterizer r;
+    Framebuffer fb = {0};
+    ByteWriter images[SERVE_BATCH];
+    memset(images, 0, sizeof(images));
+    InitRasterizer(&r, 1);
+    LockMutex(&server->lock);
+    for (;;) {
+        while (!server->queue && !server->stop)
+            WaitCondVar(&server->wake, &server->lock);
+        if (!server->queue)
+            break;
+        RenderRequest* batch = TakeRequestBatch(server);
+        ServedModel* model = AcquireServedModel(server, batch->spec);
+        UnlockMutex(&server->lock);
+        
+        RenderRequest* done[SERVE_BATCH];
+        int rendered[SERVE_BATCH], sent[SERVE_BATCH], count = 0, shared = 0;
+        double latency[SERVE_BATCH];
+        for (RenderRequest* req = batch; req; req = req->next, count++) {
+            int same = -1;
+            for (int k = 0; k < count && same < 0; k++) {
+                if (rendered[k] && SameRenderView(done[k], req))
+                    same = k;
+            }
+            ByteWriter* image = &images[same >= 0 ? same : count];
+            if (same >= 0) {
+                rendered[count] = 1;
+                shared++;
+            } else {
+                image->size = 0;
+                rendered[count] = model && RenderServedImage(&r, &fb, model, req, image);
+            }
+            if (rendered[count])
+                sent[count] = SendHttpResponse(req->client, 200, req->png ? "image/png" : "image/x-portable-pixmap",
+                                               image->data, image->size);
+            else
+                SendHttpError(req->client, model ? 500 : 404, model ? "Cannot render the model" : "Cannot load the model");
+            closesocket(req->client);
+            sent[count] = rendered[count] && sent[count];
+            latency[count] = (NowSeconds() - req->arrival) * 1000.0;
+            done[count] = req;
+        }
+        
+        LockMutex(&server->lock);
+        if (model)
+            ReleaseServedModel(server, model);
+        for (int k = 0; k < count; k++) {
+            if (sent[k])
+                server->latency[server->served++ % SERVE_LATENCY_SAMPLES] = latency[k];
+            else
+                server->failed++;
+        }
+        server->shared += shared;
+        server->batched += count;
+        server->batches++;
+        ServedModel* evicted = EvictServedModels(server);
+        UnlockMutex(&server->lock);
+        for (int k = 0; k < count; k++)
+            free(done[k]);
+        FreeServedModels(evicted);
+        LockMutex(&server->lock);
+    }
+    UnlockMutex(&server->lock);
+    for (int k = 0; k < SERVE_BATCH; k++)
+        free(images[k].data);
+    ReleaseFramebuffer(&fb);
+    ReleaseRasterizer(&r);
+}
+
+// Queue the request a connection sent, or answer it here when it is for
+// /stats or cannot be served. request is NULL when nothing complete arrived.
+void HandleServeConnection(RenderServer* server, Socket client, const char* request, double arrival) {
+    char method[8], target[SERVE_REQUEST_BYTES], message[400];
+    int status = 400;
+    snprintf(message, sizeof(message), "Bad request");
+    if (request && sscanf(request, "%7s %4095s", method, target) == 2) {
+        if (strcmp(method, "GET") != 0) {
+            status = 405;
+            snprintf(message, sizeof(message), "Only GET is supported");
+        } else if (strcmp(target, "/stats") == 0) {
+            char stats[1024];
+            LockMutex(&server->lock);
+            FormatServeStats(server, stats, sizeof(stats));
+            UnlockMutex(&server->lock);
+            strcat(stats, "\n");
+            SendHttpResponse(client, 200, "text/plain", stats, strlen(stats));
+            closesocket(client);
+            return;
+        } else if (strncmp(target, "/render", 7) != 0 || (target[7] && target[7] != '?')) {
+            status = 404;
+            snprintf(message, sizeof(message), "Unknown path, expected /render or /stats");
+        } else {
+            RenderRequest* req = calloc(1, sizeof(RenderRequest));
+            status = req ? ParseRenderRequest(server, target, req, message, sizeof(message)) : 503;
+            if (status == 200) {
+                req->client = client;
+                req->arrival = arrival;
+                LockMutex(&server->lock);
+                if (server->queued < SERVE_QUEUE_LIMIT) {
+                    if (server->queueTail)
+                        server->queueTail->next = req;
+                    else
+                        server->queue = req;
+                    server->queueTail = req;
+                    server->queued++;
+                    WakeAllCondVar(&server->wake);
+                    UnlockMutex(&server->lock);
+                    return;
+                }
+                server->rejected++;
+                UnlockMutex(&server->lock);
+                status = 503;
+                snprintf(message, sizeof(message), "Too many requests queued");
+            }
+            free(req);
+        }
+    }
+    LockMutex(&server->lock);
+    server->failed += status != 503;
+    UnlockMutex(&server->lock);
+    SendHttpError(client, status, message);
+    closesocket(client);
+}
+
+// Accept connections until the server stops or stopAt passes. The listener
+// and every connection still sending its request are waited on together, and
+// each is read only once data is there, so a client that sends nothing delays
+// no other; after SERVE_TIMEOUT_MS it gets 400 like a malformed request.
+void ServeConnections(RenderServer* server) {
+    PendingConnection* pending = malloc(SERVE_PENDING_LIMIT * sizeof(PendingConnection));
+    int pendingCount = 0;
+    if (!pending) {
+        printf("Error: Out of memory starting the server.\n");
+        exit(EXIT_FAILURE);
+    }
+    while (!AtomicLoad(&server->stop) && (server->stopAt <= 0.0 || NowSeconds() < server->stopAt)) {
+        fd_set ready;
+        struct timeval wait = { 0, 100000 };
+        Socket highest = server->listener;
+        FD_ZERO(&ready);
+        FD_SET(server->listener, &ready);
+        for (int i = 0; i < pendingCount; i++) {
+            FD_SET(pending[i].client, &ready);
+            if (pending[i].client > highest)
+                highest = pending[i].client;
+        }
+        int count = select((int)highest + 1, &ready, NULL, NULL, &wait);
+        double now = NowSeconds();
+        for (int i = 0; i < pendingCount;) {
+            PendingConnection* c = &pending[i];
+            int state = count > 0 && FD_ISSET(c->client, &ready) ?
+                        ReadHttpRequest(c->client, c->request, &c->used, sizeof(c->request)) : 0;
+            if (state == 0 && now - c->arrival < SERVE_TIMEOUT_MS / 1000.0) {
+                i++;
+                continue;
+            }
+            HandleServeConnection(server, c->client, state > 0 ? c->request : NULL, c->arrival);
+            *c = pending[--pendingCount];
+        }
+        if (count <= 0 || !FD_ISSET(server->listener, &ready))
+            continue;
+        Socket client = accept(server->listener, NULL, NULL);
+        if (client == INVALID_SOCKET)
+            continue;
+        SetSocketTimeouts(client, SERVE_TIMEOUT_MS);
+#ifdef _WIN32
+        int fits = pendingCount < SERVE_PENDING_LIMIT;
+#else
+        int fits = pendingCount < SERVE_PENDING_LIMIT && client < FD_SETSIZE;
+#endif
+        if (!fits) {
+            LockMutex(&server->lock);
+            server->rejected++;
+            UnlockMutex(&server->lock);
+            SendHttpError(client, 503, "Too many connections");
+            closesocket(client);
+            continue;
+        }
+        pending[pendingCount].client = client;
+        pending[pendingCount].arrival = now;
+        pending[pendingCount].used = 0;
+        pending[pendingCount++].request[0] = '\0';
+    }
+    for (int i = 0; i < pendingCount; i++)
+        closesocket(pending[i].client);
+    free(pending);
+}
+
+void ServeAcceptThread(void* arg) {
+    ServeConnections(arg);
+}
 
-GLUquadric* quadric = NULL; // For drawing spheres and cones
-GLuint baseList = 0;         // Display list base for font bitmaps
+// Listen on 127.0.0.1:port (0 for any free port; the one taken is stored in
+// server->port) and start threadCount workers. Returns 0 when the port
+// cannot be taken. Loads in this process are limited to scenes of cacheBytes,
+// which is SERVE_CACHE_MB when 0.
+int StartRenderServer(RenderServer* server, int port, int threadCount, size_t cacheBytes) {
+    struct sockaddr_in address;
+    SocketLength length = sizeof(address);
+    int reuse = 1;
+#ifdef _WIN32
+    WSADATA wsa;
+    if (WSAStartup(MAKEWORD(2, 2), &wsa) != 0)
+        return 0;
+#else
+    signal(SIGPIPE, SIG_IGN);   // A client hanging up mid-response must not end the server
+#endif
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    address.sin_port = htons((unsigned short)port);
+    server->listener = socket(AF_INET, SOCK_STREAM, 0);
+    if (server->listener == INVALID_SOCKET ||
+        setsockopt(server->listener, SOL_SOCKET, SO_REUSEADDR, (const char*)&reuse, sizeof(reuse)) != 0 ||
+        bind(server->listener, (struct sockaddr*)&address, sizeof(address)) != 0 ||
+        listen(server->listener, SOMAXCONN) != 0 ||
+        getsockname(server->listener, (struct sockaddr*)&address, &length) != 0) {
+        if (server->listener != INVALID_SOCKET)
+            closesocket(server->listener);
+#ifdef _WIN32
+        WSACleanup();
+#endif
+        return 0;
+    }
+    server->port = ntohs(address.sin_port);
+    server->cacheBytes = cacheBytes ? cacheBytes : (size_t)SERVE_CACHE_MB << 20;
+    // A scene that alone outgrows the model budget is refused before it is
+    // built, so a request can never run the server out of memory.
+    sceneBuildLimit = (long long)server->cacheBytes;
+    BuildMeshCache();
+    BuildEmbeddedAtlas(&embeddedAtlas);
+    InitMutex(&server->lock);
+    InitCondVar(&server->wake);
+    InitCondVar(&server->loaded);
+    server->threads = malloc(threadCount * sizeof(Thread));
+    while (server->threads && server->threadCount < threadCount &&
+           StartThread(&server->threads[server->threadCount], ServeWorker, server))
+        server->threadCount++;
+    server->started = NowSeconds();
+    return 1;
+}
 
-// Global mouse control variables
-float rotX = 0.0f, rotY = 0.0f;
-int mouseDown = 0;
-int lastMouseX = 0, lastMouseY = 0;
+// Stop accepting, answer what is still queued, and release everything.
+void StopRenderServer(RenderServer* server) {
+    AtomicStore(&server->stop, 1);
+    if (server->acceptorRunning)
+        JoinThread(server->acceptor);
+    LockMutex(&server->lock);
+    WakeAllCondVar(&server->wake);
+    UnlockMutex(&server->lock);
+    for (int i = 0; i < server->threadCount; i++)
+        JoinThread(server->threads[i]);
+    // With no workers left the queue may still hold requests.
+    for (RenderRequest* req = server->queue; req;) {
+        RenderRequest* next = req->next;
+        SendHttpError(req->client, 503, "The server is stopping");
+        closesocket(req->client);
+        free(req);
+        req = next;
+    }
+    closesocket(server->listener);
+    FreeServedModels(server->models);
+    free(server->threads);
+    DestroyCondVar(&server->wake);
+    DestroyCondVar(&server->loaded);
+    DestroyMutex(&server->lock);
+    ReleaseMeshCache();
+    ReleaseGlyphAtlas(&embeddedAtlas);
+#ifdef _WIN32
+    WSACleanup();
+#endif
+}
 
-//-------------------------
-// Console Setup
-//-------------------------
+// deep3d --serve: run the render server until it is interrupted or
+// --seconds pass, then print its statistics.
+int RunServer(int argc, char** argv) {
+    static RenderServer server;
+    int port = SERVE_PORT, threadCount = CpuCount(), cacheMb = SERVE_CACHE_MB;
+    double seconds = 0.0;
+    memset(&server, 0, sizeof(server));
+    for (int i = 2; i < argc; i++) {
+        const char* value = i + 1 < argc ? argv[i + 1] : NULL;
+        if (!value) {
+            printf("Error: Missing value for %s.\n", argv[i]);
+            return EXIT_FAILURE;
+        }
+        if (strcmp(argv[i], "--port") == 0)
+            port = atoi(value);
+        else if (strcmp(argv[i], "--jobs") == 0)
+            threadCount = atoi(value) > 0 ? atoi(value) : 1;
+        else if (strcmp(argv[i], "--cache") == 0) {
+            cacheMb = atoi(value);
+            if (cacheMb <= 0) {
+                printf("Error: Bad cache size '%s', expected megabytes above 0.\n", value);
+                return EXIT_FAILURE;
+            }
+        } else if (strcmp(argv[i], "--models") == 0)
+            server.modelDir = value;
+        else if (strcmp(argv[i], "--seconds") == 0)
+            seconds = atof(value);
+        else if (strcmp(argv[i], "--scene-cache") == 0)
+            SetSceneCacheOption(value);
+        else if (strcmp(argv[i], "--cost") == 0 && ParseCostView(value, &costView))
+            ;
+        else {
+            printf("Error: Unknown option '%s %s'.\n", argv[i], value);
+            PrintExportUsage();
+            return EXIT_FAILURE;
+        }
+        i++;
+    }
+    if (!StartRenderServer(&server, port, threadCount, (size_t)cacheMb << 20)) {
+        printf("Error: Cannot listen on 127.0.0.1:%d.\n", port);
+        return EXIT_FAILURE;
+    }
+    printf("Serving http://127.0.0.1:%d/render?model=ID on %d workers, %d MB for models\n", server.port,
+           server.threadCount, cacheMb);
+    fflush(stdout);
+    if (seconds > 0.0)
+        server.stopAt = server.started + seconds;
+    ServeConnections(&server);
+    char stats[1024];
+    LockMutex(&server.lock);
+    FormatServeStats(&server, stats, sizeof(stats));
+    UnlockMutex(&server.lock);
+    StopRenderServer(&server);
+    printf("Served %s\n", stats);
+    return EXIT_SUCCESS;
+}
 
-void SetupConsole(void) {
-    AllocConsole();
-    freopen("CONIN$", "r", stdin);
-    freopen("CONOUT$", "w", stdout);
-    printf("Console initialized.\n");
+// GET target from the server on 127.0.0.1:port. Returns the HTTP status, 0
+// when the exchange failed, with the body in body (caller frees).
+int HttpGet(int port, const char* target, ByteWriter* body) {
+    struct sockaddr_in address;
+    char request[1024];
+    ByteWriter response = {0};
+    int status = 0;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    address.sin_port = htons((unsigned short)port);
+    body->size = 0;
+    Socket s = socket(AF_INET, SOCK_STREAM, 0);
+    if (s == INVALID_SOCKET)
+        return 0;
+    SetSocketTimeouts(s, SERVE_TIMEOUT_MS * 15);
+    int length = snprintf(request, sizeof(request), "GET %s HTTP/1.1\r\nHost: 127.0.0.1\r\n\r\n", target);
+    if (connect(s, (struct sockaddr*)&address, sizeof(address)) == 0 && SendAll(s, request, length)) {
+        char chunk[16384];
+        int got;
+        while ((got = recv(s, chunk, sizeof(chunk), 0)) > 0)
+            PutBytes(&response, chunk, got);
+        PutByte(&response, 0);
+        const char* end = strstr((const char*)response.data, "\r\n\r\n");
+        if (got == 0 && end && sscanf((const char*)response.data, "HTTP/1.1 %d", &status) == 1) {
+            size_t start = end + 4 - (const char*)response.data;
+            PutBytes(body, response.data + start, response.size - 1 - start);
+        } else {
+            status = 0;
+        }
+    }
+    closesocket(s);
+    free(response.data);
+    return status;
 }
 
-//-------------------------
-// Predefined Network Setup Functions
-//-------------------------
+typedef struct {
+    int port;
+    const char** models;
+    int modelCount;
+    int width, height;
+    int index, requests;
+    double* latency;            // ms per request
+    int failures;
+} ServeClient;
 
-// AlexNet (simplified schematic)
-void SetupAlexNet(void) {
-    numLayers = 9;
-    // Layer 0: Input
-    networkLayers[0].type = LAYER_BOX;
-    networkLayers[0].box.width = 2.0f;
-    networkLayers[0].box.height = 1.0f;
-    networkLayers[0].box.depth = 2.0f;
-    networkLayers[0].color[0] = 1.0f; networkLayers[0].color[1] = 1.0f; networkLayers[0].color[2] = 1.0f;
-    strcpy(networkLayers[0].label, "Input");
-    
-    // Layer 1: Conv1
-    networkLayers[1].type = LAYER_BOX;
-    networkLayers[1].box.width = 2.0f;
-    networkLayers[1].box.height = 1.0f;
-    networkLayers[1].box.depth = 2.0f;
-    networkLayers[1].color[0] = 1.0f; networkLayers[1].color[1] = 0.0f; networkLayers[1].color[2] = 0.0f;
-    strcpy(networkLayers[1].label, "Conv1");
-    
-    // Layer 2: Conv2
-    networkLayers[2].type = LAYER_BOX;
-    networkLayers[2].box.width = 1.8f;
-    networkLayers[2].box.height = 1.0f;
-    networkLayers[2].box.depth = 1.8f;
-    networkLayers[2].color[0] = 0.0f; networkLayers[2].color[1] = 1.0f; networkLayers[2].color[2] = 0.0f;
-    strcpy(networkLayers[2].label, "Conv2");
-    
-    // Layer 3: Conv3
-    networkLayers[3].type = LAYER_BOX;
-    networkLayers[3].box.width = 1.6f;
-    networkLayers[3].box.height = 1.0f;
-    networkLayers[3].box.depth = 1.6f;
-    networkLayers[3].color[0] = 0.0f; networkLayers[3].color[1] = 0.0f; networkLayers[3].color[2] = 1.0f;
-    strcpy(networkLayers[3].label, "Conv3");
-    
-    // Layer 4: Conv4
-    networkLayers[4].type = LAYER_BOX;
-    networkLayers[4].box.width = 1.4f;
-    networkLayers[4].box.height = 1.0f;
-    networkLayers[4].box.depth = 1.4f;
-    networkLayers[4].color[0] = 1.0f; networkLayers[4].color[1] = 0.0f; networkLayers[4].color[2] = 1.0f;
-    strcpy(networkLayers[4].label, "Conv4");
-    
-    // Layer 5: Conv5
-    networkLayers[5].type = LAYER_BOX;
-    networkLayers[5].box.width = 1.2f;
-    networkLayers[5].box.height = 1.0f;
-    networkLayers[5].box.depth = 1.2f;
-    networkLayers[5].color[0] = 0.0f; networkLayers[5].color[1] = 1.0f; networkLayers[5].color[2] = 1.0f;
-    strcpy(networkLayers[5].label, "Conv5");
-    
-    // Layer 6: FC6
-    networkLayers[6].type = LAYER_FC;
-    networkLayers[6].fc.neuronCount = 5;
-    networkLayers[6].color[0] = 1.0f; networkLayers[6].color[1] = 1.0f; networkLayers[6].color[2] = 0.0f;
-    strcpy(networkLayers[6].label, "FC6");
-    
-    // Layer 7: FC7
-    networkLayers[7].type = LAYER_FC;
-    networkLayers[7].fc.neuronCount = 5;
-    networkLayers[7].color[0] = 1.0f; networkLayers[7].color[1] = 0.5f; networkLayers[7].color[2] = 0.0f;
-    strcpy(networkLayers[7].label, "FC7");
-    
-    // Layer 8: FC8
-    networkLayers[8].type = LAYER_FC;
-    networkLayers[8].fc.neuronCount = 5;
-    networkLayers[8].color[0] = 0.5f; networkLayers[8].color[1] = 0.5f; networkLayers[8].color[2] = 0.5f;
-    strcpy(networkLayers[8].label, "FC8");
-}
-
-// VGG16 (simplified schematic)
-void SetupVGG16(void) {
-    numLayers = 9;
-    strcpy(networkLayers[0].label, "Input");
-    networkLayers[0].type = LAYER_BOX;
-    networkLayers[0].box.width = 3.0f;
-    networkLayers[0].box.height = 2.0f;
-    networkLayers[0].box.depth = 3.0f;
-    networkLayers[0].color[0] = 1.0f; networkLayers[0].color[1] = 1.0f; networkLayers[0].color[2] = 1.0f;
-    
-    strcpy(networkLayers[1].label, "ConvBlock1");
-    networkLayers[1].type = LAYER_BOX;
-    networkLayers[1].box.width = 3.0f;
-    networkLayers[1].box.height = 1.5f;
-    networkLayers[1].box.depth = 3.0f;
-    networkLayers[1].color[0] = 1.0f; networkLayers[1].color[1] = 0.0f; networkLayers[1].color[2] = 0.0f;
-    
-    strcpy(networkLayers[2].label, "ConvBlock2");
-    networkLayers[2].type = LAYER_BOX;
-    networkLayers[2].box.width = 2.8f;
-    networkLayers[2].box.height = 1.5f;
-    networkLayers[2].box.depth = 2.8f;
-    networkLayers[2].color[0] = 0.0f; networkLayers[2].color[1] = 1.0f; networkLayers[2].color[2] = 0.0f;
-    
-    strcpy(networkLayers[3].label, "ConvBlock3");
-    networkLayers[3].type = LAYER_BOX;
-    networkLayers[3].box.width = 2.6f;
-    networkLayers[3].box.height = 1.5f;
-    networkLayers[3].box.depth = 2.6f;
-    networkLayers[3].color[0] = 0.0f; networkLayers[3].color[1] = 0.0f; networkLayers[3].color[2] = 1.0f;
-    
-    strcpy(networkLayers[4].label, "ConvBlock4");
-    networkLayers[4].type = LAYER_BOX;
-    networkLayers[4].box.width = 2.4f;
-    networkLayers[4].box.height = 1.5f;
-    networkLayers[4].box.depth = 2.4f;
-    networkLayers[4].color[0] = 1.0f; networkLayers[4].color[1] = 0.0f; networkLayers[4].color[2] = 1.0f;
-    
-    strcpy(networkLayers[5].label, "ConvBlock5");
-    networkLayers[5].type = LAYER_BOX;
-    networkLayers[5].box.width = 2.2f;
-    networkLayers[5].box.height = 1.5f;
-    networkLayers[5].box.depth = 2.2f;
-    networkLayers[5].color[0] = 0.0f; networkLayers[5].color[1] = 1.0f; networkLayers[5].color[2] = 1.0f;
-    
-    strcpy(networkLayers[6].label, "FC1");
-    networkLayers[6].type = LAYER_FC;
-    networkLayers[6].fc.neuronCount = 5;
-    networkLayers[6].color[0] = 1.0f; networkLayers[6].color[1] = 1.0f; networkLayers[6].color[2] = 0.0f;
-    
-    strcpy(networkLayers[7].label, "FC2");
-    networkLayers[7].type = LAYER_FC;
-    networkLayers[7].fc.neuronCount = 5;
-    networkLayers[7].color[0] = 1.0f; networkLayers[7].color[1] = 0.5f; networkLayers[7].color[2] = 0.0f;
-    
-    strcpy(networkLayers[8].label, "FC3");
-    networkLayers[8].type = LAYER_FC;
-    networkLayers[8].fc.neuronCount = 5;
-    networkLayers[8].color[0] = 0.5f; networkLayers[8].color[1] = 0.5f; networkLayers[8].color[2] = 0.5f;
-}
-
-// ResNet18 (simplified schematic)
-void SetupResNet18(void) {
-    numLayers = 7;
-    strcpy(networkLayers[0].label, "Input");
-    networkLayers[0].type = LAYER_BOX;
-    networkLayers[0].box.width = 3.0f;
-    networkLayers[0].box.height = 2.0f;
-    networkLayers[0].box.depth = 3.0f;
-    networkLayers[0].color[0] = 1.0f; networkLayers[0].color[1] = 1.0f; networkLayers[0].color[2] = 1.0f;
-    
-    strcpy(networkLayers[1].label, "InitialConv");
-    networkLayers[1].type = LAYER_BOX;
-    networkLayers[1].box.width = 3.0f;
-    networkLayers[1].box.height = 1.5f;
-    networkLayers[1].box.depth = 3.0f;
-    networkLayers[1].color[0] = 1.0f; networkLayers[1].color[1] = 0.0f; networkLayers[1].color[2] = 0.0f;
-    
-    strcpy(networkLayers[2].label, "ResBlock1");
-    networkLayers[2].type = LAYER_BOX;
-    networkLayers[2].box.width = 2.8f;
-    networkLayers[2].box.height = 1.5f;
-    networkLayers[2].box.depth = 2.8f;
-    networkLayers[2].color[0] = 0.0f; networkLayers[2].color[1] = 1.0f; networkLayers[2].color[2] = 0.0f;
-    
-    strcpy(networkLayers[3].label, "ResBlock2");
-    networkLayers[3].type = LAYER_BOX;
-    networkLayers[3].box.width = 2.6f;
-    networkLayers[3].box.height = 1.5f;
-    networkLayers[3].box.depth = 2.6f;
-    networkLayers[3].color[0] = 0.0f; networkLayers[3].color[1] = 0.0f; networkLayers[3].color[2] = 1.0f;
-    
-    strcpy(networkLayers[4].label, "ResBlock3");
-    networkLayers[4].type = LAYER_BOX;
-    networkLayers[4].box.width = 2.4f;
-    networkLayers[4].box.height = 1.5f;
-    networkLayers[4].box.depth = 2.4f;
-    networkLayers[4].color[0] = 1.0f; networkLayers[4].color[1] = 0.0f; networkLayers[4].color[2] = 1.0f;
-    
-    strcpy(networkLayers[5].label, "ResBlock4");
-    networkLayers[5].type = LAYER_BOX;
-    networkLayers[5].box.width = 2.2f;
-    networkLayers[5].box.height = 1.5f;
-    networkLayers[5].box.depth = 2.2f;
-    networkLayers[5].color[0] = 0.0f; networkLayers[5].color[1] = 1.0f; networkLayers[5].color[2] = 1.0f;
-    
-    strcpy(networkLayers[6].label, "FinalFC");
-    networkLayers[6].type = LAYER_FC;
-    networkLayers[6].fc.neuronCount = 5;
-    networkLayers[6].color[0] = 1.0f; networkLayers[6].color[1] = 1.0f; networkLayers[6].color[2] = 0.0f;
+// A dashboard client: requests one after another, across the models and a
+// round of 24 views each, so concurrent clients sometimes ask for the same one.
+void ServeClientThread(void* arg) {
+    ServeClient* c = arg;
+    ByteWriter body = {0};
+    for (int i = 0; i < c->requests; i++) {
+        int n = c->index * 7 + i;
+        char target[512];
+        snprintf(target, sizeof(target), "/render?model=%s&camera=20,%d&size=%dx%d", c->models[n % c->modelCount],
+                 (n / c->modelCount) % 24 * 15, c->width, c->height);
+        double start = NowSeconds();
+        int status = HttpGet(c->port, target, &body);
+        c->latency[i] = (NowSeconds() - start) * 1000.0;
+        if (status != 200 || body.size < 8 || memcmp(body.data, "\x89PNG", 4) != 0)
+            c->failures++;
+    }
+    free(body.data);
 }
 
-// Custom network: label each layer as "Layer i"
-void SetupCustomNetwork(void) {
-    printf("Enter the number of layers (max %d): ", MAX_LAYERS);
-    scanf("%d", &numLayers);
-    if(numLayers > MAX_LAYERS) numLayers = MAX_LAYERS;
-    
-    printf("Note: You may separate numbers with spaces or commas.\n");
+// deep3d --bench-serve: start the server on a free port and time it from
+// the client side: the first request for each model, which loads it, then
+// --clients clients sending --requests requests each. Each model's first
+// image must match a render made here directly. Exits with 1 on a failed
+// request, a mismatch or a rate below --min-rate.
+int RunServeBenchmark(int argc, char** argv) {
+    static const char* defaults[] = { "alexnet", "vgg16", "resnet18", "synth:2000x64:residual" };
+    static RenderServer server;
+    const char** models = malloc((argc + sizeof(defaults) / sizeof(defaults[0])) * sizeof(char*));
+    int modelCount = 0, clientCount = 8, requests = 100, threadCount = CpuCount(), width = 320, height = 240;
+    double minRate = 100.0;
+    for (int i = 2; i < argc; i++) {
+        if (strcmp(argv[i], "--clients") == 0 && i + 1 < argc)
+            clientCount = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--requests") == 0 && i + 1 < argc)
+            requests = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--jobs") == 0 && i + 1 < argc)
+            threadCount = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--size") == 0 && i + 1 < argc)
+            sscanf(argv[++i], "%dx%d", &width, &height);
+        else if (strcmp(argv[i], "--min-rate") == 0 && i + 1 < argc)
+            minRate = atof(argv[++i]);
+        else
+            models[modelCount++] = argv[i];
+    }
+    if (modelCount == 0) {
+        modelCount = sizeof(defaults) / sizeof(defaults[0]);
+        memcpy(models, defaults, sizeof(defaults));
+    }
+    // First requests time real loads and leave nothing in the user's cache.
+    sceneCacheOff = 1;
+    clientCount = clientCount < 1 ? 1 : clientCount;
+    requests = requests < 1 ? 1 : requests;
+    threadCount = threadCount < 1 ? 1 : threadCount;
+    memset(&server, 0, sizeof(server));
+    if (!StartRenderServer(&server, 0, threadCount, (size_t)SERVE_CACHE_MB << 20) ||
+        !StartThread(&server.acceptor, ServeAcceptThread, &server)) {
+        printf("Error: Cannot start the render server.\n");
+        return EXIT_FAILURE;
+    }
+    server.acceptorRunning = 1;
+    printf("Serve benchmark: %d models, %d clients x %d requests at %dx%d, %d workers on port %d\n", modelCount,
+           clientCount, requests, width, height, server.threadCount, server.port);
     
-    for (int i = 0; i < numLayers; i++) {
-        int typeInput;
-        printf("Layer %d: Enter type (0 for box, 1 for fully-connected): ", i);
-        scanf("%d", &typeInput);
-        if (typeInput == 0) {
-            networkLayers[i].type = LAYER_BOX;
-            printf("Enter width, height, depth for box: ");
-            scanf(" %f%*[ ,]%f%*[ ,]%f", 
-                  &networkLayers[i].box.width, 
-                  &networkLayers[i].box.height, 
-                  &networkLayers[i].box.depth);
-        } else {
-            networkLayers[i].type = LAYER_FC;
-            printf("Enter number of neurons for fully-connected layer: ");
-            scanf("%d", &networkLayers[i].fc.neuronCount);
+    // First requests, one at a time, checked against renders made here.
+    int failures = 0, mismatches = 0;
+    Rasterizer r;
+    Framebuffer fb = {0};
+    ByteWriter body = {0}, direct = {0};
+    InitRasterizer(&r, 1);
+    for (int m = 0; m < modelCount; m++) {
+        char target[512];
+        snprintf(target, sizeof(target), "/render?model=%s&camera=20,30&size=%dx%d", models[m], width, height);
+        double start = NowSeconds();
+        int status = HttpGet(server.port, target, &body);
+        double ms = (NowSeconds() - start) * 1000.0;
+        ServedModel local;
+        RenderRequest req;
+        memset(&local, 0, sizeof(local));
+        memset(&req, 0, sizeof(req));
+        req.camera.rotX = 20.0f;
+        req.camera.rotY = 30.0f;
+        req.camera.zoom = 1.0f;
+        req.width = width;
+        req.height = height;
+        req.png = 1;
+        direct.size = 0;
+        int same = 0;
+        if (status == 200 && LoadModelScene(&local.net, &local.scene, &local.labels, &embeddedAtlas, models[m], NULL)) {
+            if (local.labels.atlas != &embeddedAtlas || local.labels.builtRevision != local.net.revision)
+                LayoutLabels(&local.labels, &embeddedAtlas, &local.net);
+            same = RenderServedImage(&r, &fb, &local, &req, &direct) && direct.size == body.size &&
+                   memcmp(direct.data, body.data, body.size) == 0;
         }
-        printf("Enter color (r, g, b, each between 0 and 1): ");
-        scanf(" %f%*[ ,]%f%*[ ,]%f", 
-              &networkLayers[i].color[0], 
-              &networkLayers[i].color[1], 
-              &networkLayers[i].color[2]);
-        sprintf(networkLayers[i].label, "Layer %d", i);
+        local.next = NULL;
+        ReleaseScene(&local.scene);
+        ReleaseLabelCache(&local.labels);
+        ArenaRelease(&local.net.arena);
+        failures += status != 200;
+        mismatches += status == 200 && !same;
+        printf("  first %-24s %8.1f ms, %zu bytes, %s\n", models[m], ms, body.size,
+               status != 200 ? "failed" : same ? "same as a direct render" : "differs from a direct render");
+    }
+    ReleaseRasterizer(&r);
+    ReleaseFramebuffer(&fb);
+    free(body.data);
+    free(direct.data);
+    
+    ServeClient* clients = calloc(clientCount, sizeof(ServeClient));
+    Thread* threads = malloc(clientCount * sizeof(Thread));
+    double* latency = malloc((size_t)clientCount * requests * sizeof(double));
+    if (!clients || !threads || !latency) {
+        printf("Error: Out of memory starting clients.\n");
+        return EXIT_FAILURE;
+    }
+    double start = NowSeconds();
+    int started = 0;
+    for (int c = 0; c < clientCount; c++) {
+        ServeClient* client = &clients[c];
+        client->port = server.port;
+        client->models = models;
+        client->modelCount = modelCount;
+        client->width = width;
+        client->height = height;
+        client->index = c;
+        client->requests = requests;
+        client->latency = latency + (size_t)c * requests;
+        if (StartThread(&threads[started], ServeClientThread, client))
+            started++;
+        else
+            client->failures = requests;
+    }
+    for (int c = 0; c < started; c++)
+        JoinThread(threads[c]);
+    double elapsed = NowSeconds() - start;
+    int total = 0;
+    for (int c = 0; c < clientCount; c++) {
+        failures += clients[c].failures;
+        if (c < started)
+            total += requests;
     }
+    qsort(latency, total, sizeof(double), CompareDoubles);
+    double rate = elapsed > 0.0 ? total / elapsed : 0.0;
+    char stats[1024];
+    LockMutex(&server.lock);
+    FormatServeStats(&server, stats, sizeof(stats));
+    UnlockMutex(&server.lock);
+    printf("  load  %d requests in %.2f s, %.1f requests/s; latency %.1f ms p50, %.1f ms p95, %.1f ms p99, %.1f ms max\n",
+           total, elapsed, rate, total ? Percentile(latency, total, 50.0) : 0.0,
+           total ? Percentile(latency, total, 95.0) : 0.0, total ? Percentile(latency, total, 99.0) : 0.0,
+           total ? latency[total - 1] : 0.0);
+    printf("  server: %s\n", stats);
+    StopRenderServer(&server);
+    int ok = failures == 0 && mismatches == 0 && rate >= minRate;
+    if (failures)
+        printf("  %d requests failed\n", failures);
+    if (rate < minRate)
+        printf("  below the required %.0f requests/s\n", minRate);
+    free(clients);
+    free(threads);
+    free(latency);
+    free(models);
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
 }
 
+#ifdef _WIN32
 //-------------------------
-// Master Network Setup Menu
+// Network Drawing
 //-------------------------
 
-void SetupNetwork(void) {
-    int choice;
-    printf("Choose network option:\n");
-    printf("1. Predefined: AlexNet\n");
-    printf("2. Predefined: VGG16\n");
-    printf("3. Predefined: ResNet18\n");
-    printf("4. Custom\n");
-    printf("Enter choice (1-4): ");
-    scanf("%d", &choice);
-    if (choice == 1)
-        SetupAlexNet();
-    else if (choice == 2)
-        SetupVGG16();
-    else if (choice == 3)
-        SetupResNet18();
-    else
-        SetupCustomNetwork();
+// Edits since the last frame are patched in; anything else rebuilds. A new
+// activation frame or a timeline step only rewrites and uploads colors.
+void UpdateScene(void) {
+    if (scene.dirty || scene.builtRevision != network.revision) {
+        if (PatchScene(&scene, &network)) {
+            UploadScenePatch(&scene);
+        } else {
+            BuildScene(&scene, &network);
+            UploadScene(&scene);
+        }
+    }
+    if (ApplyLiveActivations(&scene, &network, &liveActivations))
+        UploadScenePatch(&scene);
+    if (ApplyTimeline(&scene, &network, &timeline, NowSeconds()))
+        UploadScenePatch(&scene);
 }
 
-//-------------------------
-// OpenGL Setup & Utility Functions
-//-------------------------
-
-void SetupPixelFormatForDC(HDC hDC) {
-    PIXELFORMATDESCRIPTOR pfd = {0};
-    pfd.nSize      = sizeof(PIXELFORMATDESCRIPTOR);
-    pfd.nVersion   = 1;
-    pfd.dwFlags    = PFD_DRAW_TO_WINDOW | PFD_SUPPORT_OPENGL | PFD_DOUBLEBUFFER;
-    pfd.iPixelType = PFD_TYPE_RGBA;
-    pfd.cColorBits = 32;
-    pfd.cDepthBits = 24;
-    pfd.iLayerType = PFD_MAIN_PLANE;
-    
-    int pixelFormat = ChoosePixelFormat(hDC, &pfd);
-    SetPixelFormat(hDC, pixelFormat, &pfd);
+void DrawNetwork(void) {
+    float viewProj[16];
+    UpdateScene();
+    CameraMatrix(&camera, (float)windowWidth / windowHeight, viewProj);
+    CullScene(&scene, viewProj, windowHeight, &windowVisible);
+    double profileStart = ProfileStart();
+    DrawSceneBuffers(&scene, &windowVisible);
+    ProfileEnd(PROF_DRAW_SCENE, profileStart);
+    profileStart = ProfileStart();
+    PlaceLabels(&windowLabels, &glyphAtlas, &network, &windowVisible, viewProj, windowWidth, windowHeight);
+    DrawLabels(&glyphAtlas, &windowLabels);
+    ProfileEnd(PROF_LABELS, profileStart);
 }
 
-void InitOpenGL(void) {
-    glEnable(GL_DEPTH_TEST);
+// Render with the CPU backend and copy the frame into the back buffer.
+void PresentCpuFrame(void) {
+    UpdateScene();
+    if (windowFrame.width != windowWidth || windowFrame.height != windowHeight) {
+        ReleaseFramebuffer(&windowFrame);
+        if (!InitFramebuffer(&windowFrame, windowWidth, windowHeight)) {
+            printf("Error: Out of memory allocating the CPU framebuffer.\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    if (!windowRasterReady) {
+        InitRasterizer(&windowRaster, CpuCount());
+        windowRasterReady = 1;
+    }
+    RasterScene(&windowRaster, &windowFrame, &scene, &network, &camera);
+    
+    // Rows are stored top first, so draw downwards from the top-left corner.
+    double profileStart = ProfileStart();
     glMatrixMode(GL_PROJECTION);
+    glPushMatrix();
     glLoadIdentity();
-    gluPerspective(45.0, 800.0/600.0, 1.0, 100.0);
     glMatrixMode(GL_MODELVIEW);
-    quadric = gluNewQuadric();
-    
-    // Create display lists for font bitmaps.
-    baseList = glGenLists(96);
-    HFONT hFont = CreateFont(-16, 0, 0, 0, FW_BOLD, FALSE, FALSE, FALSE,
-                             ANSI_CHARSET, OUT_TT_PRECIS, CLIP_DEFAULT_PRECIS, 
-                             ANTIALIASED_QUALITY, FF_DONTCARE | DEFAULT_PITCH, "Arial");
-    if(!hFont) {
-        printf("Error: Failed to create font.\n");
-        exit(EXIT_FAILURE);
-    }
-    SelectObject(hDC, hFont);
-    if(!wglUseFontBitmaps(hDC, 32, 96, baseList)) {
-        printf("Error: wglUseFontBitmaps failed.\n");
-        exit(EXIT_FAILURE);
-    }
+    glLoadIdentity();
+    glDisable(GL_DEPTH_TEST);
+    glRasterPos2f(-1.0f, 1.0f);
+    glPixelZoom(1.0f, -1.0f);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glDrawPixels(windowFrame.width, windowFrame.height, GL_RGB, GL_UNSIGNED_BYTE, windowFrame.color);
+    glPixelZoom(1.0f, 1.0f);
+    glEnable(GL_DEPTH_TEST);
+    glMatrixMode(GL_PROJECTION);
+    glPopMatrix();
+    glMatrixMode(GL_MODELVIEW);
+    ProfileCount(PROF_DRAW_CALLS, 1);
+    ProfileEnd(PROF_PRESENT, profileStart);
 }
 
 //-------------------------
-// Drawing Primitives
+// Rendering & Window Handling
 //-------------------------
 
-void DrawBox(float cx, float cy, float cz, float width, float height, float depth) {
-    float hw = width / 2.0f;
-    float hh = height / 2.0f;
-    float hd = depth / 2.0f;
-    
-    glBegin(GL_QUADS);
-    // Front face
-    glVertex3f(cx - hw, cy - hh, cz + hd);
-    glVertex3f(cx + hw, cy - hh, cz + hd);
-    glVertex3f(cx + hw, cy + hh, cz + hd);
-    glVertex3f(cx - hw, cy + hh, cz + hd);
-    // Back face
-    glVertex3f(cx - hw, cy - hh, cz - hd);
-    glVertex3f(cx + hw, cy - hh, cz - hd);
-    glVertex3f(cx + hw, cy + hh, cz - hd);
-    glVertex3f(cx - hw, cy + hh, cz - hd);
-    // Left face
-    glVertex3f(cx - hw, cy - hh, cz - hd);
-    glVertex3f(cx - hw, cy + hh, cz - hd);
-    glVertex3f(cx - hw, cy + hh, cz + hd);
-    glVertex3f(cx - hw, cy - hh, cz + hd);
-    // Right face
-    glVertex3f(cx + hw, cy - hh, cz - hd);
-    glVertex3f(cx + hw, cy + hh, cz - hd);
-    glVertex3f(cx + hw, cy + hh, cz + hd);
-    glVertex3f(cx + hw, cy - hh, cz + hd);
-    // Top face
-    glVertex3f(cx - hw, cy + hh, cz - hd);
-    glVertex3f(cx + hw, cy + hh, cz - hd);
-    glVertex3f(cx + hw, cy + hh, cz + hd);
-    glVertex3f(cx - hw, cy + hh, cz + hd);
-    // Bottom face
-    glVertex3f(cx - hw, cy - hh, cz - hd);
-    glVertex3f(cx + hw, cy - hh, cz - hd);
-    glVertex3f(cx + hw, cy - hh, cz + hd);
-    glVertex3f(cx - hw, cy - hh, cz + hd);
-    glEnd();
-}
-
-void DrawSphere(float x, float y, float z, float radius) {
-    glPushMatrix();
-    glTranslatef(x, y, z);
-    gluSphere(quadric, radius, 16, 16);
-    glPopMatrix();
+void RequestRedraw(void) {
+    redrawPending = 1;
 }
 
-void DrawArrow(float x1, float y1, float z1, float x2, float y2, float z2) {
-    float dx = x2 - x1, dy = y2 - y1, dz = z2 - z1;
-    float length = sqrt(dx*dx + dy*dy + dz*dz);
-    if (length < 0.0001f)
-        return;
-    
-    float arrowHeadLength = (length > 0.5f) ? 0.5f : 0.5f * length;
-    float arrowHeadRadius = 0.2f;
-    float shaftLength = length - arrowHeadLength;
-    float shaftEndX = x1 + (dx / length) * shaftLength;
-    float shaftEndY = y1 + (dy / length) * shaftLength;
-    float shaftEndZ = z1 + (dz / length) * shaftLength;
-    
-    glBegin(GL_LINES);
-    glVertex3f(x1, y1, z1);
-    glVertex3f(shaftEndX, shaftEndY, shaftEndZ);
-    glEnd();
+void RenderScene(void) {
+    double frameStart = ProfileStart();
+    const CullStats* stats;
+    redrawPending = 0;
+    if (backend == BACKEND_CPU) {
+        PresentCpuFrame();
+        stats = &windowRaster.visible.stats;
+    } else {
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        glLoadIdentity();
+        // Set a top-down view.
+        gluLookAt(0.0, 20.0 / camera.zoom, 0.0,
+                  0.0, 0.0, 0.0,
+                  0.0, 0.0, -1.0);
+        ProfileCount(PROF_GLU_CALLS, 1);
+        glRotatef(camera.rotX, 1.0f, 0.0f, 0.0f);
+        glRotatef(camera.rotY, 0.0f, 1.0f, 0.0f);
+        
+        DrawNetwork();
+        stats = &windowVisible.stats;
+    }
+    if (showProfiler)
+        DrawProfilerHud();
+    if (costView != COST_VIEW_OFF)
+        DrawCostHud();
+    if (timeline.count)
+        DrawTimelineHud();
+    if (loadBusy)
+        DrawLoadHud();
+    if (hoverX >= 0 && !mouseDown) {
+        PickAtCursor(hoverX, hoverY, &hoverHit);
+        DrawPickTooltip();
+    }
     
-    glPushMatrix();
-    glTranslatef(shaftEndX, shaftEndY, shaftEndZ);
-    float dirX = dx / length, dirY = dy / length, dirZ = dz / length;
-    float angle = acos(dirZ) * (180.0f / PI);
-    float axisX = -dirY, axisY = dirX;
-    if (sqrt(axisX*axisX + axisY*axisY) > 0.0001f)
-        glRotatef(angle, axisX, axisY, 0.0f);
-    else if (dirZ < 0)
-        glRotatef(180, 1, 0, 0);
-    gluCylinder(quadric, arrowHeadRadius, 0.0, arrowHeadLength, 12, 3);
-    glPopMatrix();
+    double swapStart = ProfileStart();
+    SwapBuffers(hDC);
+    ProfileEnd(PROF_SWAP, swapStart);
+    ProfileEnd(PROF_FRAME, frameStart);
+    ProfileFrameEnd();
+    if (showCullStats)
+        ShowCullStats(stats);
 }
 
+// Averages of earlier frames; drawing them counts toward this frame.
+void DrawProfilerHud(void) {
+    char text[2048];
+    FormatProfileHud(text, sizeof(text));
+    DrawScreenText(&embeddedAtlas, text, 8, 8);
+}
 
-void DrawFullyConnectedLayer(float y, int neuronCount) {
-    float spacing = 1.0f;
-    float startX = -((neuronCount - 1) * spacing) / 2.0f;
-    float zOffset = 0.5f;
-    for (int i = 0; i < neuronCount; i++) {
-        float x = startX + i * spacing;
-        float z = (i % 2 == 0) ? -zOffset : zOffset;
-        DrawSphere(x, y, z, 0.3f);
-    }
-    for (int i = 0; i < neuronCount; i++) {
-        for (int j = 0; j < neuronCount; j++) {
-            float x1 = startX + i * spacing;
-            float z1 = (i % 2 == 0) ? -zOffset : zOffset;
-            float x2 = startX + j * spacing;
-            float z2 = (j % 2 == 0) ? -zOffset : zOffset;
-            DrawArrow(x1, y, z1, x2, y - LAYER_SPACING, z2);
+// Totals and the costliest layers of the heat map, in the bottom-left corner.
+void DrawCostHud(void) {
+    char text[2048];
+    int lines = 1;
+    FormatCostSummary(&network, costView, 5, text, sizeof(text));
+    for (const char* c = text; *c; c++)
+        lines += *c == '\n';
+    DrawScreenText(&embeddedAtlas, text, 8, windowHeight - 8 - lines * (embeddedAtlas.cellHeight + 2));
+}
+
+// Scrub position and cache state, in the top-right corner.
+void DrawTimelineHud(void) {
+    char text[512];
+    int width = 0;
+    FormatTimelineStatus(&timeline, text, sizeof(text));
+    for (const char* c = text; *c; c++)
+        width += *c >= 32 && *c < 127 ? embeddedAtlas.glyphs[*c - 32].advance : 0;
+    DrawScreenText(&embeddedAtlas, text, windowWidth - 8 - width, 8);
+}
+
+// The model being read, in the bottom-right corner, until its load is in.
+void DrawLoadHud(void) {
+    char text[320];
+    int width = 0;
+    snprintf(text, sizeof(text), "%s %s...", modelReady ? "Reloading" : "Loading", watchedModel);
+    for (const char* c = text; *c; c++)
+        width += *c >= 32 && *c < 127 ? embeddedAtlas.glyphs[*c - 32].advance : 0;
+    DrawScreenText(&embeddedAtlas, text, windowWidth - 8 - width, windowHeight - 8 - (embeddedAtlas.cellHeight + 2));
+}
+
+// Details of the hovered element beside the cursor, kept inside the window.
+void DrawPickTooltip(void) {
+    char text[512];
+    int width = 0, lineWidth = 0, lines = 1;
+    FormatPickInfo(&network, &hoverHit, text, sizeof(text));
+    if (!text[0])
+        return;
+    for (const char* c = text; *c; c++) {
+        if (*c == '\n') {
+            lines++;
+            lineWidth = 0;
+        } else if (*c >= 32 && *c < 127) {
+            lineWidth += embeddedAtlas.glyphs[*c - 32].advance;
+            width = lineWidth > width ? lineWidth : width;
         }
     }
+    int height = lines * (embeddedAtlas.cellHeight + 2);
+    int x = hoverX + 16, y = hoverY + 20;
+    if (x + width > windowWidth - 8)
+        x = hoverX - 8 - width;
+    if (y + height > windowHeight - 8)
+        y = hoverY - 8 - height;
+    DrawScreenText(&embeddedAtlas, text, x > 8 ? x : 8, y > 8 ? y : 8);
 }
 
-// Render text at the given 3D position.
-void RenderText(const char* text, float x, float y, float z) {
-    glRasterPos3f(x, y, z);
-    glPushAttrib(GL_LIST_BIT);
-    glListBase(baseList - 32);
-    glCallLists((GLsizei)strlen(text), GL_UNSIGNED_BYTE, text);
-    glPopAttrib();
+// Write the session's trace and summary to the working directory.
+void DumpProfile(void) {
+    WriteProfile("deep3d_trace.json");
+    WriteProfile("deep3d_profile.csv");
 }
 
-//-------------------------
-// Network Drawing
-//-------------------------
+void PrintEditLayer(const char* action) {
+    int i = editLayer;
+    if (i >= network.layerCount) {
+        printf("%s: no layers\n", action);
+        return;
+    }
+    if (network.type[i] == LAYER_FC)
+        printf("%s layer %d/%d: %s, %d neurons\n", action, i + 1, network.layerCount, network.label[i], network.neuronCount[i]);
+    else
+        printf("%s layer %d/%d: %s, %.2f x %.2f x %.2f\n", action, i + 1, network.layerCount, network.label[i],
+               network.size[i * 3], network.size[i * 3 + 1], network.size[i * 3 + 2]);
+}
 
-void DrawNetwork(void) {
-    float prevY = TOP_Y;
-    int first = 1;
-    for (int i = 0; i < numLayers; i++) {
-        float y = TOP_Y - i * LAYER_SPACING;
-        // Draw arrow connecting centers of consecutive layers.
-        if (!first) {
-            DrawArrow(0.0f, prevY, 0.0f, 0.0f, y, 0.0f);
+// Edit keys: the change is journaled and the next frame patches just the
+// layers it touched.
+void EditLayer(WPARAM key) {
+    int i = editLayer;
+    if (key == 'L') {
+        LayoutNetwork(&network);
+    } else if (i >= network.layerCount) {
+        return;
+    } else if (key == VK_OEM_PLUS || key == VK_ADD || key == VK_OEM_MINUS || key == VK_SUBTRACT) {
+        int grow = key == VK_OEM_PLUS || key == VK_ADD;
+        if (network.type[i] == LAYER_FC) {
+            int n = network.neuronCount[i];
+            SetLayerNeurons(&network, i, grow ? n + (n + 3) / 4 : (n * 4 / 5 > 0 ? n * 4 / 5 : 1));
         } else {
-            first = 0;
+            float size[3], scale = grow ? 1.25f : 0.8f;
+            for (int k = 0; k < 3; k++)
+                size[k] = network.size[i * 3 + k] * scale;
+            SetLayerSize(&network, i, size);
         }
-        if (networkLayers[i].type == LAYER_BOX) {
-            glColor3fv(networkLayers[i].color);
-            DrawBox(0.0f, y, 0.0f,
-                    networkLayers[i].box.width,
-                    networkLayers[i].box.height,
-                    networkLayers[i].box.depth);
-        } else if (networkLayers[i].type == LAYER_FC) {
-            glColor3fv(networkLayers[i].color);
-            DrawFullyConnectedLayer(y, networkLayers[i].fc.neuronCount);
-        }
-        // Render label near the layer.
-        glColor3f(1.0f, 1.0f, 1.0f); // White text
-        RenderText(networkLayers[i].label, TEXT_OFFSET_X, y, 0.0f);
-        prevY = y;
+        PrintEditLayer("Resized");
+    } else if (key == 'K') {
+        float rgb[3];
+        DefaultLayerColor(1 + editColor++ % 7, rgb);
+        SetLayerColor(&network, i, rgb);
+    } else if (key == 'N') {
+        editLayer = InsertLayerBelow(&network, i);
+        PrintEditLayer("Inserted");
+    } else if (key == VK_DELETE) {
+        RemoveLayer(&network, i);
+        if (editLayer >= network.layerCount && editLayer > 0)
+            editLayer--;
+        PrintEditLayer("Removed, selected");
     }
+    RequestRedraw();
 }
 
-//-------------------------
-// Rendering & Window Handling
-//-------------------------
+// Timeline keys: comma and period step one checkpoint, Page Up and Page
+// Down a tenth of the run, Home and End jump to its ends, Space plays.
+void ScrubTimeline(WPARAM key) {
+    double position = floor(timeline.position + 0.5);
+    double tenth = timeline.count > 10 ? floor((timeline.count - 1) / 10.0 + 0.5) : 1.0;
+    if (key == VK_SPACE) {
+        timeline.playing = !timeline.playing;
+        if (timeline.playing && timeline.position >= timeline.count - 1)
+            SeekTimeline(&timeline, 0.0);
+    } else {
+        timeline.playing = 0;
+        if (key == VK_OEM_COMMA)
+            position -= 1.0;
+        else if (key == VK_OEM_PERIOD)
+            position += 1.0;
+        else if (key == VK_PRIOR)
+            position -= tenth;
+        else if (key == VK_NEXT)
+            position += tenth;
+        else
+            position = key == VK_HOME ? 0.0 : timeline.count - 1;
+        SeekTimeline(&timeline, position);
+    }
+    RequestRedraw();
+}
 
-void RenderScene(void) {
-    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-    glLoadIdentity();
-    // Set a top-down view.
-    gluLookAt(0.0, 20.0, 0.0,
-              0.0, 0.0, 0.0,
-              0.0, 0.0, -1.0);
-    glRotatef(rotX, 1.0f, 0.0f, 0.0f);
-    glRotatef(rotY, 0.0f, 1.0f, 0.0f);
-    
-    DrawNetwork();
-    
-    SwapBuffers(hDC);
+// Pick at a pixel of the window with the view the last frame was culled for.
+int PickAtCursor(int x, int y, PickHit* hit) {
+    float viewProj[16];
+    const VisibleSet* vis = backend == BACKEND_CPU ? &windowRaster.visible : &windowVisible;
+    CameraMatrix(&camera, (float)windowWidth / windowHeight, viewProj);
+    return PickScene(&scene, &network, vis, viewProj, windowWidth, windowHeight, x + 0.5f, y + 0.5f, hit);
 }
 
-LRESULT CALLBACK WndProc(HWND hWnd, UINT message, WPARAM wParam, LPARAM lParam) {
-    switch(message) {
+// Follow the cursor. The tooltip moves with it, so a frame is drawn while
+// it is over something and once more when it leaves.
+void HoverAt(int x, int y) {
+    hoverX = x;
+    hoverY = y;
+    int wasOver = hoverHit.kind != PICK_NONE;
+    if (PickAtCursor(x, y, &hoverHit) || wasOver)
+        RequestRedraw();
+}
+
+// A click that did not turn the camera prints what is under it, and a
+// layer becomes the one the edit keys act on.
+void SelectAtCursor(int x, int y) {
+    PickHit hit;
+    char text[512];
+    if (!PickAtCursor(x, y, &hit))
+        return;
+    if (hit.kind != PICK_CONNECTION) {
+        editLayer = hit.layer;
+        PrintEditLayer("Selected");
+    }
+    FormatPickInfo(&network, &hit, text, sizeof(text));
+    printf("%s\n", text);
+}
+
+// Saving the model file reloads it on a loader thread. When its layers and
+// edges are unchanged the differences are applied as edits; otherwise the
+// reloaded graph comes back laid out and is swapped in. A half-written file
+// fails to parse and is retried on the next change.
+void CheckWatchedModel(void) {
+    WIN32_FILE_ATTRIBUTE_DATA info;
+    if (!watchedModel[0] || !GetFileAttributesEx(watchedModel, GetFileExInfoStandard, &info))
+        return;
+    if (CompareFileTime(&info.ftLastWriteTime, &watchedWriteTime) == 0)
+        return;
+    int first = watchedWriteTime.dwLowDateTime == 0 && watchedWriteTime.dwHighDateTime == 0;
+    if (!first && !modelReady)
+        return;         // Seen again once the first load is in
+    watchedWriteTime = info.ftLastWriteTime;
+    if (!first)
+        SubmitModelLoad(1);
+}
+
+void ShowCullStats(const CullStats* st) {
+    char title[256];
+    FormatCullStats(st, title, sizeof(title));
+    PostWindowTitle(title);
+}
+
+// SetWindowText would wait for the window thread, which can be waiting for
+// room in the input queue, so the title is posted to it instead.
+void PostWindowTitle(const char* title) {
+    size_t len = strlen(title) + 1;
+    char* copy = malloc(len);
+    if (!copy)
+        return;
+    memcpy(copy, title, len);
+    if (!PostMessage(hWnd, WM_SHOW_TITLE, 0, (LPARAM)copy))
+        free(copy);
+}
+
+// Window thread: hand a message to the render thread. A mouse move is
+// dropped while the queue is full, as the next one carries the position;
+// anything else waits for room.
+void QueueInput(UINT message, WPARAM wParam, LPARAM lParam) {
+    InputEvent e = { message, wParam, lParam, NowSeconds() };
+    while (!PushInput(&inputQueue, &e) && message != WM_MOUSEMOVE)
+        YieldThread();
+    SetEvent(renderWake);
+}
+
+void WakeRenderThread(void) {
+    SetEvent(renderWake);
+}
+
+// Queue a load of the watched model. The first one also loads the weights
+// stored next to it; a reload carries the hash of the window's layers and
+// edges, so the loader can tell edits from a new topology.
+void SubmitModelLoad(int reload) {
+    LoadJob job;
+    memset(&job, 0, sizeof(job));
+    snprintf(job.spec, sizeof(job.spec), "%s", watchedModel);
+    job.generation = ++loadGeneration;
+    job.reload = reload;
+    job.topology = reload ? TopologyHash(&network) : 0;
+    job.loadWeights = !reload;
+    job.weights = network.weights;
+    job.atlas = &glyphAtlas;
+    job.settings = sceneSettings;
+    SubmitLoad(&loader, &job);
+    loadBusy = 1;
+    RequestRedraw();
+}
+
+// Swap in what the loaders finished, between two frames. Snapshots older than
+// the last one taken are dropped. Edits are applied only while the window's
+// graph still has the layers and edges the reload was hashed against; after
+// an edit that changed them the model is loaded again in full.
+void AdoptSnapshot(void) {
+    SceneSnapshot* snap = TakeSnapshot(&loader, &loadBusy);
+    if (!snap)
+        return;
+    if (snap->job.generation <= adoptedGeneration) {
+        RetireSnapshot(&loader, snap);
+        return;
+    }
+    adoptedGeneration = snap->job.generation;
+    if (snap->status == LOAD_FAILED && !modelReady) {
+        printf("Error: Could not load %s.\n", snap->job.spec);
+        PostMessage(hWnd, WM_CLOSE, 0, 0);
+    } else if (snap->status == LOAD_EDITS && SameTopology(&network, &snap->net)) {
+        int edited = ApplyModelEdits(&network, &snap->net);
+        printf("Reloaded %s: %d layer%s edited\n", watchedModel, edited, edited == 1 ? "" : "s");
+    } else if (snap->status == LOAD_EDITS) {
+        SubmitModelLoad(1);
+    } else if (snap->status == LOAD_BUILT) {
+        SwapInSnapshot(&network, &scene, snap);
+        UploadScene(&scene);
+        if (snap->job.settings != sceneSettings)
+            scene.dirty = 1;
+        else if (snap->labels.atlas == &glyphAtlas) {
+            SwapLabelLayouts(&windowLabels, &snap->labels);
+            windowLabels.builtRevision = network.revision;
+        }
+        if (snap->hasWeights) {
+            windowWeights = snap->weights;
+            network.weights = &windowWeights;
+            memset(&snap->weights, 0, sizeof(WeightSet));
+            snap->hasWeights = 0;
+        }
+        if (modelReady) {
+            printf("Reloaded %s: topology changed, laid out again\n", watchedModel);
+        } else {
+            modelReady = 1;
+            ReportNetworkMemory(&network);
+            printf("Loaded %s in %.2f s\n", watchedModel, snap->seconds);
+            if (!windowWeights.count)
+                weightView = WEIGHT_VIEW_OFF;
+            if (startupTimeline && OpenTimeline(&timeline, &network, startupTimeline, TIMELINE_CACHE_BYTES))
+                weightView = WEIGHT_VIEW_MEAN;
+        }
+    }
+    if (editLayer >= network.layerCount)
+        editLayer = network.layerCount > 0 ? network.layerCount - 1 : 0;
+    RequestRedraw();
+    RetireSnapshot(&loader, snap);
+}
+
+// Render thread: what WndProc did with each message before it only queued them.
+void ApplyInput(const InputEvent* e) {
+    WPARAM wParam = (WPARAM)e->wParam;
+    LPARAM lParam = (LPARAM)e->lParam;
+    switch (e->message) {
         case WM_LBUTTONDOWN:
             mouseDown = 1;
+            mouseDragged = 0;
             lastMouseX = LOWORD(lParam);
             lastMouseY = HIWORD(lParam);
             break;
         case WM_LBUTTONUP:
             mouseDown = 0;
+            if (!mouseDragged)
+                SelectAtCursor(LOWORD(lParam), HIWORD(lParam));
             break;
         case WM_MOUSEMOVE:
             if (mouseDown) {
@@ -557,11 +15234,179 @@ LRESULT CALLBACK WndProc(HWND hWnd, UINT message, WPARAM wParam, LPARAM lParam)
                 int currentY = HIWORD(lParam);
                 int dx = currentX - lastMouseX;
                 int dy = currentY - lastMouseY;
-                rotY += dx * 0.5f;
-                rotX += dy * 0.5f;
+                camera.rotY += dx * 0.5f;
+                camera.rotX += dy * 0.5f;
                 lastMouseX = currentX;
                 lastMouseY = currentY;
+                if (dx || dy) {
+                    mouseDragged = 1;
+                    RequestRedraw();
+                }
+            } else {
+                HoverAt(LOWORD(lParam), HIWORD(lParam));
+            }
+            break;
+        case WM_MOUSELEAVE:
+            hoverX = hoverY = -1;
+            hoverHit.kind = PICK_NONE;
+            RequestRedraw();
+            break;
+        case WM_MOUSEWHEEL:
+            camera.zoom *= powf(1.1f, (short)HIWORD(wParam) / 120.0f);
+            if (camera.zoom < 0.25f)
+                camera.zoom = 0.25f;
+            if (camera.zoom > 8.0f)
+                camera.zoom = 8.0f;
+            RequestRedraw();
+            break;
+        case WM_SIZE:
+            ResizeViewport(LOWORD(lParam), HIWORD(lParam));
+            RequestRedraw();
+            break;
+        case WM_PAINT:
+            RequestRedraw();
+            break;
+        case WM_KEYDOWN:
+            if (wParam == 'E') {
+                edgeSettings.mode = (EdgeMode)((edgeSettings.mode + 1) % EDGE_MODE_COUNT);
+                printf("Edge mode: %s\n", EdgeModeName(edgeSettings.mode));
+                MarkSceneDirty();
+            } else if (wParam == 'A') {
+                edgeSettings.arrowheads = !edgeSettings.arrowheads;
+                printf("Edge arrowheads: %s\n", edgeSettings.arrowheads ? "on" : "off");
+                MarkSceneDirty();
+            } else if (wParam == 'M') {
+                char summary[2048];
+                costView = (CostView)((costView + 1) % COST_VIEW_COUNT);
+                printf("Cost view: %s\n", CostViewName(costView));
+                if (costView != COST_VIEW_OFF) {
+                    FormatCostSummary(&network, costView, 10, summary, sizeof(summary));
+                    printf("%s\n", summary);
+                }
+                MarkGraphChanged(&network);     // Every layer's color, size and label changes
+                MarkSceneDirty();
+            } else if (wParam == 'W') {
+                if (!windowWeights.count && !timeline.count) {
+                    printf("No weights: put a .safetensors or .npy file next to the model, named like it\n");
+                } else {
+                    weightView = (WeightView)((weightView + 1) % WEIGHT_VIEW_COUNT);
+                    printf("Weight view: %s\n", WeightViewName(weightView));
+                    MarkGraphChanged(&network);
+                    MarkSceneDirty();
+                }
+            } else if (wParam == 'I') {
+                if (liveActivations.stream.header) {
+                    printf("Live activations: off (%lld frames shown)\n", liveActivations.frames);
+                    DetachLiveActivations(&liveActivations);
+                    MarkSceneDirty();   // Back to the layers' own colors
+                } else if (AttachLiveActivations(&liveActivations, ACTIVATION_STREAM_DEFAULT_NAME)) {
+                    printf("Live activations: on, %u layers x %u bins from '%s'\n",
+                           liveActivations.stream.header->layerCount, liveActivations.stream.header->binCount,
+                           ACTIVATION_STREAM_DEFAULT_NAME);
+                    RequestRedraw();
+                } else {
+                    printf("Live activations: no stream '%s'; start a producer, e.g. deep3d --stream-demo\n",
+                           ACTIVATION_STREAM_DEFAULT_NAME);
+                }
+            } else if (wParam == 'C') {
+                pacing.continuous = !pacing.continuous;
+                printf("Rendering: %s\n", pacing.continuous ? "continuous" : "on demand");
+                RequestRedraw();
+            } else if (wParam == 'V') {
+                pacing.vsync = !pacing.vsync;
+                ApplySwapInterval();
+                printf("Vsync: %s\n", pacing.vsync ? "on" : "off");
+            } else if (wParam == 'S') {
+                showCullStats = !showCullStats;
+                if (!showCullStats)
+                    PostWindowTitle("3D Network Visualization");
+                RequestRedraw();
+            } else if (wParam == 'P') {
+                showProfiler = !showProfiler;
+                EnableProfiler(showProfiler);
+                printf("Profiler: %s\n", showProfiler ? "on" : "off");
+                RequestRedraw();
+            } else if (wParam == 'T') {
+                DumpProfile();
+            } else if (wParam == 'R') {
+                backend = backend == BACKEND_GL ? BACKEND_CPU : BACKEND_GL;
+                printf("Renderer: %s\n", backend == BACKEND_CPU ? "CPU rasterizer" : "OpenGL");
+                RequestRedraw();
+            } else if (wParam == VK_UP || wParam == VK_DOWN) {
+                int step = wParam == VK_DOWN ? 1 : -1;
+                if (network.layerCount > 0)
+                    editLayer = (editLayer + step + network.layerCount) % network.layerCount;
+                PrintEditLayer("Selected");
+            } else if (wParam == VK_OEM_PLUS || wParam == VK_ADD || wParam == VK_OEM_MINUS || wParam == VK_SUBTRACT ||
+                       wParam == 'K' || wParam == 'N' || wParam == 'L' || wParam == VK_DELETE) {
+                EditLayer(wParam);
+            } else if (timeline.count && (wParam == VK_OEM_COMMA || wParam == VK_OEM_PERIOD || wParam == VK_PRIOR ||
+                                          wParam == VK_NEXT || wParam == VK_HOME || wParam == VK_END ||
+                                          wParam == VK_SPACE)) {
+                ScrubTimeline(wParam);
+            }
+            break;
+        case WM_TIMER:
+            CheckWatchedModel();
+            break;
+    }
+}
+
+// Apply the input queued since the last frame. Hovering picks once, at the
+// newest cursor position, however many moves arrived. Returns 0 once the
+// window thread has queued WM_QUIT.
+int DrainInput(void) {
+    InputEvent e;
+    int hovered = 0, x = 0, y = 0;
+    while (PopInput(&inputQueue, &e)) {
+        if (e.message == WM_QUIT)
+            return 0;
+        if (e.message == WM_MOUSEMOVE && !mouseDown) {
+            x = LOWORD((LPARAM)e.lParam);
+            y = HIWORD((LPARAM)e.lParam);
+            hovered = 1;
+            continue;
+        }
+        ApplyInput(&e);
+        if (e.message == WM_MOUSELEAVE)
+            hovered = 0;
+    }
+    if (hovered)
+        HoverAt(x, y);
+    return 1;
+}
+
+// Input is recorded with the time it arrived and applied by the render
+// thread, so a slow frame delays the picture but never the window. The
+// cursor leaving the window is only reported once asked for again.
+LRESULT CALLBACK WndProc(HWND hWnd, UINT message, WPARAM wParam, LPARAM lParam) {
+    switch(message) {
+        case WM_MOUSEMOVE:
+            if (!mouseTracked) {
+                TRACKMOUSEEVENT track = { sizeof(TRACKMOUSEEVENT), TME_LEAVE, hWnd, 0 };
+                mouseTracked = TrackMouseEvent(&track);
             }
+            QueueInput(message, wParam, lParam);
+            break;
+        case WM_MOUSELEAVE:
+            mouseTracked = 0;
+            QueueInput(message, wParam, lParam);
+            break;
+        case WM_PAINT:
+            ValidateRect(hWnd, NULL);
+            QueueInput(message, wParam, lParam);
+            break;
+        case WM_LBUTTONDOWN:
+        case WM_LBUTTONUP:
+        case WM_MOUSEWHEEL:
+        case WM_SIZE:
+        case WM_KEYDOWN:
+        case WM_TIMER:
+            QueueInput(message, wParam, lParam);
+            break;
+        case WM_SHOW_TITLE:
+            SetWindowText(hWnd, (const char*)lParam);
+            free((void*)lParam);
             break;
         case WM_CLOSE:
             PostQuitMessage(0);
@@ -574,14 +15419,144 @@ LRESULT CALLBACK WndProc(HWND hWnd, UINT message, WPARAM wParam, LPARAM lParam)
     return 0;
 }
 
+// Apply queued input and finished loads, then either draw or sleep until
+// the window thread or a loader sets renderWake. On-demand mode blocks, so an
+// untouched window costs no CPU; continuous mode sleeps off the remainder of
+// each frame when frameCap is set. Nothing signals a new activation frame or
+// a finished checkpoint decode, so while a stream is attached or the timeline
+// is moving on-demand mode polls once per frame interval instead of blocking.
+void RunRenderLoop(void) {
+    double nextFrame = NowSeconds();
+    while (DrainInput()) {
+        if (loadBusy)
+            AdoptSnapshot();
+        
+        if (pacing.continuous) {
+            if (pacing.frameCap > 0) {
+                double now = NowSeconds();
+                if (nextFrame - now > 0.001) {
+                    WaitForSingleObject(renderWake, (DWORD)((nextFrame - now) * 1000.0));
+                    continue;
+                }
+                nextFrame += 1.0 / pacing.frameCap;
+                if (nextFrame < now)
+                    nextFrame = now;
+            }
+            RenderScene();
+        } else if (redrawPending) {
+            RenderScene();
+        } else if (liveActivations.stream.header || TimelineBusy(&timeline)) {
+            WaitForSingleObject(renderWake, 1000 / (pacing.frameCap > 0 ? pacing.frameCap : 60));
+            if (LiveFramePending(&liveActivations, &scene) || TimelineBusy(&timeline))
+                RequestRedraw();
+            nextFrame = NowSeconds();
+        } else {
+            WaitForSingleObject(renderWake, INFINITE);
+            nextFrame = NowSeconds();
+        }
+    }
+}
+
+// Owns the GL context from start to finish: sets GL up, starts loading the
+// model named on the command line and draws until the window thread queues
+// WM_QUIT. Everything the frames used is released here, GL objects with it.
+void RenderThread(void* arg) {
+    wglMakeCurrent(hDC, hRC);
+    InitOpenGL();
+    CheckWatchedModel();        // Records the current write time
+    if (!modelReady) {
+        weightView = WEIGHT_VIEW_MEAN;      // So the scene is built with weights that turn up
+        SubmitModelLoad(0);
+    }
+    RunRenderLoop();
+    
+    StopLoader(&loader);
+    if (windowRasterReady)
+        ReleaseRasterizer(&windowRaster);
+    ReleaseFramebuffer(&windowFrame);
+    ReleaseVisibleSet(&windowVisible);
+    free(visibleIndices);
+    ReleaseLabelCache(&windowLabels);
+    ReleaseScene(&scene);
+    DetachLiveActivations(&liveActivations);
+    CloseTimeline(&timeline);
+    ReleaseWeights(&windowWeights);
+    ReleaseInstancing();
+    ReleaseMeshCache();
+    ReleaseGlyphAtlas(&glyphAtlas);
+    ReleaseGlyphAtlas(&embeddedAtlas);
+    ArenaRelease(&network.arena);
+    wglMakeCurrent(NULL, NULL);
+}
+
+// The window thread's loop. WndProc only queues input, so dispatching never
+// waits for a frame.
+void RunMessageLoop(MSG* msg) {
+    while (GetMessage(msg, NULL, 0, 0) > 0) {
+        TranslateMessage(msg);
+        DispatchMessage(msg);
+    }
+}
+
+#endif
+
 //-------------------------
 // Main Entry Point
 //-------------------------
 
+#ifdef _WIN32
 int WINAPI WinMain(HINSTANCE hInstanceCurrent, HINSTANCE hPrevInstance, LPSTR lpCmdLine, int nCmdShow) {
     SetupConsole();
-    SetupNetwork();
+    int exitCode;
+    if (RunBatchCommand(__argc, __argv, &exitCode))
+        return exitCode;
+    // Accept a quoted or bare model path as the only argument, or the model
+    // with options: --timeline DIR for a checkpoint directory, --scene-cache
+    // DIR|off.
+    char modelPath[260] = "";
+    const char* timelineDir = NULL;
+    int options = 0;
+    for (int i = 1; i + 1 < __argc; i++) {
+        if (strcmp(__argv[i], "--timeline") == 0) {
+            timelineDir = __argv[i + 1];
+            options = 1;
+        } else if (strcmp(__argv[i], "--scene-cache") == 0) {
+            SetSceneCacheOption(__argv[i + 1]);
+            options = 1;
+        }
+    }
+    if (options) {
+        for (int i = 1; i < __argc; i++) {
+            if (strcmp(__argv[i], "--timeline") == 0 || strcmp(__argv[i], "--scene-cache") == 0)
+                i++;
+            else
+                snprintf(modelPath, sizeof(modelPath), "%s", __argv[i]);
+        }
+    } else {
+        const char* arg = lpCmdLine;
+        while (*arg == ' ')
+            arg++;
+        if (*arg == '"')
+            sscanf(arg + 1, "%259[^\"]", modelPath);
+        else if (*arg)
+            sscanf(arg, "%259[^\n]", modelPath);
+    }
+    if (modelPath[0]) {
+        // Read by a loader thread once the window is up.
+        snprintf(watchedModel, sizeof(watchedModel), "%s", modelPath);
+        startupTimeline = timelineDir;
+    } else {
+        SetupNetwork(&network, modelPath);
+        if (watchedModel[0] && LoadSiblingWeights(&windowWeights, watchedModel)) {
+            AttachWeights(&network, &windowWeights);
+            weightView = WEIGHT_VIEW_MEAN;
+        }
+        if (timelineDir && OpenTimeline(&timeline, &network, timelineDir, TIMELINE_CACHE_BYTES))
+            weightView = WEIGHT_VIEW_MEAN;
+        modelReady = 1;
+    }
     
+    renderWake = CreateEvent(NULL, FALSE, FALSE, NULL);     // Before the window, which queues WM_SIZE
     WNDCLASS wc = {0};
     wc.style = CS_OWNDC;
     wc.lpfnWndProc = WndProc;
@@ -602,27 +15577,32 @@ int WINAPI WinMain(HINSTANCE hInstanceCurrent, HINSTANCE hPrevInstance, LPSTR lp
     
     hDC = GetDC(hWnd);
     SetupPixelFormatForDC(hDC);
-    hRC = wglCreateContext(hDC);
-    wglMakeCurrent(hDC, hRC);
-    
-    InitOpenGL();
+    hRC = wglCreateContext(hDC);        // Made current on the render thread
+    StartLoader(&loader, WakeRenderThread);
+    if (!renderWake || !hRC || !StartThread(&renderThread, RenderThread, NULL)) {
+        MessageBox(NULL, "Failed to start rendering.", "Error", MB_OK | MB_ICONERROR);
+        return 0;
+    }
+    SetTimer(hWnd, 1, WATCH_INTERVAL_MS, NULL);
     
     MSG msg;
-    BOOL done = FALSE;
-    while (!done) {
-        while (PeekMessage(&msg, NULL, 0, 0, PM_REMOVE)) {
-            if (msg.message == WM_QUIT)
-                done = TRUE;
-            TranslateMessage(&msg);
-            DispatchMessage(&msg);
-        }
-        RenderScene();
-    }
+    RunMessageLoop(&msg);
+    QueueInput(WM_QUIT, 0, 0);
+    JoinThread(renderThread);
     
-    gluDeleteQuadric(quadric);
-    wglMakeCurrent(NULL, NULL);
     wglDeleteContext(hRC);
     ReleaseDC(hWnd, hDC);
     DestroyWindow(hWnd);
+    CloseHandle(renderWake);
     return (int) msg.wParam;
 }
+#else
+// Without Win32 there is no window, only the batch commands.
+int main(int argc, char** argv) {
+    int exitCode;
+    if (RunBatchCommand(argc, argv, &exitCode))
+        return exitCode;
+    PrintExportUsage();
+    return EXIT_FAILURE;
+}
+#endif